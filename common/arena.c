@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* Sized so the CDPs, AFD, bar data and metadata of a typical frame fit in the first block. */
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN 16
+
+/* The arena pointer is the newest block, older blocks hang off next. */
+struct obe_arena_s
+{
+	struct obe_arena_s *next;
+	size_t size;
+	size_t used;
+	size_t total;       /* Carved across all blocks */
+	uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void *obe_arena_alloc(struct obe_arena_s **arena, size_t len)
+{
+	struct obe_arena_s *a = *arena;
+
+	len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (!a || a->used + len > a->size) {
+		size_t size = ARENA_BLOCK_SIZE - sizeof(*a);
+		if (len > size)
+			size = len;
+
+		struct obe_arena_s *b;
+		if (posix_memalign((void **)&b, ARENA_ALIGN, sizeof(*b) + size) != 0)
+			return NULL;
+
+		b->next = a;
+		b->size = size;
+		b->used = 0;
+		b->total = a ? a->total : 0;
+		*arena = a = b;
+	}
+
+	void *p = a->data + a->used;
+	a->used += len;
+	a->total += len;
+
+	return p;
+}
+
+void *obe_arena_memdup(struct obe_arena_s **arena, const void *src, size_t len)
+{
+	void *p = obe_arena_alloc(arena, len);
+	if (p && len)
+		memcpy(p, src, len);
+
+	return p;
+}
+
+size_t obe_arena_used(const struct obe_arena_s *arena)
+{
+	return arena ? arena->total : 0;
+}
+
+void obe_arena_free(struct obe_arena_s *arena)
+{
+	while (arena) {
+		struct obe_arena_s *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
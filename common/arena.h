@@ -0,0 +1,34 @@
+#ifndef OBE_ARENA_H
+#define OBE_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bump allocator for data sharing one lifetime, such as the ancillary data of a raw frame.
+ * Allocations are carved in order from a block, a new block is chained on when one fills,
+ * and everything is released with a single obe_arena_free(). Nothing is freed individually.
+ * An arena is owned by one thread at a time, there is no locking.
+ */
+struct obe_arena_s;
+
+/* Carve len bytes, 16 byte aligned. *arena may be NULL, the first block is allocated on
+ * demand and *arena updated. Returns NULL on allocation failure.
+ */
+void  *obe_arena_alloc(struct obe_arena_s **arena, size_t len);
+void  *obe_arena_memdup(struct obe_arena_s **arena, const void *src, size_t len);
+
+/* Bytes carved so far, for statistics. */
+size_t obe_arena_used(const struct obe_arena_s *arena);
+
+/* Release every block. NULL is allowed. */
+void   obe_arena_free(struct obe_arena_s *arena);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_ARENA_H */
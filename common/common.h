@@ -49,11 +49,12 @@
 #include "stream_formats.h"
 #include <common/queue.h>
 #include <common/metadata.h>
+#include <common/arena.h>
 
 /* Enable some realtime debugging commands */
 #define DO_SET_VARIABLE 1
 
-#define MAX_DEVICES 1
+#define MAX_DEVICES 4
 #define MAX_STREAMS 40
 #define MAX_CHANNELS 16
 
@@ -452,8 +453,13 @@ typedef struct
 
     /* Ancillary / User-data */
     int num_user_data;
+    int num_user_data_alloc;
     obe_user_data_t *user_data;
 
+    /* User data, its array and the metadata items are carved from here and
+     * released together with the frame. See obe_raw_frame_add_user_data(). */
+    struct obe_arena_s *arena;
+
     /* Audio */
     obe_audio_frame_t audio_frame;
     // TODO channel order
@@ -496,6 +502,13 @@ typedef struct
 
     /* HE-AAC and E-AC3 */
     int num_samples;
+
+    /* Startup timing, obe_mdate() units. Used to attribute channel start time per encoder. */
+    int64_t start_time; /* Encoder thread launched */
+    int64_t ready_time; /* Encoder signalled is_ready */
+
+    /* Audio encoders serviced by the shared audio pool, no dedicated thread drains the queue. */
+    int is_pooled;
 } obe_encoder_t;
 
 typedef struct
@@ -507,6 +520,8 @@ typedef struct
 
     /* Muxed frame queue for transmission */
     obe_queue_t queue;
+
+    obe_t *h;
 } obe_output_t;
 
 enum obe_coded_frame_type_e {
@@ -549,6 +564,8 @@ typedef struct
 
     /* MPEG-TS */
     int64_t *pcr_list;
+
+    int64_t created; /* obe_mdate() */
 } obe_muxed_data_t;
 void obe_muxed_data_print(obe_muxed_data_t *ptr, int nr);
 
@@ -577,6 +594,18 @@ struct obe_t
     obe_device_t *devices[MAX_DEVICES];
     int cur_input_stream_id;
 
+    /* Channel start barrier. Every encoder launched by obe_start() checks in here
+     * once its codec is open, allowing all encoders to initialize concurrently
+     * while we track (and log) when the channel as a whole is ready.
+     */
+    pthread_mutex_t start_mutex;
+    int             start_expected;
+    int             start_ready;
+    int64_t         start_time; /* obe_mdate() */
+
+    /* Shared audio encoder worker pool (encoders/audio/audio_pool.c), NULL when disabled. */
+    void *audio_pool;
+
     /* Frame drop flags
      * TODO: make this work for multiple inputs and outputs */
     pthread_mutex_t drop_mutex;
@@ -597,10 +626,12 @@ struct obe_t
     pthread_t mux_thread;
     int cancel_mux_thread;
     obe_mux_opts_t mux_opts;
+    struct statmux_s *statmux; /* Video bitrate shared between the device programs, NULL if not */
 
     /* Smoothing (video) */
     pthread_t mux_smoothing_thread;
     int cancel_mux_smoothing_thread;
+    int mux_fused; /* No smoothing thread, the mux paces its output */
 
     /* Filtering */
     int num_filters;
@@ -619,6 +650,7 @@ struct obe_t
     obe_queue_t     enc_smoothing_queue;
 
     int             enc_smoothing_buffer_complete;
+    int64_t         enc_smoothing_depth; /* 27MHz ticks the smoother aims to hold, 0 before it starts */
     int64_t         enc_smoothing_last_exit_time;
 
     /* Encoded frame queue for muxing */
@@ -684,6 +716,12 @@ void obe_release_video_data( void *ptr );
 void obe_release_audio_data( void *ptr );
 void obe_release_frame( void *ptr );
 
+/* Frame scoped allocations, freed by obe_release_frame(). */
+void *obe_raw_frame_alloc( obe_raw_frame_t *raw_frame, size_t len );
+/* Appends an entry with len bytes of uninitialised data. The pointer is only valid
+ * until the next append, as the array may move. NULL on allocation failure. */
+obe_user_data_t *obe_raw_frame_add_user_data( obe_raw_frame_t *raw_frame, int type, int source, int len );
+
 obe_muxed_data_t *new_muxed_data( int len );
 void destroy_muxed_data( obe_muxed_data_t *muxed_data );
 
@@ -691,11 +729,15 @@ void add_device( obe_t *h, obe_device_t *device );
 
 int add_to_filter_queue( obe_t *h, obe_raw_frame_t *raw_frame );
 int add_to_encode_queue( obe_t *h, obe_raw_frame_t *raw_frame, int output_stream_id );
-int remove_early_frames( obe_t *h, int64_t pts );
+int remove_early_frames( obe_t *h, int64_t pts, obe_device_t *device );
 int add_to_output_queue( obe_t *h, obe_muxed_data_t *muxed_data );
 int remove_from_output_queue( obe_t *h );
 
 obe_int_input_stream_t *get_input_stream( obe_t *h, int input_stream_id );
+obe_device_t *get_device_by_input_stream( obe_t *h, int input_stream_id );
+int get_device_input_stream_id( obe_device_t *device, int stream_type );
+obe_output_stream_t *get_output_stream_by_input_stream( obe_t *h, int input_stream_id );
+int get_video_renditions( obe_t *h, int input_stream_id, obe_output_stream_t **renditions, int max );
 obe_encoder_t *get_encoder( obe_t *h, int stream_id );
 obe_output_stream_t *get_output_stream_by_id( obe_t *h, int stream_id);
 obe_output_stream_t *get_output_stream_by_format( obe_t *h, int format );
@@ -720,6 +762,12 @@ __inline__ static obe_encoder_t *obe_core_encoder_alloc(enum stream_formats_e st
 	return e;
 }
 
+void obe_core_encoder_set_ready(obe_t *h, obe_encoder_t *e);
+void obe_core_encoder_wait_ready(obe_encoder_t *e);
+int obe_core_encoder_get_expected_num_samples(obe_output_stream_t *os);
+
+int ltnpthread_setname_np(pthread_t thread, const char *name);
+
 int64_t get_wallclock_in_mpeg_ticks( void );
 void sleep_mpeg_ticks( int64_t i_delay );
 void obe_clock_tick( obe_t *h, int64_t value );
@@ -729,6 +777,7 @@ void sleep_input_clock( obe_t *h, int64_t i_delay );
 int get_non_display_location( int type );
 void obe_raw_frame_printf(obe_raw_frame_t *rf);
 obe_raw_frame_t *obe_raw_frame_copy(obe_raw_frame_t *frame);
+obe_raw_frame_t *obe_raw_frame_copy_props(obe_raw_frame_t *frame);
 void obe_image_save(obe_image_t *src);
 
 #if 0
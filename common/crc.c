@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_X86 1
+#include <immintrin.h>
+#else
+#define CRC_X86 0
+#endif
+
+#define POLY16 0x8005
+#define POLY32 0x04C11DB7
+
+/* tab[k][b] is the CRC register contribution of byte b followed by k zero bytes. */
+static uint16_t tab16[8][256];
+static uint32_t tab32[8][256];
+
+/* x^n mod P, for folding a 128 bit lane forward by n bits. */
+static uint64_t k16_128, k16_192;
+static uint64_t k32_128, k32_192;
+
+static uint64_t xpow_mod(int n, uint32_t poly, int width)
+{
+	uint64_t top = 1ULL << width;
+	uint64_t r = 1;
+	for (int i = 0; i < n; i++) {
+		r <<= 1;
+		if (r & top)
+			r ^= top | poly;
+	}
+	return r;
+}
+
+static void tables_build(void)
+{
+	for (int b = 0; b < 256; b++) {
+		uint16_t c16 = b << 8;
+		uint32_t c32 = (uint32_t)b << 24;
+		for (int i = 0; i < 8; i++) {
+			c16 = (c16 & 0x8000) ? (c16 << 1) ^ POLY16 : (c16 << 1);
+			c32 = (c32 & 0x80000000) ? (c32 << 1) ^ POLY32 : (c32 << 1);
+		}
+		tab16[0][b] = c16;
+		tab32[0][b] = c32;
+	}
+	for (int k = 1; k < 8; k++) {
+		for (int b = 0; b < 256; b++) {
+			uint16_t c16 = tab16[k - 1][b];
+			uint32_t c32 = tab32[k - 1][b];
+			tab16[k][b] = (c16 << 8) ^ tab16[0][c16 >> 8];
+			tab32[k][b] = (c32 << 8) ^ tab32[0][c32 >> 24];
+		}
+	}
+
+	k16_128 = xpow_mod(128, POLY16, 16);
+	k16_192 = xpow_mod(192, POLY16, 16);
+	k32_128 = xpow_mod(128, POLY32, 32);
+	k32_192 = xpow_mod(192, POLY32, 32);
+}
+
+/* Table */
+
+static uint16_t crc16_table(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ tab16[0][(crc >> 8) ^ *p++];
+	return crc;
+}
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ tab32[0][(crc >> 24) ^ *p++];
+	return crc;
+}
+
+/* Slice by 8 */
+
+static uint16_t crc16_slice8(uint16_t crc, const uint8_t *p, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8) {
+		crc ^= (p[0] << 8) | p[1];
+		crc = tab16[7][crc >> 8] ^ tab16[6][crc & 0xff] ^
+		      tab16[5][p[2]] ^ tab16[4][p[3]] ^ tab16[3][p[4]] ^
+		      tab16[2][p[5]] ^ tab16[1][p[6]] ^ tab16[0][p[7]];
+	}
+	return crc16_table(crc, p, len);
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8) {
+		crc ^= ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		crc = tab32[7][crc >> 24] ^ tab32[6][(crc >> 16) & 0xff] ^
+		      tab32[5][(crc >> 8) & 0xff] ^ tab32[4][crc & 0xff] ^
+		      tab32[3][p[4]] ^ tab32[2][p[5]] ^ tab32[1][p[6]] ^ tab32[0][p[7]];
+	}
+	return crc32_table(crc, p, len);
+}
+
+#if CRC_X86
+/* Carryless multiply folding. The message is read big endian, 16 bytes at a time, into
+ * a 128 bit polynomial X = H.x^64 + L. Appending the next block B means X.x^128 + B, which
+ * is congruent (mod P) to H.(x^192 mod P) + L.(x^128 mod P) + B; both products fit in 128
+ * bits. What's left at the end is congruent to the whole message, so running the table
+ * CRC over its 16 bytes gives the CRC of everything folded, and the tail continues from there.
+ * The initial register value is XORed into the top bits of the first block.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t fold_clmul(uint32_t crc, int width, uint64_t k128, uint64_t k192, const uint8_t *p, size_t len, size_t *done)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i k = _mm_set_epi64x(k192, k128);
+	size_t blocks = len / 16;
+
+	__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+	x = _mm_xor_si128(x, _mm_set_epi64x((uint64_t)crc << (64 - width), 0));
+
+	for (size_t i = 1; i < blocks; i++) {
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + (i * 16))), bswap);
+		__m128i h = _mm_clmulepi64_si128(x, k, 0x11);
+		__m128i l = _mm_clmulepi64_si128(x, k, 0x00);
+		x = _mm_xor_si128(_mm_xor_si128(h, l), b);
+	}
+
+	uint8_t tmp[16];
+	_mm_storeu_si128((__m128i *)tmp, _mm_shuffle_epi8(x, bswap));
+	*done = blocks * 16;
+
+	return width == 16 ? crc16_table(0, tmp, 16) : crc32_table(0, tmp, 16);
+}
+
+static uint16_t crc16_clmul(uint16_t crc, const uint8_t *p, size_t len)
+{
+	if (len < 64)
+		return crc16_slice8(crc, p, len);
+
+	size_t done;
+	crc = fold_clmul(crc, 16, k16_128, k16_192, p, len, &done);
+	return crc16_slice8(crc, p + done, len - done);
+}
+
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+	if (len < 64)
+		return crc32_slice8(crc, p, len);
+
+	size_t done;
+	crc = fold_clmul(crc, 32, k32_128, k32_192, p, len, &done);
+	return crc32_slice8(crc, p + done, len - done);
+}
+#endif /* CRC_X86 */
+
+static uint16_t crc16_lazy(uint16_t crc, const uint8_t *p, size_t len);
+static uint32_t crc32_lazy(uint32_t crc, const uint8_t *p, size_t len);
+
+static uint16_t (*crc16_func)(uint16_t crc, const uint8_t *p, size_t len) = crc16_lazy;
+static uint32_t (*crc32_func)(uint32_t crc, const uint8_t *p, size_t len) = crc32_lazy;
+static enum obe_crc_impl_e current_impl = OBE_CRC_IMPL_AUTO;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+const char *obe_crc_impl_name(enum obe_crc_impl_e impl)
+{
+	switch (impl) {
+	case OBE_CRC_IMPL_TABLE:  return "table";
+	case OBE_CRC_IMPL_SLICE8: return "slice8";
+	case OBE_CRC_IMPL_CLMUL:  return "clmul";
+	default:                  return "auto";
+	}
+}
+
+enum obe_crc_impl_e obe_crc_init(enum obe_crc_impl_e impl)
+{
+	pthread_once(&tables_once, tables_build);
+
+	int has_clmul = 0;
+#if CRC_X86
+	__builtin_cpu_init();
+	has_clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#endif
+
+	if (impl == OBE_CRC_IMPL_AUTO)
+		impl = has_clmul ? OBE_CRC_IMPL_CLMUL : OBE_CRC_IMPL_SLICE8;
+	if (impl == OBE_CRC_IMPL_CLMUL && !has_clmul)
+		impl = OBE_CRC_IMPL_SLICE8;
+
+	switch (impl) {
+#if CRC_X86
+	case OBE_CRC_IMPL_CLMUL:
+		crc16_func = crc16_clmul;
+		crc32_func = crc32_clmul;
+		break;
+#endif
+	case OBE_CRC_IMPL_TABLE:
+		crc16_func = crc16_table;
+		crc32_func = crc32_table;
+		break;
+	default:
+		impl = OBE_CRC_IMPL_SLICE8;
+		crc16_func = crc16_slice8;
+		crc32_func = crc32_slice8;
+	}
+
+	current_impl = impl;
+	return current_impl;
+}
+
+static uint16_t crc16_lazy(uint16_t crc, const uint8_t *p, size_t len)
+{
+	obe_crc_init(OBE_CRC_IMPL_AUTO);
+	return crc16_func(crc, p, len);
+}
+
+static uint32_t crc32_lazy(uint32_t crc, const uint8_t *p, size_t len)
+{
+	obe_crc_init(OBE_CRC_IMPL_AUTO);
+	return crc32_func(crc, p, len);
+}
+
+uint16_t obe_crc16_ac3(uint16_t crc, const uint8_t *buf, size_t len)
+{
+	return crc16_func(crc, buf, len);
+}
+
+uint32_t obe_crc32_mpeg(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	return crc32_func(crc, buf, len);
+}
@@ -0,0 +1,43 @@
+#ifndef OBE_CRC_H
+#define OBE_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Non reflected CRCs used by broadcast bitstreams.
+ *   CRC-16, polynomial 0x8005, AC-3 / E-AC-3 syncframe crc1 and crc2 (init 0)
+ *   CRC-32, polynomial 0x04C11DB7, MPEG-2 PSI / SCTE-35 sections (init 0xFFFFFFFF)
+ * A receiver running the CRC over a section or frame including its CRC field gets 0.
+ * Pass the previous return value as crc to continue a calculation.
+ * The slice by 8 and PCLMULQDQ paths are bit identical, tools/crc-bench checks this.
+ */
+
+#define OBE_CRC16_AC3_INIT   0x0000
+#define OBE_CRC32_MPEG_INIT  0xFFFFFFFF
+
+enum obe_crc_impl_e
+{
+	OBE_CRC_IMPL_AUTO = 0,
+	OBE_CRC_IMPL_TABLE,     /* Byte at a time, the reference */
+	OBE_CRC_IMPL_SLICE8,
+	OBE_CRC_IMPL_CLMUL,     /* Carryless multiply folding, x86 PCLMULQDQ */
+};
+
+/* Optional, the first CRC call picks the fastest implementation the cpu supports.
+ * Returns the implementation selected, which may differ from the request if unsupported.
+ */
+enum obe_crc_impl_e obe_crc_init(enum obe_crc_impl_e impl);
+const char *obe_crc_impl_name(enum obe_crc_impl_e impl);
+
+uint16_t obe_crc16_ac3(uint16_t crc, const uint8_t *buf, size_t len);
+uint32_t obe_crc32_mpeg(uint32_t crc, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_CRC_H */
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_ctl.h"
+
+#define TICKS_PER_MS 27000LL
+#define MAX_OF(a, b) ((a) > (b) ? (a) : (b))
+
+int g_latency_control = 0;
+int g_latency_control_margin_ms = 20;
+int g_latency_control_step_down_ms = 5;
+int g_latency_control_step_up_ms = 40;
+int g_latency_control_window_s = 10;
+int g_latency_control_slew_ppm = 500;
+
+struct latency_ctl_s
+{
+	char name[32];
+	int64_t max_depth;
+	int64_t depth;          /* Applied to the stage's clock */
+	int64_t target;         /* What depth is slewing towards */
+	int64_t last_sample;
+	int have_sample;
+
+	int64_t window_start;
+	int64_t window_min_slack;
+	int have_window;
+
+	struct latency_ctl_stats_s stats;
+};
+
+struct latency_ctl_s *latency_ctl_alloc(const char *name, int64_t max_depth)
+{
+	struct latency_ctl_s *c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->max_depth = max_depth;
+	c->depth = max_depth;
+	c->target = max_depth;
+	c->stats.depth = max_depth;
+	c->stats.target = max_depth;
+
+	return c;
+}
+
+void latency_ctl_free(struct latency_ctl_s *c)
+{
+	free(c);
+}
+
+static void new_window(struct latency_ctl_s *c, int64_t now)
+{
+	c->window_start = now;
+	c->window_min_slack = INT64_MAX;
+	c->have_window = 1;
+}
+
+static void set_target(struct latency_ctl_s *c, int64_t target)
+{
+	c->target = target;
+	c->stats.target = target;
+}
+
+/* Move depth towards target by at most slew_ppm of the time since the last sample */
+static int64_t slew(struct latency_ctl_s *c, int64_t now)
+{
+	int64_t elapsed = c->have_sample ? now - c->last_sample : 0;
+	c->last_sample = now;
+	c->have_sample = 1;
+
+	/* A stage that stalled refills anyway, don't turn the gap into a step */
+	if (elapsed < 0)
+		elapsed = 0;
+	if (elapsed > TICKS_PER_MS * 1000)
+		elapsed = TICKS_PER_MS * 1000;
+
+	int64_t max_delta = elapsed * MAX_OF(g_latency_control_slew_ppm, 0) / 1000000;
+	int64_t delta = c->target - c->depth;
+	if (delta > max_delta)
+		delta = max_delta;
+	if (delta < -max_delta)
+		delta = -max_delta;
+
+	c->depth += delta;
+	c->stats.depth = c->depth;
+
+	return delta;
+}
+
+int64_t latency_ctl_sample(struct latency_ctl_s *c, int64_t now, int64_t slack)
+{
+	if (!g_latency_control)
+		return 0;
+
+	int64_t margin = MAX_OF(g_latency_control_margin_ms, 0) * TICKS_PER_MS;
+	int64_t step_down = MAX_OF(g_latency_control_step_down_ms, 0) * TICKS_PER_MS;
+	int64_t step_up = MAX_OF(g_latency_control_step_up_ms, 1) * TICKS_PER_MS;
+	int64_t window = MAX_OF(g_latency_control_window_s, 1) * TICKS_PER_MS * 1000;
+
+	if (!c->have_window)
+		new_window(c, now);
+	if (slack < c->window_min_slack)
+		c->window_min_slack = slack;
+
+	if (slack < 0)
+		c->stats.late++;
+
+	/* Late: the data is already behind, step up now by enough to restore the margin */
+	if (slack < 0 && c->depth < c->max_depth) {
+		int64_t delta = margin - slack > step_up ? margin - slack : step_up;
+		if (delta > c->max_depth - c->depth)
+			delta = c->max_depth - c->depth;
+		c->depth += delta;
+		c->stats.depth = c->depth;
+		if (c->target < c->depth)
+			set_target(c, c->depth);
+		c->stats.step_ups++;
+		c->last_sample = now;
+		c->have_sample = 1;
+		printf("[latency] %s: late by %.1fms, stepped up to %.1fms\n", c->name,
+			(double)-slack / TICKS_PER_MS, (double)c->depth / TICKS_PER_MS);
+		new_window(c, now);
+		return delta;
+	}
+
+	/* Too close: aim higher and slew there, the data is still on time */
+	if (slack < margin / 2 && c->target < c->max_depth) {
+		int64_t need = margin - slack > step_up ? margin - slack : step_up;
+		int64_t target = c->depth + need;
+		if (target > c->max_depth)
+			target = c->max_depth;
+		if (target > c->target) {
+			if (c->target <= c->depth) {
+				c->stats.step_ups++;
+				printf("[latency] %s: slack %.1fms, slewing up to %.1fms\n", c->name,
+					(double)slack / TICKS_PER_MS, (double)target / TICKS_PER_MS);
+			}
+			set_target(c, target);
+		}
+		new_window(c, now);
+		return slew(c, now);
+	}
+
+	/* A full window with room to spare: aim a step lower, keeping the margin. The slack
+	 * seen was at the depth applied during the window, so wait for any slew to finish. */
+	if (now - c->window_start >= window) {
+		int64_t spare = c->window_min_slack - margin;
+		c->stats.min_slack = c->window_min_slack;
+		if (spare >= TICKS_PER_MS && c->target == c->depth && c->depth > 0) {
+			int64_t delta = spare < step_down ? spare : step_down;
+			if (delta > c->depth)
+				delta = c->depth;
+			set_target(c, c->depth - delta);
+			c->stats.step_downs++;
+		}
+		new_window(c, now);
+	}
+
+	return slew(c, now);
+}
+
+int64_t latency_ctl_refill_depth(struct latency_ctl_s *c)
+{
+	c->depth = c->target;
+	c->stats.depth = c->depth;
+	c->have_sample = 0;
+
+	return c->depth;
+}
+
+int64_t latency_ctl_depth(struct latency_ctl_s *c)
+{
+	return c->depth;
+}
+
+void latency_ctl_get_stats(struct latency_ctl_s *c, struct latency_ctl_stats_s *stats)
+{
+	*stats = c->stats;
+}
@@ -0,0 +1,65 @@
+#ifndef OBE_LATENCY_CTL_H
+#define OBE_LATENCY_CTL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Buffer depth controller for the encoder and mux smoothing stages.
+ * A stage starts at its worst case depth and reports, for each unit it releases, the slack:
+ * how long before its release time the unit arrived. When the smallest slack seen over a
+ * window stays above the safety margin, the target depth comes down by at most a step. A
+ * unit inside half the margin raises the target. The applied depth moves towards the target
+ * by at most slew_ppm of elapsed time, so the stage's clock runs slightly fast or slow
+ * rather than bursting or pausing; 500ppm takes 10s to move 5ms. Only a unit that arrives
+ * late steps the depth straight up. Depths and slack are 27MHz ticks.
+ *
+ * Slack is taken where the stage releases the unit, so it already includes the encoder's
+ * VBV: a large frame after the buffer has filled leaves the encoder later and shows up as
+ * less slack.
+ *
+ * Off unless g_latency_control is set. The knobs are read on every sample so they can be
+ * changed at runtime.
+ */
+struct latency_ctl_s;
+
+extern int g_latency_control;
+extern int g_latency_control_margin_ms;
+extern int g_latency_control_step_down_ms;
+extern int g_latency_control_step_up_ms;
+extern int g_latency_control_window_s;
+extern int g_latency_control_slew_ppm;
+
+struct latency_ctl_stats_s
+{
+	int64_t depth;
+	int64_t target;
+	int64_t min_slack;      /* Over the last complete window */
+	uint64_t step_downs;
+	uint64_t step_ups;
+	uint64_t late;          /* Units that arrived after their release time */
+};
+
+struct latency_ctl_s *latency_ctl_alloc(const char *name, int64_t max_depth);
+void latency_ctl_free(struct latency_ctl_s *c);
+
+/* Returns the depth change to apply now, negative to release earlier, 0 for none.
+ * Apart from a late step this is at most slew_ppm of the time since the last sample. */
+int64_t latency_ctl_sample(struct latency_ctl_s *c, int64_t now, int64_t slack);
+
+/* The depth currently applied. */
+int64_t latency_ctl_depth(struct latency_ctl_s *c);
+
+/* What a stage refilling after a drop should buffer before it starts. The refill puts the
+ * stage at the target directly, so the applied depth jumps there too. */
+int64_t latency_ctl_refill_depth(struct latency_ctl_s *c);
+
+void latency_ctl_get_stats(struct latency_ctl_s *c, struct latency_ctl_stats_s *stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_LATENCY_CTL_H */
@@ -1,4 +1,5 @@
 #include "metadata.h"
+#include "arena.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +36,21 @@ void avmetadata_clone(struct avmetadata_s *dst, struct avmetadata_s *src)
 	}
 }
 
+void avmetadata_clone_arena(struct avmetadata_s *dst, struct avmetadata_s *src, struct obe_arena_s **arena)
+{
+	if (src->count == 0)
+		return;
+
+	avmetadata_reset(dst);
+
+	for (int i = 0; i < src->count; i++) {
+		struct avmetadata_item_s *item = avmetadata_item_clone_arena(src->array[i], arena);
+		if (!item)
+			break;
+		dst->array[dst->count++] = item;
+	}
+}
+
 int avmetadata_count_by_type(struct avmetadata_s *src, enum avmetadata_item_type_e item_type)
 {
 	int c = 0;
@@ -49,7 +65,7 @@ int avmetadata_count_by_type(struct avmetadata_s *src, enum avmetadata_item_type
 
 struct avmetadata_item_s *avmetadata_item_alloc(int lengthBytes, enum avmetadata_item_type_e item_type)
 {
-	struct avmetadata_item_s *dst = malloc(lengthBytes);
+	struct avmetadata_item_s *dst = calloc(1, sizeof(*dst));
 	if (!dst) {
 		printf("%s(%d)\n", __func__, lengthBytes);
 		return NULL;
@@ -88,9 +104,24 @@ struct avmetadata_item_s *avmetadata_item_clone(struct avmetadata_item_s *src)
 	return dst;
 }
 
+struct avmetadata_item_s *avmetadata_item_clone_arena(struct avmetadata_item_s *src, struct obe_arena_s **arena)
+{
+	struct avmetadata_item_s *dst = obe_arena_alloc(arena, sizeof(*dst));
+	if (!dst)
+		return NULL;
+
+	*dst = *src;
+	dst->inArena = 1;
+	dst->data = obe_arena_memdup(arena, src->data, src->dataLengthAlloc);
+	if (!dst->data)
+		return NULL;
+
+	return dst;
+}
+
 void avmetadata_item_free(struct avmetadata_item_s *src)
 {
-	if (!src)
+	if (!src || src->inArena)
 		return;
 
 	switch (src->item_type) {
@@ -144,6 +175,9 @@ void avmetadata_item_dprintf(int fd, struct avmetadata_item_s *src)
 
 int avmetadata_item_data_realloc(struct avmetadata_item_s *src, int lengthBytes)
 {
+	if (src->inArena)
+		return -1; /* Clone it to the heap first */
+
 	src->data = realloc(src->data, lengthBytes);
 	if (!src->data)
 		return -1;
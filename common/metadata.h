@@ -18,8 +18,13 @@ struct avmetadata_item_s
 
 	/* VANC */
 	int lineNr;
+
+	/* Carved from a frame arena, freed with the frame rather than by avmetadata_item_free(). */
+	int inArena;
 };
 
+struct obe_arena_s;
+
 struct avmetadata_s
 {
 #define MAX_RAW_FRAME_METADATA_ITEMS 16
@@ -30,12 +35,15 @@ struct avmetadata_s
 void avmetadata_init(struct avmetadata_s *);  /* One time call during startup / initialization */
 void avmetadata_reset(struct avmetadata_s *); /* Erase any prior items */
 void avmetadata_clone(struct avmetadata_s *dst, struct avmetadata_s *src);
+/* As above, with the items carved from *arena. They are fixed size, and must not outlive it. */
+void avmetadata_clone_arena(struct avmetadata_s *dst, struct avmetadata_s *src, struct obe_arena_s **arena);
 
 /* Count the number of metadata items in the array matching item_type 'type' */
 int  avmetadata_count_by_type(struct avmetadata_s *src, enum avmetadata_item_type_e item_type);
 
 struct avmetadata_item_s *avmetadata_item_alloc(int lengthBytes, enum avmetadata_item_type_e item_type);
 struct avmetadata_item_s *avmetadata_item_clone(struct avmetadata_item_s *src);
+struct avmetadata_item_s *avmetadata_item_clone_arena(struct avmetadata_item_s *src, struct obe_arena_s **arena);
 void avmetadata_item_dprintf(int fd, struct avmetadata_item_s *src);
 const char *avmetadata_item_name(struct avmetadata_item_s *src);
 
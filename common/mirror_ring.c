@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "mirror_ring.h"
+
+struct mirror_ring_s
+{
+	uint8_t *base;      /* 2 * capacity of address space, the second half aliases the first */
+	size_t capacity;
+
+	/* Each index has a single writer. Stores release, loads of the other side's index
+	 * acquire, so the bytes behind an index are visible before the index is.
+	 * Separate cache lines, so producer and consumer don't bounce one line.
+	 */
+	uint64_t head __attribute__((aligned(64)));    /* Written, producer */
+	uint64_t tail __attribute__((aligned(64)));    /* Consumed, consumer */
+};
+
+#define LOAD_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int ring_fd(const char *name, size_t len)
+{
+	int fd = -1;
+
+#if defined(SYS_memfd_create)
+	fd = syscall(SYS_memfd_create, name, 1 /* MFD_CLOEXEC */);
+#endif
+	if (fd < 0) {
+		/* Pre memfd kernels */
+		char tmpl[] = "/dev/shm/obe-ring-XXXXXX";
+		fd = mkstemp(tmpl);
+		if (fd >= 0)
+			unlink(tmpl);
+	}
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, len) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct mirror_ring_s *mirror_ring_alloc(size_t capacity, const char *name)
+{
+	size_t len = sysconf(_SC_PAGESIZE);
+	while (len < capacity)
+		len <<= 1;
+
+	struct mirror_ring_s *r;
+	if (posix_memalign((void **)&r, 64, sizeof(*r)) != 0)
+		return NULL;
+	memset(r, 0, sizeof(*r));
+
+	int fd = ring_fd(name ? name : "obe-ring", len);
+	if (fd < 0) {
+		free(r);
+		return NULL;
+	}
+
+	/* Reserve both halves, then map the same pages into each. */
+	uint8_t *base = mmap(NULL, len * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		free(r);
+		return NULL;
+	}
+
+	if (mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(base + len, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, len * 2);
+		close(fd);
+		free(r);
+		return NULL;
+	}
+	close(fd); /* The mappings hold the pages */
+
+	r->base = base;
+	r->capacity = len;
+
+	return r;
+}
+
+void mirror_ring_free(struct mirror_ring_s *r)
+{
+	if (!r)
+		return;
+
+	munmap(r->base, r->capacity * 2);
+	free(r);
+}
+
+size_t mirror_ring_capacity(const struct mirror_ring_s *r)
+{
+	return r->capacity;
+}
+
+size_t mirror_ring_used(const struct mirror_ring_s *r)
+{
+	return LOAD_ACQ(&r->head) - LOAD_ACQ(&r->tail);
+}
+
+size_t mirror_ring_space(const struct mirror_ring_s *r)
+{
+	return r->capacity - mirror_ring_used(r);
+}
+
+uint64_t mirror_ring_head(const struct mirror_ring_s *r)
+{
+	return LOAD_ACQ(&r->head);
+}
+
+uint64_t mirror_ring_tail(const struct mirror_ring_s *r)
+{
+	return LOAD_ACQ(&r->tail);
+}
+
+uint8_t *mirror_ring_write_ptr(struct mirror_ring_s *r)
+{
+	return r->base + (r->head & (r->capacity - 1));
+}
+
+void mirror_ring_write_commit(struct mirror_ring_s *r, size_t len)
+{
+	STORE_REL(&r->head, r->head + len);
+}
+
+size_t mirror_ring_write(struct mirror_ring_s *r, const void *buf, size_t len)
+{
+	size_t space = mirror_ring_space(r);
+	if (len > space)
+		len = space;
+
+	memcpy(mirror_ring_write_ptr(r), buf, len);
+	mirror_ring_write_commit(r, len);
+
+	return len;
+}
+
+const uint8_t *mirror_ring_read_ptr(const struct mirror_ring_s *r)
+{
+	return r->base + (r->tail & (r->capacity - 1));
+}
+
+void mirror_ring_read_consume(struct mirror_ring_s *r, size_t len)
+{
+	STORE_REL(&r->tail, r->tail + len);
+}
+
+size_t mirror_ring_read(struct mirror_ring_s *r, void *buf, size_t len)
+{
+	size_t used = mirror_ring_used(r);
+	if (len > used)
+		len = used;
+
+	memcpy(buf, mirror_ring_read_ptr(r), len);
+	mirror_ring_read_consume(r, len);
+
+	return len;
+}
+
+void mirror_ring_flush(struct mirror_ring_s *r)
+{
+	STORE_REL(&r->tail, LOAD_ACQ(&r->head));
+}
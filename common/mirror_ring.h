@@ -0,0 +1,53 @@
+#ifndef OBE_MIRROR_RING_H
+#define OBE_MIRROR_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fixed capacity byte ring, backed by a memfd mapped twice back to back. Any span of up
+ * to the capacity starting anywhere in the ring is contiguous in memory, so readers and
+ * writers work on plain pointers and never split a copy at the wrap.
+ *
+ * Lock free for a single producer and a single consumer: the producer owns the write
+ * calls, the consumer owns the read calls and flush. Either side may query the fill.
+ */
+struct mirror_ring_s;
+
+/* Capacity is rounded up to a power of two, and at least a page. Name is for /proc only. */
+struct mirror_ring_s *mirror_ring_alloc(size_t capacity, const char *name);
+void   mirror_ring_free(struct mirror_ring_s *r);
+
+size_t mirror_ring_capacity(const struct mirror_ring_s *r);
+size_t mirror_ring_used(const struct mirror_ring_s *r);
+size_t mirror_ring_space(const struct mirror_ring_s *r);
+
+/* Absolute stream offsets, bytes written and consumed since allocation or reset. */
+uint64_t mirror_ring_head(const struct mirror_ring_s *r);
+uint64_t mirror_ring_tail(const struct mirror_ring_s *r);
+
+/* Fill up to mirror_ring_space() bytes at the write pointer, then commit them. */
+uint8_t *mirror_ring_write_ptr(struct mirror_ring_s *r);
+void   mirror_ring_write_commit(struct mirror_ring_s *r, size_t len);
+
+/* Copy in, returns the number of bytes written, short if the ring is full. */
+size_t mirror_ring_write(struct mirror_ring_s *r, const void *buf, size_t len);
+
+/* mirror_ring_used() bytes are readable from the read pointer. */
+const uint8_t *mirror_ring_read_ptr(const struct mirror_ring_s *r);
+void   mirror_ring_read_consume(struct mirror_ring_s *r, size_t len);
+
+/* Copy out and consume, returns the number of bytes read. */
+size_t mirror_ring_read(struct mirror_ring_s *r, void *buf, size_t len);
+
+/* Discard everything written so far, the stream offsets carry on. */
+void   mirror_ring_flush(struct mirror_ring_s *r);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_MIRROR_RING_H */
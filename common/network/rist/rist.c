@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rist.h"
+
+#define MAX_PACKET        1500
+#define RTP_HEADER_SIZE   12
+#define RTCP_INTERVAL_US  100000
+#define DEFAULT_LATENCY   1000
+#define DEFAULT_PACKETS   8192
+#define HOLDOFF_US        10000 /* Before the first RTT measurement */
+
+#define NTP_OFFSET 2208988800ULL
+
+#define RTCP_SR    200
+#define RTCP_RR    201
+#define RTCP_SDES  202
+#define RTCP_APP   204
+#define RTCP_RTPFB 205
+
+/* TR-06-1 APP subtypes, name "RIST" */
+#define RIST_RANGE_NACK    0
+#define RIST_ECHO_REQUEST  2
+#define RIST_ECHO_RESPONSE 3
+
+int g_rist_output_rtt_ms = -1;
+int g_rist_output_loss_permille = 0;
+int64_t g_rist_output_retransmits = 0;
+
+struct slot_s
+{
+	uint16_t seq;
+	int len;
+	int64_t sent;           /* Monotonic us */
+	int64_t last_rtx;       /* 0 when never retransmitted */
+	uint8_t data[MAX_PACKET];
+};
+
+struct rist_sender_s
+{
+	int fd, rtcp_fd;
+	struct sockaddr_storage dst, rtcp_dst;
+	socklen_t dst_len;
+
+	pthread_mutex_t mutex;
+	struct slot_s *ring;
+	uint32_t mask;
+	int64_t latency_us;
+
+	/* Taken from the packets written, for the sender report */
+	uint32_t ssrc;
+	uint32_t last_rtp_ts;
+	int64_t last_rtp_time;
+	uint32_t pkt_cnt, octet_cnt;
+	char cname[64];
+
+	struct rist_sender_stats_s stats;
+
+	pthread_t thread;
+	int thread_running;
+	volatile int terminate;
+};
+
+#define RB16(p) (((p)[0] << 8) | (p)[1])
+#define RB32(p) (((uint32_t)(p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+
+static void wb16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void wb32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t ntp_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((uint64_t)(ts.tv_sec + NTP_OFFSET) << 32) | (((uint64_t)ts.tv_nsec << 32) / 1000000000);
+}
+
+static void set_port(struct sockaddr_storage *addr, int port)
+{
+	if (addr->ss_family == AF_INET6)
+		((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+	else
+		((struct sockaddr_in *)addr)->sin_port = htons(port);
+}
+
+static int is_multicast(const struct sockaddr_storage *addr)
+{
+	if (addr->ss_family == AF_INET6)
+		return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)addr)->sin6_addr);
+	return IN_MULTICAST(ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr));
+}
+
+static int open_socket(const struct rist_sender_s *r, const struct rist_sender_opts_s *opts, int port)
+{
+	int fd = socket(r->dst.ss_family, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	struct sockaddr_storage local;
+	memset(&local, 0, sizeof(local));
+	local.ss_family = r->dst.ss_family;
+	set_port(&local, port);
+	if (bind(fd, (struct sockaddr *)&local, r->dst_len) < 0)
+		goto fail;
+
+	if (is_multicast(&r->dst)) {
+		if (r->dst.ss_family == AF_INET) {
+			struct ip_mreqn req = { .imr_ifindex = opts->miface };
+			if (opts->ttl && setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &opts->ttl, sizeof(opts->ttl)) < 0)
+				goto fail;
+			if (opts->miface && setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &req, sizeof(req)) < 0)
+				goto fail;
+		} else {
+			if (opts->ttl && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &opts->ttl, sizeof(opts->ttl)) < 0)
+				goto fail;
+			if (opts->miface && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &opts->miface, sizeof(opts->miface)) < 0)
+				goto fail;
+		}
+	}
+
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+/* Called with the mutex held, the packet is copied to pkt for sending outside it. */
+static int prepare_retransmit(struct rist_sender_s *r, uint16_t seq, int64_t now, uint8_t *pkt)
+{
+	struct slot_s *s = &r->ring[seq & r->mask];
+
+	r->stats.nacked++;
+	if (!s->len || s->seq != seq || now - s->sent > r->latency_us) {
+		r->stats.expired++;
+		return 0;
+	}
+
+	/* A NACK repeated before our retransmit could have arrived is not a new loss */
+	int64_t holdoff = r->stats.rtt_us > 0 ? r->stats.rtt_us : HOLDOFF_US;
+	if (s->last_rtx && now - s->last_rtx < holdoff) {
+		r->stats.suppressed++;
+		return 0;
+	}
+	s->last_rtx = now;
+	r->stats.retransmits++;
+
+	memcpy(pkt, s->data, s->len);
+	pkt[11] |= 1;
+
+	return s->len;
+}
+
+static void retransmit(struct rist_sender_s *r, uint16_t seq, int64_t now)
+{
+	uint8_t pkt[MAX_PACKET];
+
+	pthread_mutex_lock(&r->mutex);
+	int len = prepare_retransmit(r, seq, now, pkt);
+	pthread_mutex_unlock(&r->mutex);
+
+	if (len)
+		sendto(r->fd, pkt, len, 0, (struct sockaddr *)&r->dst, r->dst_len);
+}
+
+static void report_blocks(struct rist_sender_s *r, const uint8_t *b, int count, const uint8_t *end)
+{
+	for (int i = 0; i < count && b + 24 <= end; i++, b += 24) {
+		if ((RB32(b) & ~1) != r->ssrc)
+			continue;
+
+		uint32_t lsr = RB32(b + 16);
+		uint32_t dlsr = RB32(b + 20);
+
+		pthread_mutex_lock(&r->mutex);
+		r->stats.loss_permille = b[4] * 1000 / 256;
+		r->stats.cumulative_lost = (b[5] << 16) | (b[6] << 8) | b[7];
+		if (lsr) {
+			/* Middle 32 bits of NTP time, 1/65536 s */
+			uint32_t rtt = (uint32_t)(ntp_now() >> 16) - lsr - dlsr;
+			if (rtt < 10 * 65536)
+				r->stats.rtt_us = (int)(((uint64_t)rtt * 1000000) >> 16);
+		}
+		pthread_mutex_unlock(&r->mutex);
+	}
+}
+
+static void echo_response(struct rist_sender_s *r, const uint8_t *req, int len, int fd,
+	const struct sockaddr_storage *from, socklen_t from_len)
+{
+	uint8_t pkt[24];
+
+	if (len < 20)
+		return;
+
+	pkt[0] = 0x80 | RIST_ECHO_RESPONSE;
+	pkt[1] = RTCP_APP;
+	wb16(pkt + 2, sizeof(pkt) / 4 - 1);
+	wb32(pkt + 4, r->ssrc);
+	memcpy(pkt + 8, "RIST", 4);
+	memcpy(pkt + 12, req + 12, 8); /* The requester's timestamp */
+	wb32(pkt + 20, 0);             /* Processing delay, us */
+
+	sendto(fd, pkt, sizeof(pkt), 0, (const struct sockaddr *)from, from_len);
+}
+
+static void handle_rtcp(struct rist_sender_s *r, const uint8_t *buf, int len, int fd,
+	const struct sockaddr_storage *from, socklen_t from_len)
+{
+	int64_t now = now_us();
+
+	while (len >= 8) {
+		int count = buf[0] & 0x1f;
+		int pt = buf[1];
+		int plen = (RB16(buf + 2) + 1) * 4;
+		if ((buf[0] >> 6) != 2 || plen > len)
+			return;
+
+		const uint8_t *end = buf + plen;
+
+		if (pt == RTCP_SR)
+			report_blocks(r, buf + 28, count, end);
+		else if (pt == RTCP_RR)
+			report_blocks(r, buf + 8, count, end);
+		else if (pt == RTCP_RTPFB && count == 1) {
+			/* Generic NACK, a packet id and a bitmask of the 16 that follow */
+			for (const uint8_t *p = buf + 12; p + 4 <= end; p += 4) {
+				uint16_t pid = RB16(p);
+				uint16_t blp = RB16(p + 2);
+				retransmit(r, pid, now);
+				for (int b = 0; b < 16; b++) {
+					if (blp & (1 << b))
+						retransmit(r, pid + b + 1, now);
+				}
+			}
+		} else if (pt == RTCP_APP && plen >= 12 && !memcmp(buf + 8, "RIST", 4)) {
+			if (count == RIST_RANGE_NACK) {
+				for (const uint8_t *p = buf + 12; p + 4 <= end; p += 4) {
+					uint16_t start = RB16(p);
+					uint32_t extra = RB16(p + 2);
+					if (extra > r->mask)
+						extra = r->mask;
+					for (uint32_t k = 0; k <= extra; k++)
+						retransmit(r, start + k, now);
+				}
+			} else if (count == RIST_ECHO_REQUEST)
+				echo_response(r, buf, plen, fd, from, from_len);
+		}
+
+		buf += plen;
+		len -= plen;
+	}
+}
+
+static void send_report(struct rist_sender_s *r)
+{
+	uint8_t pkt[28 + 8 + 2 + sizeof(r->cname) + 4];
+	uint64_t ntp = ntp_now();
+	int64_t now = now_us();
+
+	pthread_mutex_lock(&r->mutex);
+	uint32_t ssrc = r->ssrc;
+	uint32_t rtp_ts = r->last_rtp_ts + (uint32_t)((now - r->last_rtp_time) * 90 / 1000);
+	uint32_t pkt_cnt = r->pkt_cnt;
+	uint32_t octet_cnt = r->octet_cnt;
+
+	g_rist_output_rtt_ms = r->stats.rtt_us < 0 ? -1 : r->stats.rtt_us / 1000;
+	g_rist_output_loss_permille = r->stats.loss_permille;
+	g_rist_output_retransmits = r->stats.retransmits;
+	pthread_mutex_unlock(&r->mutex);
+
+	/* Sender report */
+	pkt[0] = 0x80;
+	pkt[1] = RTCP_SR;
+	wb16(pkt + 2, 6);
+	wb32(pkt + 4, ssrc);
+	wb32(pkt + 8, ntp >> 32);
+	wb32(pkt + 12, ntp);
+	wb32(pkt + 16, rtp_ts);
+	wb32(pkt + 20, pkt_cnt);
+	wb32(pkt + 24, octet_cnt);
+
+	/* SDES with a CNAME, null terminated and padded to a word */
+	uint8_t *s = pkt + 28;
+	int clen = strlen(r->cname);
+	int slen = (8 + 2 + clen + 1 + 3) & ~3;
+	memset(s, 0, slen);
+	s[0] = 0x81;
+	s[1] = RTCP_SDES;
+	wb16(s + 2, slen / 4 - 1);
+	wb32(s + 4, ssrc);
+	s[8] = 1;
+	s[9] = clen;
+	memcpy(s + 10, r->cname, clen);
+
+	sendto(r->rtcp_fd, pkt, 28 + slen, 0, (struct sockaddr *)&r->rtcp_dst, r->dst_len);
+}
+
+static void *rtcp_thread(void *arg)
+{
+	struct rist_sender_s *r = arg;
+	int64_t next_report = now_us();
+	uint8_t buf[MAX_PACKET];
+
+	while (!r->terminate) {
+		/* Receivers reply to our RTCP port, some to the RTP one */
+		struct pollfd pfd[2] = {
+			{ .fd = r->rtcp_fd, .events = POLLIN },
+			{ .fd = r->fd, .events = POLLIN },
+		};
+		int64_t wait = next_report - now_us();
+		if (poll(pfd, 2, wait > 0 ? (int)(wait / 1000) + 1 : 0) < 0 && errno != EINTR)
+			break;
+
+		for (int i = 0; i < 2; i++) {
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+
+			struct sockaddr_storage from;
+			socklen_t from_len = sizeof(from);
+			int n = recvfrom(pfd[i].fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+			if (n > 0)
+				handle_rtcp(r, buf, n, pfd[i].fd, &from, from_len);
+		}
+
+		if (now_us() >= next_report) {
+			if (r->stats.packets_sent)
+				send_report(r);
+			next_report += RTCP_INTERVAL_US;
+		}
+	}
+
+	return NULL;
+}
+
+struct rist_sender_s *rist_sender_alloc(const struct rist_sender_opts_s *opts)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM };
+	struct addrinfo *res = NULL;
+	char port[16];
+
+	if (opts->port & 1)
+		fprintf(stderr, "[rist] port %d is odd, TR-06-1 expects RTP on an even port\n", opts->port);
+
+	snprintf(port, sizeof(port), "%d", opts->port);
+	if (getaddrinfo(opts->hostname, port, &hints, &res) || !res) {
+		fprintf(stderr, "[rist] Could not resolve %s\n", opts->hostname);
+		return NULL;
+	}
+
+	struct rist_sender_s *r = calloc(1, sizeof(*r));
+	if (!r) {
+		freeaddrinfo(res);
+		return NULL;
+	}
+	r->fd = r->rtcp_fd = -1;
+
+	memcpy(&r->dst, res->ai_addr, res->ai_addrlen);
+	r->dst_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	r->rtcp_dst = r->dst;
+	set_port(&r->rtcp_dst, opts->port + 1);
+
+	uint32_t num = 1;
+	while (num < (uint32_t)(opts->buffer_packets > 0 ? opts->buffer_packets : DEFAULT_PACKETS))
+		num <<= 1;
+	r->mask = num - 1;
+	r->latency_us = (int64_t)(opts->latency_ms > 0 ? opts->latency_ms : DEFAULT_LATENCY) * 1000;
+	r->stats.rtt_us = -1;
+
+	char host[48];
+	if (gethostname(host, sizeof(host)) < 0)
+		strcpy(host, "localhost");
+	host[sizeof(host) - 1] = 0;
+	snprintf(r->cname, sizeof(r->cname), "obe@%s", host);
+
+	pthread_mutex_init(&r->mutex, NULL);
+
+	r->ring = calloc(num, sizeof(*r->ring));
+	if (!r->ring)
+		goto fail;
+
+	r->fd = open_socket(r, opts, opts->local_port);
+	r->rtcp_fd = open_socket(r, opts, opts->local_port ? opts->local_port + 1 : 0);
+	if (r->fd < 0 || r->rtcp_fd < 0) {
+		fprintf(stderr, "[rist] Could not open sockets: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	if (pthread_create(&r->thread, NULL, rtcp_thread, r) < 0)
+		goto fail;
+	r->thread_running = 1;
+
+	printf("[rist] sending to %s:%d, %" PRIi64 "ms window, %u packet buffer\n",
+		opts->hostname, opts->port, r->latency_us / 1000, num);
+
+	return r;
+
+fail:
+	rist_sender_free(r);
+	return NULL;
+}
+
+void rist_sender_free(struct rist_sender_s *r)
+{
+	if (!r)
+		return;
+
+	if (r->thread_running) {
+		r->terminate = 1;
+		pthread_join(r->thread, NULL);
+
+		struct rist_sender_stats_s *s = &r->stats;
+		printf("[rist] %" PRIu64 " sent, %" PRIu64 " nacked, %" PRIu64 " retransmitted, %" PRIu64 " expired, "
+			"%" PRIu64 " suppressed, rtt %dus, receiver lost %u\n",
+			s->packets_sent, s->nacked, s->retransmits, s->expired, s->suppressed, s->rtt_us, s->cumulative_lost);
+	}
+
+	if (r->fd >= 0)
+		close(r->fd);
+	if (r->rtcp_fd >= 0)
+		close(r->rtcp_fd);
+	pthread_mutex_destroy(&r->mutex);
+	free(r->ring);
+	free(r);
+}
+
+int rist_sender_write(struct rist_sender_s *r, const uint8_t *pkt, int len)
+{
+	if (len < RTP_HEADER_SIZE || len > MAX_PACKET)
+		return -1;
+
+	uint16_t seq = RB16(pkt + 2);
+
+	pthread_mutex_lock(&r->mutex);
+	struct slot_s *s = &r->ring[seq & r->mask];
+	memcpy(s->data, pkt, len);
+	s->seq = seq;
+	s->len = len;
+	s->sent = now_us();
+	s->last_rtx = 0;
+
+	r->ssrc = RB32(pkt + 8);
+	r->last_rtp_ts = RB32(pkt + 4);
+	r->last_rtp_time = s->sent;
+	r->pkt_cnt++;
+	r->octet_cnt += len - RTP_HEADER_SIZE;
+	r->stats.packets_sent++;
+	pthread_mutex_unlock(&r->mutex);
+
+	if (sendto(r->fd, pkt, len, 0, (struct sockaddr *)&r->dst, r->dst_len) < 0)
+		return -1;
+
+	return len;
+}
+
+void rist_sender_get_stats(struct rist_sender_s *r, struct rist_sender_stats_s *stats)
+{
+	pthread_mutex_lock(&r->mutex);
+	*stats = r->stats;
+	pthread_mutex_unlock(&r->mutex);
+}
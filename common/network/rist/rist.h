@@ -0,0 +1,60 @@
+#ifndef OBE_COMMON_RIST_H
+#define OBE_COMMON_RIST_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* RIST simple profile sender, VSF TR-06-1.
+ * RTP goes to the receiver's port P, which should be even, and RTCP to P+1. Every packet
+ * sent is kept in a bounded ring for the latency window. Receiver NACKs, generic (RFC 4585)
+ * or RIST range, are answered from the ring with the SSRC LSB set to mark a retransmission.
+ * A sender report and CNAME go out every 100ms, the receiver's reports give RTT and loss.
+ */
+struct rist_sender_s;
+
+struct rist_sender_opts_s
+{
+	const char *hostname;
+	int port;
+	int local_port;         /* RTP from here and RTCP from local_port + 1, 0 for any */
+	int ttl;                /* Multicast only, 0 leaves the system default */
+	int miface;             /* Multicast interface index, 0 for the default */
+	int latency_ms;         /* Packets older than this are not retransmitted, 0 for 1000 */
+	int buffer_packets;     /* Ring bound, rounded up to a power of two, 0 for 8192 */
+};
+
+struct rist_sender_stats_s
+{
+	uint64_t packets_sent;
+	uint64_t nacked;        /* Sequence numbers the receiver asked for */
+	uint64_t retransmits;
+	uint64_t expired;       /* Asked for but older than the latency window, or gone from the ring */
+	uint64_t suppressed;    /* Asked for again within an RTT of the last retransmit */
+	int rtt_us;             /* From the last receiver report, -1 before the first */
+	int loss_permille;      /* Fraction lost in the last receiver report */
+	uint32_t cumulative_lost;
+};
+
+struct rist_sender_s *rist_sender_alloc(const struct rist_sender_opts_s *opts);
+void rist_sender_free(struct rist_sender_s *r);
+
+/* Send one complete RTP packet, header included, and keep it for retransmission.
+ * The SSRC LSB must be clear. Returns len, or -1 if the send failed.
+ */
+int rist_sender_write(struct rist_sender_s *r, const uint8_t *pkt, int len);
+
+void rist_sender_get_stats(struct rist_sender_s *r, struct rist_sender_stats_s *stats);
+
+/* Most recent values from any RIST output, for the runtime statistics */
+extern int g_rist_output_rtt_ms;
+extern int g_rist_output_loss_permille;
+extern int64_t g_rist_output_retransmits;
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_COMMON_RIST_H */
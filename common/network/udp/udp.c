@@ -26,6 +26,7 @@
 #include "common/network/network.h"
 #include "output/output.h"
 #include "udp.h"
+#include "xdp.h"
 #include <libltntstools/ltntstools.h>
 
 typedef struct
@@ -46,6 +47,8 @@ typedef struct
 
     time_t bps_last;
     void *throughputHandle;
+
+    struct xdp_tx_s *xdp;
 } obe_udp_ctx;
 
 int g_udp_output_bps = 0;
@@ -244,6 +247,28 @@ void udp_populate_opts( obe_udp_opts_t *udp_opts, char *uri )
 
         if( av_find_info_tag( buf, sizeof(buf), "miface", p ) )
             udp_opts->miface = if_nametoindex( buf );
+
+        if( av_find_info_tag( buf, sizeof(buf), "null_deletion", p ) )
+            udp_opts->null_deletion = strtol( buf, NULL, 10 );
+
+        if( av_find_info_tag( buf, sizeof(buf), "xdp", p ) )
+            snprintf( udp_opts->xdp, sizeof(udp_opts->xdp), "%s", buf );
+
+        if( av_find_info_tag( buf, sizeof(buf), "xdp_queue", p ) )
+            udp_opts->xdp_queue = strtol( buf, NULL, 10 );
+
+        if( av_find_info_tag( buf, sizeof(buf), "xdp_dmac", p ) )
+        {
+            uint8_t *m = udp_opts->xdp_dmac;
+            udp_opts->has_xdp_dmac = sscanf( buf, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                                             &m[0], &m[1], &m[2], &m[3], &m[4], &m[5] ) == 6;
+        }
+
+        if( av_find_info_tag( buf, sizeof(buf), "latency", p ) )
+            udp_opts->latency = strtol( buf, NULL, 10 );
+
+        if( av_find_info_tag( buf, sizeof(buf), "retransmit_buffer", p ) )
+            udp_opts->retransmit_buffer = strtol( buf, NULL, 10 );
     }
 
     /* fill the dest addr */
@@ -320,6 +345,29 @@ int udp_open( hnd_t *p_handle, obe_udp_opts_t *udp_opts )
      */
     throughput_hires_alloc(&s->throughputHandle, ((40 * 1e6) / 8 ) / 1316);
 
+    /* The socket stays open, it holds the local port and is the fallback when the ring is full */
+    if( udp_opts->xdp[0] )
+    {
+        if( s->dest_addr.ss_family == AF_INET )
+        {
+            struct xdp_tx_opts_s xopts = {
+                .ifname   = udp_opts->xdp,
+                .queue_id = udp_opts->xdp_queue,
+                .dst      = *(struct sockaddr_in *)&s->dest_addr,
+                .src_port = s->local_port,
+                .ttl      = s->ttl,
+                .has_dmac = udp_opts->has_xdp_dmac,
+            };
+            memcpy( xopts.dmac, udp_opts->xdp_dmac, sizeof(xopts.dmac) );
+            s->xdp = xdp_tx_open( &xopts );
+        }
+        else
+            fprintf( stderr, "[udp] AF_XDP output is IPv4 only\n" );
+
+        if( !s->xdp )
+            fprintf( stderr, "[udp] Falling back to the socket path for %s:%d\n", s->hostname, s->port );
+    }
+
     s->udp_fd = udp_fd;
     *p_handle = s;
     return 0;
@@ -379,7 +427,10 @@ int udp_write( hnd_t handle, uint8_t *buf, int size )
                 break;
             }
         } /* (g_sei_timestamping) */
-        ret = sendto( s->udp_fd, buf, size, 0, (struct sockaddr *)&s->dest_addr, s->dest_addr_len );
+        if( s->xdp && xdp_tx_write( s->xdp, buf, size ) >= 0 )
+            ret = size;
+        else
+            ret = sendto( s->udp_fd, buf, size, 0, (struct sockaddr *)&s->dest_addr, s->dest_addr_len );
     } else {
         /* !s->is_connected */
         ret = send( s->udp_fd, buf, size, 0 );
@@ -398,6 +449,7 @@ void udp_close( hnd_t handle )
 {
     obe_udp_ctx *s = handle;
 
+    xdp_tx_close( s->xdp );
     close( s->udp_fd );
     throughput_hires_free(s->throughputHandle);
     free( s );
@@ -33,6 +33,13 @@ typedef struct obe_udp_opts_t
     int  ttl;
     int  buffer_size;
     int  miface;
+    int  null_deletion; /* Output only, strip null packets, see ip.c */
+    char xdp[32];       /* Output only, transmit through AF_XDP on this interface, see xdp.h */
+    int  xdp_queue;
+    int  has_xdp_dmac;
+    uint8_t xdp_dmac[6];
+    int  latency;       /* RIST only, retransmit window in ms */
+    int  retransmit_buffer; /* RIST only, retransmit ring size in packets */
 } obe_udp_opts_t;
 
 void udp_populate_opts( obe_udp_opts_t *udp_opts, char *uri );
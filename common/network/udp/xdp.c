@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "xdp.h"
+
+#if HAVE_LINUX_IF_XDP_H
+#include <linux/if_xdp.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define FRAME_SIZE  2048
+#define NUM_FRAMES  4096
+#define RING_SIZE   2048
+#define FILL_SIZE   64
+#define REAP_BATCH  64
+#define HDR_LEN     (14 + 20 + 8)
+#define MAX_PAYLOAD (FRAME_SIZE - HDR_LEN)
+
+#define LOAD_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+struct ring_s
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	void *map;
+	size_t map_len;
+};
+
+struct xdp_tx_s
+{
+	int fd;
+	int need_wakeup;
+
+	uint8_t *umem;
+	struct ring_s tx, cq, fq;
+
+	/* Free UMEM frames, as a stack of offsets */
+	uint64_t *free_frames;
+	int num_free;
+
+	uint8_t hdr[HDR_LEN];
+	uint32_t ip_sum;        /* Checksum of the constant IP header words, unfolded */
+	uint16_t ip_id;
+
+	uint64_t sent, ring_full;
+};
+
+static int ring_map(int fd, struct ring_s *r, const struct xdp_ring_offset *off, off_t pgoff, size_t desc_size, int n)
+{
+	r->map_len = off->desc + (n * desc_size);
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+
+	r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+	r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+	r->flags = (uint32_t *)((uint8_t *)r->map + off->flags);
+	r->desc = (uint8_t *)r->map + off->desc;
+	return 0;
+}
+
+static int if_ioctl(const char *ifname, unsigned long req, struct ifreq *ifr)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(ifr, 0, sizeof(*ifr));
+	strncpy(ifr->ifr_name, ifname, IFNAMSIZ - 1);
+	int ret = ioctl(fd, req, ifr);
+	close(fd);
+	return ret;
+}
+
+/* Unicast destinations must already be in the ARP table, or given with xdp_dmac */
+static int arp_lookup(struct in_addr ip, uint8_t *mac)
+{
+	char line[256], addr[64], hw[64];
+	int found = -1;
+
+	FILE *fh = fopen("/proc/net/arp", "r");
+	if (!fh)
+		return -1;
+
+	while (found < 0 && fgets(line, sizeof(line), fh)) {
+		if (sscanf(line, "%63s %*s %*s %63s", addr, hw) != 2 || strcmp(addr, inet_ntoa(ip)) != 0)
+			continue;
+		if (sscanf(hw, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6 &&
+			(mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]))
+			found = 0;
+	}
+	fclose(fh);
+	return found;
+}
+
+static int build_header(struct xdp_tx_s *x, const struct xdp_tx_opts_s *opts)
+{
+	struct ifreq ifr;
+	uint8_t smac[6], dmac[6];
+	uint32_t saddr, daddr = opts->dst.sin_addr.s_addr;
+
+	if (if_ioctl(opts->ifname, SIOCGIFHWADDR, &ifr) < 0)
+		return -1;
+	memcpy(smac, ifr.ifr_hwaddr.sa_data, 6);
+
+	if (if_ioctl(opts->ifname, SIOCGIFADDR, &ifr) < 0)
+		return -1;
+	saddr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+
+	const uint8_t *d = (const uint8_t *)&daddr;
+	if (opts->has_dmac)
+		memcpy(dmac, opts->dmac, 6);
+	else if ((d[0] & 0xf0) == 0xe0) {
+		/* IPv4 multicast MAC mapping */
+		dmac[0] = 0x01; dmac[1] = 0x00; dmac[2] = 0x5e;
+		dmac[3] = d[1] & 0x7f; dmac[4] = d[2]; dmac[5] = d[3];
+	} else if (arp_lookup(opts->dst.sin_addr, dmac) < 0) {
+		fprintf(stderr, "[xdp] %s is not in the ARP table, set xdp_dmac\n", inet_ntoa(opts->dst.sin_addr));
+		return -1;
+	}
+
+	uint8_t *h = x->hdr;
+	memcpy(h, dmac, 6);
+	memcpy(h + 6, smac, 6);
+	h[12] = 0x08; h[13] = 0x00;
+
+	uint8_t *ip = h + 14;
+	ip[0] = 0x45;
+	ip[1] = 0;
+	ip[6] = 0x40;           /* Don't fragment */
+	ip[7] = 0;
+	ip[8] = opts->ttl ? opts->ttl : 64;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, &saddr, 4);
+	memcpy(ip + 16, &daddr, 4);
+
+	/* Length, id and checksum (bytes 2-5, 10-11) are zero here and patched per datagram */
+	x->ip_sum = 0;
+	for (int i = 0; i < 20; i += 2)
+		x->ip_sum += (ip[i] << 8) | ip[i + 1];
+
+	uint8_t *udp = ip + 20;
+	udp[0] = opts->src_port >> 8; udp[1] = opts->src_port & 0xff;
+	udp[2] = ntohs(opts->dst.sin_port) >> 8; udp[3] = ntohs(opts->dst.sin_port) & 0xff;
+
+	return 0;
+}
+
+/* Return the frames the kernel has finished with */
+static void reap_completions(struct xdp_tx_s *x)
+{
+	uint32_t prod = LOAD_ACQ(x->cq.producer);
+	uint32_t cons = *x->cq.consumer;
+	uint64_t *addrs = x->cq.desc;
+
+	for (; cons != prod; cons++)
+		x->free_frames[x->num_free++] = addrs[cons & (RING_SIZE - 1)];
+
+	STORE_REL(x->cq.consumer, cons);
+}
+
+static int kick(struct xdp_tx_s *x)
+{
+	if (x->need_wakeup && !(LOAD_ACQ(x->tx.flags) & XDP_RING_NEED_WAKEUP))
+		return 0;
+
+	if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+		return -1;
+
+	return 0;
+}
+
+static int tx_full(struct xdp_tx_s *x)
+{
+	return x->num_free == 0 || (*x->tx.producer - LOAD_ACQ(x->tx.consumer)) >= RING_SIZE;
+}
+
+int xdp_tx_write(struct xdp_tx_s *x, const uint8_t *buf, int len)
+{
+	if (len > MAX_PAYLOAD)
+		return -1;
+
+	/* The kernel stops transmitting when the completion ring is full */
+	if (LOAD_ACQ(x->cq.producer) - *x->cq.consumer >= REAP_BATCH)
+		reap_completions(x);
+
+	if (tx_full(x)) {
+		reap_completions(x);
+		if (tx_full(x)) {
+			/* Copy mode drivers only transmit from the syscall, give them another go */
+			kick(x);
+			reap_completions(x);
+			if (tx_full(x)) {
+				x->ring_full++;
+				return -1;
+			}
+		}
+	}
+
+	uint64_t addr = x->free_frames[--x->num_free];
+	uint8_t *f = x->umem + addr;
+
+	memcpy(f, x->hdr, HDR_LEN);
+	memcpy(f + HDR_LEN, buf, len);
+
+	uint16_t ip_len = 20 + 8 + len;
+	uint16_t udp_len = 8 + len;
+	uint16_t id = x->ip_id++;
+	uint32_t sum = x->ip_sum + ip_len + id;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~sum & 0xffff;
+
+	uint8_t *ip = f + 14;
+	ip[2] = ip_len >> 8; ip[3] = ip_len & 0xff;
+	ip[4] = id >> 8; ip[5] = id & 0xff;
+	ip[10] = sum >> 8; ip[11] = sum & 0xff;
+	ip[24] = udp_len >> 8; ip[25] = udp_len & 0xff;
+
+	uint32_t prod = *x->tx.producer;
+	struct xdp_desc *desc = &((struct xdp_desc *)x->tx.desc)[prod & (RING_SIZE - 1)];
+	desc->addr = addr;
+	desc->len = HDR_LEN + len;
+	desc->options = 0;
+	STORE_REL(x->tx.producer, prod + 1);
+
+	if (kick(x) < 0)
+		return -1;
+
+	x->sent++;
+	return len;
+}
+
+struct xdp_tx_s *xdp_tx_open(const struct xdp_tx_opts_s *opts)
+{
+	int ifindex = if_nametoindex(opts->ifname);
+	if (!ifindex) {
+		fprintf(stderr, "[xdp] no interface %s\n", opts->ifname);
+		return NULL;
+	}
+
+	struct xdp_tx_s *x = calloc(1, sizeof(*x));
+	if (!x)
+		return NULL;
+	x->fd = -1;
+
+	if (build_header(x, opts) < 0) {
+		fprintf(stderr, "[xdp] could not build headers for %s\n", opts->ifname);
+		goto fail;
+	}
+
+	x->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (x->fd < 0) {
+		fprintf(stderr, "[xdp] AF_XDP socket failed, %s\n", strerror(errno));
+		goto fail;
+	}
+
+	x->umem = mmap(NULL, NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	x->free_frames = malloc(NUM_FRAMES * sizeof(*x->free_frames));
+	if (x->umem == MAP_FAILED || !x->free_frames) {
+		x->umem = NULL;
+		goto fail;
+	}
+	for (int i = 0; i < NUM_FRAMES; i++)
+		x->free_frames[x->num_free++] = (uint64_t)i * FRAME_SIZE;
+
+	struct xdp_umem_reg reg = {
+		.addr = (uint64_t)(uintptr_t)x->umem,
+		.len = NUM_FRAMES * FRAME_SIZE,
+		.chunk_size = FRAME_SIZE,
+		.headroom = 0,
+	};
+	int tx_size = RING_SIZE, cq_size = RING_SIZE, fq_size = FILL_SIZE;
+	if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+		setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &fq_size, sizeof(fq_size)) < 0 ||
+		setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &cq_size, sizeof(cq_size)) < 0 ||
+		setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &tx_size, sizeof(tx_size)) < 0) {
+		fprintf(stderr, "[xdp] UMEM setup failed, %s\n", strerror(errno));
+		goto fail;
+	}
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0 ||
+		ring_map(x->fd, &x->tx, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc), RING_SIZE) < 0 ||
+		ring_map(x->fd, &x->cq, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t), RING_SIZE) < 0 ||
+		ring_map(x->fd, &x->fq, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t), FILL_SIZE) < 0) {
+		fprintf(stderr, "[xdp] ring mapping failed, %s\n", strerror(errno));
+		goto fail;
+	}
+
+	/* Older kernels don't know need_wakeup, they get a kick on every write */
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_flags = XDP_USE_NEED_WAKEUP,
+		.sxdp_ifindex = ifindex,
+		.sxdp_queue_id = opts->queue_id,
+	};
+	x->need_wakeup = 1;
+	if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+		sxdp.sxdp_flags = 0;
+		x->need_wakeup = 0;
+		if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+			fprintf(stderr, "[xdp] bind to %s queue %d failed, %s\n", opts->ifname, opts->queue_id, strerror(errno));
+			goto fail;
+		}
+	}
+
+	printf("[xdp] transmitting on %s queue %d to %s:%d\n", opts->ifname, opts->queue_id,
+		inet_ntoa(opts->dst.sin_addr), ntohs(opts->dst.sin_port));
+
+	return x;
+
+fail:
+	xdp_tx_close(x);
+	return NULL;
+}
+
+void xdp_tx_close(struct xdp_tx_s *x)
+{
+	if (!x)
+		return;
+
+	/* Let the kernel drain what is queued, copy mode only moves frames from the syscall */
+	for (int i = 0; i < 1000 && x->tx.map && *x->tx.producer != LOAD_ACQ(x->tx.consumer); i++) {
+		if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			break;
+		reap_completions(x);
+		usleep(100);
+	}
+
+	if (x->sent || x->ring_full)
+		printf("[xdp] %" PRIu64 " datagrams sent, %" PRIu64 " ring full\n", x->sent, x->ring_full);
+
+	struct ring_s *rings[] = { &x->tx, &x->cq, &x->fq };
+	for (int i = 0; i < 3; i++) {
+		if (rings[i]->map)
+			munmap(rings[i]->map, rings[i]->map_len);
+	}
+	if (x->fd >= 0)
+		close(x->fd);
+	if (x->umem)
+		munmap(x->umem, NUM_FRAMES * FRAME_SIZE);
+	free(x->free_frames);
+	free(x);
+}
+
+#else /* !HAVE_LINUX_IF_XDP_H */
+
+struct xdp_tx_s *xdp_tx_open(const struct xdp_tx_opts_s *opts)
+{
+	fprintf(stderr, "[xdp] not built with AF_XDP support\n");
+	return NULL;
+}
+
+void xdp_tx_close(struct xdp_tx_s *x)
+{
+}
+
+int xdp_tx_write(struct xdp_tx_s *x, const uint8_t *buf, int len)
+{
+	return -1;
+}
+
+#endif
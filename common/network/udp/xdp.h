@@ -0,0 +1,42 @@
+#ifndef OBE_COMMON_XDP_H
+#define OBE_COMMON_XDP_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* AF_XDP transmit of IPv4 UDP datagrams, bypassing the kernel network stack.
+ * Ethernet, IP and UDP headers come from a template built at open, only the lengths,
+ * IP id and IP checksum are patched per datagram. The UDP checksum is left at zero.
+ * Frames live in a UMEM shared with the kernel, completions are reaped in batches and
+ * the kernel is only kicked when the driver asks for it.
+ * No XDP program is needed to transmit. Test locally on one end of a veth pair.
+ */
+struct xdp_tx_s;
+
+struct xdp_tx_opts_s
+{
+	const char *ifname;
+	int queue_id;
+	struct sockaddr_in dst;
+	uint16_t src_port;
+	int ttl;                /* 0 for 64 */
+	int has_dmac;           /* Otherwise multicast mapping, or the ARP table for unicast */
+	uint8_t dmac[6];
+};
+
+/* Returns NULL and says why if XDP can't be used, the caller keeps its socket path. */
+struct xdp_tx_s *xdp_tx_open(const struct xdp_tx_opts_s *opts);
+void xdp_tx_close(struct xdp_tx_s *x);
+
+/* Queue one datagram payload for transmit. Returns -1 if the ring is full. */
+int xdp_tx_write(struct xdp_tx_s *x, const uint8_t *buf, int len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_COMMON_XDP_H */
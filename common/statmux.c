@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "statmux.h"
+
+/* Complexity is measured as the bits a frame would have taken at this quantiser */
+#define STATMUX_REF_QP 24
+
+int g_statmux_period_ms = 500;
+int g_statmux_min_pct = 50;
+
+struct statmux_program_s
+{
+	int64_t bitrate;        /* Configured */
+	int64_t vbv_max_bitrate;
+	int64_t target;         /* Current share */
+
+	double complexity;      /* Over the current period */
+	int frames;
+};
+
+struct statmux_s
+{
+	pthread_mutex_t mutex;
+	int num;
+	struct statmux_program_s *p;
+	int64_t pool;
+	int64_t last;           /* Last reallocation, -1 before the first report */
+
+	struct statmux_stats_s stats;
+};
+
+struct statmux_s *statmux_alloc(int num_programs)
+{
+	struct statmux_s *sm = calloc(1, sizeof(*sm));
+	if (!sm)
+		return NULL;
+
+	sm->p = calloc(num_programs, sizeof(*sm->p));
+	if (!sm->p) {
+		free(sm);
+		return NULL;
+	}
+
+	pthread_mutex_init(&sm->mutex, NULL);
+	sm->num = num_programs;
+	sm->last = -1;
+
+	return sm;
+}
+
+void statmux_free(struct statmux_s *sm)
+{
+	if (!sm)
+		return;
+
+	pthread_mutex_destroy(&sm->mutex);
+	free(sm->p);
+	free(sm);
+}
+
+void statmux_set_program(struct statmux_s *sm, int idx, int64_t bitrate, int64_t vbv_max_bitrate)
+{
+	struct statmux_program_s *p = &sm->p[idx];
+
+	pthread_mutex_lock(&sm->mutex);
+	sm->pool += bitrate - p->bitrate;
+	p->bitrate = bitrate;
+	p->vbv_max_bitrate = vbv_max_bitrate > bitrate ? vbv_max_bitrate : bitrate;
+	p->target = bitrate;
+	pthread_mutex_unlock(&sm->mutex);
+}
+
+/* Share the pool by complexity, within each program's floor and VBV ceiling. Programs
+ * pushed against a limit are fixed there and the rest shared again among the others.
+ */
+static void reallocate(struct statmux_s *sm)
+{
+	int64_t lo[sm->num], hi[sm->num], share[sm->num];
+	int fixed[sm->num];
+	int min_pct = g_statmux_min_pct < 0 ? 0 : g_statmux_min_pct > 100 ? 100 : g_statmux_min_pct;
+
+	for (int i = 0; i < sm->num; i++) {
+		struct statmux_program_s *p = &sm->p[i];
+		lo[i] = p->bitrate * min_pct / 100;
+		hi[i] = p->vbv_max_bitrate;
+
+		/* Nothing reported, keep the current share */
+		fixed[i] = !p->frames;
+		share[i] = p->target;
+	}
+
+	for (int pass = 0; pass <= sm->num; pass++) {
+		int64_t remaining = sm->pool;
+		double weight = 0;
+		int num_free = 0, clamped = 0;
+
+		for (int i = 0; i < sm->num; i++) {
+			if (fixed[i])
+				remaining -= share[i];
+			else {
+				weight += sm->p[i].complexity;
+				num_free++;
+			}
+		}
+		if (!num_free)
+			break;
+
+		for (int i = 0; i < sm->num; i++) {
+			if (!fixed[i])
+				share[i] = weight > 0 ? remaining * (sm->p[i].complexity / weight) : remaining / num_free;
+		}
+
+		for (int i = 0; i < sm->num; i++) {
+			if (fixed[i] || (share[i] >= lo[i] && share[i] <= hi[i]))
+				continue;
+			share[i] = share[i] < lo[i] ? lo[i] : hi[i];
+			fixed[i] = 1;
+			clamped = 1;
+		}
+		if (!clamped)
+			break;
+	}
+
+	/* Move half way each period, the shares still sum to the pool. Encoders take whole kb/s. */
+	for (int i = 0; i < sm->num; i++) {
+		struct statmux_program_s *p = &sm->p[i];
+		int64_t target = (p->target + (share[i] - p->target) / 2) / 1000 * 1000;
+		p->target = target < 1000 ? 1000 : target;
+		p->complexity = 0;
+		p->frames = 0;
+	}
+	sm->stats.reallocations++;
+}
+
+void statmux_report(struct statmux_s *sm, int idx, int64_t now, int frame_bytes, int qp)
+{
+	struct statmux_program_s *p = &sm->p[idx];
+	double scale = qp >= 0 ? pow(2.0, (qp - STATMUX_REF_QP) / 6.0) : 1.0;
+
+	pthread_mutex_lock(&sm->mutex);
+	p->complexity += frame_bytes * 8.0 * scale;
+	p->frames++;
+
+	if (sm->last < 0)
+		sm->last = now;
+	else if (now - sm->last >= (int64_t)g_statmux_period_ms * 1000) {
+		reallocate(sm);
+		sm->last = now;
+	}
+	pthread_mutex_unlock(&sm->mutex);
+}
+
+int64_t statmux_get_bitrate(struct statmux_s *sm, int idx)
+{
+	pthread_mutex_lock(&sm->mutex);
+	int64_t bitrate = sm->p[idx].target;
+	pthread_mutex_unlock(&sm->mutex);
+
+	return bitrate;
+}
+
+void statmux_get_stats(struct statmux_s *sm, struct statmux_stats_s *stats)
+{
+	pthread_mutex_lock(&sm->mutex);
+	*stats = sm->stats;
+	pthread_mutex_unlock(&sm->mutex);
+}
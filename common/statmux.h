@@ -0,0 +1,49 @@
+#ifndef OBE_STATMUX_H
+#define OBE_STATMUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Statistical sharing of the video bitrate between the programs of a multiple program TS.
+ * Each program's video encoder reports the size and average quantiser of every frame. A
+ * frame's complexity is its size scaled to a reference quantiser, since the size of a
+ * frame roughly halves for every 6 steps of QP. Every period the pool, the sum of the
+ * programs' configured bitrates, is shared out in proportion to each program's complexity
+ * over the period. A program never gets less than g_statmux_min_pct of its configured
+ * bitrate, or more than its VBV maximum rate, so it only has room to grow when it was set
+ * up with a vbv-maxrate above its bitrate. Whatever a capped program can't take goes to
+ * the others. Each encoder picks its bitrate up from statmux_get_bitrate() and runs its
+ * VBV at that rate, so the programs together never exceed the pool.
+ */
+struct statmux_s;
+
+extern int g_statmux_period_ms;
+extern int g_statmux_min_pct;
+
+struct statmux_stats_s
+{
+	uint64_t reallocations;
+};
+
+struct statmux_s *statmux_alloc(int num_programs);
+void statmux_free(struct statmux_s *sm);
+
+/* Bits per second, for every program before its encoder starts. */
+void statmux_set_program(struct statmux_s *sm, int idx, int64_t bitrate, int64_t vbv_max_bitrate);
+
+/* now in microseconds, qp is the frame's average quantiser or negative when unknown. */
+void statmux_report(struct statmux_s *sm, int idx, int64_t now, int frame_bytes, int qp);
+
+/* Bits per second the program's encoder should run at. */
+int64_t statmux_get_bitrate(struct statmux_s *sm, int idx);
+
+void statmux_get_stats(struct statmux_s *sm, struct statmux_stats_s *stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_STATMUX_H */
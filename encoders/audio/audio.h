@@ -57,4 +57,17 @@ extern const obe_aud_enc_func_t twolame_encoder;
 extern const obe_aud_enc_func_t lavc_encoder;
 extern const obe_aud_enc_func_t ac3bitstream_encoder;
 
+/* Shared audio encoder worker pool, see audio_pool.c */
+typedef int  (*obe_aud_enc_process_func)( void *ctx, obe_raw_frame_t *raw_frame );
+typedef void (*obe_aud_enc_close_func)( void *ctx );
+
+extern int g_audio_encoder_pool_threads;
+extern int64_t g_audio_encoder_pool_cpumask;
+
+int  obe_audio_pool_start( obe_t *h );
+int  obe_audio_pool_attach( obe_t *h, obe_encoder_t *encoder, void *ctx,
+                            obe_aud_enc_process_func process, obe_aud_enc_close_func close );
+void obe_audio_pool_kick( obe_t *h );
+void obe_audio_pool_stop( obe_t *h );
+
 #endif
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+
+#include "common/common.h"
+#include <encoders/audio/audio.h>
+
+/* A small pool of threads that services every pooled audio encoder.
+ *
+ * With eight or more audio output streams OBE used to run one thread per encoder,
+ * each waking for every input frame period to convert and encode a handful of
+ * samples. Instead, the audio filter distributes one input frame to all encoder
+ * queues and kicks the pool once. The workers then drain the encoder queues,
+ * a single encoder is only ever serviced by one worker at a time, so the
+ * per-encoder frame ordering is preserved.
+ *
+ * The pool is optional and disabled by default:
+ *   set variable audio_encoder.pool_threads = 2
+ *   set variable audio_encoder.pool_cpumask = 0xc0
+ */
+
+#define MODULE_PREFIX "[audio-pool]: "
+
+#define LOCAL_DEBUG 0
+
+int g_audio_encoder_pool_threads = 0;     /* 0 = one thread per audio encoder */
+int64_t g_audio_encoder_pool_cpumask = 0; /* 0 = no affinity */
+
+struct audio_pool_job_s
+{
+	obe_encoder_t *encoder;
+	void *ctx;
+	obe_aud_enc_process_func process;
+	obe_aud_enc_close_func close;
+	int busy;
+};
+
+struct audio_pool_s
+{
+	obe_t *h;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+	int cancel;
+
+	int num_threads;
+	pthread_t *threads;
+
+	int num_jobs;
+	struct audio_pool_job_s jobs[MAX_STREAMS];
+
+	/* Stats */
+	uint64_t wakeups;
+	uint64_t frames;
+};
+
+/* Called with the pool mutex held. Find an idle job with pending frames. */
+static struct audio_pool_job_s *_pool_next_job(struct audio_pool_s *ctx)
+{
+	for (int i = 0; i < ctx->num_jobs; i++) {
+		struct audio_pool_job_s *job = &ctx->jobs[i];
+		if (job->busy)
+			continue;
+
+		pthread_mutex_lock(&job->encoder->queue.mutex);
+		int pending = job->encoder->queue.size;
+		pthread_mutex_unlock(&job->encoder->queue.mutex);
+
+		if (pending)
+			return job;
+	}
+
+	return NULL;
+}
+
+static void *_pool_worker(void *p)
+{
+	struct audio_pool_s *ctx = p;
+
+	if (g_audio_encoder_pool_cpumask) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+			if (g_audio_encoder_pool_cpumask & (1LL << i))
+				CPU_SET(i, &cpus);
+		}
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			fprintf(stderr, MODULE_PREFIX "unable to set cpu affinity 0x%" PRIx64 "\n", g_audio_encoder_pool_cpumask);
+	}
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (!ctx->cancel) {
+		struct audio_pool_job_s *job = _pool_next_job(ctx);
+		if (!job) {
+			pthread_cond_wait(&ctx->cv, &ctx->mutex);
+			ctx->wakeups++;
+			continue;
+		}
+		job->busy = 1;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		/* Drain everything queued for this encoder. */
+		int count = 0;
+		while (1) {
+			obe_encoder_t *encoder = job->encoder;
+
+			pthread_mutex_lock(&encoder->queue.mutex);
+			if (!encoder->queue.size || encoder->cancel_thread) {
+				pthread_mutex_unlock(&encoder->queue.mutex);
+				break;
+			}
+			obe_raw_frame_t *raw_frame = encoder->queue.queue[0];
+			remove_from_queue_without_lock(&encoder->queue);
+			pthread_cond_signal(&encoder->queue.out_cv);
+			pthread_mutex_unlock(&encoder->queue.mutex);
+
+			if (job->process(job->ctx, raw_frame) < 0) {
+				fprintf(stderr, MODULE_PREFIX "output stream %d failed to process a frame\n",
+					encoder->output_stream_id);
+			}
+			count++;
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		job->busy = 0;
+		ctx->frames += count;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return NULL;
+}
+
+int obe_audio_pool_start(obe_t *h)
+{
+	if (g_audio_encoder_pool_threads <= 0)
+		return 0;
+
+	struct audio_pool_s *ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->h = h;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cv, NULL);
+
+	ctx->threads = calloc(g_audio_encoder_pool_threads, sizeof(pthread_t));
+	if (!ctx->threads) {
+		free(ctx);
+		return -1;
+	}
+
+	for (int i = 0; i < g_audio_encoder_pool_threads; i++) {
+		if (pthread_create(&ctx->threads[i], NULL, _pool_worker, ctx) != 0) {
+			fprintf(stderr, MODULE_PREFIX "unable to create worker %d\n", i);
+			break;
+		}
+		ltnpthread_setname_np(ctx->threads[i], "obe-aud-pool");
+		ctx->num_threads++;
+	}
+
+	printf(MODULE_PREFIX "started %d worker(s), cpumask 0x%" PRIx64 "\n",
+		ctx->num_threads, g_audio_encoder_pool_cpumask);
+
+	h->audio_pool = ctx;
+
+	return 0;
+}
+
+int obe_audio_pool_attach(obe_t *h, obe_encoder_t *encoder, void *encoder_ctx,
+	obe_aud_enc_process_func process, obe_aud_enc_close_func close)
+{
+	struct audio_pool_s *ctx = h->audio_pool;
+	if (!ctx)
+		return -1;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->num_jobs == MAX_STREAMS) {
+		pthread_mutex_unlock(&ctx->mutex);
+		return -1;
+	}
+
+	struct audio_pool_job_s *job = &ctx->jobs[ctx->num_jobs++];
+	job->encoder = encoder;
+	job->ctx = encoder_ctx;
+	job->process = process;
+	job->close = close;
+	job->busy = 0;
+
+	pthread_mutex_lock(&encoder->queue.mutex);
+	encoder->is_pooled = 1;
+	pthread_mutex_unlock(&encoder->queue.mutex);
+
+	/* Frames may have been queued before we attached. */
+	pthread_cond_signal(&ctx->cv);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	printf(MODULE_PREFIX "output stream %d attached\n", encoder->output_stream_id);
+
+	return 0;
+}
+
+void obe_audio_pool_kick(obe_t *h)
+{
+	struct audio_pool_s *ctx = h->audio_pool;
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&ctx->mutex);
+	pthread_cond_broadcast(&ctx->cv);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+void obe_audio_pool_stop(obe_t *h)
+{
+	struct audio_pool_s *ctx = h->audio_pool;
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->cancel = 1;
+	pthread_cond_broadcast(&ctx->cv);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	for (int i = 0; i < ctx->num_threads; i++)
+		pthread_join(ctx->threads[i], NULL);
+
+	printf(MODULE_PREFIX "processed %" PRIu64 " frames with %" PRIu64 " wakeups\n", ctx->frames, ctx->wakeups);
+
+	for (int i = 0; i < ctx->num_jobs; i++) {
+		if (ctx->jobs[i].close)
+			ctx->jobs[i].close(ctx->jobs[i].ctx);
+	}
+
+	pthread_cond_destroy(&ctx->cv);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx->threads);
+	free(ctx);
+
+	h->audio_pool = NULL;
+}
@@ -56,7 +56,17 @@ struct context_s
     int total_size_bytes;
 #if AUDIO_DEBUG_ENABLE
     uint64_t cfQD;
+    uint64_t audioFramesDQ;
 #endif
+
+    AVCodecContext *codec;
+    struct SwrContext *avr;
+    AVFrame *frame;
+    AVFifoBuffer *out_fifo_compressed;
+
+    /* Conversion planes, sized once and reused for every frame. */
+    uint8_t *audio_planes[8];
+    int audio_planes_samples;
 };
 
 typedef struct
@@ -222,35 +232,287 @@ static void processCodecOutput(struct context_s *ctx, AVPacket *pkt, AVFifoBuffe
     ctx->total_size_bytes = ctx->num_frames = 0;
 }
 
-static void *aac_start_encoder(void *ptr)
+/* Create some data planes that we'll fill with raw input audio samples.
+ * We'll pass these planes into the audio format convertor.
+ * We'll re-use these planes later again, when reading converted audio
+ * samples so they need to be capable of holding codec->frame_size samples.
+ * For AAC, frame_size is 1000, for AC3 its 1536. This number is given to us
+ * by libavcodec, and represents the minimum number of samples we must
+ * pass to the compression codec.
+ * The slower the framerate, the higher the linesize is the more audio at 48Khz,
+ * is associated with a frame.
+ *
+ *                   raw_frame->audio_frame.linesize   codec->frame_size   Codec  Card
+ *  1080i29.97                                  6528                1024     AAC  duo2
+ *  1080i29.97                                  6528                1536     AC3  duo2
+ *   720p59.94                                  3328                1024     AAC  duo2
+ *   720p59.94                                  3328                1536     AC3  duo2
+ *  1080p24                                     8086                1024     AAC  duo2
+ *  1080p24                                     8086                1536     AC3  duo2
+ *  1080p30                                     1024                1536     AC3  vega
+ *  1080p30                                     1024                1024     AAC  vega
+ *  1080p59.94                                  1024                1536     AC3  vega
+ *  1080p59.94                                  1024                1024     AAC  vega
+ *
+ * Instead of using raw_frame->audio_frame.linesize or codec->frame_size, lets
+ * create a massive buffer to handle very small and very large cases in a single size.
+ * The planes are allocated once and only grow if we see an unusually large frame,
+ * we used to allocate and free them for every frame.
+ */
+static int _alloc_planes(struct context_s *ctx, int num_samples)
+{
+    if (num_samples <= ctx->audio_planes_samples)
+        return 0;
+
+    if (ctx->audio_planes[0])
+        av_freep(&ctx->audio_planes[0]);
+    memset(ctx->audio_planes, 0, sizeof(ctx->audio_planes));
+
+    if (av_samples_alloc(ctx->audio_planes, NULL, ctx->codec->channels,
+            num_samples, ctx->codec->sample_fmt, 0) < 0) {
+        fprintf(stderr, MODULE "Could not allocate audio samples\n");
+        ctx->audio_planes_samples = 0;
+        return -1;
+    }
+    ctx->audio_planes_samples = num_samples;
+
+    return 0;
+}
+
+static void _close_encoder(void *p)
+{
+    struct context_s *ctx = p;
+
+    if (ctx->frame)
+        av_frame_free(&ctx->frame);
+
+    if (ctx->audio_planes[0])
+        av_freep(&ctx->audio_planes[0]);
+
+    if (ctx->audio_pcm_fifo)
+        av_audio_fifo_free(ctx->audio_pcm_fifo);
+
+    if (ctx->out_fifo_compressed)
+        av_fifo_free(ctx->out_fifo_compressed);
+
+    if (ctx->avr)
+        swr_free(&ctx->avr);
+
+    if (ctx->codec)
+    {
+        avcodec_close(ctx->codec);
+        av_free(ctx->codec);
+    }
+
+    aud_enc_params_free(ctx->enc_params);
+    free(ctx);
+}
+
+/* Convert and compress a single raw frame. Takes ownership of the frame. */
+static int _process_frame(void *p, obe_raw_frame_t *raw_frame)
+{
+    struct context_s *ctx = p;
+    AVCodecContext *codec = ctx->codec;
+    AVPacket pkt;
+    int ret;
+
+#if AUDIO_DEBUG_ENABLE
+    ctx->audioFramesDQ++;
+#endif
+#if LOCAL_DEBUG
+    if (ctx->encoder->output_stream_id == 1) {
+        printf("\n");
+        printf(MODULE "strm %d raw audio frame pts %" PRIi64 " linesize %d channels %d num_samples %d, pts delta %" PRIi64 "\n",
+            ctx->encoder->output_stream_id,
+            raw_frame->avfm.audio_pts,
+            raw_frame->audio_frame.linesize,
+            av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
+            raw_frame->audio_frame.num_samples,
+            raw_frame->avfm.audio_pts - ctx->avfm.audio_pts);
+    }
+#endif
+    if (raw_frame->avfm.audio_pts - ctx->avfm.audio_pts >= (2 * ctx->frameLengthTicks)) {
+        printf("Reset the cur_pts because of the hardware\n");
+        printf("raw_frame->avfm.audio_pts %" PRIi64 "\n", raw_frame->avfm.audio_pts);
+        printf("ctx->avfm.audio_pts %" PRIi64 "\n", ctx->avfm.audio_pts);
+        printf("ctx->frameLengthTicks %" PRIi64 "\n", ctx->frameLengthTicks);
+        printf("violation %" PRIi64 " >= %" PRIi64 "\n", raw_frame->avfm.audio_pts - ctx->avfm.audio_pts, 2 * ctx->frameLengthTicks);
+        ctx->cur_pts = -1; /* Reset the audio timebase from the hardware. */
+    }
+    memcpy(&ctx->avfm, &raw_frame->avfm, sizeof(ctx->avfm));
+
+    if (ctx->cur_pts == -1) {
+        /* Drain any fifos and zero our processing latency, the clock has been
+         * reset so we're rebasing time from the audio hardward clock.
+         */
+        ctx->cur_pts = ctx->avfm.audio_pts;
+        ctx->ptsfixup = 0;
+
+        printf(MODULE "strm %d audio pts reset to %" PRIi64 "\n",
+            ctx->encoder->output_stream_id,
+            ctx->cur_pts);
+
+        /* Drain the conversion fifos else we induce drift. */
+        av_fifo_drain(ctx->out_fifo_compressed, av_fifo_size(ctx->out_fifo_compressed));
+        av_audio_fifo_drain(ctx->audio_pcm_fifo, av_audio_fifo_size(ctx->audio_pcm_fifo));
+        swr_drop_output(ctx->avr, 65535);
+        ctx->num_frames = 0;
+        ctx->total_size_bytes = 0;
+    }
+
+    if (_alloc_planes(ctx, raw_frame->audio_frame.linesize * 4) < 0) {
+        raw_frame->release_data(raw_frame);
+        raw_frame->release_frame(raw_frame);
+        return -1;
+    }
+
+    int64_t swrdelay = swr_get_delay(ctx->avr, 1000);
+    if (swrdelay != 0) {
+       printf(MODULE "SWR delay %" PRIi64 ", warning!\n", swrdelay);
+    }
+
+#if AUDIO_DEBUG_ENABLE
+    /* write pre-resample payload to disk for debug */
+    if (g_audio_cf_debug & 0x80) {
+        char fn[128];
+        sprintf(fn, "/storage/ltn/stoth/audio-debug-pre--%02x-strm-%d-framenr-%012" PRIu64 "-ch%d-samples%d.raw",
+            g_audio_cf_debug,
+            ctx->encoder->output_stream_id,
+            ctx->audioFramesDQ,
+            av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
+            raw_frame->audio_frame.num_samples);
+        printf("Creating %s\n", fn);
+        FILE *fh = fopen(fn, "wb");
+        if (fh) {
+            for (int i = 0; i < 8; i++) {
+                if (ctx->audio_planes[i]) {
+                    fwrite(raw_frame->audio_frame.audio_data[i], 4, raw_frame->audio_frame.num_samples, fh);
+                }
+            }
+            fclose(fh);
+        }
+    }
+#endif
+    int count;
+    count = swr_convert(ctx->avr,
+            (uint8_t **)ctx->audio_planes,
+            raw_frame->audio_frame.num_samples,
+            (const uint8_t **)raw_frame->audio_frame.audio_data,
+            raw_frame->audio_frame.num_samples);
+    if (count < 0)
+    {
+        fprintf(stderr, MODULE "Sample format conversion failed\n");
+        syslog(LOG_ERR, MODULE "Sample format conversion failed\n");
+        raw_frame->release_data(raw_frame);
+        raw_frame->release_frame(raw_frame);
+        return -1;
+    }
+
+#if AUDIO_DEBUG_ENABLE
+    /* write post-resamples payload to disk for debug */
+    if (g_audio_cf_debug & 0x80) {
+        char fn[128];
+        sprintf(fn, "/storage/ltn/stoth/audio-debug-post-%02x-strm-%d-framenr-%012" PRIu64 "-ch%d-samples%d.raw",
+            g_audio_cf_debug,
+            ctx->encoder->output_stream_id,
+            ctx->audioFramesDQ,
+            av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
+            raw_frame->audio_frame.num_samples);
+        printf("Creating %s\n", fn);
+        FILE *fh = fopen(fn, "wb");
+        if (fh) {
+            for (int i = 0; i < 8; i++) {
+                if (ctx->audio_planes[i]) {
+                    fwrite(ctx->audio_planes[i], 4, raw_frame->audio_frame.num_samples, fh);
+                }
+            }
+            fclose(fh);
+        }
+    }
+#endif
+
+    /* Push the converted samples into the audio pcm fifo. */
+    ret = av_audio_fifo_write(ctx->audio_pcm_fifo, (void **)ctx->audio_planes, raw_frame->audio_frame.num_samples);
+    if (ret != raw_frame->audio_frame.num_samples) {
+        fprintf(stderr, MODULE "Unable to write to audio fifo, ret = %d - should be %d\n", ret, raw_frame->audio_frame.num_samples);
+        exit(1);
+    }
+
+    raw_frame->release_data(raw_frame);
+    raw_frame->release_frame(raw_frame);
+
+    /* Number of samples less than required codec samples reqd? */
+    while (av_audio_fifo_size(ctx->audio_pcm_fifo) >= codec->frame_size) {
+
+        /* Construct the AVFrame then compress it. */
+        ctx->frame->nb_samples = codec->frame_size;
+
+        /* Read sample pointers from the AVR convert into AV frame pointer area */
+        memcpy(ctx->frame->data, ctx->audio_planes, sizeof(ctx->frame->data));
+        int sr = av_audio_fifo_read(ctx->audio_pcm_fifo, (void **)ctx->frame->data, ctx->frame->nb_samples);
+        if (sr != codec->frame_size) {
+            fprintf(stderr, MODULE "Error reading from fifo\n");
+            exit(1);
+        }
+
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+
+        ret = avcodec_send_frame(codec, ctx->frame);
+        if (ret < 0) {
+            fprintf(stderr, MODULE "avcodec_send_frame failed %d\n", ret);
+            /* Now what? */
+            exit(1);
+        }
+
+        /* Read any available frames and output them as obe coded_frames. */
+        while (ret >= 0) {
+           ret = avcodec_receive_packet(codec, &pkt);
+           if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+               continue;
+           else if (ret < 0) {
+               fprintf(stderr, MODULE "Error compressing audio frame\n");
+               exit(1);
+           }
+
+           /* Process the compressed audio */
+           ctx->total_size_bytes += pkt.size;
+           ctx->num_frames++;
+
+           processCodecOutput(ctx, &pkt, ctx->out_fifo_compressed);
+           av_packet_unref(&pkt);
+        }
+    }
+
+    return 0;
+}
+
+static struct context_s *_open_encoder(obe_aud_enc_params_t *enc_params)
 {
     struct context_s *ctx = calloc(1, sizeof(*ctx));
-    ctx->enc_params = ptr;
+    if (!ctx) {
+        aud_enc_params_free(enc_params);
+        return NULL;
+    }
+    ctx->enc_params = enc_params;
     ctx->h = ctx->enc_params->h;
     ctx->encoder = ctx->enc_params->encoder;
     ctx->cur_pts = -1;
     ctx->stream = ctx->enc_params->stream;
     ctx->frameLengthTicks = 576000;
 
-    obe_raw_frame_t *raw_frame;
-    int i, frame_size, ret;
-    AVFifoBuffer *out_fifo_compressed = NULL;
-    struct SwrContext *avr = NULL;
-    AVPacket pkt;
+    int i, frame_size;
     AVCodecContext *codec = NULL;
-    AVFrame *frame = NULL;
     AVDictionary *opts = NULL;
     char is_latm[2];
-    uint8_t *audio_planes[8] = { NULL };
-    int dst_linesize = -1;
-#if AUDIO_DEBUG_ENABLE
-    uint64_t audioFramesDQ = 0;
-#endif
+
     codec = avcodec_alloc_context3(NULL);
     if (!codec) {
         fprintf(stderr, MODULE "avcodec_alloc_context3 failed\n");
-        goto finish;
+        goto fail;
     }
+    ctx->codec = codec;
 
     for( i = 0; lavc_encoders[i].obe_name != -1; i++ )
     {
@@ -262,7 +524,7 @@ static void *aac_start_encoder(void *ptr)
     if( lavc_encoders[i].obe_name == -1 )
     {
         fprintf(stderr, MODULE "Could not find encoder1\n");
-        goto finish;
+        goto fail;
     }
 
     printf(MODULE "Searching for audio encoder %s (id 0x%08x)\n",
@@ -299,7 +561,7 @@ static void *aac_start_encoder(void *ptr)
     if( enc->sample_fmts[0] == -1 )
     {
         fprintf(stderr, MODULE "No valid sample formats\n");
-        goto finish;
+        goto fail;
     }
 
     codec->sample_rate = ctx->enc_params->sample_rate;
@@ -325,23 +587,23 @@ static void *aac_start_encoder(void *ptr)
     if( avcodec_open2( codec, enc, &opts ) < 0 )
     {
         fprintf(stderr, MODULE "Could not open encoder\n");
-        goto finish;
+        goto fail;
     }
 
-    avr = swr_alloc();
-    if (!avr) {
+    ctx->avr = swr_alloc();
+    if (!ctx->avr) {
         fprintf(stderr, MODULE "swr_alloc() failed\n");
-        goto finish;
+        goto fail;
     }
 
-    av_opt_set_int( avr, "in_channel_layout",    codec->channel_layout, 0 );
-    av_opt_set_int( avr, "in_sample_rate",       ctx->enc_params->sample_rate, 0 );
-    av_opt_set_sample_fmt( avr, "in_sample_fmt", ctx->enc_params->input_sample_format, 0 );
+    av_opt_set_int( ctx->avr, "in_channel_layout",    codec->channel_layout, 0 );
+    av_opt_set_int( ctx->avr, "in_sample_rate",       ctx->enc_params->sample_rate, 0 );
+    av_opt_set_sample_fmt( ctx->avr, "in_sample_fmt", ctx->enc_params->input_sample_format, 0 );
 
-    av_opt_set_int( avr, "out_channel_layout",    codec->channel_layout, 0 );
-    av_opt_set_int( avr, "out_sample_rate",       ctx->enc_params->sample_rate, 0 );
-    av_opt_set_sample_fmt( avr, "out_sample_fmt", codec->sample_fmt,     0 );
-    av_opt_set_int( avr, "dither_method",         SWR_DITHER_TRIANGULAR, 0 );
+    av_opt_set_int( ctx->avr, "out_channel_layout",    codec->channel_layout, 0 );
+    av_opt_set_int( ctx->avr, "out_sample_rate",       ctx->enc_params->sample_rate, 0 );
+    av_opt_set_sample_fmt( ctx->avr, "out_sample_fmt", codec->sample_fmt,     0 );
+    av_opt_set_int( ctx->avr, "dither_method",         SWR_DITHER_TRIANGULAR, 0 );
 
     printf(MODULE "in_channel_layout  = %" PRIi64 "\n", codec->channel_layout);
     printf(MODULE "in_sample_fmt      = %d %s\n", ctx->enc_params->input_sample_format, av_get_sample_fmt_name(ctx->enc_params->input_sample_format));
@@ -350,21 +612,19 @@ static void *aac_start_encoder(void *ptr)
     printf(MODULE "out_sample_fmt     = %d %s\n", codec->sample_fmt, av_get_sample_fmt_name(codec->sample_fmt));
     printf(MODULE "out_sample_rate    = %d\n", ctx->enc_params->sample_rate);
 
-    if (swr_init(avr) < 0)
+    if (swr_init(ctx->avr) < 0)
     {
         fprintf(stderr, MODULE "Could not open AVResample\n");
-        goto finish;
+        goto fail;
     }
 
-    /* The number of samples per E-AC3 frame is unknown until the encoder is ready */
-    if (ctx->stream->stream_format == AUDIO_E_AC_3 || ctx->stream->stream_format == AUDIO_AAC)
-    {
-        pthread_mutex_lock(&ctx->encoder->queue.mutex);
-        ctx->encoder->is_ready = 1;
-        ctx->encoder->num_samples = codec->frame_size;
-        /* Broadcast because input and muxer can be stuck waiting for encoder */
-        pthread_cond_broadcast(&ctx->encoder->queue.in_cv);
-        pthread_mutex_unlock(&ctx->encoder->queue.mutex);
+    /* The muxer builds its PSI from the expected frame size rather than waiting for us,
+     * make sure the codec agrees.
+     */
+    int expected_samples = obe_core_encoder_get_expected_num_samples(ctx->stream);
+    if (expected_samples && expected_samples != codec->frame_size) {
+        fprintf(stderr, MODULE "codec frame_size %d differs from the expected %d, PES timing will be wrong\n",
+            codec->frame_size, expected_samples);
     }
 
     frame_size = (double)codec->frame_size * 125 * ctx->stream->bitrate *
@@ -376,26 +636,29 @@ static void *aac_start_encoder(void *ptr)
     ctx->audio_pcm_fifo = av_audio_fifo_alloc(codec->sample_fmt, codec->channels, 8000);
     if (!ctx->audio_pcm_fifo) {
         fprintf(stderr, MODULE "audio fifo alloc failed\n");
-        goto finish;
+        goto fail;
     }
 
-    out_fifo_compressed = av_fifo_alloc(frame_size);
-    if (!out_fifo_compressed) {
+    ctx->out_fifo_compressed = av_fifo_alloc(frame_size);
+    if (!ctx->out_fifo_compressed) {
         fprintf(stderr, MODULE "compressed fifo alloc failed\n");
-        goto finish;
+        goto fail;
     }
 
-    frame = av_frame_alloc();
-    if( !frame )
+    ctx->frame = av_frame_alloc();
+    if( !ctx->frame )
     {
         fprintf(stderr, MODULE "Could not allocate frame\n");
-        goto finish;
+        goto fail;
     }
 
+    if (_alloc_planes(ctx, 8086 * 4) < 0)
+        goto fail;
+
 /* AAC has 1 frame per pes in lowest latency mode, frame size 1024. */
 /* AAC has 6 frame per pes in normal latency mode, frame size 2048. */
     printf(MODULE "frames per pes     = %d\n", ctx->enc_params->frames_per_pes);
-    printf(MODULE "dst_linesize       = %d\n", dst_linesize);
+    printf(MODULE "plane samples      = %d\n", ctx->audio_planes_samples);
     printf(MODULE "codec->frame_size  = %d\n", codec->frame_size);
     printf(MODULE "codec->channels    = %d\n", codec->channels);
     printf(MODULE "codec->sample_fmt  = %d\n", codec->sample_fmt);
@@ -404,6 +667,34 @@ static void *aac_start_encoder(void *ptr)
     printf(MODULE "frameLengthTicks   = %" PRIi64 "\n", ctx->frameLengthTicks);
     printf(MODULE "pts_increment      = %" PRIi64 "\n", ctx->pts_increment);
 
+    pthread_mutex_lock(&ctx->encoder->queue.mutex);
+    ctx->encoder->num_samples = codec->frame_size;
+    obe_core_encoder_set_ready(ctx->h, ctx->encoder);
+    /* Broadcast because input and muxer can be stuck waiting for encoder */
+    pthread_cond_broadcast(&ctx->encoder->queue.in_cv);
+    pthread_mutex_unlock(&ctx->encoder->queue.mutex);
+
+    return ctx;
+
+fail:
+    _close_encoder(ctx);
+    return NULL;
+}
+
+static void *aac_start_encoder(void *ptr)
+{
+    obe_raw_frame_t *raw_frame;
+
+    struct context_s *ctx = _open_encoder(ptr);
+    if (!ctx)
+        return NULL;
+
+    /* When the shared pool is enabled it owns the context from here on,
+     * the pool workers drain our queue and close the codec on shutdown.
+     */
+    if (obe_audio_pool_attach(ctx->h, ctx->encoder, ctx, _process_frame, _close_encoder) == 0)
+        return NULL;
+
     while (1)
     {
         /* TODO: detect bitrate or channel reconfig */
@@ -415,241 +706,20 @@ static void *aac_start_encoder(void *ptr)
         if (ctx->encoder->cancel_thread)
         {
             pthread_mutex_unlock(&ctx->encoder->queue.mutex);
-            goto finish;
+            break;
         }
 
         raw_frame = ctx->encoder->queue.queue[0];
-#if AUDIO_DEBUG_ENABLE
-        audioFramesDQ++;
-#endif
-#if LOCAL_DEBUG
-        if (ctx->encoder->output_stream_id == 1) {
-            printf("\n");
-            printf(MODULE "strm %d raw audio frame pts %" PRIi64 " linesize %d channels %d num_samples %d, pts delta %" PRIi64 "\n",
-                ctx->encoder->output_stream_id,
-                raw_frame->avfm.audio_pts,
-                raw_frame->audio_frame.linesize,
-                av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
-                raw_frame->audio_frame.num_samples,
-                raw_frame->avfm.audio_pts - ctx->avfm.audio_pts);
-        }
-#endif
-        if (raw_frame->avfm.audio_pts - ctx->avfm.audio_pts >= (2 * ctx->frameLengthTicks)) {
-            printf("Reset the cur_pts because of the hardware\n");
-            printf("raw_frame->avfm.audio_pts %" PRIi64 "\n", raw_frame->avfm.audio_pts);
-            printf("ctx->avfm.audio_pts %" PRIi64 "\n", ctx->avfm.audio_pts);
-            printf("ctx->frameLengthTicks %" PRIi64 "\n", ctx->frameLengthTicks);
-            printf("violation %" PRIi64 " >= %" PRIi64 "\n", raw_frame->avfm.audio_pts - ctx->avfm.audio_pts, 2 * ctx->frameLengthTicks);
-            ctx->cur_pts = -1; /* Reset the audio timebase from the hardware. */
-        }
-        memcpy(&ctx->avfm, &raw_frame->avfm, sizeof(ctx->avfm));
-
+        remove_from_queue_without_lock(&ctx->encoder->queue);
+        pthread_cond_signal(&ctx->encoder->queue.out_cv);
         pthread_mutex_unlock(&ctx->encoder->queue.mutex);
 
-        if (ctx->cur_pts == -1) {
-            /* Drain any fifos and zero our processing latency, the clock has been
-             * reset so we're rebasing time from the audio hardward clock.
-             */
-            ctx->cur_pts = ctx->avfm.audio_pts;
-            ctx->ptsfixup = 0;
-
-            printf(MODULE "strm %d audio pts reset to %" PRIi64 "\n",
-                ctx->encoder->output_stream_id,
-                ctx->cur_pts);
-
-            /* Drain the conversion fifos else we induce drift. */
-            av_fifo_drain(out_fifo_compressed, av_fifo_size(out_fifo_compressed));
-            av_audio_fifo_drain(ctx->audio_pcm_fifo, av_audio_fifo_size(ctx->audio_pcm_fifo));
-            swr_drop_output(avr, 65535);
-            ctx->num_frames = 0;
-            ctx->total_size_bytes = 0;
-        }
-
-        /* Create some data planes that we'll fill with raw input audio samples.
-         * We'll pass these planes into the audio format convertor.
-         * We'll re-use these planes later again, when reading converted audio
-         * samples so they need to be capable of holding codec->frame_size samples.
-         * For AAC, frame_size is 1000, for AC3 its 1536. This number is given to us
-         * by libavcodec, and represents the minimum number of samples we must
-         * pass to the compression codec.
-         * The slower the framerate, the higher the linesize is the more audio at 48Khz,
-         * is associated with a frame.
-         *
-         *                   raw_frame->audio_frame.linesize   codec->frame_size   Codec  Card
-         *  1080i29.97                                  6528                1024     AAC  duo2
-         *  1080i29.97                                  6528                1536     AC3  duo2
-         *   720p59.94                                  3328                1024     AAC  duo2
-         *   720p59.94                                  3328                1536     AC3  duo2
-         *  1080p24                                     8086                1024     AAC  duo2
-         *  1080p24                                     8086                1536     AC3  duo2
-         *  1080p30                                     1024                1536     AC3  vega
-         *  1080p30                                     1024                1024     AAC  vega
-         *  1080p59.94                                  1024                1536     AC3  vega
-         *  1080p59.94                                  1024                1024     AAC  vega
-         * 
-         * Instead of using raw_frame->audio_frame.linesize or codec->frame_size, lets
-         * create a massive buffer to handle very small and very large cases in a single size.
-         */
-        int newlinesize = 8086 * 4;
-	    if (raw_frame->audio_frame.linesize > newlinesize) {
-		    newlinesize = raw_frame->audio_frame.linesize * 4;
-	    }
-        if (av_samples_alloc(audio_planes, NULL,
-                av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
-                newlinesize, codec->sample_fmt, 0) < 0) {
-            fprintf(stderr, MODULE "Could not allocate audio samples\n");
-            goto finish;
-        }
-
-        int64_t swrdelay = swr_get_delay(avr, 1000);
-        if (swrdelay != 0) {
-           printf(MODULE "SWR delay %" PRIi64 ", warning!\n", swrdelay);
-        }
-
-//printf("swr_convert(avr, planes, %d, data, %d)\n", raw_frame->audio_frame.num_samples, raw_frame->audio_frame.num_samples);
-#if AUDIO_DEBUG_ENABLE
-        /* write pre-resample payload to disk for debug */
-        if (g_audio_cf_debug & 0x80) {
-            char fn[128];
-            sprintf(fn, "/storage/ltn/stoth/audio-debug-pre--%02x-strm-%d-framenr-%012" PRIu64 "-ch%d-samples%d.raw",
-                g_audio_cf_debug,
-                ctx->encoder->output_stream_id,
-                audioFramesDQ,
-                av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
-                raw_frame->audio_frame.num_samples);
-            printf("Creating %s\n", fn);
-            FILE *fh = fopen(fn, "wb");
-            if (fh) {
-                for (int i = 0; i < 8; i++) {
-                    if (audio_planes[i]) {
-                        fwrite(raw_frame->audio_frame.audio_data[i], 4, raw_frame->audio_frame.num_samples, fh);
-                    }
-                }
-                fclose(fh);
-            }
-        }
-#endif
-        int count;
-        count = swr_convert(avr,
-                (uint8_t **)audio_planes,
-                raw_frame->audio_frame.num_samples,
-                (const uint8_t **)raw_frame->audio_frame.audio_data,
-                raw_frame->audio_frame.num_samples);
-        if (count < 0)
-        {
-            fprintf(stderr, MODULE "Sample format conversion failed\n");
-            syslog(LOG_ERR, MODULE "Sample format conversion failed\n");
+        if (_process_frame(ctx, raw_frame) < 0)
             break;
-        }
-
-#if AUDIO_DEBUG_ENABLE
-        /* write post-resamples payload to disk for debug */
-        if (g_audio_cf_debug & 0x80) {
-            char fn[128];
-            sprintf(fn, "/storage/ltn/stoth/audio-debug-post-%02x-strm-%d-framenr-%012" PRIu64 "-ch%d-samples%d.raw",
-                g_audio_cf_debug,
-                ctx->encoder->output_stream_id,
-                audioFramesDQ,
-                av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout),
-                raw_frame->audio_frame.num_samples);
-            printf("Creating %s\n", fn);
-            FILE *fh = fopen(fn, "wb");
-            if (fh) {
-                for (int i = 0; i < 8; i++) {
-                    if (audio_planes[i]) {
-                        fwrite(audio_planes[i], 4, raw_frame->audio_frame.num_samples, fh);
-                    }
-                }
-                fclose(fh);
-            }
-        }
-#endif
-
-        /* Push the converted samples into the audio pcm fifo. */
-        ret = av_audio_fifo_write(ctx->audio_pcm_fifo, (void **)audio_planes, raw_frame->audio_frame.num_samples);
-        if (ret != raw_frame->audio_frame.num_samples) {
-            fprintf(stderr, MODULE "Unable to write to audio fifo, ret = %d - should be %d\n", ret, raw_frame->audio_frame.num_samples);
-            exit(1);
-        }
-
-        raw_frame->release_data(raw_frame);
-        raw_frame->release_frame(raw_frame);
-        remove_from_queue(&ctx->encoder->queue);
-
-	/* Number of samples less than required codec samples reqd? */
-        while (av_audio_fifo_size(ctx->audio_pcm_fifo) >= codec->frame_size) {
-
-            /* Construct the AVFrame then compress it. */
-            frame->nb_samples = codec->frame_size;
-
-            /* Read sample pointers from the AVR convert into AV frame pointer area */
-            memcpy(frame->data, audio_planes, sizeof(frame->data));
-            int sr = av_audio_fifo_read(ctx->audio_pcm_fifo, (void **)frame->data, frame->nb_samples);
-            if (sr != codec->frame_size) {
-                fprintf(stderr, MODULE "Error reading from fifo\n");
-		exit(1);
-            }
-
-            av_init_packet(&pkt);
-            pkt.data = NULL;
-            pkt.size = 0;
-
-            ret = avcodec_send_frame(codec, frame);
-            if (ret < 0) {
-                fprintf(stderr, MODULE "avcodec_send_frame failed %d\n", ret);
-                /* Now what? */
-                exit(1);
-            }
-
-            /* Read any available frames and output them as obe coded_frames. */
-            while (ret >= 0) {
-               ret = avcodec_receive_packet(codec, &pkt);
-               if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                   continue;
-               else if (ret < 0) {
-                   fprintf(stderr, MODULE "Error compressing audio frame\n");
-                   exit(1);
-               }
-
-               /* Process the compressed audio */
-               //printf(MODULE "pkt.size = %d\n", pkt.size);
-               ctx->total_size_bytes += pkt.size;
-               ctx->num_frames++;
-
-               processCodecOutput(ctx, &pkt, out_fifo_compressed);
-               av_packet_unref(&pkt);
-            }
-        }
-
-        /* Compression done, cleanup. */
-        av_freep(&audio_planes[0]);
-        audio_planes[0] = NULL;
 
     } /* While 1 */
 
-finish:
-    if( frame )
-       av_frame_free( &frame );
-
-    if( audio_planes[0] )
-        av_free( audio_planes[0] );
-
-    if (ctx->audio_pcm_fifo)
-        av_audio_fifo_free(ctx->audio_pcm_fifo);
-
-    if( out_fifo_compressed )
-        av_fifo_free( out_fifo_compressed );
-
-    if (avr)
-        swr_free(&avr);
-
-    if( codec )
-    {
-        avcodec_close( codec );
-        av_free( codec );
-    }
-
-    aud_enc_params_free(ctx->enc_params);
+    _close_encoder(ctx);
 
     return NULL;
 }
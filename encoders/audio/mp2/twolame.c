@@ -56,23 +56,274 @@ __inline__ void historical_int64_printf(struct historical_int64_s *s, char *pref
 
 int64_t mp2_offset_ms = 0;
 
-static void *start_encoder_mp2( void *ptr )
+struct context_s
 {
-#if LOCAL_DEBUG
-    printf("%s()\n", __func__);
+    obe_aud_enc_params_t *enc_params;
+    obe_t *h;
+    obe_encoder_t *encoder;
+    obe_output_stream_t *stream;
+
+    int64_t ptsfixup;
+    struct avfm_s avfm;
+    int64_t cur_pts, pts_increment;
+
+    struct historical_int64_s rf_pts;
+    struct historical_int64_s avfm_pts;
+    struct historical_int64_s cf_pts;
+
+    twolame_options *tl_opts;
+    int frame_size;
+    uint8_t *output_buf;
+    struct SwrContext *avr;
+    AVFifoBuffer *fifo;
+
+    /* Conversion buffer, sized once and reused for every frame. */
+    float *audio_buf;
+    int audio_buf_samples;
+
+#if REPORT_AUDIO_DISCONTINUITIES
+    int64_t lastOutputFramePTS; /* Last pts we output, we'll comare against future version to warn for discontinuities. */
 #endif
+};
 
-    obe_aud_enc_params_t *enc_params = ptr;
-    obe_t *h = enc_params->h;
-    obe_encoder_t *encoder = enc_params->encoder;
-    obe_output_stream_t *stream = enc_params->stream;
-    obe_raw_frame_t *raw_frame;
+static void _close_encoder( void *p )
+{
+    struct context_s *ctx = p;
+
+    if( ctx->output_buf )
+        free( ctx->output_buf );
+
+    if( ctx->audio_buf )
+        av_freep( &ctx->audio_buf );
+
+    if( ctx->avr )
+        swr_free( &ctx->avr );
+
+    if( ctx->fifo )
+        av_fifo_free( ctx->fifo );
+
+    if( ctx->tl_opts )
+        twolame_close( &ctx->tl_opts );
+    aud_enc_params_free( ctx->enc_params );
+    free( ctx );
+}
+
+/* Convert and compress a single raw frame. Takes ownership of the frame. */
+static int _process_frame( void *p, obe_raw_frame_t *raw_frame )
+{
+    struct context_s *ctx = p;
+    obe_encoder_t *encoder = ctx->encoder;
     obe_coded_frame_t *coded_frame;
-    int64_t ptsfixup = 0;
+    int output_size;
+    int ret = -1;
 
-    struct avfm_s avfm;
-    int64_t cur_pts = -1, pts_increment = 0;
+#define DEKTEC 0
+#if DEKTEC
+    if (raw_frame->avfm.audio_pts - ctx->avfm.audio_pts >= (2 * 648000)) {
+#else
+    if (raw_frame->avfm.audio_pts - ctx->avfm.audio_pts >= (4 * 648000)) {
+#endif
+        ctx->cur_pts = -1; /* Reset the audio timebase from the hardware. */
+#if DEKTEC
+/* 720p30 seems to go through constant reset because the math exceeds our sense of normality.
+ * I changed to be 4 * 648000 to keep the console debug noise down.
+ */
+printf("Reset audio because raw_frame->avfm.audio_pts %" PRIi64 " - avfm.audio_pts %" PRIi64 " >= (2 * 648000)\n",
+raw_frame->avfm.audio_pts, ctx->avfm.audio_pts);
+#endif
+
+    }
+    memcpy(&ctx->avfm, &raw_frame->avfm, sizeof(ctx->avfm));
+
+    historical_int64_set(&ctx->avfm_pts, ctx->avfm.audio_pts);
+    //historical_int64_printf(&ctx->avfm_pts, "avfm_pts");
+
+    if (ctx->cur_pts == -1) {
+        /* Drain any fifos and zero our processing latency, the clock has been
+         * reset so we're rebasing time from the audio hardward clock.
+         */
+        ctx->cur_pts = ctx->avfm.audio_pts;
+        ctx->ptsfixup = 0;
+
+        printf(MODULE "strm %d audio pts reset to %" PRIi64 "\n",
+            encoder->output_stream_id,
+            ctx->cur_pts);
+
+        /* Drain the conversion fifos else we induce drift. */
+        av_fifo_drain(ctx->fifo, av_fifo_size(ctx->fifo));
+        swr_drop_output(ctx->avr, 65535);
+
+        output_size = twolame_encode_flush(ctx->tl_opts, ctx->output_buf, MP2_AUDIO_BUFFER_SIZE);
+    }
+
+    historical_int64_set(&ctx->rf_pts, raw_frame->pts);
+    //historical_int64_printf(&ctx->rf_pts, "  rf_pts");
+
+#if LOCAL_DEBUG
+    printf("%s() output_stream_id = %d linesize = %d, num_samples = %d, num_channels = %d, sample_fmt = %d, raw_frame->input_stream_id = %d\n",
+            __func__,
+            encoder->output_stream_id,
+            raw_frame->audio_frame.linesize,
+            raw_frame->audio_frame.num_samples,
+            raw_frame->audio_frame.num_channels,
+            raw_frame->audio_frame.sample_fmt,
+            raw_frame->input_stream_id);
+#endif
+
+    /* (Re)allocate the conversion buffer, only when a frame larger than any previous arrives */
+    if( raw_frame->audio_frame.linesize > ctx->audio_buf_samples )
+    {
+        if( ctx->audio_buf )
+            av_freep( &ctx->audio_buf );
 
+        if( av_samples_alloc( (uint8_t**)&ctx->audio_buf, NULL, av_get_channel_layout_nb_channels( ctx->stream->channel_layout ),
+                              raw_frame->audio_frame.linesize, AV_SAMPLE_FMT_FLT, 0 ) < 0 )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            ctx->audio_buf_samples = 0;
+            goto out;
+        }
+        ctx->audio_buf_samples = raw_frame->audio_frame.linesize;
+    }
+
+    if (swr_convert(ctx->avr, (uint8_t **)&ctx->audio_buf, raw_frame->audio_frame.num_samples, (const uint8_t **)raw_frame->audio_frame.audio_data,
+                            raw_frame->audio_frame.num_samples) < 0)
+    {
+        syslog( LOG_ERR, "[twolame] Sample format conversion failed\n" );
+        goto out;
+    }
+
+    output_size = twolame_encode_buffer_float32_interleaved( ctx->tl_opts, ctx->audio_buf, raw_frame->audio_frame.num_samples, ctx->output_buf, MP2_AUDIO_BUFFER_SIZE );
+
+    if( output_size < 0 )
+    {
+        syslog( LOG_ERR, "[twolame] Encode failed\n" );
+        goto out;
+    }
+
+    raw_frame->release_data( raw_frame );
+    raw_frame->release_frame( raw_frame );
+    raw_frame = NULL;
+
+    if( av_fifo_realloc2( ctx->fifo, av_fifo_size( ctx->fifo ) + output_size ) < 0 )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        goto out;
+    }
+
+    av_fifo_generic_write( ctx->fifo, ctx->output_buf, output_size, NULL );
+
+    while( av_fifo_size( ctx->fifo ) >= ctx->frame_size )
+    {
+        coded_frame = new_coded_frame( encoder->output_stream_id, ctx->frame_size );
+        if( !coded_frame )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            goto out;
+        }
+        av_fifo_generic_read( ctx->fifo, coded_frame->data, ctx->frame_size, NULL );
+        memcpy(&coded_frame->avfm, &ctx->avfm, sizeof(ctx->avfm));
+
+        /* 648000 27MHz ticks equates to 24ms.
+         * 24ms is the smallest amount of time this audio codec and eject as compressed data.
+         * Hence, lowest latency means we get 24ms PES frames.
+         * Hence, normal latency is N * pes frames.
+         * OBE itself determines what N should be in various latency modes.
+         */
+        coded_frame->pts = ctx->cur_pts;
+
+        /* This code originated from the aac implementation in lavc.c
+         * The comments related to how and why should be maintained there.
+         * Highly specific to 29.97 for the time being.
+         */
+        if (ctx->ptsfixup == 0 &&
+            avfm_get_hw_status_mask(&ctx->avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_HALF) &&
+            avfm_get_video_interval_clk(&ctx->avfm) == 900900) {
+
+            /* Fixup the clock for 10.11.2, due to an audio clocking bug. */
+            int64_t drift = avfm_get_av_drift(&ctx->avfm);
+            int64_t video_interval_clk = avfm_get_video_interval_clk(&ctx->avfm);
+            int64_t drifted_frames = (drift / video_interval_clk);
+
+            ctx->ptsfixup = drift % video_interval_clk;
+
+            if (drifted_frames == 0) {
+                if (ctx->ptsfixup < -181000) {
+                    drifted_frames++;
+                } else
+                if (ctx->ptsfixup > (video_interval_clk - 181000)) {
+                    drifted_frames--;
+                }
+            } else {
+                if (drift > 0) {
+                    drifted_frames = 0;
+                    if (ctx->ptsfixup > (video_interval_clk - 181000))
+                        drifted_frames--;
+                } else {
+                    drifted_frames *= -1;
+                }
+
+            }
+            ctx->ptsfixup += (drifted_frames * video_interval_clk);
+        }
+
+        coded_frame->pts += (ctx->ptsfixup * -1);
+
+        /* Testing shows 720p59.94 is 16ms ahead of where it should be. */
+        if (avfm_get_video_interval_clk(&ctx->avfm) == 450450) {
+            coded_frame->pts -=  (16LL * 27000LL);
+            coded_frame->pts -=  (67LL * 270LL);
+        }
+        coded_frame->pts +=  ((int64_t)ctx->stream->audio_offset_ms * 27000LL);
+        coded_frame->pts +=  (mp2_offset_ms * 27000LL);
+        coded_frame->random_access = 1; /* Every frame output is a random access point */
+        coded_frame->type = CF_AUDIO;
+
+        historical_int64_set(&ctx->cf_pts, coded_frame->pts);
+        //historical_int64_printf(&ctx->cf_pts, "  cf_pts");
+
+#if REPORT_AUDIO_DISCONTINUITIES
+        if (ctx->lastOutputFramePTS + (648000 * ctx->enc_params->frames_per_pes) != coded_frame->pts) {
+            printf(MODULE "Output PTS discontinuity\n\tShould be %" PRIi64 " was %" PRIi64 " diff %9" PRIi64 " frames_per_pes %d\n",
+                ctx->lastOutputFramePTS + (648000 * ctx->enc_params->frames_per_pes),
+                coded_frame->pts,
+                (ctx->lastOutputFramePTS + (648000 * ctx->enc_params->frames_per_pes)) - coded_frame->pts,
+                ctx->enc_params->frames_per_pes);
+        }
+        ctx->lastOutputFramePTS = coded_frame->pts;
+#endif
+        add_to_queue( &ctx->h->mux_queue, coded_frame );
+
+        ctx->cur_pts += ctx->pts_increment;
+    }
+
+    ret = 0;
+out:
+    if( raw_frame )
+    {
+        raw_frame->release_data( raw_frame );
+        raw_frame->release_frame( raw_frame );
+    }
+
+    return ret;
+}
+
+static struct context_s *_open_encoder( obe_aud_enc_params_t *enc_params )
+{
+    struct context_s *ctx = calloc( 1, sizeof(*ctx) );
+    if( !ctx )
+    {
+        aud_enc_params_free( enc_params );
+        return NULL;
+    }
+    ctx->enc_params = enc_params;
+    ctx->h = enc_params->h;
+    ctx->encoder = enc_params->encoder;
+    ctx->stream = enc_params->stream;
+    ctx->cur_pts = -1;
+
+    obe_encoder_t *encoder = ctx->encoder;
+    obe_output_stream_t *stream = ctx->stream;
 
     /* Interesting 10.8.5 quirk related to the audio clock occasionally being ahead
      * of the video clock. This translates into 'too much' data in the audio fifo.
@@ -86,99 +337,107 @@ static void *start_encoder_mp2( void *ptr )
      */
     enc_params->use_fifo_head_timing = 1;
 
-    struct historical_int64_s rf_pts;
-    historical_int64_init(&rf_pts);
-
-    struct historical_int64_s avfm_pts;
-    historical_int64_init(&avfm_pts);
-
-    struct historical_int64_s cf_pts;
-    historical_int64_init(&cf_pts);
+    historical_int64_init(&ctx->rf_pts);
+    historical_int64_init(&ctx->avfm_pts);
+    historical_int64_init(&ctx->cf_pts);
 
 #if LOCAL_DEBUG
     printf("%s() output_stream_id = %d\n", __func__, encoder->output_stream_id);
 #endif
 
-    twolame_options *tl_opts = NULL;
-    int output_size, frame_size, linesize; /* Linesize in libavresample terminology is the entire buffer size for packed formats */
-    float *audio_buf = NULL;
-    uint8_t *output_buf = NULL;
-    struct SwrContext *avr = NULL;
-    AVFifoBuffer *fifo = NULL;
-
-#if REPORT_AUDIO_DISCONTINUITIES
-    int64_t lastOutputFramePTS = 0; /* Last pts we output, we'll comare against future version to warn for discontinuities. */
-#endif
-
-    pts_increment = 648000 * enc_params->frames_per_pes; /* 24ms, the codec frame size * number of frames per pes. */
+    ctx->pts_increment = 648000 * enc_params->frames_per_pes; /* 24ms, the codec frame size * number of frames per pes. */
 
     /* Lock the mutex until we verify parameters */
     pthread_mutex_lock( &encoder->queue.mutex );
 
-    tl_opts = twolame_init();
-    if( !tl_opts )
+    ctx->tl_opts = twolame_init();
+    if( !ctx->tl_opts )
     {
         fprintf( stderr, "[twolame] could not load options" );
         pthread_mutex_unlock( &encoder->queue.mutex );
-        goto end;
+        goto fail;
     }
 
     /* TODO: setup bitrate reconfig, errors */
-    twolame_set_bitrate( tl_opts, stream->bitrate );
-    twolame_set_in_samplerate( tl_opts, enc_params->sample_rate );
-    twolame_set_out_samplerate( tl_opts, enc_params->sample_rate );
-    twolame_set_copyright( tl_opts, 1 );
-    twolame_set_original( tl_opts, 1 );
-    twolame_set_num_channels( tl_opts, av_get_channel_layout_nb_channels( stream->channel_layout ) );
-    twolame_set_error_protection( tl_opts, 1 );
+    twolame_set_bitrate( ctx->tl_opts, stream->bitrate );
+    twolame_set_in_samplerate( ctx->tl_opts, enc_params->sample_rate );
+    twolame_set_out_samplerate( ctx->tl_opts, enc_params->sample_rate );
+    twolame_set_copyright( ctx->tl_opts, 1 );
+    twolame_set_original( ctx->tl_opts, 1 );
+    twolame_set_num_channels( ctx->tl_opts, av_get_channel_layout_nb_channels( stream->channel_layout ) );
+    twolame_set_error_protection( ctx->tl_opts, 1 );
     if( stream->channel_layout == AV_CH_LAYOUT_STEREO )
-        twolame_set_mode( tl_opts, stream->mp2_mode-1 );
+        twolame_set_mode( ctx->tl_opts, stream->mp2_mode-1 );
 
-    twolame_init_params( tl_opts );
+    twolame_init_params( ctx->tl_opts );
 
-    frame_size = twolame_get_framelength( tl_opts ) * enc_params->frames_per_pes;
+    ctx->frame_size = twolame_get_framelength( ctx->tl_opts ) * enc_params->frames_per_pes;
 
-    encoder->is_ready = 1;
+    obe_core_encoder_set_ready(ctx->h, encoder);
     /* Broadcast because input and muxer can be stuck waiting for encoder */
     pthread_cond_broadcast( &encoder->queue.in_cv );
     pthread_mutex_unlock( &encoder->queue.mutex );
 
-    output_buf = malloc( MP2_AUDIO_BUFFER_SIZE );
-    if( !output_buf )
+    ctx->output_buf = malloc( MP2_AUDIO_BUFFER_SIZE );
+    if( !ctx->output_buf )
     {
         fprintf( stderr, "Malloc failed\n" );
-        goto end;
+        goto fail;
     }
 
-    avr = swr_alloc();
-    if (!avr)
+    ctx->avr = swr_alloc();
+    if (!ctx->avr)
     {
         fprintf( stderr, "Malloc failed\n" );
-        goto end;
+        goto fail;
     }
 
-    av_opt_set_int( avr, "in_channel_layout",   stream->channel_layout,  0 );
-    av_opt_set_int( avr, "in_sample_fmt",       enc_params->input_sample_format, 0 );
-    av_opt_set_int( avr, "in_sample_rate",      enc_params->sample_rate, 0 );
-    av_opt_set_int( avr, "out_channel_layout",  stream->channel_layout, 0 );
-    av_opt_set_int( avr, "out_sample_fmt",      AV_SAMPLE_FMT_FLT,   0 );
-    av_opt_set_int( avr, "dither_method",       SWR_DITHER_TRIANGULAR, 0 );
-    av_opt_set_int( avr, "out_sample_rate",     enc_params->sample_rate, 0 );
+    av_opt_set_int( ctx->avr, "in_channel_layout",   stream->channel_layout,  0 );
+    av_opt_set_int( ctx->avr, "in_sample_fmt",       enc_params->input_sample_format, 0 );
+    av_opt_set_int( ctx->avr, "in_sample_rate",      enc_params->sample_rate, 0 );
+    av_opt_set_int( ctx->avr, "out_channel_layout",  stream->channel_layout, 0 );
+    av_opt_set_int( ctx->avr, "out_sample_fmt",      AV_SAMPLE_FMT_FLT,   0 );
+    av_opt_set_int( ctx->avr, "dither_method",       SWR_DITHER_TRIANGULAR, 0 );
+    av_opt_set_int( ctx->avr, "out_sample_rate",     enc_params->sample_rate, 0 );
 
-    if (swr_init(avr) < 0)
+    if (swr_init(ctx->avr) < 0)
     {
         fprintf( stderr, "Could not open AVResample\n" );
-        goto end;
+        goto fail;
     }
 
     /* Setup the output FIFO */
-    fifo = av_fifo_alloc( frame_size );
-    if( !fifo )
+    ctx->fifo = av_fifo_alloc( ctx->frame_size );
+    if( !ctx->fifo )
     {
         fprintf( stderr, "Malloc failed\n" );
-        goto end;
+        goto fail;
     }
 
+    return ctx;
+
+fail:
+    _close_encoder( ctx );
+    return NULL;
+}
+
+static void *start_encoder_mp2( void *ptr )
+{
+#if LOCAL_DEBUG
+    printf("%s()\n", __func__);
+#endif
+    obe_raw_frame_t *raw_frame;
+
+    struct context_s *ctx = _open_encoder( ptr );
+    if( !ctx )
+        return NULL;
+
+    obe_encoder_t *encoder = ctx->encoder;
+
+    /* When the shared pool is enabled it owns the context from here on. */
+    if( obe_audio_pool_attach( ctx->h, encoder, ctx, _process_frame, _close_encoder ) == 0 )
+        return NULL;
+
     while( 1 )
     {
         pthread_mutex_lock( &encoder->queue.mutex );
@@ -193,206 +452,15 @@ static void *start_encoder_mp2( void *ptr )
         }
 
         raw_frame = encoder->queue.queue[0];
-
-#define DEKTEC 0
-#if DEKTEC
-        if (raw_frame->avfm.audio_pts - avfm.audio_pts >= (2 * 648000)) {
-#else
-	if (raw_frame->avfm.audio_pts - avfm.audio_pts >= (4 * 648000)) {
-#endif
-            cur_pts = -1; /* Reset the audio timebase from the hardware. */
-#if DEKTEC
-/* 720p30 seems to go through constant reset because the math exceeds our sense of normality.
- * I changed to be 4 * 648000 to keep the console debug noise down.
- */
-printf("Reset audio because raw_frame->avfm.audio_pts %" PRIi64 " - avfm.audio_pts %" PRIi64 " >= (2 * 648000)\n",
-raw_frame->avfm.audio_pts, avfm.audio_pts);
-#endif
-
-        }
-        memcpy(&avfm, &raw_frame->avfm, sizeof(avfm));
-
-        historical_int64_set(&avfm_pts, avfm.audio_pts);
-        //historical_int64_printf(&avfm_pts, "avfm_pts");
-
+        remove_from_queue_without_lock( &encoder->queue );
+        pthread_cond_signal( &encoder->queue.out_cv );
         pthread_mutex_unlock( &encoder->queue.mutex );
 
-        if (cur_pts == -1) {
-            /* Drain any fifos and zero our processing latency, the clock has been
-             * reset so we're rebasing time from the audio hardward clock.
-             */
-            cur_pts = avfm.audio_pts;
-            ptsfixup = 0;
-
-            printf(MODULE "strm %d audio pts reset to %" PRIi64 "\n",
-                encoder->output_stream_id,
-                cur_pts);
-
-            /* Drain the conversion fifos else we induce drift. */
-            av_fifo_drain(fifo, av_fifo_size(fifo));
-            swr_drop_output(avr, 65535);
-
-            output_size = twolame_encode_flush(tl_opts, output_buf, MP2_AUDIO_BUFFER_SIZE);
-        }
-
-        historical_int64_set(&rf_pts, raw_frame->pts);
-        //historical_int64_printf(&rf_pts, "  rf_pts");
-
-#if LOCAL_DEBUG
-        /* Send any audio to the AC3 frame slicer.
-         * Push the buffer starting at the channel containing bitstream, and span 2 channels,
-         * we'll get called back with a completely aligned, crc'd and valid AC3 frame.
-         */
-        printf("%s() output_stream_id = %d linesize = %d, num_samples = %d, num_channels = %d, sample_fmt = %d, raw_frame->input_stream_id = %d\n",
-                __func__,
-                encoder->output_stream_id,
-                raw_frame->audio_frame.linesize,
-                raw_frame->audio_frame.num_samples,
-                raw_frame->audio_frame.num_channels,
-                raw_frame->audio_frame.sample_fmt,
-                raw_frame->input_stream_id);
-#endif
-
-        /* Allocate the output buffer */
-        if( av_samples_alloc( (uint8_t**)&audio_buf, &linesize, av_get_channel_layout_nb_channels( raw_frame->audio_frame.channel_layout ),
-                              raw_frame->audio_frame.linesize, AV_SAMPLE_FMT_FLT, 0 ) < 0 )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto end;
-        }
-
-        if (swr_convert(avr, (uint8_t **)&audio_buf, raw_frame->audio_frame.num_samples, (const uint8_t **)raw_frame->audio_frame.audio_data,
-                                raw_frame->audio_frame.num_samples) < 0)
-        {
-            syslog( LOG_ERR, "[twolame] Sample format conversion failed\n" );
-            break;
-        }
-
-        output_size = twolame_encode_buffer_float32_interleaved( tl_opts, audio_buf, raw_frame->audio_frame.num_samples, output_buf, MP2_AUDIO_BUFFER_SIZE );
-
-        if( output_size < 0 )
-        {
-            syslog( LOG_ERR, "[twolame] Encode failed\n" );
-            break;
-        }
-
-        free( audio_buf );
-        audio_buf = NULL;
-
-
-        raw_frame->release_data( raw_frame );
-        raw_frame->release_frame( raw_frame );
-        remove_from_queue( &encoder->queue );
-
-        if( av_fifo_realloc2( fifo, av_fifo_size( fifo ) + output_size ) < 0 )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
+        if( _process_frame( ctx, raw_frame ) < 0 )
             break;
-        }
-
-        av_fifo_generic_write( fifo, output_buf, output_size, NULL );
-
-        while( av_fifo_size( fifo ) >= frame_size )
-        {
-            coded_frame = new_coded_frame( encoder->output_stream_id, frame_size );
-            if( !coded_frame )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                goto end;
-            }
-            av_fifo_generic_read( fifo, coded_frame->data, frame_size, NULL );
-            memcpy(&coded_frame->avfm, &avfm, sizeof(avfm));
-
-            /* 648000 27MHz ticks equates to 24ms.
-             * 24ms is the smallest amount of time this audio codec and eject as compressed data.
-             * Hence, lowest latency means we get 24ms PES frames.
-             * Hence, normal latency is N * pes frames.
-             * OBE itself determines what N should be in various latency modes.
-             */
-            coded_frame->pts = cur_pts;
-
-            /* This code originated from the aac implementation in lavc.c
-             * The comments related to how and why should be maintained there.
-             * Highly specific to 29.97 for the time being.
-             */
-            if (ptsfixup == 0 &&
-                avfm_get_hw_status_mask(&avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_HALF) &&
-                avfm_get_video_interval_clk(&avfm) == 900900) {
-
-                /* Fixup the clock for 10.11.2, due to an audio clocking bug. */
-                int64_t drift = avfm_get_av_drift(&avfm);
-                int64_t video_interval_clk = avfm_get_video_interval_clk(&avfm);
-                int64_t drifted_frames = (drift / video_interval_clk);
-
-                ptsfixup = drift % video_interval_clk;
-
-                if (drifted_frames == 0) {
-                    if (ptsfixup < -181000) {
-                        drifted_frames++;
-                    } else
-                    if (ptsfixup > (video_interval_clk - 181000)) {
-                        drifted_frames--;
-                    }
-                } else {
-                    if (drift > 0) {
-                        drifted_frames = 0;
-                        if (ptsfixup > (video_interval_clk - 181000))
-                            drifted_frames--;
-                    } else {
-                        drifted_frames *= -1;
-                    }
-
-                }
-                ptsfixup += (drifted_frames * video_interval_clk);
-            }
-
-            coded_frame->pts += (ptsfixup * -1);
-
-            /* Testing shows 720p59.94 is 16ms ahead of where it should be. */
-            if (avfm_get_video_interval_clk(&avfm) == 450450) {
-                coded_frame->pts -=  (16LL * 27000LL);
-                coded_frame->pts -=  (67LL * 270LL);
-            }
-            coded_frame->pts +=  ((int64_t)stream->audio_offset_ms * 27000LL);
-            coded_frame->pts +=  (mp2_offset_ms * 27000LL);
-            coded_frame->random_access = 1; /* Every frame output is a random access point */
-            coded_frame->type = CF_AUDIO;
-
-            historical_int64_set(&cf_pts, coded_frame->pts);
-            //historical_int64_printf(&cf_pts, "  cf_pts");
-
-#if REPORT_AUDIO_DISCONTINUITIES
-            if (lastOutputFramePTS + (648000 * enc_params->frames_per_pes) != coded_frame->pts) {
-                printf(MODULE "Output PTS discontinuity\n\tShould be %" PRIi64 " was %" PRIi64 " diff %9" PRIi64 " frames_per_pes %d\n",
-                    lastOutputFramePTS + (648000 * enc_params->frames_per_pes),
-                    coded_frame->pts,
-                    (lastOutputFramePTS + (648000 * enc_params->frames_per_pes)) - coded_frame->pts,
-                    enc_params->frames_per_pes);
-            }
-            lastOutputFramePTS = coded_frame->pts;
-#endif
-            add_to_queue( &h->mux_queue, coded_frame );
-
-            cur_pts += pts_increment;
-        }
     }
 
-end:
-    if( output_buf )
-        free( output_buf );
-
-    if( audio_buf )
-        free( audio_buf );
-
-    if( avr )
-        swr_free( &avr );
-
-    if( fifo )
-        av_fifo_free( fifo );
-
-    if( tl_opts )
-        twolame_close( &tl_opts );
-    aud_enc_params_free(enc_params);
+    _close_encoder( ctx );
 
     return NULL;
 }
@@ -21,13 +21,19 @@
  *
  *****************************************************************************/
 
+#include <libavutil/mathematics.h>
 #include "common/common.h"
+#include "common/latency_ctl.h"
 
 static int64_t last_clock = -1;
 static int64_t start_pts = -1;
 static int64_t start_dts = -1;
 static int num_enc_smoothing_frames = 0;
 static int buffer_frames = 0;
+static int64_t frame_duration = 0;
+static struct latency_ctl_s *latency_ctl = NULL;
+
+int64_t g_enc_smoother_latency_ms = 0;
 
 void encoder_smoothing_dump(obe_t *h)
 {
@@ -51,6 +57,7 @@ void encoder_smoothing_dump(obe_t *h)
     printf("\tsmoother.start_dts = %" PRIi64 "\n", start_dts);
     printf("\tsmoother.num_enc_smoothing_frames = %d\n", num_enc_smoothing_frames);
     printf("\tsmoother.buffer_frames = %d\n", buffer_frames);
+    printf("\tsmoother.depth_ms = %" PRIi64 "\n", g_enc_smoother_latency_ms);
     printf("\tsmoother.h->obe_clock_last_pts = %" PRIi64 "\n", h->obe_clock_last_pts);
 }
 
@@ -74,17 +81,23 @@ static void *encoder_start_smoothing( void *ptr )
         {
             if( h->encoders[i]->is_video )
             {
-                pthread_mutex_lock( &h->encoders[i]->queue.mutex );
-                while( !h->encoders[i]->is_ready )
-                    pthread_cond_wait( &h->encoders[i]->queue.in_cv, &h->encoders[i]->queue.mutex );
+                obe_core_encoder_wait_ready( h->encoders[i] );
 
                 x264_param_t *params = h->encoders[i]->encoder_params;
                 buffer_frames = params->sc.i_buffer_size;
-
-                pthread_mutex_unlock( &h->encoders[i]->queue.mutex );
+                frame_duration = av_rescale_q( 1, (AVRational){ params->i_fps_den, params->i_fps_num }, (AVRational){ 1, OBE_CLOCK } );
                 break;
             }
         }
+
+        if( buffer_frames && frame_duration )
+        {
+            latency_ctl = latency_ctl_alloc( "encoder smoothing", buffer_frames * frame_duration );
+            pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
+            h->enc_smoothing_depth = buffer_frames * frame_duration;
+            pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
+            g_enc_smoother_latency_ms = buffer_frames * frame_duration / 27000;
+        }
     }
 
     //int64_t send_delta = 0;
@@ -106,7 +119,15 @@ static void *encoder_start_smoothing( void *ptr )
 
         if( !h->enc_smoothing_buffer_complete )
         {
-            if( num_enc_smoothing_frames >= buffer_frames )
+            /* After a drop, refill only as far as the controller has found safe */
+            int fill_frames = buffer_frames;
+            if( latency_ctl )
+            {
+                h->enc_smoothing_depth = latency_ctl_refill_depth( latency_ctl );
+                fill_frames = ( h->enc_smoothing_depth + frame_duration - 1 ) / frame_duration;
+            }
+
+            if( num_enc_smoothing_frames >= fill_frames )
             {
                 h->enc_smoothing_buffer_complete = 1;
                 start_dts = -1;
@@ -123,6 +144,29 @@ static void *encoder_start_smoothing( void *ptr )
         coded_frame = h->enc_smoothing_queue.queue[0];
         pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
 
+        /* Slack is how long before its release time the frame left the encoder. Moving
+         * start_pts is how the depth changes, a little per frame, or all at once when
+         * the frame is late. */
+        if( latency_ctl && start_dts != -1 )
+        {
+            struct timeval now_tv, age;
+            gettimeofday( &now_tv, NULL );
+            obe_timeval_subtract( &age, &now_tv, &coded_frame->creationDate );
+
+            int64_t now = get_input_clock_in_mpeg_ticks( h );
+            int64_t arrival = now - ( (int64_t)age.tv_sec * 1000000 + age.tv_usec ) * 27;
+            int64_t due = start_pts + coded_frame->real_dts - start_dts;
+            int64_t delta = latency_ctl_sample( latency_ctl, now, due - arrival );
+            if( delta )
+            {
+                start_pts += delta;
+                pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
+                h->enc_smoothing_depth = latency_ctl_depth( latency_ctl );
+                pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
+                g_enc_smoother_latency_ms = latency_ctl_depth( latency_ctl ) / 27000;
+            }
+        }
+
         /* The terminology can be a cause for confusion:
          *   pts refers to the pts from the input which is monotonic
          *   dts refers to the dts out of the encoder which is monotonic */
@@ -164,6 +208,9 @@ static void *encoder_start_smoothing( void *ptr )
         num_enc_smoothing_frames = 0;
     }
 
+    latency_ctl_free( latency_ctl );
+    latency_ctl = NULL;
+
     return NULL;
 }
 
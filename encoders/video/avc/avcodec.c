@@ -664,7 +664,7 @@ static void *avc_gpu_avcodec_start_encoder(void *ptr)
 	/* Lock the mutex until we verify and fetch new parameters */
 	pthread_mutex_lock(&ctx->encoder->queue.mutex);
 
-	ctx->encoder->is_ready = 1;
+	obe_core_encoder_set_ready(ctx->h, ctx->encoder);
 
 	//int64_t frame_duration = av_rescale_q(1, (AVRational){ ctx->enc_params->avc_param.i_fps_den, ctx->enc_params->avc_param.i_fps_num}, (AVRational){ 1, OBE_CLOCK } );
 
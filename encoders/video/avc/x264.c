@@ -26,6 +26,7 @@
 
 #include "common/common.h"
 #include "common/vancprocessor.h"
+#include "common/statmux.h"
 #include "encoders/video/video.h"
 #include "encoders/codec_metadata.h"
 #include <libavutil/mathematics.h>
@@ -40,6 +41,8 @@ int64_t cpb_removal_time = 0;
 int64_t g_x264_monitor_bps = 0;
 
 int g_x264_nal_debug = 0;
+/* Runtime tunables. The _new counters are bumped on every change, each encoder
+ * applies a change once and remembers the count it has seen. */
 int g_x264_encode_alternate = 0;
 int g_x264_encode_alternate_new = 0;
 int g_x264_bitrate_bps = 0;
@@ -148,18 +151,20 @@ printf("pic->img.i_csp = %d [%s] bits = %d\n",
             if( raw_frame->user_data[i].type == USER_DATA_AVC_REGISTERED_ITU_T35 ||
                 raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
             {
+                /* x264 frees the payloads with sei_free once it's done with them, which can be
+                 * after the raw frame and its arena are gone, so it gets its own copy. */
                 pic->extra_sei.payloads[idx].payload_type = raw_frame->user_data[i].type;
                 pic->extra_sei.payloads[idx].payload_size = raw_frame->user_data[i].len;
-                pic->extra_sei.payloads[idx].payload = raw_frame->user_data[i].data;
+                pic->extra_sei.payloads[idx].payload = malloc( raw_frame->user_data[i].len );
+                if( !pic->extra_sei.payloads[idx].payload )
+                    return -1;
+                memcpy( pic->extra_sei.payloads[idx].payload, raw_frame->user_data[i].data, raw_frame->user_data[i].len );
                 idx++;
             }
             else
             {
                 syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-                free( raw_frame->user_data[i].data );
             }
-            /* Set the pointer to NULL so only x264 can free the data if necessary */
-            raw_frame->user_data[i].data = NULL;
         }
     }
     else if( raw_frame->num_user_data )
@@ -167,7 +172,6 @@ printf("pic->img.i_csp = %d [%s] bits = %d\n",
         for( int i = 0; i < raw_frame->num_user_data; i++ )
         {
             syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-            free( raw_frame->user_data[i].data );
         }
     }
 
@@ -372,6 +376,12 @@ static void *x264_start_encoder( void *ptr )
     int64_t last_raw_frame_pts = 0;
     int64_t current_raw_frame_pts = 0;
     int upstream_signal_lost = 0;
+    int lookahead_seen = 0, keyint_min_seen = 0, keyint_max_seen = 0, bitrate_seen = 0;
+
+    /* Drift of the rewritten DTS from a steady frame cadence, carried into the CPB arrival times.
+     * Per encoder, ABR renditions each run their own thread. */
+    int64_t last_dts = 0;
+    int64_t dts_diff_accum = 0;
 
     /* TODO: check for width, height changes */
 
@@ -553,7 +563,7 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
     }
     memcpy( encoder->encoder_params, &enc_params->avc_param, sizeof(enc_params->avc_param) );
 
-    encoder->is_ready = 1;
+    obe_core_encoder_set_ready(h, encoder);
     /* XXX: This will need fixing for soft pulldown streams */
     frame_duration = av_rescale_q( 1, (AVRational){enc_params->avc_param.i_fps_den, enc_params->avc_param.i_fps_num}, (AVRational){1, OBE_CLOCK} );
     buffer_duration = frame_duration * enc_params->avc_param.sc.i_buffer_size;
@@ -647,8 +657,8 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
         }
 #endif
 
-        if (g_x264_lookahead_new) {
-            g_x264_lookahead_new = 0;
+        if (lookahead_seen != g_x264_lookahead_new) {
+            lookahead_seen = g_x264_lookahead_new;
 
             enc_params->avc_param.rc.i_lookahead = g_x264_lookahead;
 
@@ -661,8 +671,8 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                 exit(1);
             }
         }
-        if (g_x264_keyint_min_new) {
-            g_x264_keyint_min_new = 0;
+        if (keyint_min_seen != g_x264_keyint_min_new) {
+            keyint_min_seen = g_x264_keyint_min_new;
 
             enc_params->avc_param.i_keyint_min = g_x264_keyint_min;
 
@@ -675,8 +685,8 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                 exit(1);
             }
         }
-        if (g_x264_keyint_max_new) {
-            g_x264_keyint_max_new = 0;
+        if (keyint_max_seen != g_x264_keyint_max_new) {
+            keyint_max_seen = g_x264_keyint_max_new;
 
             enc_params->avc_param.i_keyint_max = g_x264_keyint_max;
 
@@ -689,8 +699,8 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                 exit(1);
             }
         }
-        if (g_x264_bitrate_bps_new) {
-            g_x264_bitrate_bps_new = 0;
+        if (bitrate_seen != g_x264_bitrate_bps_new) {
+            bitrate_seen = g_x264_bitrate_bps_new;
 
             enc_params->avc_param.rc.i_bitrate = g_x264_bitrate_bps / 1000;
             enc_params->avc_param.rc.i_vbv_max_bitrate = enc_params->avc_param.rc.i_bitrate;
@@ -705,6 +715,21 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                 exit(1);
             }
         }
+        /* Take up this program's share of the statmux pool */
+        if (enc_params->statmux) {
+            int kbps = statmux_get_bitrate(enc_params->statmux, enc_params->statmux_idx) / 1000;
+            if (kbps && kbps != enc_params->avc_param.rc.i_bitrate) {
+                enc_params->avc_param.rc.i_bitrate = kbps;
+                enc_params->avc_param.rc.i_vbv_max_bitrate = kbps;
+
+                int ret = x264_encoder_reconfig(s, &enc_params->avc_param);
+                if (ret < 0) {
+                    fprintf(stderr, MESSAGE_PREFIX " failed to reconfigure encoder.\n");
+                    exit(1);
+                }
+            }
+        }
+
         /* convert obe_frame_t into x264 friendly struct */
         if( convert_obe_to_x264_pic( &pic, raw_frame ) < 0 )
         {
@@ -760,6 +785,10 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                 while( !h->enc_smoothing_last_exit_time )
                     pthread_cond_wait( &h->enc_smoothing_queue.out_cv, &h->enc_smoothing_queue.mutex );
 
+                /* Fill is judged against what the smoother holds now, which the latency
+                 * controller may have brought below the speedcontrol buffer */
+                int64_t smoothing_duration = h->enc_smoothing_depth ? h->enc_smoothing_depth : buffer_duration;
+
                 /* time elapsed since last frame was removed */
                 int64_t last_frame_delta = get_input_clock_in_mpeg_ticks( h ) - h->enc_smoothing_last_exit_time;
 
@@ -769,10 +798,10 @@ printf("param.rc.i_vbv_buffer_size = %d\n", param.rc.i_vbv_buffer_size);
                     first_frame = h->enc_smoothing_queue.queue[0];
                     last_frame = h->enc_smoothing_queue.queue[h->enc_smoothing_queue.size-1];
                     int64_t frame_durations = last_frame->real_dts - first_frame->real_dts + frame_duration;
-                    buffer_fill = (float)(frame_durations - last_frame_delta)/buffer_duration;
+                    buffer_fill = (float)(frame_durations - last_frame_delta)/smoothing_duration;
                 }
                 else
-                    buffer_fill = (float)(-1 * last_frame_delta)/buffer_duration;
+                    buffer_fill = (float)(-1 * last_frame_delta)/smoothing_duration;
 
                 x264_speedcontrol_sync( s, buffer_fill, enc_params->avc_param.sc.i_buffer_size, 1 );
             }
@@ -860,6 +889,9 @@ printf("frame_size = %7d pic_type %d (%s) time %6d keyframe %d qp %d\n", frame_s
                 _monitor_bps(enc_params, frame_size);
             }
 
+            if (enc_params->statmux)
+                statmux_report(enc_params->statmux, enc_params->statmux_idx, obe_mdate(), frame_size, pic_out.i_qpplus1 - 1);
+
             coded_frame = new_coded_frame( encoder->output_stream_id, frame_size );
             if( !coded_frame )
             {
@@ -943,8 +975,6 @@ if (fh)
             coded_frame->cpb_final_arrival_time   = new_dts + abs(pic_out.hrd_timing.cpb_final_arrival_time - pic_out.hrd_timing.cpb_final_arrival_time);
 #else
 
-            static int64_t last_dts = 0;
-            static int64_t dts_diff_accum = 0;
             int64_t dts_diff = 0;
             if (last_dts > 0) {
                 dts_diff = coded_frame->real_dts - last_dts - (1 * frame_duration);
@@ -163,7 +163,7 @@ static void *vega_start_encoder( void *ptr )
 	}
 	memcpy( encoder->encoder_params, &ctx->enc_params->avc_param, sizeof(ctx->enc_params->avc_param) );
 
-	ctx->encoder->is_ready = 1;
+	obe_core_encoder_set_ready(ctx->h, ctx->encoder);
 
 	/* Wake up the muxer */
 	pthread_cond_broadcast(&ctx->encoder->queue.in_cv);
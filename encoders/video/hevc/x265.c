@@ -129,6 +129,9 @@ struct context_s
 	x265_nal     *hevc_nals;
 
 	uint64_t      raw_frame_count;
+
+	/* Hardware PTS of the last frame that carried one, per encoder for ABR renditions */
+	int64_t       last_hw_pts;
 };
 
 /* TODO: Duplicated from video.c */
@@ -466,14 +469,12 @@ static int convert_obe_to_x265_pic(struct context_s *ctx, x265_picture *p, struc
 			} else {
 				syslog(LOG_WARNING, MESSAGE_PREFIX " Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
 				printf(MESSAGE_PREFIX " (1) Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
-				free(rf->user_data[i].data);
 			}
 		}
 	} else if (rf->num_user_data) {
 		for (int i = 0; i < rf->num_user_data; i++) {
 			syslog(LOG_WARNING, MESSAGE_PREFIX " Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
 			printf(MESSAGE_PREFIX " (2) Invalid user data presented to encoder - type %i\n", rf->user_data[i].type);
-			free(rf->user_data[i].data);
 		}
 	}
 
@@ -552,17 +553,16 @@ static int dispatch_payload(struct context_s *ctx, const unsigned char *buf, int
 		}
 	}
 
-	static int64_t last_hw_pts = 0;
 	struct opaque_ctx_s *out_ud = ctx->hevc_picture_out->userData; 
 	if (out_ud) {
 		/* Make sure we push the original hardware timing into the new frame. */
 		memcpy(&cf->avfm, &out_ud->avfm, sizeof(struct avfm_s));
 
 		cf->pts = out_ud->avfm.audio_pts;
-		last_hw_pts = out_ud->avfm.audio_pts;
+		ctx->last_hw_pts = out_ud->avfm.audio_pts;
 	} else {
 		//fprintf(stderr, MESSAGE_PREFIX " missing pic out userData\n");
-		cf->pts = last_hw_pts;
+		cf->pts = ctx->last_hw_pts;
 	}
 
 	memcpy(cf->data, buf, lengthBytes);
@@ -866,11 +866,18 @@ static int reconfigure_encoder(struct context_s *ctx)
 	x265_param_parse(ctx->hevc_params, "keyint", val);
 	printf(MESSAGE_PREFIX "keyint = %s\n", val);
 
-	if (obe_core_get_platform_model() == 573) {
+	if (obe_core_get_platform_model() == 573 || ctx->enc_params->avc_param.i_keyint_min == ctx->enc_params->avc_param.i_keyint_max) {
 		x265_param_parse(ctx->hevc_params, "min-keyint", val);
 		printf(MESSAGE_PREFIX "min-keyint = %s\n", val);
 	}
 
+	/* ABR ladder renditions, IDRs only on the GOP boundary. */
+	if (ctx->enc_params->avc_param.i_scenecut_threshold == 0) {
+		x265_param_parse(ctx->hevc_params, "scenecut", "0");
+		x265_param_parse(ctx->hevc_params, "no-open-gop", "1");
+		printf(MESSAGE_PREFIX "scenecut = 0, no-open-gop\n");
+	}
+
 	if (ctx->h->obe_system == OBE_SYSTEM_TYPE_LOWEST_LATENCY) {
 		/* Found that in lowest mode, obe doesn't accept the param, but the codec reports underruns. */
 		ctx->enc_params->avc_param.rc.i_vbv_buffer_size = ctx->enc_params->avc_param.rc.i_vbv_max_bitrate;
@@ -1002,7 +1009,7 @@ static void *x265_start_encoder( void *ptr )
 	/* Lock the mutex until we verify and fetch new parameters */
 	pthread_mutex_lock(&ctx->encoder->queue.mutex);
 
-	ctx->encoder->is_ready = 1;
+	obe_core_encoder_set_ready(ctx->h, ctx->encoder);
 
 	g_frame_duration = av_rescale_q( 1, (AVRational){ ctx->enc_params->avc_param.i_fps_den, ctx->enc_params->avc_param.i_fps_num}, (AVRational){ 1, OBE_CLOCK } );
 	printf("frame_duration = %" PRIi64 "\n", g_frame_duration);
@@ -36,6 +36,10 @@ typedef struct
     obe_t *h;
     obe_encoder_t *encoder;
     x264_param_t avc_param;
+
+    /* Set when this encode's bitrate is shared with other programs */
+    struct statmux_s *statmux;
+    int statmux_idx;
 } obe_vid_enc_params_t;
 
 extern const obe_vid_enc_func_t x264_obe_encoder;
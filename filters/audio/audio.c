@@ -20,10 +20,14 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
  */
 
+#include <math.h>
 #include <libavutil/eval.h>
 
 #include "common/common.h"
 #include "audio.h"
+#include "encoders/audio/audio.h"
+#include "audio_dsp.h"
+#include "loudness.h"
 
 #define LOCAL_DEBUG 0
 #define MODULE_PREFIX "[audio-filter]: "
@@ -42,6 +46,41 @@
  */
 int g_filter_audio_effect_pcm = 0;
 
+/* Loudness metering (BS.1770) of every PCM stream we encode, see loudness.c. Off by default,
+ * it costs a filter pass per sample.
+ * Normalization slowly steers each stream towards the target, on top of any static gain_db.
+ * It needs the measurements, so the meters also run whenever normalization is enabled.
+ */
+int g_filter_audio_loudness_meter = 0;
+int g_filter_audio_loudness_true_peak = 1;
+int g_filter_audio_loudness_normalize = 0;
+int g_filter_audio_loudness_target = -24; /* LUFS, ATSC A/85. EBU R128 is -23 */
+
+#define LOUDNESS_NORMALIZE_MAX_DB 12.0
+#define LOUDNESS_NORMALIZE_DB_PER_SEC 1.0
+
+/* A meter per PCM encoder, owned by the filter thread feeding it. Rebuilt whenever the
+ * format it was built for changes.
+ */
+struct loudness_state_s
+{
+    struct loudness_meter_s *meter;
+    int num_channels;
+    int sample_rate;
+    uint64_t channel_layout;
+    double normalize_db; /* Currently applied normalization gain */
+};
+
+/* The latest measurements, published by the filters for the CLI and the runtime statistics.
+ * Indexed by encoder, like the filters' own state.
+ */
+static pthread_mutex_t g_loudness_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    int valid;
+    struct audio_filter_loudness_s loudness;
+} g_loudness[MAX_STREAMS];
+
 
 static double compute_dB__to_scaler(const char *dbval)
 {
@@ -78,47 +117,37 @@ static double compute_dB__to_scaler(const char *dbval)
  */
 static void applyGain(obe_output_stream_t *output_stream, obe_raw_frame_t *rf, double volumeScaler)
 {
-    /* Gain adjust audio gain for left and right channels - assumption 32bit samples S32P from decklink */
-    int32_t *data = (int32_t *)rf->audio_frame.audio_data[0];
-
+    /* Gain adjust audio gain for each plane - assumption 32bit samples S32P from decklink */
 #if 0
     printf("output_stream_id %d, applying gain of %f\n", output_stream->output_stream_id, volumeScaler);
 #endif
 
-    for (int i = 0; i < rf->audio_frame.num_samples * rf->audio_frame.num_channels; i++) {
-        double a = (double)data[i];
-        double b = a * volumeScaler;
-        data[i] = (int32_t)b;
-    }
+    audio_dsp_gain_s32p(rf->audio_frame.audio_data, rf->audio_frame.num_channels,
+        rf->audio_frame.num_samples, (float)volumeScaler);
 }
 
 static void applyEffects(obe_raw_frame_t *rf)
 {
+    static uint32_t noise_seed = 0;
+    int channels = rf->audio_frame.num_channels < 2 ? rf->audio_frame.num_channels : 2;
+
     if (g_filter_audio_effect_pcm & 0x03) {
         /* Mute audio right (or left or both) - assumption 32bit samples S32P from decklink */
-        uint32_t *l = (uint32_t *)rf->audio_frame.audio_data[0];
-        uint32_t *r = (uint32_t *)rf->audio_frame.audio_data[1];
-        for (int i = 0; i < rf->audio_frame.num_samples; i++) {
-            if (g_filter_audio_effect_pcm & (1 << 0)) {
-                *(r++) = 0; /* Mute Right */
-            }
-            if (g_filter_audio_effect_pcm & (1 << 1)) {
-                *(l++) = 0; /* Mute Left */
-            }
-        }
+        uint32_t mask = 0;
+        if (g_filter_audio_effect_pcm & (1 << 0))
+            mask |= (1 << 1); /* Mute Right */
+        if (g_filter_audio_effect_pcm & (1 << 1))
+            mask |= (1 << 0); /* Mute Left */
+        audio_dsp_mute_s32p(rf->audio_frame.audio_data, channels, rf->audio_frame.num_samples, mask);
     }
     if (g_filter_audio_effect_pcm & 0x0c) {
         /* Static audio right (or left or both) - assumption 32bit samples S32P from decklink */
-        int32_t *l = (int32_t *)rf->audio_frame.audio_data[0];
-        int32_t *r = (int32_t *)rf->audio_frame.audio_data[1];
-        for (int i = 0; i < rf->audio_frame.num_samples; i++) {
-            if (g_filter_audio_effect_pcm & (1 << 2)) {
-                *(r++) = rand(); /* Right */
-            }
-            if (g_filter_audio_effect_pcm & (1 << 3)) {
-                *(l++) = rand(); /* Left */
-            }
-        }
+        uint32_t mask = 0;
+        if (g_filter_audio_effect_pcm & (1 << 2))
+            mask |= (1 << 1); /* Right */
+        if (g_filter_audio_effect_pcm & (1 << 3))
+            mask |= (1 << 0); /* Left */
+        audio_dsp_noise_s32p(rf->audio_frame.audio_data, channels, rf->audio_frame.num_samples, mask, &noise_seed);
     }
     if (g_filter_audio_effect_pcm & 0x30) {
         /* Buzz audio right (or left or both) - assumption 32bit samples S32P from decklink */
@@ -173,6 +202,180 @@ static void applyEffects(obe_raw_frame_t *rf)
     }
 }
 
+int audio_filter_loudness_get(struct audio_filter_loudness_s *loudness, int max)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&g_loudness_mutex);
+    for (int i = 0; i < MAX_STREAMS && count < max; i++) {
+        if (g_loudness[i].valid)
+            loudness[count++] = g_loudness[i].loudness;
+    }
+    pthread_mutex_unlock(&g_loudness_mutex);
+
+    return count;
+}
+
+/* Called from the cli, show loudness */
+void audio_filter_loudness_show(void)
+{
+    struct audio_filter_loudness_s loudness[MAX_STREAMS];
+    int count = audio_filter_loudness_get(loudness, MAX_STREAMS);
+
+    for (int i = 0; i < count; i++) {
+        struct loudness_stats_s *stats = &loudness[i].stats;
+        printf("output_stream_id %2d: M %6.1f S %6.1f I %6.1f LUFS, true-peak %6.1f dBTP, normalization %+5.1f dB\n",
+            loudness[i].output_stream_id,
+            stats->momentary_lufs, stats->shortterm_lufs, stats->integrated_lufs,
+            stats->true_peak_dbtp, loudness[i].normalize_db);
+    }
+}
+
+static void publishLoudness(int idx, int output_stream_id, struct loudness_state_s *state)
+{
+    pthread_mutex_lock(&g_loudness_mutex);
+    if (state->meter) {
+        g_loudness[idx].loudness.output_stream_id = output_stream_id;
+        loudness_meter_get_stats(state->meter, &g_loudness[idx].loudness.stats);
+        g_loudness[idx].loudness.normalize_db = state->normalize_db;
+        g_loudness[idx].valid = 1;
+    } else {
+        g_loudness[idx].valid = 0;
+    }
+    pthread_mutex_unlock(&g_loudness_mutex);
+}
+
+static void freeLoudness(int idx, struct loudness_state_s *state)
+{
+    if (state->meter)
+        loudness_meter_free(state->meter);
+    memset(state, 0, sizeof(*state));
+    publishLoudness(idx, 0, state);
+}
+
+static void measureLoudness(obe_t *h, int idx, struct loudness_state_s *state, obe_output_stream_t *output_stream,
+    uint8_t **planes, int num_channels, int num_samples)
+{
+    int sample_rate = 48000;
+    obe_int_input_stream_t *input_stream = get_input_stream(h, output_stream->input_stream_id);
+    if (input_stream && input_stream->sample_rate)
+        sample_rate = input_stream->sample_rate;
+
+    /* A new channel count or layout (or rate) invalidates the filter and gating history. */
+    if (state->meter && (state->num_channels != num_channels || state->sample_rate != sample_rate ||
+        state->channel_layout != output_stream->channel_layout)) {
+        printf(MODULE_PREFIX "output_stream_id %d, audio format changed, loudness meter restarted\n",
+            output_stream->output_stream_id);
+        freeLoudness(idx, state);
+    }
+
+    if (!state->meter) {
+        state->meter = loudness_meter_alloc(sample_rate, num_channels, output_stream->channel_layout,
+            g_filter_audio_loudness_true_peak);
+        if (!state->meter)
+            return;
+        state->num_channels = num_channels;
+        state->sample_rate = sample_rate;
+        state->channel_layout = output_stream->channel_layout;
+    }
+
+    loudness_meter_process_s32p(state->meter, planes, num_samples);
+
+    if (g_filter_audio_loudness_normalize) {
+        /* Prefer the gated integrated value, fall back to short-term until it settles. */
+        struct loudness_stats_s stats;
+        loudness_meter_get_stats(state->meter, &stats);
+        double measured = stats.integrated_lufs;
+        if (measured <= LOUDNESS_SILENCE)
+            measured = stats.shortterm_lufs;
+
+        if (measured > LOUDNESS_SILENCE) {
+            double desired = g_filter_audio_loudness_target - measured;
+            if (desired > LOUDNESS_NORMALIZE_MAX_DB)
+                desired = LOUDNESS_NORMALIZE_MAX_DB;
+            if (desired < -LOUDNESS_NORMALIZE_MAX_DB)
+                desired = -LOUDNESS_NORMALIZE_MAX_DB;
+
+            /* Slew slowly, so program dynamics survive. */
+            double step = LOUDNESS_NORMALIZE_DB_PER_SEC * num_samples / sample_rate;
+            double *cur = &state->normalize_db;
+            if (desired > *cur + step)
+                *cur += step;
+            else if (desired < *cur - step)
+                *cur -= step;
+            else
+                *cur = desired;
+        }
+    }
+
+    publishLoudness(idx, output_stream->output_stream_id, state);
+}
+
+/* Zero-copy routing of sdi_audio_pairs to encoders.
+ * Split frames reference the planar source planes, the source frame is released
+ * once the filter and every encoder holding a split frame are done with it.
+ */
+struct audio_ref_s
+{
+    pthread_mutex_t mutex;
+    int refcount;
+    obe_raw_frame_t *src;
+};
+
+static struct audio_ref_s *audio_ref_alloc(obe_raw_frame_t *src)
+{
+    struct audio_ref_s *ref = calloc(1, sizeof(*ref));
+    if (!ref)
+        return NULL;
+
+    pthread_mutex_init(&ref->mutex, NULL);
+    ref->refcount = 1; /* Held by the filter until distribution is complete */
+    ref->src = src;
+
+    return ref;
+}
+
+static void audio_ref_get(struct audio_ref_s *ref)
+{
+    pthread_mutex_lock(&ref->mutex);
+    ref->refcount++;
+    pthread_mutex_unlock(&ref->mutex);
+}
+
+static void audio_ref_put(struct audio_ref_s *ref)
+{
+    pthread_mutex_lock(&ref->mutex);
+    int refcount = --ref->refcount;
+    pthread_mutex_unlock(&ref->mutex);
+
+    if (refcount)
+        return;
+
+    ref->src->release_data(ref->src);
+    ref->src->release_frame(ref->src);
+    pthread_mutex_destroy(&ref->mutex);
+    free(ref);
+}
+
+/* release_data() for split frames that point into the source planes */
+static void audio_ref_release_data(void *ptr)
+{
+    obe_raw_frame_t *rf = ptr;
+
+    memset(rf->audio_frame.audio_data, 0, sizeof(rf->audio_frame.audio_data));
+    audio_ref_put(rf->opaque);
+    rf->opaque = NULL;
+}
+
+/* Each device has its own audio filters, only feed the encoders of our program. */
+static int is_device_output(obe_t *h, obe_device_t *device, obe_output_stream_t *output_stream)
+{
+    if (h->num_devices < 2)
+        return 1;
+
+    return get_device_by_input_stream(h, output_stream->input_stream_id) == device;
+}
+
 static void *start_filter_audio( void *ptr )
 {
     obe_raw_frame_t *raw_frame, *split_raw_frame;
@@ -182,12 +385,23 @@ static void *start_filter_audio( void *ptr )
     obe_output_stream_t *output_stream;
     int num_channels;
 
-    /* ignore the video track, process all PCM encoders first */
-    for (int i = 1; i < h->num_encoders; i++)
+    struct loudness_state_s loudness[MAX_STREAMS];
+    memset(loudness, 0, sizeof(loudness));
+
+    enum audio_dsp_impl_e impl = audio_dsp_init(AUDIO_DSP_IMPL_AUTO);
+    printf(MODULE_PREFIX "using %s sample processing\n", audio_dsp_impl_name(impl));
+
+    /* ignore the video tracks, process all PCM encoders first */
+    for (int i = 0; i < h->num_encoders; i++)
     {
+        if (h->encoders[i]->is_video)
+            continue;
+
         output_stream = get_output_stream_by_id(h, h->encoders[i]->output_stream_id);
         if (output_stream->stream_format == AUDIO_AC_3_BITSTREAM)
             continue; /* Ignore downstream AC3 bitstream encoders */
+        if (!is_device_output(h, filter_params->device, output_stream))
+            continue;
 
         num_channels = av_get_channel_layout_nb_channels(output_stream->channel_layout);
         output_stream->audioGain = 0.0;
@@ -221,6 +435,8 @@ static void *start_filter_audio( void *ptr )
         raw_frame = filter->queue.queue[0];
         pthread_mutex_unlock( &filter->queue.mutex );
 
+        struct audio_ref_s *ref = NULL;
+
 #if LOCAL_DEBUG
         printf("%s() raw_frame->input_stream_id = %d, num_encoders = %d\n", __func__,
             raw_frame->input_stream_id, h->num_encoders);
@@ -231,12 +447,17 @@ static void *start_filter_audio( void *ptr )
             raw_frame->audio_frame.sample_fmt);
 #endif
 
-        /* ignore the video track, process all PCM encoders first */
-        for (int i = 1; i < h->num_encoders; i++)
+        /* ignore the video tracks, process all PCM encoders first */
+        for (int i = 0; i < h->num_encoders; i++)
         {
+            if (h->encoders[i]->is_video)
+                continue;
+
             output_stream = get_output_stream_by_id(h, h->encoders[i]->output_stream_id);
             if (output_stream->stream_format == AUDIO_AC_3_BITSTREAM)
                 continue; /* Ignore downstream AC3 bitstream encoders */
+            if (!is_device_output(h, filter_params->device, output_stream))
+                continue;
 
             if (raw_frame->audio_frame.sample_fmt == AV_SAMPLE_FMT_NONE)
                 continue; /* Ignore non-pcm frames */
@@ -255,17 +476,79 @@ static void *start_filter_audio( void *ptr )
                 return NULL;
             }
             memcpy(split_raw_frame, raw_frame, sizeof(*split_raw_frame));
+            /* The arena, and anything carved from it, stays with the source frame */
+            split_raw_frame->arena = NULL;
+            split_raw_frame->user_data = NULL;
+            split_raw_frame->num_user_data = split_raw_frame->num_user_data_alloc = 0;
+            avmetadata_init(&split_raw_frame->metadata);
             memset(split_raw_frame->audio_frame.audio_data, 0, sizeof(split_raw_frame->audio_frame.audio_data));
             split_raw_frame->audio_frame.linesize = split_raw_frame->audio_frame.num_channels = 0;
             split_raw_frame->audio_frame.channel_layout = output_stream->channel_layout;
             split_raw_frame->audio_frame.num_channels = num_channels;
 
+            int first_channel = ((output_stream->sdi_audio_pair - 1) << 1) + output_stream->mono_channel;
+
+            int planar = av_sample_fmt_is_planar(raw_frame->audio_frame.sample_fmt);
+            int src_channels = raw_frame->audio_frame.num_channels;
+            if (!src_channels)
+                src_channels = av_get_channel_layout_nb_channels(raw_frame->audio_frame.channel_layout);
+            if ((g_filter_audio_loudness_meter || g_filter_audio_loudness_normalize) && planar && first_channel + num_channels <= MAX_CHANNELS &&
+                first_channel + num_channels <= src_channels) {
+                /* Measure the source, before any gain, so normalization doesn't chase itself. */
+                measureLoudness(h, i, &loudness[i], output_stream, &raw_frame->audio_frame.audio_data[first_channel],
+                    num_channels, raw_frame->audio_frame.num_samples);
+            } else if (loudness[i].meter) {
+                freeLoudness(i, &loudness[i]);
+            }
+            int normalize = g_filter_audio_loudness_normalize && loudness[i].normalize_db != 0.0;
+
+            /* The source has fewer channels than the encoder takes, Eg. a 5.1 encoder on a
+             * stereo input or a stereo encoder on a mono one. Upmix with the default matrix
+             * rather than reading past the source planes.
+             */
+            int src_avail = src_channels - first_channel;
+            int upmix = raw_frame->audio_frame.sample_fmt == AV_SAMPLE_FMT_S32P &&
+                num_channels <= MAX_CHANNELS && src_avail > 0 && src_avail < num_channels;
+
+            /* Encoders only read the samples, so unless we're about to modify them
+             * (gain, effects) the split frame can simply point at the source planes.
+             */
+            int needs_copy = g_filter_audio_effect_pcm || normalize || upmix ||
+                !planar ||
+                first_channel + num_channels > MAX_CHANNELS ||
+                ((num_channels == 2 || num_channels == 6) && strlen(output_stream->gain_db) > 0);
+
+            if (!needs_copy)
+            {
+                if (!ref) {
+                    ref = audio_ref_alloc(raw_frame);
+                    if (!ref) {
+                        syslog(LOG_ERR, "Malloc failed\n");
+                        return NULL;
+                    }
+                }
+                audio_ref_get(ref);
+
+                for (int c = 0; c < num_channels; c++)
+                    split_raw_frame->audio_frame.audio_data[c] = raw_frame->audio_frame.audio_data[first_channel + c];
+                split_raw_frame->audio_frame.linesize = raw_frame->audio_frame.linesize;
+                split_raw_frame->opaque = ref;
+                split_raw_frame->release_data = audio_ref_release_data;
+
+#if LOCAL_DEBUG
+                obe_raw_frame_printf(split_raw_frame);
+#endif
+                add_to_encode_queue(h, split_raw_frame, h->encoders[i]->output_stream_id);
+                continue;
+            }
+
             if (av_samples_alloc(split_raw_frame->audio_frame.audio_data, &split_raw_frame->audio_frame.linesize, num_channels,
                               split_raw_frame->audio_frame.num_samples, split_raw_frame->audio_frame.sample_fmt, 0) < 0)
             {
                 syslog(LOG_ERR, "Malloc failed\n");
                 return NULL;
             }
+            split_raw_frame->release_data = obe_release_audio_data;
 
             /* Copy samples for each channel into a new buffer, so each downstream encoder can
              * compress the channels the user has selected via sdi_audio_pair.
@@ -277,18 +560,33 @@ printf(" split_raw_frame->audio_frame.num_samples %d", split_raw_frame->audio_fr
 printf(" split_raw_frame->audio_frame.sample_fmt %d", split_raw_frame->audio_frame.sample_fmt);
 printf(" split_raw_frame->audio_frame.linesize %d", split_raw_frame->audio_frame.linesize);
 #endif
-            av_samples_copy(split_raw_frame->audio_frame.audio_data, /* dst */
-                            &raw_frame->audio_frame.audio_data[((output_stream->sdi_audio_pair - 1) << 1) + output_stream->mono_channel], /* src */
-                            0, /* dst offset */
-                            0, /* src offset */
-                            split_raw_frame->audio_frame.num_samples,
-                            num_channels,
-                            split_raw_frame->audio_frame.sample_fmt);
+            if (upmix) {
+                float matrix[MAX_CHANNELS * MAX_CHANNELS];
+                audio_dsp_matrix_default(matrix, num_channels, src_avail);
+                audio_dsp_mix_s32p(split_raw_frame->audio_frame.audio_data, num_channels,
+                    &raw_frame->audio_frame.audio_data[first_channel], src_avail,
+                    split_raw_frame->audio_frame.num_samples, matrix);
+            } else {
+                av_samples_copy(split_raw_frame->audio_frame.audio_data, /* dst */
+                                &raw_frame->audio_frame.audio_data[first_channel], /* src */
+                                0, /* dst offset */
+                                0, /* src offset */
+                                split_raw_frame->audio_frame.num_samples,
+                                num_channels,
+                                split_raw_frame->audio_frame.sample_fmt);
+            }
 
             applyEffects(split_raw_frame);
 
+            double gain = 1.0;
             if ((num_channels == 2 || num_channels == 6) && strlen(output_stream->gain_db) > 0) {
-                applyGain(output_stream, split_raw_frame, output_stream->audioGain);
+                gain = output_stream->audioGain;
+            }
+            if (normalize) {
+                gain *= pow(10.0, loudness[i].normalize_db / 20.0);
+            }
+            if (gain != 1.0) {
+                applyGain(output_stream, split_raw_frame, gain);
             }
 
 #if LOCAL_DEBUG
@@ -297,6 +595,9 @@ printf(" split_raw_frame->audio_frame.linesize %d", split_raw_frame->audio_frame
             add_to_encode_queue(h, split_raw_frame, h->encoders[i]->output_stream_id);
         } /* For all PCM encoders */
 
+        /* Pooled encoders are woken once per input frame, rather than once per encoder. */
+        obe_audio_pool_kick(h);
+
         /* ignore the video track, process all AC3 bitstream encoders.... */
 	/* TODO: Only one buffer can be passed to one encoder, as the input SDI
 	 * group defines a single stream of data, so this buffer can only end up at one
@@ -304,11 +605,16 @@ printf(" split_raw_frame->audio_frame.linesize %d", split_raw_frame->audio_frame
 	 * That being said, the decklink input creates one bitstream buffer per detected pair.
 	 */
         int didForward = 0;
-        for (int i = 1; i < h->num_encoders; i++)
+        for (int i = 0; i < h->num_encoders; i++)
         {
+            if (h->encoders[i]->is_video)
+                continue;
+
             output_stream = get_output_stream_by_id(h, h->encoders[i]->output_stream_id);
             if (output_stream->stream_format != AUDIO_AC_3_BITSTREAM)
                 continue; /* Ignore downstream AC3 bitstream encoders */
+            if (!is_device_output(h, filter_params->device, output_stream))
+                continue;
 
             if (raw_frame->audio_frame.sample_fmt != AV_SAMPLE_FMT_NONE)
                 continue; /* Ignore pcm frames */
@@ -320,7 +626,8 @@ printf(" split_raw_frame->audio_frame.linesize %d", split_raw_frame->audio_frame
             printf("input_stream->input_stream_id %d\n", input_stream->input_stream_id);
 #endif
             /* Discard this buffer if it's not destined for our encoders sdi_audio_pair. */
-            if (raw_frame->input_stream_id != output_stream->sdi_audio_pair)
+            obe_int_input_stream_t *pair_stream = get_input_stream(h, raw_frame->input_stream_id);
+            if (!pair_stream || pair_stream->sdi_audio_pair != output_stream->sdi_audio_pair)
                 continue;
 
             /* PTS is the standard 27MHz clock. Adjust by ms. */
@@ -339,12 +646,22 @@ printf(" split_raw_frame->audio_frame.linesize %d", split_raw_frame->audio_frame
 
         if (!didForward) {
             remove_from_queue(&filter->queue);
-            raw_frame->release_data(raw_frame);
-            raw_frame->release_frame(raw_frame);
+            if (ref) {
+                /* Encoders referencing our planes will release the source frame. */
+                audio_ref_put(ref);
+            } else {
+                raw_frame->release_data(raw_frame);
+                raw_frame->release_frame(raw_frame);
+            }
             raw_frame = NULL;
         }
     }
 
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (loudness[i].meter)
+            freeLoudness(i, &loudness[i]);
+    }
+
     free( filter_params );
 
     return NULL;
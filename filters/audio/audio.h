@@ -25,6 +25,7 @@
 #define OBE_FILTERS_AUDIO_H
 #include <libavutil/samplefmt.h>
 #include <libavutil/channel_layout.h>
+#include "loudness.h"
 
 typedef struct
 {
@@ -35,8 +36,21 @@ typedef struct
 {
     obe_t *h;
     obe_filter_t *filter;
+    obe_device_t *device;
 } obe_aud_filter_params_t;
 
 extern const obe_aud_filter_func_t audio_filter;
 
+/* Loudness of a metered PCM output stream, as last published by its audio filter */
+struct audio_filter_loudness_s
+{
+    int output_stream_id;
+    struct loudness_stats_s stats;
+    double normalize_db;
+};
+
+/* Copies up to max entries, returns the number copied. Safe from any thread. */
+int audio_filter_loudness_get(struct audio_filter_loudness_s *loudness, int max);
+void audio_filter_loudness_show(void);
+
 #endif
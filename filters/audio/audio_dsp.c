@@ -0,0 +1,363 @@
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "audio_dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_DSP_X86 1
+#include <immintrin.h>
+#else
+#define AUDIO_DSP_X86 0
+#endif
+
+/* Sample DSP for the audio filter. Every routine converts to float, scales and
+ * saturates back to int32. SDI audio is 24bit left justified in 32bit words,
+ * so single precision floats hold each input sample exactly.
+ * The C and SIMD paths produce bit identical results, tools/audio-dsp-bench checks this.
+ */
+
+#define SAT_MAX  2147483520.0f /* Largest float below 2^31 */
+#define SAT_MIN -2147483648.0f
+
+static inline int32_t sat_s32(float f)
+{
+	if (f > SAT_MAX)
+		f = SAT_MAX;
+	if (f < SAT_MIN)
+		f = SAT_MIN;
+	return (int32_t)lrintf(f);
+}
+
+/* C */
+
+static void gain_c(int32_t *p, int n, float gain)
+{
+	for (int i = 0; i < n; i++)
+		p[i] = sat_s32((float)p[i] * gain);
+}
+
+static void mix_c(int32_t *dst, int32_t **src, int src_channels, int n, const float *m)
+{
+	for (int i = 0; i < n; i++) {
+		float acc = 0.0f;
+		for (int s = 0; s < src_channels; s++)
+			acc += (float)src[s][i] * m[s];
+		dst[i] = sat_s32(acc);
+	}
+}
+
+/* src points at the first channel of the pair, stride is in words */
+static void deinterleave_pair_c(int32_t *dst0, int32_t *dst1, const int32_t *src, int stride, int n)
+{
+	for (int i = 0; i < n; i++) {
+		dst0[i] = src[0];
+		dst1[i] = src[1];
+		src += stride;
+	}
+}
+
+static void extract_pair_c(int32_t *dst, const int32_t *src, int stride, int n)
+{
+	for (int i = 0; i < n; i++) {
+		dst[(i * 2) + 0] = src[0];
+		dst[(i * 2) + 1] = src[1];
+		src += stride;
+	}
+}
+
+#if AUDIO_DSP_X86
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static void gain_sse2(int32_t *p, int n, float gain)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	const __m128 hi = _mm_set1_ps(SAT_MAX);
+	const __m128 lo = _mm_set1_ps(SAT_MIN);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 f = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(p + i)));
+		f = _mm_min_ps(_mm_max_ps(_mm_mul_ps(f, g), lo), hi);
+		_mm_storeu_si128((__m128i *)(p + i), _mm_cvtps_epi32(f));
+	}
+	gain_c(p + i, n - i, gain);
+}
+
+__attribute__((target("sse2")))
+static void mix_sse2(int32_t *dst, int32_t **src, int src_channels, int n, const float *m)
+{
+	const __m128 hi = _mm_set1_ps(SAT_MAX);
+	const __m128 lo = _mm_set1_ps(SAT_MIN);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 acc = _mm_setzero_ps();
+		for (int s = 0; s < src_channels; s++) {
+			__m128 f = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src[s] + i)));
+			acc = _mm_add_ps(acc, _mm_mul_ps(f, _mm_set1_ps(m[s])));
+		}
+		acc = _mm_min_ps(_mm_max_ps(acc, lo), hi);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_cvtps_epi32(acc));
+	}
+
+	if (i < n) {
+		int32_t *tail[32];
+		for (int s = 0; s < src_channels; s++)
+			tail[s] = src[s] + i;
+		mix_c(dst + i, tail, src_channels, n - i, m);
+	}
+}
+
+/* Four sample periods, each pair is a single 64bit load. */
+__attribute__((target("sse2")))
+static void deinterleave_pair_sse2(int32_t *dst0, int32_t *dst1, const int32_t *src, int stride, int n)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i a = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src + (0 * stride))),
+		                               _mm_loadl_epi64((const __m128i *)(src + (1 * stride)))); /* L0 R0 L1 R1 */
+		__m128i b = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src + (2 * stride))),
+		                               _mm_loadl_epi64((const __m128i *)(src + (3 * stride)))); /* L2 R2 L3 R3 */
+		a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)); /* L0 L1 R0 R1 */
+		b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0)); /* L2 L3 R2 R3 */
+		_mm_storeu_si128((__m128i *)(dst0 + i), _mm_unpacklo_epi64(a, b));
+		_mm_storeu_si128((__m128i *)(dst1 + i), _mm_unpackhi_epi64(a, b));
+		src += 4 * stride;
+	}
+	deinterleave_pair_c(dst0 + i, dst1 + i, src, stride, n - i);
+}
+
+__attribute__((target("sse2")))
+static void extract_pair_sse2(int32_t *dst, const int32_t *src, int stride, int n)
+{
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128i a = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src)),
+		                               _mm_loadl_epi64((const __m128i *)(src + stride)));
+		_mm_storeu_si128((__m128i *)(dst + (i * 2)), a);
+		src += 2 * stride;
+	}
+	extract_pair_c(dst + (i * 2), src, stride, n - i);
+}
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static void gain_avx2(int32_t *p, int n, float gain)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	const __m256 hi = _mm256_set1_ps(SAT_MAX);
+	const __m256 lo = _mm256_set1_ps(SAT_MIN);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 f = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(p + i)));
+		f = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(f, g), lo), hi);
+		_mm256_storeu_si256((__m256i *)(p + i), _mm256_cvtps_epi32(f));
+	}
+	gain_c(p + i, n - i, gain);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(int32_t *dst, int32_t **src, int src_channels, int n, const float *m)
+{
+	const __m256 hi = _mm256_set1_ps(SAT_MAX);
+	const __m256 lo = _mm256_set1_ps(SAT_MIN);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 acc = _mm256_setzero_ps();
+		for (int s = 0; s < src_channels; s++) {
+			__m256 f = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src[s] + i)));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(f, _mm256_set1_ps(m[s])));
+		}
+		acc = _mm256_min_ps(_mm256_max_ps(acc, lo), hi);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_cvtps_epi32(acc));
+	}
+
+	if (i < n) {
+		int32_t *tail[32];
+		for (int s = 0; s < src_channels; s++)
+			tail[s] = src[s] + i;
+		mix_c(dst + i, tail, src_channels, n - i, m);
+	}
+}
+
+__attribute__((target("avx2")))
+static void deinterleave_pair_avx2(int32_t *dst0, int32_t *dst1, const int32_t *src, int stride, int n)
+{
+#define PAIR2(r0, r1) _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src + ((r0) * stride))), \
+                                         _mm_loadl_epi64((const __m128i *)(src + ((r1) * stride))))
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		/* L0 R0 L1 R1 | L4 R4 L5 R5 and L2 R2 L3 R3 | L6 R6 L7 R7 */
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(PAIR2(0, 1)), PAIR2(4, 5), 1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(PAIR2(2, 3)), PAIR2(6, 7), 1);
+		a = _mm256_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+		b = _mm256_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(dst0 + i), _mm256_unpacklo_epi64(a, b));
+		_mm256_storeu_si256((__m256i *)(dst1 + i), _mm256_unpackhi_epi64(a, b));
+		src += 8 * stride;
+	}
+#undef PAIR2
+	deinterleave_pair_sse2(dst0 + i, dst1 + i, src, stride, n - i);
+}
+#endif /* AUDIO_DSP_X86 */
+
+static void (*gain_func)(int32_t *p, int n, float gain) = gain_c;
+static void (*mix_func)(int32_t *dst, int32_t **src, int src_channels, int n, const float *m) = mix_c;
+static void (*deinterleave_pair_func)(int32_t *dst0, int32_t *dst1, const int32_t *src, int stride, int n) = deinterleave_pair_c;
+static void (*extract_pair_func)(int32_t *dst, const int32_t *src, int stride, int n) = extract_pair_c;
+static enum audio_dsp_impl_e current_impl = AUDIO_DSP_IMPL_C;
+
+const char *audio_dsp_impl_name(enum audio_dsp_impl_e impl)
+{
+	switch (impl) {
+	case AUDIO_DSP_IMPL_AUTO: return "auto";
+	case AUDIO_DSP_IMPL_C:    return "c";
+	case AUDIO_DSP_IMPL_SSE2: return "sse2";
+	case AUDIO_DSP_IMPL_AVX2: return "avx2";
+	}
+	return "unknown";
+}
+
+static void select_impl(enum audio_dsp_impl_e impl)
+{
+#if AUDIO_DSP_X86
+	__builtin_cpu_init();
+	int has_sse2 = __builtin_cpu_supports("sse2");
+	int has_avx2 = __builtin_cpu_supports("avx2");
+
+	if (impl == AUDIO_DSP_IMPL_AUTO)
+		impl = has_avx2 ? AUDIO_DSP_IMPL_AVX2 : has_sse2 ? AUDIO_DSP_IMPL_SSE2 : AUDIO_DSP_IMPL_C;
+	if (impl == AUDIO_DSP_IMPL_AVX2 && !has_avx2)
+		impl = AUDIO_DSP_IMPL_SSE2;
+	if (impl == AUDIO_DSP_IMPL_SSE2 && !has_sse2)
+		impl = AUDIO_DSP_IMPL_C;
+
+	switch (impl) {
+	case AUDIO_DSP_IMPL_AVX2:
+		gain_func = gain_avx2;
+		mix_func = mix_avx2;
+		deinterleave_pair_func = deinterleave_pair_avx2;
+		extract_pair_func = extract_pair_sse2;
+		break;
+	case AUDIO_DSP_IMPL_SSE2:
+		gain_func = gain_sse2;
+		mix_func = mix_sse2;
+		deinterleave_pair_func = deinterleave_pair_sse2;
+		extract_pair_func = extract_pair_sse2;
+		break;
+	default:
+		impl = AUDIO_DSP_IMPL_C;
+		gain_func = gain_c;
+		mix_func = mix_c;
+		deinterleave_pair_func = deinterleave_pair_c;
+		extract_pair_func = extract_pair_c;
+	}
+#else
+	impl = AUDIO_DSP_IMPL_C;
+#endif
+	current_impl = impl;
+}
+
+static pthread_once_t auto_once = PTHREAD_ONCE_INIT;
+
+static void select_auto(void)
+{
+	select_impl(AUDIO_DSP_IMPL_AUTO);
+}
+
+enum audio_dsp_impl_e audio_dsp_init(enum audio_dsp_impl_e impl)
+{
+	/* Every input and filter thread asks for AUTO, only the first one selects. */
+	if (impl == AUDIO_DSP_IMPL_AUTO)
+		pthread_once(&auto_once, select_auto);
+	else
+		select_impl(impl);
+
+	return current_impl;
+}
+
+void audio_dsp_gain_s32p(uint8_t **planes, int num_channels, int num_samples, float gain)
+{
+	for (int c = 0; c < num_channels; c++)
+		gain_func((int32_t *)planes[c], num_samples, gain);
+}
+
+void audio_dsp_mute_s32p(uint8_t **planes, int num_channels, int num_samples, uint32_t channel_mask)
+{
+	for (int c = 0; c < num_channels; c++) {
+		if (channel_mask & (1 << c))
+			memset(planes[c], 0, num_samples * sizeof(int32_t));
+	}
+}
+
+void audio_dsp_noise_s32p(uint8_t **planes, int num_channels, int num_samples, uint32_t channel_mask, uint32_t *seed)
+{
+	uint32_t x = *seed ? *seed : 0x12345678;
+
+	for (int c = 0; c < num_channels; c++) {
+		if ((channel_mask & (1 << c)) == 0)
+			continue;
+
+		int32_t *p = (int32_t *)planes[c];
+		for (int i = 0; i < num_samples; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			p[i] = (int32_t)x;
+		}
+	}
+
+	*seed = x;
+}
+
+void audio_dsp_mix_s32p(uint8_t **dst, int dst_channels, uint8_t **src, int src_channels,
+	int num_samples, const float *matrix)
+{
+	if (src_channels > 32)
+		return;
+
+	for (int d = 0; d < dst_channels; d++)
+		mix_func((int32_t *)dst[d], (int32_t **)src, src_channels, num_samples, &matrix[d * src_channels]);
+}
+
+void audio_dsp_matrix_default(float *m, int dst_channels, int src_channels)
+{
+	const float k = 0.70710678f; /* -3dB */
+
+	memset(m, 0, dst_channels * src_channels * sizeof(float));
+
+#define M(d, s) m[(d) * src_channels + (s)]
+	if (src_channels == 6 && dst_channels == 2) {
+		M(0, 0) = 1.0f; M(0, 2) = k; M(0, 4) = k;
+		M(1, 1) = 1.0f; M(1, 2) = k; M(1, 5) = k;
+	} else
+	if (src_channels == 2 && dst_channels == 1) {
+		M(0, 0) = 0.5f; M(0, 1) = 0.5f;
+	} else
+	if (src_channels == 1 && dst_channels == 2) {
+		M(0, 0) = 1.0f;
+		M(1, 0) = 1.0f;
+	} else {
+		/* Identity, which also covers stereo to 5.1 (FL/FR only). */
+		for (int i = 0; i < dst_channels && i < src_channels; i++)
+			M(i, i) = 1.0f;
+	}
+#undef M
+}
+
+void audio_dsp_deinterleave_pair_s32(uint8_t *dst0, uint8_t *dst1, const uint8_t *src,
+	int in_channels, int first_channel, int num_samples)
+{
+	deinterleave_pair_func((int32_t *)dst0, (int32_t *)dst1, (const int32_t *)src + first_channel, in_channels, num_samples);
+}
+
+void audio_dsp_extract_pair_s32(uint8_t *dst, const uint8_t *src,
+	int in_channels, int first_channel, int num_samples)
+{
+	extract_pair_func((int32_t *)dst, (const int32_t *)src + first_channel, in_channels, num_samples);
+}
@@ -0,0 +1,69 @@
+#ifndef OBE_FILTERS_AUDIO_DSP_H
+#define OBE_FILTERS_AUDIO_DSP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* In place DSP on planar signed 32bit audio (S32P, as delivered by the SDI inputs).
+ * Each function takes an array of plane pointers, one per channel.
+ * SSE2 and AVX2 implementations are selected at runtime, with a C fallback.
+ */
+
+enum audio_dsp_impl_e
+{
+	AUDIO_DSP_IMPL_AUTO = 0,
+	AUDIO_DSP_IMPL_C,
+	AUDIO_DSP_IMPL_SSE2,
+	AUDIO_DSP_IMPL_AVX2,
+};
+
+/* Select an implementation, AUTO picks the best the cpu supports.
+ * Returns the implementation actually selected.
+ * AUTO is safe to call from any thread and only selects once. Forcing a specific
+ * implementation swaps the functions under any running caller, so it is for
+ * single threaded tools such as tools/audio-dsp-bench.
+ */
+enum audio_dsp_impl_e audio_dsp_init(enum audio_dsp_impl_e impl);
+const char *audio_dsp_impl_name(enum audio_dsp_impl_e impl);
+
+/* Multiply every sample by gain, saturating to the int32 range. */
+void audio_dsp_gain_s32p(uint8_t **planes, int num_channels, int num_samples, float gain);
+
+/* Zero every channel whose bit is set in channel_mask. */
+void audio_dsp_mute_s32p(uint8_t **planes, int num_channels, int num_samples, uint32_t channel_mask);
+
+/* Replace the channels in channel_mask with white noise (cheap xorshift, not rand()). */
+void audio_dsp_noise_s32p(uint8_t **planes, int num_channels, int num_samples, uint32_t channel_mask, uint32_t *seed);
+
+/* Channel mapping, dst[d] = sum(matrix[d * src_channels + s] * src[s]), saturating.
+ * Source and destination planes must not overlap.
+ */
+void audio_dsp_mix_s32p(uint8_t **dst, int dst_channels, uint8_t **src, int src_channels,
+	int num_samples, const float *matrix);
+
+/* Fill matrix (dst_channels * src_channels floats) with a sensible default mapping:
+ * 5.1 to stereo (ITU-R BS.775 downmix, LFE dropped), stereo to mono, mono to stereo,
+ * stereo to 5.1 (L/R passed through, other channels silent), otherwise identity.
+ * Channel order follows libavutil, FL FR FC LFE SL SR.
+ */
+void audio_dsp_matrix_default(float *matrix, int dst_channels, int src_channels);
+
+/* Capture side unpacking of interleaved S32 (in_channels words per sample period), so an
+ * input only pays for the channels something downstream reads.
+ * Channels first_channel and first_channel + 1 are written to dst0 and dst1.
+ */
+void audio_dsp_deinterleave_pair_s32(uint8_t *dst0, uint8_t *dst1, const uint8_t *src,
+	int in_channels, int first_channel, int num_samples);
+
+/* As above, but the pair stays interleaved in dst (2 * num_samples words), Eg. SMPTE 337 bitstream. */
+void audio_dsp_extract_pair_s32(uint8_t *dst, const uint8_t *src,
+	int in_channels, int first_channel, int num_samples);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_FILTERS_AUDIO_DSP_H */
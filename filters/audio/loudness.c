@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <libavutil/channel_layout.h>
+
+#include "loudness.h"
+
+/* ITU-R BS.1770-4 loudness measurement.
+ *
+ * Samples are K-weighted (a high shelf followed by a high pass biquad, coefficients
+ * derived for the actual sample rate), squared and accumulated into 100ms sub-blocks.
+ * Momentary loudness is the mean of the last 4 sub-blocks, short-term the last 30.
+ * Every sub-block completes a 400ms gating block (75% overlap), which is added to a
+ * histogram used for the absolute (-70 LUFS) and relative (-10 LU) gated integrated value.
+ *
+ * True-peak is estimated by 4x oversampling each channel with a 48 tap windowed sinc,
+ * evaluated phase by phase so the inner loops auto-vectorize.
+ */
+
+#define SUBBLOCKS_MOMENTARY 4
+#define SUBBLOCKS_SHORTTERM 30
+
+#define HIST_MIN_LUFS -70.0
+#define HIST_BINS 800 /* 0.1 LU bins, -70 to +10 LUFS */
+
+#define TP_PHASES 4
+#define TP_TAPS 12 /* Per phase */
+
+struct loudness_meter_s
+{
+	pthread_mutex_t mutex;
+	struct loudness_stats_s stats; /* Protected by mutex */
+
+	int sample_rate;
+	int num_channels;
+	int true_peak;
+	double weight[LOUDNESS_MAX_CHANNELS];
+
+	/* K-weighting, two cascaded biquads, transposed direct form II */
+	double pre_b[3], pre_a[3];
+	double rlb_b[3], rlb_a[3];
+	double z[LOUDNESS_MAX_CHANNELS][4];
+
+	/* 100ms sub-block accumulation */
+	int subblock_len;
+	int subblock_pos;
+	double subblock_sum[LOUDNESS_MAX_CHANNELS];
+	double subblocks[SUBBLOCKS_SHORTTERM];
+	int subblock_count;
+	int subblock_idx;
+
+	/* Gating histogram */
+	uint64_t hist_count[HIST_BINS];
+	double hist_energy[HIST_BINS];
+
+	/* True-peak */
+	float tp_coeffs[TP_PHASES][TP_TAPS];
+	float tp_hist[LOUDNESS_MAX_CHANNELS][TP_TAPS - 1];
+	float *tp_buf;
+	float *tp_acc;
+	int tp_buf_samples;
+	double peak; /* Linear, full scale = 1.0 */
+};
+
+static double energy_to_lufs(double energy)
+{
+	if (energy <= 0.0)
+		return LOUDNESS_SILENCE;
+	return -0.691 + 10.0 * log10(energy);
+}
+
+static double linear_to_db(double v)
+{
+	if (v <= 0.0)
+		return LOUDNESS_SILENCE;
+	return 20.0 * log10(v);
+}
+
+static void _init_kweighting(struct loudness_meter_s *m)
+{
+	double rate = m->sample_rate;
+
+	/* Stage 1, high shelf modelling the acoustic effect of the head. */
+	double f0 = 1681.974450955533;
+	double G  = 3.999843853973347;
+	double Q  = 0.7071752369554196;
+	double K  = tan(M_PI * f0 / rate);
+	double Vh = pow(10.0, G / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+
+	m->pre_b[0] = (Vh + Vb * K / Q + K * K) / a0;
+	m->pre_b[1] = 2.0 * (K * K - Vh) / a0;
+	m->pre_b[2] = (Vh - Vb * K / Q + K * K) / a0;
+	m->pre_a[0] = 1.0;
+	m->pre_a[1] = 2.0 * (K * K - 1.0) / a0;
+	m->pre_a[2] = (1.0 - K / Q + K * K) / a0;
+
+	/* Stage 2, RLB high pass. */
+	f0 = 38.13547087602444;
+	Q  = 0.5003270373238773;
+	K  = tan(M_PI * f0 / rate);
+	a0 = 1.0 + K / Q + K * K;
+
+	m->rlb_b[0] = 1.0;
+	m->rlb_b[1] = -2.0;
+	m->rlb_b[2] = 1.0;
+	m->rlb_a[0] = 1.0;
+	m->rlb_a[1] = 2.0 * (K * K - 1.0) / a0;
+	m->rlb_a[2] = (1.0 - K / Q + K * K) / a0;
+}
+
+static void _init_truepeak(struct loudness_meter_s *m)
+{
+	const int taps = TP_PHASES * TP_TAPS;
+	double h[TP_PHASES * TP_TAPS];
+
+	for (int i = 0; i < taps; i++) {
+		double t = (i - (taps - 1) / 2.0) / TP_PHASES;
+		double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+		double window = 0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / taps);
+		h[i] = sinc * window;
+	}
+
+	/* Unity DC gain per phase */
+	for (int p = 0; p < TP_PHASES; p++) {
+		double sum = 0.0;
+		for (int k = 0; k < TP_TAPS; k++)
+			sum += h[p + k * TP_PHASES];
+		for (int k = 0; k < TP_TAPS; k++)
+			m->tp_coeffs[p][k] = h[p + k * TP_PHASES] / sum;
+	}
+}
+
+static void _init_weights(struct loudness_meter_s *m, uint64_t channel_layout)
+{
+	for (int c = 0; c < LOUDNESS_MAX_CHANNELS; c++)
+		m->weight[c] = c < m->num_channels ? 1.0 : 0.0;
+
+	if (!channel_layout)
+		return;
+
+	int c = 0;
+	for (int bit = 0; bit < 64 && c < m->num_channels; bit++) {
+		uint64_t ch = 1ULL << bit;
+		if ((channel_layout & ch) == 0)
+			continue;
+
+		if (ch == AV_CH_LOW_FREQUENCY)
+			m->weight[c] = 0.0;
+		else
+		if (ch & (AV_CH_BACK_LEFT | AV_CH_BACK_RIGHT | AV_CH_SIDE_LEFT | AV_CH_SIDE_RIGHT))
+			m->weight[c] = 1.41;
+		c++;
+	}
+}
+
+struct loudness_meter_s *loudness_meter_alloc(int sample_rate, int num_channels, uint64_t channel_layout, int true_peak)
+{
+	if (num_channels < 1 || num_channels > LOUDNESS_MAX_CHANNELS || sample_rate < 8000)
+		return NULL;
+
+	struct loudness_meter_s *m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	pthread_mutex_init(&m->mutex, NULL);
+	m->sample_rate = sample_rate;
+	m->num_channels = num_channels;
+	m->true_peak = true_peak;
+	m->subblock_len = sample_rate / 10;
+
+	_init_kweighting(m);
+	_init_truepeak(m);
+	_init_weights(m, channel_layout);
+	loudness_meter_reset(m);
+
+	return m;
+}
+
+void loudness_meter_free(struct loudness_meter_s *m)
+{
+	if (!m)
+		return;
+
+	pthread_mutex_destroy(&m->mutex);
+	free(m->tp_buf);
+	free(m->tp_acc);
+	free(m);
+}
+
+void loudness_meter_reset(struct loudness_meter_s *m)
+{
+	memset(m->z, 0, sizeof(m->z));
+	memset(m->subblock_sum, 0, sizeof(m->subblock_sum));
+	memset(m->subblocks, 0, sizeof(m->subblocks));
+	memset(m->hist_count, 0, sizeof(m->hist_count));
+	memset(m->hist_energy, 0, sizeof(m->hist_energy));
+	memset(m->tp_hist, 0, sizeof(m->tp_hist));
+	m->subblock_pos = 0;
+	m->subblock_count = 0;
+	m->subblock_idx = 0;
+	m->peak = 0.0;
+
+	pthread_mutex_lock(&m->mutex);
+	m->stats.momentary_lufs = LOUDNESS_SILENCE;
+	m->stats.shortterm_lufs = LOUDNESS_SILENCE;
+	m->stats.integrated_lufs = LOUDNESS_SILENCE;
+	m->stats.true_peak_dbtp = LOUDNESS_SILENCE;
+	m->stats.blocks = 0;
+	pthread_mutex_unlock(&m->mutex);
+}
+
+static double _integrated(struct loudness_meter_s *m)
+{
+	uint64_t count = 0;
+	double energy = 0.0;
+
+	for (int i = 0; i < HIST_BINS; i++) {
+		count += m->hist_count[i];
+		energy += m->hist_energy[i];
+	}
+	if (!count)
+		return LOUDNESS_SILENCE;
+
+	/* Relative gate, 10 LU below the absolute gated loudness */
+	double gate = energy_to_lufs(energy / count) - 10.0;
+	int first = (int)ceil((gate - HIST_MIN_LUFS) * 10.0);
+	if (first < 0)
+		first = 0;
+
+	count = 0;
+	energy = 0.0;
+	for (int i = first; i < HIST_BINS; i++) {
+		count += m->hist_count[i];
+		energy += m->hist_energy[i];
+	}
+	if (!count)
+		return LOUDNESS_SILENCE;
+
+	return energy_to_lufs(energy / count);
+}
+
+static void _complete_subblock(struct loudness_meter_s *m)
+{
+	double energy = 0.0;
+	for (int c = 0; c < m->num_channels; c++) {
+		energy += m->weight[c] * (m->subblock_sum[c] / m->subblock_len);
+		m->subblock_sum[c] = 0.0;
+	}
+
+	m->subblocks[m->subblock_idx] = energy;
+	m->subblock_idx = (m->subblock_idx + 1) % SUBBLOCKS_SHORTTERM;
+	if (m->subblock_count < SUBBLOCKS_SHORTTERM)
+		m->subblock_count++;
+
+	double momentary = LOUDNESS_SILENCE, shortterm = LOUDNESS_SILENCE;
+	int added = 0;
+
+	if (m->subblock_count >= SUBBLOCKS_MOMENTARY) {
+		double sum = 0.0;
+		for (int i = 1; i <= SUBBLOCKS_MOMENTARY; i++)
+			sum += m->subblocks[(m->subblock_idx - i + SUBBLOCKS_SHORTTERM) % SUBBLOCKS_SHORTTERM];
+		double block = sum / SUBBLOCKS_MOMENTARY;
+		momentary = energy_to_lufs(block);
+
+		/* Absolute gate */
+		if (momentary > HIST_MIN_LUFS) {
+			int bin = (int)((momentary - HIST_MIN_LUFS) * 10.0);
+			if (bin >= HIST_BINS)
+				bin = HIST_BINS - 1;
+			m->hist_count[bin]++;
+			m->hist_energy[bin] += block;
+		}
+		added = 1;
+	}
+
+	if (m->subblock_count == SUBBLOCKS_SHORTTERM) {
+		double sum = 0.0;
+		for (int i = 0; i < SUBBLOCKS_SHORTTERM; i++)
+			sum += m->subblocks[i];
+		shortterm = energy_to_lufs(sum / SUBBLOCKS_SHORTTERM);
+	}
+
+	double integrated = _integrated(m);
+
+	pthread_mutex_lock(&m->mutex);
+	m->stats.momentary_lufs = momentary;
+	m->stats.shortterm_lufs = shortterm;
+	m->stats.integrated_lufs = integrated;
+	m->stats.blocks += added;
+	pthread_mutex_unlock(&m->mutex);
+}
+
+static void _kweight_segment(struct loudness_meter_s *m, int c, const int32_t *src, int count)
+{
+	double *z = m->z[c];
+	double sum = 0.0;
+
+	for (int i = 0; i < count; i++) {
+		double x = src[i] * (1.0 / 2147483648.0);
+
+		double y = m->pre_b[0] * x + z[0];
+		z[0] = m->pre_b[1] * x - m->pre_a[1] * y + z[1];
+		z[1] = m->pre_b[2] * x - m->pre_a[2] * y;
+
+		double w = m->rlb_b[0] * y + z[2];
+		z[2] = m->rlb_b[1] * y - m->rlb_a[1] * w + z[3];
+		z[3] = m->rlb_b[2] * y - m->rlb_a[2] * w;
+
+		sum += w * w;
+	}
+
+	m->subblock_sum[c] += sum;
+}
+
+static void _truepeak(struct loudness_meter_s *m, int c, const int32_t *src, int num_samples)
+{
+	const int hist = TP_TAPS - 1;
+	float *buf = m->tp_buf;
+	float *acc = m->tp_acc;
+	float peak = 0.0f;
+
+	memcpy(buf, m->tp_hist[c], hist * sizeof(float));
+	for (int i = 0; i < num_samples; i++)
+		buf[hist + i] = src[i] * (1.0f / 2147483648.0f);
+
+	for (int p = 0; p < TP_PHASES; p++) {
+		memset(acc, 0, num_samples * sizeof(float));
+		for (int k = 0; k < TP_TAPS; k++) {
+			const float coeff = m->tp_coeffs[p][k];
+			const float *in = buf + hist - k;
+			for (int i = 0; i < num_samples; i++)
+				acc[i] += coeff * in[i];
+		}
+		for (int i = 0; i < num_samples; i++) {
+			float v = fabsf(acc[i]);
+			peak = v > peak ? v : peak;
+		}
+	}
+
+	memcpy(m->tp_hist[c], buf + num_samples, hist * sizeof(float));
+
+	if (peak > m->peak)
+		m->peak = peak;
+}
+
+void loudness_meter_process_s32p(struct loudness_meter_s *m, uint8_t **planes, int num_samples)
+{
+	if (m->true_peak && num_samples > m->tp_buf_samples) {
+		free(m->tp_buf);
+		free(m->tp_acc);
+		m->tp_buf = malloc((num_samples + TP_TAPS) * sizeof(float));
+		m->tp_acc = malloc(num_samples * sizeof(float));
+		m->tp_buf_samples = m->tp_buf && m->tp_acc ? num_samples : 0;
+	}
+
+	int pos = 0;
+	while (pos < num_samples) {
+		int count = m->subblock_len - m->subblock_pos;
+		if (count > num_samples - pos)
+			count = num_samples - pos;
+
+		for (int c = 0; c < m->num_channels; c++) {
+			if (m->weight[c] == 0.0)
+				continue;
+			_kweight_segment(m, c, (const int32_t *)planes[c] + pos, count);
+		}
+
+		pos += count;
+		m->subblock_pos += count;
+		if (m->subblock_pos == m->subblock_len) {
+			m->subblock_pos = 0;
+			_complete_subblock(m);
+		}
+	}
+
+	if (m->true_peak && m->tp_buf_samples >= num_samples) {
+		for (int c = 0; c < m->num_channels; c++)
+			_truepeak(m, c, (const int32_t *)planes[c], num_samples);
+
+		pthread_mutex_lock(&m->mutex);
+		m->stats.true_peak_dbtp = linear_to_db(m->peak);
+		pthread_mutex_unlock(&m->mutex);
+	}
+}
+
+void loudness_meter_get_stats(struct loudness_meter_s *m, struct loudness_stats_s *stats)
+{
+	pthread_mutex_lock(&m->mutex);
+	memcpy(stats, &m->stats, sizeof(*stats));
+	pthread_mutex_unlock(&m->mutex);
+}
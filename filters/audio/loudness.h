@@ -0,0 +1,36 @@
+#ifndef OBE_FILTERS_AUDIO_LOUDNESS_H
+#define OBE_FILTERS_AUDIO_LOUDNESS_H
+
+#include <stdint.h>
+
+/* Streaming ITU-R BS.1770 loudness meter (EBU R128 / ATSC A/85) for planar S32 audio.
+ * Momentary (400ms), short-term (3s), gated integrated loudness and 4x oversampled true-peak.
+ * Integrated loudness uses a 0.1 LU histogram, so memory is constant regardless of run time.
+ */
+
+#define LOUDNESS_MAX_CHANNELS 16
+#define LOUDNESS_SILENCE -144.0
+
+struct loudness_stats_s
+{
+	double momentary_lufs;
+	double shortterm_lufs;
+	double integrated_lufs;
+	double true_peak_dbtp;  /* Since the meter was created or reset */
+	uint64_t blocks;        /* Number of 400ms gating blocks measured */
+};
+
+struct loudness_meter_s;
+
+/* channel_layout is a libavutil AV_CH_LAYOUT_*, used to weight surround channels and exclude LFE. */
+struct loudness_meter_s *loudness_meter_alloc(int sample_rate, int num_channels, uint64_t channel_layout, int true_peak);
+void loudness_meter_free(struct loudness_meter_s *m);
+void loudness_meter_reset(struct loudness_meter_s *m);
+
+/* Feed num_samples of S32P audio. */
+void loudness_meter_process_s32p(struct loudness_meter_s *m, uint8_t **planes, int num_samples);
+
+/* Thread safe snapshot of the current measurements. */
+void loudness_meter_get_stats(struct loudness_meter_s *m, struct loudness_stats_s *stats);
+
+#endif /* OBE_FILTERS_AUDIO_LOUDNESS_H */
@@ -85,6 +85,13 @@ typedef struct
     int sws_ctx_flags;
     enum AVPixelFormat dst_pix_fmt;
 
+    /* ABR ladder, one scaler per rendition, each fed by the level above */
+    struct
+    {
+        struct SwsContext *sws_ctx;
+        int src_width, src_height, csp, interlaced;
+    } rendition[MAX_STREAMS];
+
     /* JPEG thumbnailing */
     struct filter_compress_ctx *fc_ctx;
 
@@ -371,6 +378,82 @@ static int resize_frame( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame
     return 0;
 }
 
+/* Scale a finished frame down to a rendition's size, in the same colourspace. Interlaced
+ * frames are scaled a field at a time so the fields stay separate.
+ */
+static obe_raw_frame_t *scale_rendition( obe_vid_filter_ctx_t *vfilt, int idx, obe_raw_frame_t *src,
+                                         int width, int height )
+{
+    int interlaced = IS_INTERLACED( src->img.format );
+    int fields = interlaced ? 2 : 1;
+
+    if( !vfilt->rendition[idx].sws_ctx || src->reset_obe ||
+        vfilt->rendition[idx].src_width != src->img.width || vfilt->rendition[idx].src_height != src->img.height ||
+        vfilt->rendition[idx].csp != src->img.csp || vfilt->rendition[idx].interlaced != interlaced )
+    {
+        if( vfilt->rendition[idx].sws_ctx )
+            sws_freeContext( vfilt->rendition[idx].sws_ctx );
+
+        vfilt->rendition[idx].sws_ctx = sws_getContext( src->img.width, src->img.height / fields, src->img.csp,
+                                                        width, height / fields, src->img.csp,
+                                                        SWS_BICUBIC | SWS_ACCURATE_RND, NULL, NULL, NULL );
+        if( !vfilt->rendition[idx].sws_ctx )
+        {
+            fprintf( stderr, "Rendition scaling failed\n" );
+            return NULL;
+        }
+        vfilt->rendition[idx].src_width = src->img.width;
+        vfilt->rendition[idx].src_height = src->img.height;
+        vfilt->rendition[idx].csp = src->img.csp;
+        vfilt->rendition[idx].interlaced = interlaced;
+    }
+
+    obe_raw_frame_t *dst = obe_raw_frame_copy_props( src );
+    if( !dst )
+        return NULL;
+
+    dst->alloc_img.width = width;
+    dst->alloc_img.height = height;
+    dst->alloc_img.planes = src->img.planes;
+    dst->alloc_img.csp = src->img.csp;
+    dst->alloc_img.format = src->img.format;
+    dst->release_data = obe_release_video_data;
+    dst->release_frame = obe_release_frame;
+
+    if( av_image_alloc( dst->alloc_img.plane, dst->alloc_img.stride, width, height+1, dst->alloc_img.csp, 16 ) < 0 )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        dst->release_frame( dst );
+        return NULL;
+    }
+    memcpy( &dst->img, &dst->alloc_img, sizeof(obe_image_t) );
+
+    for( int f = 0; f < fields; f++ )
+    {
+        const uint8_t *src_plane[4] = { 0 };
+        uint8_t *dst_plane[4] = { 0 };
+        int src_stride[4] = { 0 }, dst_stride[4] = { 0 };
+
+        for( int i = 0; i < src->img.planes; i++ )
+        {
+            src_plane[i] = src->img.plane[i] + f * src->img.stride[i];
+            src_stride[i] = src->img.stride[i] * fields;
+            dst_plane[i] = dst->img.plane[i] + f * dst->img.stride[i];
+            dst_stride[i] = dst->img.stride[i] * fields;
+        }
+
+        sws_scale( vfilt->rendition[idx].sws_ctx, src_plane, src_stride, 0, src->img.height / fields,
+                   dst_plane, dst_stride );
+    }
+
+    /* Keep the display aspect ratio of the level above */
+    av_reduce( &dst->sar_width, &dst->sar_height,
+               (int64_t)src->sar_width * src->img.width * height,
+               (int64_t)src->sar_height * src->img.height * width, 65535 );
+
+    return dst;
+}
+
 static int csp_num_interleaved( int csp, int plane )
 {
     return ( csp == AV_PIX_FMT_NV12 && plane == 1 ) ? 2 : 1;
@@ -612,9 +695,7 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
     user_data->len = bs_pos( &r ) >> 3;
 
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
+    user_data->data = obe_raw_frame_alloc( raw_frame, user_data->len );
     if( !user_data->data )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
@@ -626,7 +707,7 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     return 0;
 }
 
-static int write_bar_data( obe_user_data_t *user_data )
+static int write_bar_data( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t r;
     uint8_t temp[100];
@@ -680,9 +761,7 @@ static int write_bar_data( obe_user_data_t *user_data )
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
     user_data->len = bs_pos( &r ) >> 3;
 
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
+    user_data->data = obe_raw_frame_alloc( raw_frame, user_data->len );
     if( !user_data->data )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
@@ -710,11 +789,11 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
         if( raw_frame->user_data[i].type == USER_DATA_CEA_608 )
             ret = write_608_cc( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_CEA_708_CDP )
-            ret = read_cdp( &raw_frame->user_data[i] );
+            ret = read_cdp( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_AFD )
             ret = write_afd( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_BAR_DATA )
-            ret = write_bar_data( &raw_frame->user_data[i] );
+            ret = write_bar_data( &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_WSS )
             ret = convert_wss_to_afd( &raw_frame->user_data[i], raw_frame );
 
@@ -724,7 +803,7 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
 
         if( ret == 1 )
         {
-            free( raw_frame->user_data[i].data );
+            /* Dropped, the data goes with the frame arena */
             memmove( &raw_frame->user_data[i], &raw_frame->user_data[i+1],
                      sizeof(*raw_frame->user_data) * (raw_frame->num_user_data-i-1) );
             raw_frame->num_user_data--;
@@ -732,12 +811,6 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
         }
     }
 
-    if( !raw_frame->num_user_data )
-    {
-        free( raw_frame->user_data );
-        raw_frame->user_data = NULL;
-    }
-
     return ret;
 }
 
@@ -748,7 +821,7 @@ static void *start_filter_video( void *ptr )
     obe_filter_t *filter = filter_params->filter;
     obe_int_input_stream_t *input_stream = filter_params->input_stream;
     obe_raw_frame_t *raw_frame;
-    obe_output_stream_t *output_stream = get_output_stream_by_id(h, 0); /* FIXME when output_stream_id for video is not zero */
+    obe_output_stream_t *output_stream = filter_params->output_stream;
     int h_shift, v_shift;
     const AVPixFmtDescriptor *pfd;
 
@@ -802,7 +875,7 @@ static void *start_filter_video( void *ptr )
         if (raw_frame->alloc_img.csp == AV_PIX_FMT_QSV) {
             //printf(PREFIX "detected VEGA nals frame, %p\n", raw_frame);
             remove_from_queue(&filter->queue);
-            add_to_encode_queue(h, raw_frame, 0);
+            add_to_encode_queue(h, raw_frame, output_stream->output_stream_id);
 #if PERFORMANCE_PROFILE
         gettimeofday(&tsframeEnd, NULL);
         obe_timeval_subtract(&tsframeDiff, &tsframeEnd, &tsframeBegin);
@@ -891,6 +964,20 @@ static void *start_filter_video( void *ptr )
             raw_frame->sar_guess = 1;
         }
 
+        /* ABR ladder, each rendition scaled from the one above it rather than the full frame.
+         * A rendition that can't be scaled misses this frame, the main encode carries on. */
+        obe_raw_frame_t *renditions[MAX_STREAMS];
+        obe_raw_frame_t *above = raw_frame;
+        for( int i = 0; i < filter_params->num_renditions; i++ )
+        {
+            obe_output_stream_t *r = filter_params->renditions[i];
+            renditions[i] = scale_rendition( vfilt, i, above, r->avc_param.i_width, r->avc_param.i_height );
+            if( renditions[i] )
+                above = renditions[i];
+            else
+                syslog( LOG_ERR, PREFIX "Rendition %dx%d skipped a frame\n", r->avc_param.i_width, r->avc_param.i_height );
+        }
+
         remove_from_queue( &filter->queue );
 //PRINT_OBE_IMAGE(&raw_frame->img, "VIDEO FILTER POST");
 
@@ -913,7 +1000,13 @@ static void *start_filter_video( void *ptr )
             bypass_vs = filter_vapoursynth_process(vs_ctx, raw_frame);
         
         if (bypass_vs)
-            add_to_encode_queue( h, raw_frame, 0 );
+            add_to_encode_queue( h, raw_frame, output_stream->output_stream_id );
+
+        for( int i = 0; i < filter_params->num_renditions; i++ )
+        {
+            if( renditions[i] )
+                add_to_encode_queue( h, renditions[i], filter_params->renditions[i]->output_stream_id );
+        }
 
 #if PERFORMANCE_PROFILE
         gettimeofday(&tsframeEnd, NULL);
@@ -929,6 +1022,12 @@ end:
         if( vfilt->sws_ctx )
             sws_freeContext( vfilt->sws_ctx );
 
+        for( int i = 0; i < MAX_STREAMS; i++ )
+        {
+            if( vfilt->rendition[i].sws_ctx )
+                sws_freeContext( vfilt->rendition[i].sws_ctx );
+        }
+
         free( vfilt );
     }
 
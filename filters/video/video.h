@@ -34,7 +34,12 @@ typedef struct
     obe_t *h;
     obe_filter_t *filter;
     obe_int_input_stream_t *input_stream;
+    obe_output_stream_t *output_stream;
     int target_csp;
+
+    /* ABR ladder, further encodes of this input, largest first */
+    int num_renditions;
+    obe_output_stream_t *renditions[MAX_STREAMS];
 } obe_vid_filter_params_t;
 
 extern const obe_vid_filter_func_t video_filter;
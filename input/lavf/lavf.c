@@ -0,0 +1,1069 @@
+/* libavformat URL input. Demuxes MPEG-TS (or anything else libavformat understands) from
+ * udp://, rtp://, srt:// or a local file, decodes the video with frame threading and
+ * ships raw frames into the filters exactly the way the SDI inputs do.
+ *
+ * Audio tracks are decoded and resampled to 48KHz S32P stereo, track N lands in sdi_audio_pair N,
+ * and the pipeline sees one 16 channel PCM buffer per video frame (SDI cadence).
+ * With lavf_input.ac3_passthrough, AC-3 tracks are instead wrapped into SMPTE 337 bursts
+ * so the existing AC3 bitstream encoder passes them to the mux untouched.
+ *
+ * Source PTS is unwrapped (33 bits) and rebased onto the 27MHz OBE clock. File sources default to
+ * free-run: timestamps are synthesized from the frame rate, output is paced against CLOCK_MONOTONIC
+ * and the file loops at EOF, so a single box can run many channels without any capture hardware.
+ *
+ * Each audio track keeps the source time of the first sample it has queued. Samples are taken
+ * out against the source time of the video frame they ship with, padding with silence or dropping
+ * samples when the two disagree, so start offsets and gaps in the source survive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+
+#include "common/common.h"
+#include "input/input.h"
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+
+#define MODULE_PREFIX "[lavf]: "
+
+#define LAVF_MAX_AUDIO_TRACKS (MAX_CHANNELS / 2)
+#define LAVF_AUDIO_RATE 48000
+#define LAVF_AC3_BURST_SAMPLES 1536
+#define LAVF_AUDIO_SYNC_SLACK (OBE_CLOCK / 500) /* 2ms, above timestamp rounding, well inside lip sync */
+#define LAVF_AUDIO_MAX_QUEUED (LAVF_AUDIO_RATE * 2)
+
+/* -1 = auto (files free-run, network sources follow the source clock), 0 = off, 1 = on */
+int g_lavf_input_freerun = -1;
+/* Decoder threads for the video decoder, 0 = one per cpu. */
+int g_lavf_input_decode_threads = 0;
+/* Wrap AC-3 tracks into SMPTE 337 for the AC3 bitstream encoder, instead of decoding them. */
+int g_lavf_input_ac3_passthrough = 0;
+
+struct lavf_video_format_s
+{
+	int obe_name;
+	int width, height;
+	int timebase_num, timebase_den;
+	int interlaced;
+};
+
+static const struct lavf_video_format_s video_format_tab[] =
+{
+	{ INPUT_VIDEO_FORMAT_PAL,         720,  576, 1,    25,    1 },
+	{ INPUT_VIDEO_FORMAT_NTSC,        720,  480, 1001, 30000, 1 },
+	{ INPUT_VIDEO_FORMAT_NTSC,        720,  486, 1001, 30000, 1 },
+	{ INPUT_VIDEO_FORMAT_720P_50,     1280, 720, 1,    50,    0 },
+	{ INPUT_VIDEO_FORMAT_720P_5994,   1280, 720, 1001, 60000, 0 },
+	{ INPUT_VIDEO_FORMAT_720P_60,     1280, 720, 1,    60,    0 },
+	{ INPUT_VIDEO_FORMAT_1080I_50,    1920, 1080, 1,    25,    1 },
+	{ INPUT_VIDEO_FORMAT_1080I_5994,  1920, 1080, 1001, 30000, 1 },
+	{ INPUT_VIDEO_FORMAT_1080I_60,    1920, 1080, 1,    30,    1 },
+	{ INPUT_VIDEO_FORMAT_1080P_2398,  1920, 1080, 1001, 24000, 0 },
+	{ INPUT_VIDEO_FORMAT_1080P_24,    1920, 1080, 1,    24,    0 },
+	{ INPUT_VIDEO_FORMAT_1080P_25,    1920, 1080, 1,    25,    0 },
+	{ INPUT_VIDEO_FORMAT_1080P_2997,  1920, 1080, 1001, 30000, 0 },
+	{ INPUT_VIDEO_FORMAT_1080P_30,    1920, 1080, 1,    30,    0 },
+	{ INPUT_VIDEO_FORMAT_1080P_50,    1920, 1080, 1,    50,    0 },
+	{ INPUT_VIDEO_FORMAT_1080P_5994,  1920, 1080, 1001, 60000, 0 },
+	{ INPUT_VIDEO_FORMAT_1080P_60,    1920, 1080, 1,    60,    0 },
+	{ INPUT_VIDEO_FORMAT_2160P_25,    3840, 2160, 1,    25,    0 },
+	{ INPUT_VIDEO_FORMAT_2160P_2997,  3840, 2160, 1001, 30000, 0 },
+	{ INPUT_VIDEO_FORMAT_2160P_30,    3840, 2160, 1,    30,    0 },
+	{ INPUT_VIDEO_FORMAT_2160P_50,    3840, 2160, 1,    50,    0 },
+	{ INPUT_VIDEO_FORMAT_2160P_5994,  3840, 2160, 1001, 60000, 0 },
+	{ INPUT_VIDEO_FORMAT_2160P_60,    3840, 2160, 1,    60,    0 },
+};
+
+struct lavf_audio_track_s
+{
+	int stream_idx;
+	int input_stream_id;
+	int sdi_audio_pair;
+	int passthrough;
+
+	AVCodecContext *codec;
+	SwrContext *avr;
+	AVAudioFifo *fifo;  /* S32P stereo when decoding, S32 interleaved 337 bursts in passthrough */
+	uint8_t *conv[2];
+	int conv_samples;
+
+	/* Source time (27MHz) of the first queued sample is head_pts plus head_samples read since.
+	 * Counting samples rather than adding ticks keeps it exact over long runs.
+	 */
+	int have_pts;
+	int64_t head_pts;
+	int64_t head_samples;
+};
+
+struct lavf_ctx_s
+{
+	obe_t *h;
+	obe_device_t *device;
+	char *location;
+
+	AVFormatContext *fmt;
+	pthread_t threadId;
+	int threadRunning;
+	volatile int terminate;
+
+	/* Video */
+	int video_idx;
+	int video_input_stream_id;
+	AVCodecContext *vcodec;
+	struct SwsContext *sws;
+	enum AVPixelFormat out_csp;
+	int width, height;
+	int timebase_num, timebase_den;
+	int interlaced, tff;
+	int sar_num, sar_den;
+	int video_format;
+
+	/* Audio */
+	int num_tracks;
+	struct lavf_audio_track_s tracks[LAVF_MAX_AUDIO_TRACKS];
+	int pcm_input_stream_id;
+
+	/* Clock */
+	int freerun;
+	uint64_t frame_count;
+	int64_t frame_duration;   /* 27MHz */
+	int64_t source_time;      /* 27MHz, unwrapped source time of the last video frame */
+	int64_t pts_offset;       /* 27MHz, source to OBE */
+	int64_t last_pts;         /* 27MHz, last pts delivered */
+	int have_source_pts;
+	struct timespec freerun_start;
+};
+
+static int lookupOBEName(int w, int h, int num, int den, int interlaced)
+{
+	for (unsigned int i = 0; i < sizeof(video_format_tab) / sizeof(video_format_tab[0]); i++) {
+		const struct lavf_video_format_s *fmt = &video_format_tab[i];
+		if (fmt->width == w && fmt->height == h && fmt->timebase_num == num &&
+			fmt->timebase_den == den && fmt->interlaced == interlaced)
+			return fmt->obe_name;
+	}
+
+	return INPUT_VIDEO_FORMAT_UNDEFINED;
+}
+
+static int _is_file_source(const char *location)
+{
+	return strstr(location, "://") == NULL || strncmp(location, "file:", 5) == 0;
+}
+
+/* The video filter and encoders natively handle these, anything else is converted to 4:2:2 10bit. */
+static int _csp_is_native(enum AVPixelFormat csp)
+{
+	return csp == AV_PIX_FMT_YUV420P || csp == AV_PIX_FMT_YUV422P10;
+}
+
+static int _interrupt_cb(void *p)
+{
+	struct lavf_ctx_s *ctx = p;
+	return ctx->terminate;
+}
+
+static void _close_codecs(struct lavf_ctx_s *ctx)
+{
+	if (ctx->vcodec)
+		avcodec_free_context(&ctx->vcodec);
+	if (ctx->sws) {
+		sws_freeContext(ctx->sws);
+		ctx->sws = NULL;
+	}
+
+	for (int i = 0; i < ctx->num_tracks; i++) {
+		struct lavf_audio_track_s *t = &ctx->tracks[i];
+		if (t->codec)
+			avcodec_free_context(&t->codec);
+		if (t->avr)
+			swr_free(&t->avr);
+		if (t->fifo) {
+			av_audio_fifo_free(t->fifo);
+			t->fifo = NULL;
+		}
+		av_freep(&t->conv[0]);
+	}
+
+	if (ctx->fmt)
+		avformat_close_input(&ctx->fmt);
+}
+
+static AVCodecContext *_open_decoder(AVStream *st, int threads)
+{
+	const AVCodec *dec = avcodec_find_decoder(st->codecpar->codec_id);
+	if (!dec) {
+		fprintf(stderr, MODULE_PREFIX "No decoder for stream #%d\n", st->index);
+		return NULL;
+	}
+
+	AVCodecContext *c = avcodec_alloc_context3(dec);
+	if (!c)
+		return NULL;
+
+	if (avcodec_parameters_to_context(c, st->codecpar) < 0) {
+		avcodec_free_context(&c);
+		return NULL;
+	}
+
+	c->pkt_timebase = st->time_base;
+	if (threads >= 0) {
+		/* Frame threading trades a few frames of latency for a decoder that scales across cores. */
+		c->thread_count = threads;
+		c->thread_type = FF_THREAD_FRAME;
+	}
+
+	if (avcodec_open2(c, dec, NULL) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Could not open decoder for stream #%d\n", st->index);
+		avcodec_free_context(&c);
+		return NULL;
+	}
+
+	return c;
+}
+
+static int _open_source(struct lavf_ctx_s *ctx)
+{
+	AVDictionary *options = NULL;
+
+	if (strncmp(ctx->location, "udp://", 6) == 0 || strncmp(ctx->location, "rtp://", 6) == 0) {
+		/* Keep going if the kernel socket buffer overruns, a dropped datagram beats a dead channel. */
+		av_dict_set(&options, "overrun_nonfatal", "1", 0);
+		av_dict_set(&options, "fifo_size", "1000000", 0);
+		av_dict_set(&options, "buffer_size", "8388608", 0);
+	}
+
+	ctx->fmt = avformat_alloc_context();
+	if (!ctx->fmt) {
+		av_dict_free(&options);
+		return -1;
+	}
+	ctx->fmt->interrupt_callback.callback = _interrupt_cb;
+	ctx->fmt->interrupt_callback.opaque = ctx;
+
+	int ret = avformat_open_input(&ctx->fmt, ctx->location, NULL, &options);
+	av_dict_free(&options);
+	if (ret < 0) {
+		fprintf(stderr, MODULE_PREFIX "Could not open '%s'\n", ctx->location);
+		return -1;
+	}
+
+	if (avformat_find_stream_info(ctx->fmt, NULL) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Could not find stream info for '%s'\n", ctx->location);
+		return -1;
+	}
+
+	ctx->video_idx = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (ctx->video_idx < 0) {
+		fprintf(stderr, MODULE_PREFIX "No video stream found in '%s'\n", ctx->location);
+		return -1;
+	}
+
+	AVStream *vst = ctx->fmt->streams[ctx->video_idx];
+	AVRational fr = av_guess_frame_rate(ctx->fmt, vst, NULL);
+	if (fr.num <= 0 || fr.den <= 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to determine the video frame rate\n");
+		return -1;
+	}
+
+	ctx->width = vst->codecpar->width;
+	ctx->height = vst->codecpar->height;
+	ctx->interlaced = vst->codecpar->field_order != AV_FIELD_PROGRESSIVE &&
+		vst->codecpar->field_order != AV_FIELD_UNKNOWN;
+	ctx->tff = vst->codecpar->field_order == AV_FIELD_TT || vst->codecpar->field_order == AV_FIELD_TB;
+	ctx->timebase_num = fr.den;
+	ctx->timebase_den = fr.num;
+
+	AVRational sar = av_guess_sample_aspect_ratio(ctx->fmt, vst, NULL);
+	ctx->sar_num = sar.num > 0 ? sar.num : 1;
+	ctx->sar_den = sar.den > 0 ? sar.den : 1;
+
+	ctx->video_format = lookupOBEName(ctx->width, ctx->height, ctx->timebase_num, ctx->timebase_den, ctx->interlaced);
+	ctx->frame_duration = av_rescale(OBE_CLOCK, ctx->timebase_num, ctx->timebase_den);
+	ctx->out_csp = _csp_is_native(vst->codecpar->format) ? vst->codecpar->format : AV_PIX_FMT_YUV422P10;
+
+	ctx->num_tracks = 0;
+	for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
+		AVStream *st = ctx->fmt->streams[i];
+		if (st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+			continue;
+		if (ctx->num_tracks == LAVF_MAX_AUDIO_TRACKS) {
+			fprintf(stderr, MODULE_PREFIX "Ignoring audio stream #%d, maximum of %d tracks\n",
+				i, LAVF_MAX_AUDIO_TRACKS);
+			continue;
+		}
+
+		struct lavf_audio_track_s *t = &ctx->tracks[ctx->num_tracks++];
+		t->stream_idx = i;
+		t->sdi_audio_pair = ctx->num_tracks;
+		t->passthrough = g_lavf_input_ac3_passthrough && st->codecpar->codec_id == AV_CODEC_ID_AC3;
+	}
+
+	printf(MODULE_PREFIX "'%s' %dx%d%c @ %d/%d, %d audio track(s), format %s\n",
+		ctx->location, ctx->width, ctx->height, ctx->interlaced ? 'i' : 'p',
+		ctx->timebase_den, ctx->timebase_num, ctx->num_tracks, ctx->fmt->iformat->name);
+
+	return 0;
+}
+
+static int _open_codecs(struct lavf_ctx_s *ctx)
+{
+	ctx->vcodec = _open_decoder(ctx->fmt->streams[ctx->video_idx], g_lavf_input_decode_threads);
+	if (!ctx->vcodec)
+		return -1;
+
+	for (int i = 0; i < ctx->num_tracks; i++) {
+		struct lavf_audio_track_s *t = &ctx->tracks[i];
+
+		if (t->passthrough) {
+			t->fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_S32, 2, LAVF_AC3_BURST_SAMPLES * 4);
+			if (!t->fifo)
+				return -1;
+			continue;
+		}
+
+		t->codec = _open_decoder(ctx->fmt->streams[t->stream_idx], -1);
+		if (!t->codec)
+			return -1;
+
+		t->fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_S32P, 2, LAVF_AUDIO_RATE / 10);
+		if (!t->fifo)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* 33 bit MPEG timestamps wrap every ~26.5 hours. Every stream is rescaled to 27MHz and unwrapped
+ * against the video, so all tracks share one monotonic source clock.
+ */
+static int64_t _source_time(struct lavf_ctx_s *ctx, AVStream *st, int64_t ts)
+{
+	int64_t t = av_rescale_q(ts, st->time_base, (AVRational){ 1, OBE_CLOCK });
+	if (st->pts_wrap_bits <= 0 || st->pts_wrap_bits >= 63 || !ctx->have_source_pts)
+		return t;
+
+	int64_t wrap = av_rescale_q(1LL << st->pts_wrap_bits, st->time_base, (AVRational){ 1, OBE_CLOCK });
+	while (t - ctx->source_time < -(wrap / 2))
+		t += wrap;
+	while (t - ctx->source_time > (wrap / 2))
+		t -= wrap;
+
+	return t;
+}
+
+static int64_t _video_pts(struct lavf_ctx_s *ctx, AVFrame *frame)
+{
+	AVStream *st = ctx->fmt->streams[ctx->video_idx];
+	int64_t ts = frame->best_effort_timestamp;
+
+	/* The audio tracks line up against the source time, free-run or not. */
+	if (ts == AV_NOPTS_VALUE)
+		ctx->source_time += ctx->frame_duration;
+	else
+		ctx->source_time = _source_time(ctx, st, ts);
+
+	if (ctx->freerun) {
+		if (ts != AV_NOPTS_VALUE)
+			ctx->have_source_pts = 1;
+		return ctx->frame_count * ctx->frame_duration;
+	}
+
+	if (ts == AV_NOPTS_VALUE)
+		return ctx->last_pts + ctx->frame_duration;
+
+	int64_t pts = ctx->source_time + ctx->pts_offset;
+
+	if (!ctx->have_source_pts) {
+		/* First frame, start the OBE clock at zero. */
+		ctx->pts_offset -= pts;
+		pts = 0;
+	} else {
+		/* Source discontinuity (splice, encoder restart), continue our clock seamlessly. */
+		int64_t expected = ctx->last_pts + ctx->frame_duration;
+		if (llabs(pts - expected) > OBE_CLOCK) {
+			fprintf(stderr, MODULE_PREFIX "Timestamp discontinuity of %" PRIi64 " ticks, rebasing\n",
+				pts - expected);
+			ctx->pts_offset += expected - pts;
+			pts = expected;
+		}
+	}
+
+	ctx->have_source_pts = 1;
+
+	return pts;
+}
+
+static void _freerun_wait(struct lavf_ctx_s *ctx, int64_t pts)
+{
+	int64_t ns = av_rescale(pts, 1000000000, OBE_CLOCK);
+	struct timespec ts = ctx->freerun_start;
+
+	ts.tv_sec += ns / 1000000000;
+	ts.tv_nsec += ns % 1000000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !ctx->terminate)
+		;
+}
+
+static void _release_video_frame(void *ptr)
+{
+	obe_raw_frame_t *raw_frame = ptr;
+	AVFrame *frame = raw_frame->opaque;
+
+	av_frame_free(&frame);
+	raw_frame->opaque = NULL;
+
+	/* The video filter may swap in its own image after releasing ours, that one is av_malloc'd. */
+	memset(&raw_frame->alloc_img.plane, 0, sizeof(raw_frame->alloc_img.plane));
+	raw_frame->release_data = obe_release_video_data;
+}
+
+static void _set_avfm(struct lavf_ctx_s *ctx, obe_raw_frame_t *raw_frame, enum avfm_frame_type_e type, int64_t pts)
+{
+	avfm_init(&raw_frame->avfm, type);
+	avfm_set_hw_status_mask(&raw_frame->avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_FULL);
+
+	/* Like the SDI inputs, audio and video share the frame clock. */
+	avfm_set_pts_video(&raw_frame->avfm, pts);
+	avfm_set_pts_audio(&raw_frame->avfm, pts);
+	avfm_set_hw_received_time(&raw_frame->avfm);
+	avfm_set_video_interval_clk(&raw_frame->avfm, ctx->frame_duration);
+}
+
+/* One video frame worth of audio, following the SDI 48KHz cadence (1602/1601 at 29.97 etc). */
+static int _audio_samples_for_frame(struct lavf_ctx_s *ctx, uint64_t frame)
+{
+	int64_t n = (int64_t)LAVF_AUDIO_RATE * ctx->timebase_num;
+	return av_rescale(frame + 1, n, ctx->timebase_den) - av_rescale(frame, n, ctx->timebase_den);
+}
+
+static int64_t _samples_to_ticks(int64_t samples)
+{
+	return av_rescale(samples, OBE_CLOCK, LAVF_AUDIO_RATE);
+}
+
+static int64_t _ticks_to_samples(int64_t ticks)
+{
+	return av_rescale(ticks, LAVF_AUDIO_RATE, OBE_CLOCK);
+}
+
+static int64_t _track_head(struct lavf_audio_track_s *t)
+{
+	return t->head_pts + _samples_to_ticks(t->head_samples);
+}
+
+static void _track_reset(struct lavf_audio_track_s *t, int64_t pts)
+{
+	av_audio_fifo_reset(t->fifo);
+	t->head_pts = pts;
+	t->head_samples = 0;
+}
+
+static void _track_consume(struct lavf_audio_track_s *t, int samples)
+{
+	av_audio_fifo_drain(t->fifo, samples);
+	t->head_samples += samples;
+}
+
+static void _track_write_silence(struct lavf_audio_track_s *t, int samples)
+{
+	enum AVSampleFormat fmt = t->passthrough ? AV_SAMPLE_FMT_S32 : AV_SAMPLE_FMT_S32P;
+	uint8_t *silence[2] = { NULL, NULL };
+
+	if (samples <= 0 || av_samples_alloc(silence, NULL, 2, samples, fmt, 0) < 0)
+		return;
+	av_samples_set_silence(silence, 0, samples, 2, fmt);
+	av_audio_fifo_write(t->fifo, (void **)silence, samples);
+	av_freep(&silence[0]);
+}
+
+/* Queue samples, pts is the source time of the first one or AV_NOPTS_VALUE when the source has none.
+ * A gap up to a second is filled with silence, anything else out of line restarts the queue there.
+ */
+static void _track_write(struct lavf_audio_track_s *t, void **data, int samples, int64_t pts)
+{
+	if (pts != AV_NOPTS_VALUE) {
+		int queued = av_audio_fifo_size(t->fifo);
+		int64_t gap = pts - (_track_head(t) + _samples_to_ticks(queued));
+
+		if (!t->have_pts || !queued)
+			_track_reset(t, pts);
+		else if (gap > LAVF_AUDIO_SYNC_SLACK && gap < OBE_CLOCK)
+			_track_write_silence(t, _ticks_to_samples(gap));
+		else if (llabs(gap) > LAVF_AUDIO_SYNC_SLACK) {
+			fprintf(stderr, MODULE_PREFIX "Audio track %d timestamps jumped %" PRIi64 " ticks, resyncing\n",
+				t->sdi_audio_pair, gap);
+			_track_reset(t, pts);
+		}
+		t->have_pts = 1;
+	}
+
+	av_audio_fifo_write(t->fifo, data, samples);
+}
+
+/* Fill samples at dst (already silent) with the track's audio for the current video frame.
+ * With timestamps on both sides, the front of the queue is dropped or the output starts with
+ * silence until the track's source time matches the video's. Without, the track is simply kept
+ * from running more than max_queued samples ahead.
+ */
+static void _track_read(struct lavf_ctx_s *ctx, struct lavf_audio_track_s *t, uint8_t **dst,
+	int samples, int max_queued)
+{
+	int pad = 0;
+
+	if (t->have_pts && ctx->have_source_pts) {
+		int64_t diff = _track_head(t) - ctx->source_time;
+		int queued = av_audio_fifo_size(t->fifo);
+
+		if (diff < -LAVF_AUDIO_SYNC_SLACK) {
+			int64_t late = _ticks_to_samples(-diff);
+			_track_consume(t, late < queued ? late : queued);
+		} else if (diff > LAVF_AUDIO_SYNC_SLACK) {
+			int64_t early = _ticks_to_samples(diff);
+			pad = early < samples ? early : samples;
+		}
+		max_queued = LAVF_AUDIO_MAX_QUEUED;
+	}
+
+	int excess = av_audio_fifo_size(t->fifo) - max_queued;
+	if (excess > 0)
+		_track_consume(t, excess);
+
+	int bytes_per_sample = t->passthrough ? 2 * sizeof(int32_t) : sizeof(int32_t);
+	uint8_t *planes[2] = { dst[0] + pad * bytes_per_sample, t->passthrough ? NULL : dst[1] + pad * bytes_per_sample };
+	int n = av_audio_fifo_read(t->fifo, (void **)planes, samples - pad);
+	if (n > 0)
+		t->head_samples += n;
+}
+
+static void _deliver_audio(struct lavf_ctx_s *ctx, int64_t pts)
+{
+	int num_samples = _audio_samples_for_frame(ctx, ctx->frame_count);
+	obe_raw_frame_t *raw_frame = NULL;
+
+	/* Decoded tracks share a single 16 channel frame, the audio filter splits out the pairs. */
+	for (int i = 0; i < ctx->num_tracks; i++) {
+		struct lavf_audio_track_s *t = &ctx->tracks[i];
+		if (t->passthrough)
+			continue;
+
+		if (!raw_frame) {
+			raw_frame = new_raw_frame();
+			if (!raw_frame)
+				return;
+
+			raw_frame->audio_frame.num_samples = num_samples;
+			raw_frame->audio_frame.num_channels = MAX_CHANNELS;
+			raw_frame->audio_frame.channel_layout = 0;
+			raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
+			if (av_samples_alloc(raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize,
+				MAX_CHANNELS, num_samples, AV_SAMPLE_FMT_S32P, 0) < 0) {
+				free(raw_frame);
+				return;
+			}
+			av_samples_set_silence(raw_frame->audio_frame.audio_data, 0, num_samples, MAX_CHANNELS,
+				AV_SAMPLE_FMT_S32P);
+		}
+
+		int ch = (t->sdi_audio_pair - 1) * 2;
+		_track_read(ctx, t, &raw_frame->audio_frame.audio_data[ch], num_samples, num_samples * 4);
+	}
+
+	if (raw_frame) {
+		raw_frame->pts = pts;
+		raw_frame->input_stream_id = ctx->pcm_input_stream_id;
+		raw_frame->release_data = obe_release_audio_data;
+		raw_frame->release_frame = obe_release_frame;
+		_set_avfm(ctx, raw_frame, AVFM_AUDIO_PCM, pts);
+		if (add_to_filter_queue(ctx->h, raw_frame) < 0) {
+			raw_frame->release_data(raw_frame);
+			raw_frame->release_frame(raw_frame);
+		}
+	}
+
+	/* SMPTE 337 tracks, each gets its own buffer holding just the interleaved pair, as decklink does. */
+	for (int i = 0; i < ctx->num_tracks; i++) {
+		struct lavf_audio_track_s *t = &ctx->tracks[i];
+		if (!t->passthrough)
+			continue;
+
+		raw_frame = new_raw_frame();
+		if (!raw_frame)
+			return;
+
+		int stride = 2 * sizeof(int32_t);
+		uint8_t *buf = av_mallocz(num_samples * stride);
+		if (!buf) {
+			free(raw_frame);
+			return;
+		}
+
+		_track_read(ctx, t, &buf, num_samples, LAVF_AC3_BURST_SAMPLES * 3);
+
+		raw_frame->audio_frame.audio_data[0] = buf;
+		raw_frame->audio_frame.num_samples = num_samples;
+		raw_frame->audio_frame.num_channels = 2;
+		raw_frame->audio_frame.linesize = stride;
+		raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE;
+		raw_frame->pts = pts;
+		raw_frame->input_stream_id = t->input_stream_id;
+		raw_frame->release_data = obe_release_audio_data;
+		raw_frame->release_frame = obe_release_frame;
+		_set_avfm(ctx, raw_frame, AVFM_AUDIO_A52, pts);
+		if (add_to_filter_queue(ctx->h, raw_frame) < 0) {
+			raw_frame->release_data(raw_frame);
+			raw_frame->release_frame(raw_frame);
+		}
+	}
+}
+
+static int _deliver_video(struct lavf_ctx_s *ctx, AVFrame *frame)
+{
+	int64_t pts = _video_pts(ctx, frame);
+
+	if (ctx->freerun)
+		_freerun_wait(ctx, pts);
+
+	obe_raw_frame_t *raw_frame = new_raw_frame();
+	if (!raw_frame) {
+		fprintf(stderr, MODULE_PREFIX "Could not allocate raw video frame\n");
+		return -1;
+	}
+
+	obe_image_t *img = &raw_frame->alloc_img;
+	if (frame->format == ctx->out_csp && frame->width == ctx->width && frame->height == ctx->height) {
+		/* Zero copy, the raw frame holds a reference on the decoders buffer until the encoder is done. */
+		AVFrame *ref = av_frame_clone(frame);
+		if (!ref) {
+			free(raw_frame);
+			return -1;
+		}
+		for (int i = 0; i < 4; i++) {
+			img->plane[i] = ref->data[i];
+			img->stride[i] = ref->linesize[i];
+		}
+		raw_frame->opaque = ref;
+		raw_frame->release_data = _release_video_frame;
+	} else {
+		ctx->sws = sws_getCachedContext(ctx->sws, frame->width, frame->height, frame->format,
+			ctx->width, ctx->height, ctx->out_csp, SWS_BICUBIC, NULL, NULL, NULL);
+		if (!ctx->sws ||
+			av_image_alloc(img->plane, img->stride, ctx->width, ctx->height + 1, ctx->out_csp, 32) < 0) {
+			free(raw_frame);
+			return -1;
+		}
+		sws_scale(ctx->sws, (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height,
+			img->plane, img->stride);
+		raw_frame->release_data = obe_release_video_data;
+	}
+	raw_frame->release_frame = obe_release_frame;
+
+	img->csp = ctx->out_csp;
+	img->planes = av_pix_fmt_desc_get(ctx->out_csp)->nb_components;
+	img->width = ctx->width;
+	img->height = ctx->height;
+	img->format = ctx->video_format;
+	memcpy(&raw_frame->img, img, sizeof(*img));
+
+	raw_frame->timebase_num = ctx->timebase_num;
+	raw_frame->timebase_den = ctx->timebase_den;
+	raw_frame->sar_width = ctx->sar_num;
+	raw_frame->sar_height = ctx->sar_den;
+	raw_frame->input_stream_id = ctx->video_input_stream_id;
+	raw_frame->pts = pts;
+
+	obe_clock_tick(ctx->h, pts);
+	_set_avfm(ctx, raw_frame, AVFM_VIDEO, pts);
+
+	if (add_to_filter_queue(ctx->h, raw_frame) < 0) {
+		raw_frame->release_data(raw_frame);
+		raw_frame->release_frame(raw_frame);
+		return -1;
+	}
+
+	_deliver_audio(ctx, pts);
+
+	ctx->last_pts = pts;
+	ctx->frame_count++;
+
+	return 0;
+}
+
+static int _decode_video(struct lavf_ctx_s *ctx, AVPacket *pkt, AVFrame *frame)
+{
+	int ret = avcodec_send_packet(ctx->vcodec, pkt);
+	if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+		return 0; /* Corrupt packet, keep going */
+
+	while (!ctx->terminate) {
+		ret = avcodec_receive_frame(ctx->vcodec, frame);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			break;
+		if (ret < 0)
+			return ret;
+
+		ret = _deliver_video(ctx, frame);
+		av_frame_unref(frame);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void _decode_audio(struct lavf_ctx_s *ctx, struct lavf_audio_track_s *t, AVPacket *pkt, AVFrame *frame)
+{
+	if (avcodec_send_packet(t->codec, pkt) < 0)
+		return;
+
+	while (avcodec_receive_frame(t->codec, frame) == 0) {
+		if (!t->avr) {
+			uint64_t layout = frame->channel_layout ? frame->channel_layout :
+				av_get_default_channel_layout(frame->channels);
+
+			t->avr = swr_alloc();
+			if (!t->avr)
+				break;
+			av_opt_set_int(t->avr, "in_channel_layout", layout, 0);
+			av_opt_set_int(t->avr, "in_sample_rate", frame->sample_rate, 0);
+			av_opt_set_sample_fmt(t->avr, "in_sample_fmt", frame->format, 0);
+			av_opt_set_int(t->avr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+			av_opt_set_int(t->avr, "out_sample_rate", LAVF_AUDIO_RATE, 0);
+			av_opt_set_sample_fmt(t->avr, "out_sample_fmt", AV_SAMPLE_FMT_S32P, 0);
+			if (swr_init(t->avr) < 0) {
+				fprintf(stderr, MODULE_PREFIX "Could not configure the resampler\n");
+				swr_free(&t->avr);
+				break;
+			}
+		}
+
+		int n = swr_get_out_samples(t->avr, frame->nb_samples);
+		if (n > t->conv_samples) {
+			av_freep(&t->conv[0]);
+			if (av_samples_alloc(t->conv, NULL, 2, n, AV_SAMPLE_FMT_S32P, 0) < 0) {
+				t->conv_samples = 0;
+				break;
+			}
+			t->conv_samples = n;
+		}
+
+		/* What comes out first is whatever the resampler was still holding from the last frame. */
+		int64_t pts = AV_NOPTS_VALUE;
+		if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+			pts = _source_time(ctx, ctx->fmt->streams[t->stream_idx], frame->best_effort_timestamp) -
+				swr_get_delay(t->avr, OBE_CLOCK);
+
+		n = swr_convert(t->avr, t->conv, t->conv_samples, (const uint8_t **)frame->extended_data, frame->nb_samples);
+		if (n > 0)
+			_track_write(t, (void **)t->conv, n, pts);
+
+		av_frame_unref(frame);
+	}
+}
+
+/* SMPTE 337 burst, 16bit data mode, repeated every 1536 samples for AC-3.
+ * Words are left justified in the 32bit sample, the same layout decklink hands us.
+ */
+static void _pack_smpte337(struct lavf_ctx_s *ctx, struct lavf_audio_track_s *t, AVPacket *pkt)
+{
+	int32_t burst[LAVF_AC3_BURST_SAMPLES * 2] = { 0 };
+	int max_bytes = (sizeof(burst) / sizeof(burst[0]) - 4) * 2;
+
+	if (pkt->size > max_bytes)
+		return;
+
+	burst[0] = (int32_t)(0xf872u << 16);
+	burst[1] = (int32_t)(0x4e1fu << 16);
+	burst[2] = (int32_t)(0x0001u << 16); /* AC-3, data stream 0 */
+	burst[3] = (int32_t)((uint32_t)(pkt->size * 8) << 16);
+
+	for (int i = 0; i < pkt->size; i += 2) {
+		uint32_t w = pkt->data[i] << 8;
+		if (i + 1 < pkt->size)
+			w |= pkt->data[i + 1];
+		burst[4 + (i / 2)] = (int32_t)(w << 16);
+	}
+
+	int64_t pts = AV_NOPTS_VALUE;
+	if (pkt->pts != AV_NOPTS_VALUE)
+		pts = _source_time(ctx, ctx->fmt->streams[t->stream_idx], pkt->pts);
+
+	void *planes[1] = { burst };
+	_track_write(t, planes, LAVF_AC3_BURST_SAMPLES, pts);
+}
+
+static int _rewind(struct lavf_ctx_s *ctx)
+{
+	if (av_seek_frame(ctx->fmt, -1, ctx->fmt->start_time != AV_NOPTS_VALUE ? ctx->fmt->start_time : 0,
+		AVSEEK_FLAG_BACKWARD) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to loop '%s'\n", ctx->location);
+		return -1;
+	}
+
+	/* The source clock starts over, so does every track's queue. */
+	avcodec_flush_buffers(ctx->vcodec);
+	for (int i = 0; i < ctx->num_tracks; i++) {
+		struct lavf_audio_track_s *t = &ctx->tracks[i];
+		if (t->codec)
+			avcodec_flush_buffers(t->codec);
+		_track_reset(t, 0);
+		t->have_pts = 0;
+	}
+
+	return 0;
+}
+
+static void *lavf_thread_func(void *p)
+{
+	struct lavf_ctx_s *ctx = p;
+
+	printf(MODULE_PREFIX "Demux thread starts, %s mode\n", ctx->freerun ? "free-run" : "source clock");
+
+	AVPacket *pkt = av_packet_alloc();
+	AVFrame *frame = av_frame_alloc();
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx->freerun_start);
+
+	while (!ctx->terminate && pkt && frame) {
+		int ret = av_read_frame(ctx->fmt, pkt);
+		if (ret == AVERROR(EAGAIN)) {
+			usleep(1000);
+			continue;
+		}
+		if (ret == AVERROR_EOF) {
+			if (ctx->freerun && _rewind(ctx) == 0)
+				continue;
+
+			/* Flush the last few frames out of the threaded decoder. */
+			_decode_video(ctx, NULL, frame);
+			printf(MODULE_PREFIX "End of input '%s'\n", ctx->location);
+			break;
+		}
+		if (ret < 0) {
+			fprintf(stderr, MODULE_PREFIX "Read error %d on '%s'\n", ret, ctx->location);
+			break;
+		}
+
+		if (pkt->stream_index == ctx->video_idx) {
+			if (_decode_video(ctx, pkt, frame) < 0) {
+				av_packet_unref(pkt);
+				break;
+			}
+		} else {
+			for (int i = 0; i < ctx->num_tracks; i++) {
+				struct lavf_audio_track_s *t = &ctx->tracks[i];
+				if (t->stream_idx != pkt->stream_index)
+					continue;
+				if (t->passthrough)
+					_pack_smpte337(ctx, t, pkt);
+				else
+					_decode_audio(ctx, t, pkt, frame);
+			}
+		}
+
+		av_packet_unref(pkt);
+	}
+
+	av_frame_free(&frame);
+	av_packet_free(&pkt);
+
+	printf(MODULE_PREFIX "Demux thread complete\n");
+
+	return NULL;
+}
+
+static struct lavf_ctx_s *_ctx_alloc(obe_t *h, obe_input_t *user_opts)
+{
+	if (!user_opts->location) {
+		fprintf(stderr, MODULE_PREFIX "No location specified\n");
+		return NULL;
+	}
+
+	struct lavf_ctx_s *ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->h = h;
+	ctx->location = strdup(user_opts->location);
+	ctx->freerun = g_lavf_input_freerun < 0 ? _is_file_source(ctx->location) : g_lavf_input_freerun;
+	ctx->pcm_input_stream_id = -1;
+
+	avformat_network_init();
+
+	return ctx;
+}
+
+static void _ctx_free(struct lavf_ctx_s *ctx)
+{
+	_close_codecs(ctx);
+	free(ctx->location);
+	free(ctx);
+}
+
+/* Called from open_input() */
+static void close_thread(void *handle)
+{
+	struct lavf_ctx_s *ctx = handle;
+	if (!ctx)
+		return;
+
+	printf(MODULE_PREFIX "%s()\n", __func__);
+
+	if (ctx->threadRunning) {
+		ctx->terminate = 1;
+		pthread_join(ctx->threadId, NULL);
+		ctx->threadRunning = 0;
+	}
+
+	_ctx_free(ctx);
+}
+
+static void *lavf_probe_stream(void *ptr)
+{
+	obe_input_probe_t *probe_ctx = (obe_input_probe_t *)ptr;
+	obe_t *h = probe_ctx->h;
+	obe_input_t *user_opts = &probe_ctx->user_opts;
+	obe_int_input_stream_t *streams[MAX_STREAMS];
+	obe_device_t *device;
+	int num_streams = 0;
+
+	printf(MODULE_PREFIX "%s()\n", __func__);
+
+	struct lavf_ctx_s *ctx = _ctx_alloc(h, user_opts);
+	if (!ctx)
+		goto finish;
+
+	if (_open_source(ctx) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Probe failed for '%s'\n", user_opts->location);
+		goto finish;
+	}
+
+	for (int i = 0; i < 1 + ctx->num_tracks; i++) {
+		streams[i] = calloc(1, sizeof(*streams[i]));
+		if (!streams[i])
+			goto finish;
+		num_streams++;
+
+		pthread_mutex_lock(&h->device_list_mutex);
+		streams[i]->input_stream_id = h->cur_input_stream_id++;
+		pthread_mutex_unlock(&h->device_list_mutex);
+
+		if (i == 0) {
+			AVStream *st = ctx->fmt->streams[ctx->video_idx];
+			streams[i]->lavf_stream_idx = ctx->video_idx;
+			streams[i]->pid = st->id;
+			streams[i]->stream_type = STREAM_TYPE_VIDEO;
+			streams[i]->stream_format = VIDEO_UNCOMPRESSED;
+			streams[i]->width = ctx->width;
+			streams[i]->height = ctx->height;
+			streams[i]->timebase_num = ctx->timebase_num;
+			streams[i]->timebase_den = ctx->timebase_den;
+			streams[i]->csp = ctx->out_csp;
+			streams[i]->interlaced = ctx->interlaced;
+			streams[i]->tff = ctx->tff;
+			streams[i]->sar_num = ctx->sar_num;
+			streams[i]->sar_den = ctx->sar_den;
+		} else {
+			struct lavf_audio_track_s *t = &ctx->tracks[i - 1];
+			AVStream *st = ctx->fmt->streams[t->stream_idx];
+			AVDictionaryEntry *lang = av_dict_get(st->metadata, "language", NULL, 0);
+
+			streams[i]->lavf_stream_idx = t->stream_idx;
+			streams[i]->pid = st->id;
+			streams[i]->stream_type = STREAM_TYPE_AUDIO;
+			streams[i]->stream_format = t->passthrough ? AUDIO_AC_3_BITSTREAM : AUDIO_PCM;
+			streams[i]->num_channels = 2;
+			streams[i]->channel_layout = AV_CH_LAYOUT_STEREO;
+			streams[i]->sample_format = AV_SAMPLE_FMT_S32P;
+			streams[i]->sample_rate = LAVF_AUDIO_RATE;
+			streams[i]->sdi_audio_pair = t->sdi_audio_pair;
+			if (lang)
+				snprintf(streams[i]->lang_code, sizeof(streams[i]->lang_code), "%s", lang->value);
+		}
+	}
+
+	device = new_device();
+	if (!device)
+		goto finish;
+
+	device->num_input_streams = num_streams;
+	memcpy(device->input_streams, streams, device->num_input_streams * sizeof(obe_int_input_stream_t**));
+	device->device_type = INPUT_URL;
+	memcpy(&device->user_opts, user_opts, sizeof(*user_opts));
+
+	add_device(h, device);
+
+finish:
+	if (ctx)
+		_ctx_free(ctx);
+
+	free(probe_ctx);
+
+	return NULL;
+}
+
+static void *lavf_open_input(void *ptr)
+{
+	obe_input_params_t *input = (obe_input_params_t *)ptr;
+	obe_t *h = input->h;
+	obe_device_t *device = input->device;
+
+	struct lavf_ctx_s *ctx = _ctx_alloc(h, &device->user_opts);
+	if (!ctx)
+		return NULL;
+
+	pthread_cleanup_push(close_thread, (void *)ctx);
+
+	ctx->device = device;
+
+	if (_open_source(ctx) < 0 || _open_codecs(ctx) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to open '%s'\n", ctx->location);
+		goto out;
+	}
+
+	/* Map the demuxed streams back onto the input stream ids assigned at probe time. */
+	for (int i = 0; i < device->num_input_streams; i++) {
+		obe_int_input_stream_t *s = device->input_streams[i];
+		if (s->stream_type == STREAM_TYPE_VIDEO)
+			ctx->video_input_stream_id = s->input_stream_id;
+		else if (s->stream_type == STREAM_TYPE_AUDIO) {
+			for (int j = 0; j < ctx->num_tracks; j++) {
+				if (ctx->tracks[j].stream_idx == s->lavf_stream_idx)
+					ctx->tracks[j].input_stream_id = s->input_stream_id;
+			}
+			if (ctx->pcm_input_stream_id < 0 && s->stream_format == AUDIO_PCM)
+				ctx->pcm_input_stream_id = s->input_stream_id;
+		}
+	}
+
+	if (pthread_create(&ctx->threadId, NULL, lavf_thread_func, ctx) < 0) {
+		fprintf(stderr, MODULE_PREFIX "Unable to create the demux thread\n");
+		goto out;
+	}
+	ctx->threadRunning = 1;
+	ltnpthread_setname_np(ctx->threadId, "obe-lavf-input");
+
+	sleep(INT_MAX);
+
+out:
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+
+const obe_input_func_t lavf_input = { lavf_probe_stream, lavf_open_input };
@@ -319,7 +319,7 @@ static void processFrameAudio(ndi_opts_t *opts, NDIlib_audio_frame_v2_t *frame)
 	rf->audio_frame.num_samples = out_samples;
 	rf->audio_frame.num_channels = 16;
 	rf->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
-	rf->input_stream_id = 1;
+	rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_AUDIO);
 
 	delete[] a_frame.p_data;
 
@@ -552,6 +552,8 @@ lastTimestamp = frame->timestamp;
 	//avfm_dump(&raw_frame->avfm);
 
 //printf("video pts %" PRIi64 "\n", pts);
+	rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_VIDEO);
+
 	if (add_to_filter_queue(ctx->h, rf) < 0 ) {
 	}
 }
@@ -48,7 +48,7 @@ static int parse_afd( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
                       uint16_t *line, int line_number, int len )
 {
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
 
     if( READ_8( line[0] ) != 8 )
     {
@@ -103,34 +103,19 @@ static int parse_afd( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
     if( check_active_non_display_data( raw_frame, USER_DATA_AFD ) )
         return 0;
 
-    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+2) * sizeof(*raw_frame->user_data) );
-    if( !tmp2 )
-        goto fail;
-
-    raw_frame->user_data = tmp2;
-    user_data = &raw_frame->user_data[raw_frame->num_user_data];
-    raw_frame->num_user_data += 2;
-
     /* Read AFD */
-    user_data->len = 1;
-    user_data->type = USER_DATA_AFD;
-    user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    user_data = obe_raw_frame_add_user_data( raw_frame, USER_DATA_AFD, VANC_GENERIC, 1 );
+    if( !user_data )
         goto fail;
 
     user_data->data[0] = READ_8( line[0] );
 
     /* Skip two reserved words */
     line += 2;
-    user_data++;
 
     /* Read Bar Data */
-    user_data->len = 5;
-    user_data->type = USER_DATA_BAR_DATA;
-    user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    user_data = obe_raw_frame_add_user_data( raw_frame, USER_DATA_BAR_DATA, VANC_GENERIC, 5 );
+    if( !user_data )
         goto fail;
 
     for( int i = 0; i < user_data->len; i++)
@@ -221,7 +206,7 @@ static int parse_cdp( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
                       uint16_t *line, int line_number, int len )
 {
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
 
     /* Skip DC word */
     line++;
@@ -255,17 +240,8 @@ static int parse_cdp( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
     if( check_active_non_display_data( raw_frame, USER_DATA_CEA_708_CDP ) )
         return 0;
 
-    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-    if( !tmp2 )
-        goto fail;
-
-    raw_frame->user_data = tmp2;
-    user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-    user_data->len = len;
-    user_data->type = USER_DATA_CEA_708_CDP;
-    user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    user_data = obe_raw_frame_add_user_data( raw_frame, USER_DATA_CEA_708_CDP, VANC_GENERIC, len );
+    if( !user_data )
         goto fail;
 
     for( int i = 0; i < user_data->len; i++ )
@@ -280,7 +256,7 @@ fail:
 
 int inject_708_cdp( obe_t *h, obe_raw_frame_t *raw_frame, uint8_t *cdp, int len)
 {
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
 
     /* Return if user didn't select CEA-708 */
     if( !check_user_selected_non_display_data( h, CAPTIONS_CEA_708, USER_DATA_LOCATION_FRAME ) )
@@ -290,17 +266,8 @@ int inject_708_cdp( obe_t *h, obe_raw_frame_t *raw_frame, uint8_t *cdp, int len)
     if( check_active_non_display_data( raw_frame, USER_DATA_CEA_708_CDP ) )
         return 0;
 
-    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-    if( !tmp2 )
-        goto fail;
-
-    raw_frame->user_data = tmp2;
-    user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-    user_data->len = len;
-    user_data->type = USER_DATA_CEA_708_CDP;
-    user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    user_data = obe_raw_frame_add_user_data( raw_frame, USER_DATA_CEA_708_CDP, VANC_GENERIC, len );
+    if( !user_data )
         goto fail;
 
     memcpy(user_data->data, cdp, len);
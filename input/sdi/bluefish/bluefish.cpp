@@ -427,6 +427,8 @@ static void *bluefish_videoThreadFunc(void *p)
 			//raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 			//avfm_dump(&raw_frame->avfm);
 
+			raw_frame->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_VIDEO);
+
 			if (add_to_filter_queue(ctx->h, raw_frame) < 0 ) {
 			}
 
@@ -447,7 +449,7 @@ static void *bluefish_videoThreadFunc(void *p)
 				aud_frame->audio_frame.num_channels = nAudioChannels;
 				aud_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
 				aud_frame->audio_frame.linesize = nAudioChannels * (16 /*bits */ / 8);
-				aud_frame->input_stream_id = 1;
+				aud_frame->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_AUDIO);
 
 				/* Allocate a new sample buffer ready to hold S32P */
 				if (av_samples_alloc(aud_frame->audio_frame.audio_data,
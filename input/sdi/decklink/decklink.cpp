@@ -56,12 +56,14 @@ extern "C"
 #include "input/sdi/x86/sdi.h"
 #include "input/sdi/smpte337_detector.h"
 #include <libavcodec/avcodec.h>
-#include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
+#include <libavutil/mathematics.h>
 #include <libklvanc/vanc.h>
 #include <libklscte35/scte35.h>
 #include "input/sdi/v210.h"
+#include "input/sdi/sdi_record.h"
+#include "filters/audio/audio_dsp.h"
 #include "common/bitstream.h"
 }
 
@@ -170,6 +172,26 @@ static const char *getModeName(BMDDisplayMode m)
 
 class DeckLinkCaptureDelegate;
 
+/* Planar capture buffers. Allocated and zeroed once, then recycled when the audio filter
+ * and encoders release them. Channels nobody reads are never written, so stay silent.
+ */
+#define DECKLINK_AUDIO_POOL_SAMPLES 2048 /* A frame at 23.976, with margin */
+
+struct decklink_audio_pool_s;
+struct decklink_audio_buf_s {
+    struct decklink_audio_buf_s *next;
+    struct decklink_audio_pool_s *pool;
+    uint8_t *planes[MAX_CHANNELS];
+    int linesize;
+};
+
+struct decklink_audio_pool_s {
+    pthread_mutex_t mutex;
+    int refcount; /* The capture context, plus every buffer in flight */
+    int num_channels;
+    struct decklink_audio_buf_s *free_list;
+};
+
 struct audio_pair_s {
     int    nr; /* 0 - 7 */
     struct smpte337_detector_s *smpte337_detector;
@@ -193,8 +215,13 @@ typedef struct
     AVCodec         *dec;
     AVCodecContext  *codec;
 
-    /* Audio - Sample Rate Conversion. We convert S32 interleaved into S32P planer. */
-    struct SwrContext *avr;
+    /* Audio - We unpack S32 interleaved into S32P planar, only for the channels an output
+     * stream reads (audio_channel_mask). SMPTE337 pairs are only forwarded when an
+     * AC3 bitstream output uses them (audio_bitstream_pair_mask).
+     */
+    struct decklink_audio_pool_s *audio_pool;
+    uint32_t audio_channel_mask;
+    uint32_t audio_bitstream_pair_mask;
 
     int64_t last_frame_time;
 
@@ -214,6 +241,15 @@ typedef struct
 
     /* LIBKLVANC handle / context */
     struct klvanc_context_s *vanchdl;
+
+    /* Adaptive VANC pre-scan. Lines which have never carried ANC are pre-scanned for an
+     * ADF and skipped when empty. Once a line has carried ANC we assume it will again,
+     * and go straight to the full unpack and parse.
+     */
+#define VANC_PRESCAN_MAX_LINES 4096
+    uint8_t vanc_line_seen_anc[VANC_PRESCAN_MAX_LINES];
+    uint64_t vanc_lines_parsed;
+    uint64_t vanc_lines_skipped;
 #define VANC_CACHE_DUMP_INTERVAL 60
     time_t last_vanc_cache_dump;
 
@@ -248,6 +284,21 @@ typedef struct
      * managed downstream (in each video codec).
      */
     struct avmetadata_s metadataVANC;
+
+    /* Capture recording, see sdi_input.record_frames */
+    struct sdi_record_s *recorder;
+    int recorder_segment;
+
+    /* LOS frame injection, the last good frame is repeated while the signal is missing */
+    int inject_frame_enable;
+    obe_raw_frame_t *cached_frame;
+    int injected_frame_count;
+
+    /* Replay of a recording in place of the hardware */
+    struct sdi_replay_s *replay;
+    pthread_t replay_threadId;
+    int replay_threadRunning;
+    volatile int replay_threadTerminate;
 } decklink_ctx_t;
 
 typedef struct
@@ -262,6 +313,7 @@ typedef struct
     int video_format;
     int num_channels;
     int probe;
+    const char *replay_location; /* A recorded segment to replay instead of opening the card */
 #define OPTION_ENABLED(opt) (decklink_opts->enable_##opt)
 #define OPTION_ENABLED_(opt) (decklink_opts_->enable_##opt)
     int enable_smpte2038;
@@ -372,6 +424,9 @@ static void calculate_audio_sfc_window(decklink_opts_t *opts)
 }
 
 static int transmit_pes_to_muxer(decklink_ctx_t *decklink_ctx, uint8_t *buf, uint32_t byteCount, stream_formats_e stream_format);
+static void replay_stop(decklink_opts_t *decklink_opts);
+
+extern int g_decklink_vanc_prescan;
 
 /* Take one line of V210 from VANC, colorspace convert and feed it to the
  * VANC parser. We'll expect our VANC message callbacks to happen on this
@@ -385,6 +440,18 @@ static void convert_colorspace_and_parse_vanc(decklink_ctx_t *decklink_ctx, stru
 	/* TODO: What the hell is this, two ptrs? */
 	const uint32_t *src = (const uint32_t *)buf;
 
+	/* Most VANC lines carry nothing, look for an ADF in the packed words before paying
+	 * for the unpack and parse.
+	 */
+	if (g_decklink_vanc_prescan && lineNr < VANC_PRESCAN_MAX_LINES && !decklink_ctx->vanc_line_seen_anc[lineNr]) {
+		if (!V210_line_has_adf(src, uiWidth)) {
+			decklink_ctx->vanc_lines_skipped++;
+			return;
+		}
+		decklink_ctx->vanc_line_seen_anc[lineNr] = 1;
+	}
+	decklink_ctx->vanc_lines_parsed++;
+
 	/* Convert Blackmagic pixel format to nv20.
 	 * src pointer gets mangled during conversion, hence we need its own
 	 * ptr instead of passing vbiBufferPtr.
@@ -395,7 +462,9 @@ static void convert_colorspace_and_parse_vanc(decklink_ctx_t *decklink_ctx, stru
 	/* On output each pixel will be decomposed into three 16-bit words (one for Y, U, V) */
 	assert(uiWidth * 6 < sizeof(decoded_words));
 
-	memset(&decoded_words[0], 0, sizeof(decoded_words));
+	/* Both conversions produce two words per pixel, nothing beyond that is parsed. */
+	unsigned int decoded_count = uiWidth * 2;
+	memset(&decoded_words[0], 0, decoded_count * sizeof(uint16_t));
 	uint16_t *p_anc = decoded_words;
 	if (uiWidth == 720) {
 		klvanc_v210_line_to_uyvy_c(src, p_anc, uiWidth);
@@ -408,7 +477,7 @@ static void convert_colorspace_and_parse_vanc(decklink_ctx_t *decklink_ctx, stru
         klvanc_smpte2038_packetizer_begin(decklink_ctx->smpte2038_ctx);
 
     if (decklink_ctx->vanchdl) {
-        int ret = klvanc_packet_parse(vanchdl, lineNr, decoded_words, sizeof(decoded_words) / (sizeof(unsigned short)));
+        int ret = klvanc_packet_parse(vanchdl, lineNr, decoded_words, decoded_count);
         if (ret < 0) {
       	  /* No VANC on this line */
         } else
@@ -756,6 +825,155 @@ static int64_t queryAudioClock(IDeckLinkAudioInputPacket *audioframe)
     return time;
 }
 
+static struct decklink_audio_pool_s *audio_pool_alloc(int num_channels)
+{
+    struct decklink_audio_pool_s *pool = (struct decklink_audio_pool_s *)calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->refcount = 1;
+    pool->num_channels = num_channels;
+
+    return pool;
+}
+
+static void audio_pool_free(struct decklink_audio_pool_s *pool)
+{
+    while (pool->free_list) {
+        struct decklink_audio_buf_s *buf = pool->free_list;
+        pool->free_list = buf->next;
+        av_freep(&buf->planes[0]);
+        free(buf);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+static void audio_pool_put(struct decklink_audio_pool_s *pool, struct decklink_audio_buf_s *buf)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (buf) {
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+    }
+    int refcount = --pool->refcount;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (refcount == 0)
+        audio_pool_free(pool);
+}
+
+static struct decklink_audio_buf_s *audio_pool_get(struct decklink_audio_pool_s *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    struct decklink_audio_buf_s *buf = pool->free_list;
+    if (buf)
+        pool->free_list = buf->next;
+    pool->refcount++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (buf)
+        return buf;
+
+    buf = (struct decklink_audio_buf_s *)calloc(1, sizeof(*buf));
+    if (buf && av_samples_alloc(buf->planes, &buf->linesize, pool->num_channels,
+        DECKLINK_AUDIO_POOL_SAMPLES, AV_SAMPLE_FMT_S32P, 0) < 0) {
+        free(buf);
+        buf = NULL;
+    }
+    if (!buf) {
+        audio_pool_put(pool, NULL);
+        return NULL;
+    }
+    av_samples_set_silence(buf->planes, 0, DECKLINK_AUDIO_POOL_SAMPLES, pool->num_channels, AV_SAMPLE_FMT_S32P);
+    buf->pool = pool;
+
+    return buf;
+}
+
+static void decklink_release_audio_data(void *ptr)
+{
+    obe_raw_frame_t *raw_frame = (obe_raw_frame_t *)ptr;
+    struct decklink_audio_buf_s *buf = (struct decklink_audio_buf_s *)raw_frame->opaque;
+
+    memset(raw_frame->audio_frame.audio_data, 0, sizeof(raw_frame->audio_frame.audio_data));
+    raw_frame->opaque = NULL;
+    audio_pool_put(buf->pool, buf);
+}
+
+/* Work out which input channels something downstream reads. PCM encoders read from their
+ * first channel for the width of their layout (as the audio filter splits them),
+ * AC3 bitstream passthrough reads a whole pair.
+ */
+static void calculate_audio_channel_masks(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+    obe_t *h = decklink_ctx->h;
+    uint32_t pcm = 0, bitstream = 0;
+
+    for (int i = 0; i < h->num_output_streams; i++) {
+        obe_output_stream_t *os = obe_core_get_output_stream_by_index(h, i);
+
+        /* Streams carried in another device's program */
+        if (decklink_ctx->device && h->num_devices > 1 &&
+            get_device_by_input_stream(h, os->input_stream_id) != decklink_ctx->device)
+            continue;
+
+        switch (os->stream_format) {
+        case AUDIO_AC_3_BITSTREAM:
+            if (os->sdi_audio_pair >= 1 && os->sdi_audio_pair <= MAX_AUDIO_PAIRS)
+                bitstream |= 1 << (os->sdi_audio_pair - 1);
+            break;
+        case AUDIO_PCM:
+        case AUDIO_MP2:
+        case AUDIO_AC_3:
+        case AUDIO_E_AC_3:
+        case AUDIO_AAC:
+        {
+            int first_channel = ((os->sdi_audio_pair - 1) << 1) + os->mono_channel;
+            int nb = av_get_channel_layout_nb_channels(os->channel_layout);
+            if (nb <= 0)
+                nb = 2;
+            for (int c = first_channel; c < first_channel + nb; c++) {
+                if (c >= 0 && c < decklink_opts->num_channels)
+                    pcm |= 1 << c;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    /* No streams configured, keep everything. */
+    if (h->num_output_streams == 0) {
+        pcm = (1 << decklink_opts->num_channels) - 1;
+        bitstream = (1 << MAX_AUDIO_PAIRS) - 1;
+    }
+
+    decklink_ctx->audio_channel_mask = pcm;
+    decklink_ctx->audio_bitstream_pair_mask = bitstream;
+
+    printf(PREFIX "Unpacking audio channel mask 0x%04x, bitstream pair mask 0x%02x\n", pcm, bitstream);
+}
+
+static int open_audio(decklink_opts_t *decklink_opts)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    audio_dsp_init(AUDIO_DSP_IMPL_AUTO);
+    calculate_audio_channel_masks(decklink_opts);
+
+    decklink_ctx->audio_pool = audio_pool_alloc(decklink_opts->num_channels);
+    if (!decklink_ctx->audio_pool) {
+        fprintf(stderr, PREFIX "Could not alloc the audio buffer pool\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_opts_, IDeckLinkAudioInputPacket *audioframe, int64_t videoPTS)
 {
     obe_raw_frame_t *raw_frame = NULL;
@@ -766,13 +984,14 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
         for (int i = 0; i < MAX_AUDIO_PAIRS; i++) {
             struct audio_pair_s *pair = &decklink_ctx->audio_pairs[i];
 
-            if (!pair->smpte337_detected_ac3 && hasSentAudioBuffer == 0) {
+            if (!pair->smpte337_detected_ac3 && hasSentAudioBuffer == 0 && decklink_ctx->audio_channel_mask) {
                 /* PCM audio, forward to compressors */
                 raw_frame = new_raw_frame();
                 if (!raw_frame) {
                     syslog(LOG_ERR, "Malloc failed\n");
                     goto end;
                 }
+                raw_frame->release_frame = obe_release_frame;
                 raw_frame->audio_frame.num_samples = audioframe->GetSampleFrameCount();
                 raw_frame->audio_frame.num_channels = decklink_opts_->num_channels;
                 raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
@@ -818,23 +1037,35 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
             }
 #endif
 
-                /* Allocate a samples buffer for num_samples samples, and fill data pointers and linesize accordingly. */
-                if( av_samples_alloc( raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize, decklink_opts_->num_channels,
-                              raw_frame->audio_frame.num_samples, (AVSampleFormat)raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
-                {
-                    syslog( LOG_ERR, "Malloc failed\n" );
-                    return -1;
+                /* Planar buffer from the pool, or a one off if the packet is unusually large. */
+                if (raw_frame->audio_frame.num_samples <= DECKLINK_AUDIO_POOL_SAMPLES) {
+                    struct decklink_audio_buf_s *buf = audio_pool_get(decklink_ctx->audio_pool);
+                    if (!buf) {
+                        syslog(LOG_ERR, "Malloc failed\n");
+                        goto fail;
+                    }
+                    memcpy(raw_frame->audio_frame.audio_data, buf->planes, sizeof(buf->planes));
+                    raw_frame->audio_frame.linesize = buf->linesize;
+                    raw_frame->opaque = buf;
+                    raw_frame->release_data = decklink_release_audio_data;
+                } else {
+                    if (av_samples_alloc(raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize, decklink_opts_->num_channels,
+                        raw_frame->audio_frame.num_samples, (AVSampleFormat)raw_frame->audio_frame.sample_fmt, 0) < 0) {
+                        syslog(LOG_ERR, "Malloc failed\n");
+                        goto fail;
+                    }
+                    av_samples_set_silence(raw_frame->audio_frame.audio_data, 0, raw_frame->audio_frame.num_samples,
+                        decklink_opts_->num_channels, (AVSampleFormat)raw_frame->audio_frame.sample_fmt);
+                    raw_frame->release_data = obe_release_audio_data;
                 }
 
-                /* Convert input samples from S32 interleaved into S32P planer. */
-                if (swr_convert(decklink_ctx->avr,
-                        raw_frame->audio_frame.audio_data,
-                        raw_frame->audio_frame.num_samples,
-                        (const uint8_t**)&frame_bytes,
-                        raw_frame->audio_frame.num_samples) < 0)
-                {
-                    syslog(LOG_ERR, PREFIX "Sample format conversion failed\n");
-                    return -1;
+                /* Unpack S32 interleaved into S32P planar, only the pairs an encoder reads. */
+                for (int c = 0; c + 1 < decklink_opts_->num_channels; c += 2) {
+                    if (!(decklink_ctx->audio_channel_mask & (3 << c)))
+                        continue;
+                    audio_dsp_deinterleave_pair_s32(raw_frame->audio_frame.audio_data[c],
+                        raw_frame->audio_frame.audio_data[c + 1], (const uint8_t *)frame_bytes,
+                        decklink_opts_->num_channels, c, raw_frame->audio_frame.num_samples);
                 }
 
                 raw_frame->pts = queryAudioClock(audioframe);
@@ -849,8 +1080,6 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
                 avfm_set_video_interval_clk(&raw_frame->avfm, decklink_ctx->vframe_duration);
                 //raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 
-                raw_frame->release_data = obe_release_audio_data;
-                raw_frame->release_frame = obe_release_frame;
                 raw_frame->input_stream_id = pair->input_stream_id;
                 if (add_to_filter_queue(decklink_ctx->h, raw_frame) < 0)
                     goto fail;
@@ -858,28 +1087,32 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
 
             } /* !pair->smpte337_detected_ac3 */
 
-            if (pair->smpte337_detected_ac3) {
+            if (pair->smpte337_detected_ac3 && (decklink_ctx->audio_bitstream_pair_mask & (1 << i))) {
 
-                /* Ship the buffer + offset into it, down to the encoders. The encoders will look at offset 0. */
-		/* In summary, we prepare a new and unique buffer for each detected audio pair, unlike PCM - 
+                /* Ship just this pair, still interleaved, down to the AC3 bitstream encoder.
+		 * In summary, we prepare a new and unique buffer for each detected audio pair, unlike PCM -
 		 * which gets a single buffer containing all channels (and the audio filter splits them out).
 		 */
                 int depth = 32;
                 int span = 2;
-                int offset = i * ((depth / 8) * span);
                 raw_frame = new_raw_frame();
+                if (!raw_frame) {
+                    syslog(LOG_ERR, "Malloc failed\n");
+                    goto end;
+                }
+                raw_frame->release_frame = obe_release_frame;
                 raw_frame->audio_frame.num_samples = audioframe->GetSampleFrameCount();
-                raw_frame->audio_frame.num_channels = decklink_opts_->num_channels;
-                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P; /* No specific format. The audio filter will play passthrough. */
-
-                int l = audioframe->GetSampleFrameCount() * decklink_opts_->num_channels * (depth / 8);
-                raw_frame->audio_frame.audio_data[0] = (uint8_t *)malloc(l);
-                raw_frame->audio_frame.linesize = raw_frame->audio_frame.num_channels * (depth / 8);
-
-		/* Move the audio to allign the bitstream audio in this specific pair into pair0 then send the buffer downstream. */
-                memcpy(raw_frame->audio_frame.audio_data[0], (uint8_t *)frame_bytes + offset, l - offset);
+                raw_frame->audio_frame.num_channels = span;
+                raw_frame->audio_frame.linesize = span * (depth / 8);
+                raw_frame->audio_frame.audio_data[0] = (uint8_t *)av_malloc(raw_frame->audio_frame.num_samples * raw_frame->audio_frame.linesize);
+                if (!raw_frame->audio_frame.audio_data[0]) {
+                    syslog(LOG_ERR, "Malloc failed\n");
+                    goto fail;
+                }
+                audio_dsp_extract_pair_s32(raw_frame->audio_frame.audio_data[0], (const uint8_t *)frame_bytes,
+                    decklink_opts_->num_channels, i * span, raw_frame->audio_frame.num_samples);
 
-                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE;
+                raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_NONE; /* No specific format. The audio filter will play passthrough. */
 
                 raw_frame->pts = queryAudioClock(audioframe);
 
@@ -895,7 +1128,6 @@ static int processAudio(decklink_ctx_t *decklink_ctx, decklink_opts_t *decklink_
                 //avfm_dump(&raw_frame->avfm);
 
                 raw_frame->release_data = obe_release_audio_data;
-                raw_frame->release_frame = obe_release_frame;
                 raw_frame->input_stream_id = pair->input_stream_id;
                 //printf("frame for pair->nr %d rf->input_stream_id %d at offset %d\n", pair->nr, raw_frame->input_stream_id, offset);
 
@@ -1015,7 +1247,7 @@ uint32_t      g_decklink_burnwriter_linenr = 0;
 
 int           g_decklink_monitor_hw_clocks = 0;
 
-int           g_decklink_injected_frame_count = 0;
+/* Frame injection is enabled per device by its frame-injection option, this turns it on for all of them */
 int           g_decklink_injected_frame_count_max = 600;
 int           g_decklink_inject_frame_enable = 0;
 
@@ -1032,6 +1264,13 @@ int           g_decklink_inject_scte104_fragmented = 0;
 
 int           g_decklink_op47_teletext_reverse = 1;
 
+int           g_decklink_vanc_prescan = 1;
+
+/* Record and replay, by card index. record_frames > 0 records that many callbacks, -1 records until set back to zero. */
+int           g_decklink_record_frames[SDI_RECORD_MAX_CARDS] = { 0 };
+int           g_decklink_replay_turbo = 0;
+int           g_decklink_replay_loop = 1;
+
 struct udp_vanc_receiver_s {
     int active;
     int skt;
@@ -1041,24 +1280,178 @@ struct udp_vanc_receiver_s {
 } g_decklink_udp_vanc_receiver;
 int g_decklink_udp_vanc_receiver_port; /* UDP Port number to activate a VANC receiver on */
 
-static obe_raw_frame_t *cached = NULL;
-static void cache_video_frame(obe_raw_frame_t *frame)
+static int inject_frame_enabled(decklink_ctx_t *decklink_ctx)
+{
+    return decklink_ctx->inject_frame_enable || g_decklink_inject_frame_enable;
+}
+
+static void cache_video_frame(decklink_ctx_t *decklink_ctx, obe_raw_frame_t *frame)
 {
-    if (cached != NULL) {
-        cached->release_data(cached);
-        cached->release_frame(cached);
+    if (decklink_ctx->cached_frame != NULL) {
+        decklink_ctx->cached_frame->release_data(decklink_ctx->cached_frame);
+        decklink_ctx->cached_frame->release_frame(decklink_ctx->cached_frame);
     }
 
-    cached = obe_raw_frame_copy(frame);
+    decklink_ctx->cached_frame = frame ? obe_raw_frame_copy(frame) : NULL;
+}
+
+/* The sdi_input.record_frames count for this card, NULL if the card index can't be addressed. */
+static int *recordFramesRemaining(decklink_opts_t *decklink_opts_)
+{
+    if (decklink_opts_->card_idx < 0 || decklink_opts_->card_idx >= SDI_RECORD_MAX_CARDS)
+        return NULL;
+
+    return &g_decklink_record_frames[decklink_opts_->card_idx];
+}
+
+/* Copy everything the hardware handed us for this callback into the recording. Cheap enough
+ * to run on the callback thread, it's a memcpy into a mapped file.
+ */
+static void recordFrame(decklink_opts_t *decklink_opts_, IDeckLinkVideoInputFrame *videoframe,
+    IDeckLinkAudioInputPacket *audioframe, BMDTimeValue vtime, BMDTimeValue atime)
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
+    int *remaining = recordFramesRemaining(decklink_opts_);
+
+    if (!remaining || *remaining == 0 || decklink_opts_->probe || decklink_ctx->replay) {
+        if (decklink_ctx->recorder) {
+            klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: recording stopped after %" PRIu64 " frames",
+                decklink_opts_->card_idx, sdi_record_frame_count(decklink_ctx->recorder));
+            sdi_record_close(decklink_ctx->recorder);
+            decklink_ctx->recorder = NULL;
+        }
+        return;
+    }
+
+    /* A recording holds one geometry, the replay buffers and VANC line lengths come from its header.
+     * When the signal changes format, finish this recording and start another.
+     */
+    if (decklink_ctx->recorder && videoframe && !(videoframe->GetFlags() & bmdFrameHasNoInputSource)) {
+        const struct sdi_record_header_s *hdr = sdi_record_header(decklink_ctx->recorder);
+        if (hdr->video_format != decklink_opts_->video_format ||
+            hdr->width != (uint32_t)videoframe->GetWidth() ||
+            hdr->height != (uint32_t)videoframe->GetHeight() ||
+            hdr->stride != (uint32_t)videoframe->GetRowBytes() ||
+            hdr->audio_channels != (uint32_t)decklink_opts_->num_channels) {
+            klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: signal format changed, recording split after %" PRIu64 " frames",
+                decklink_opts_->card_idx, sdi_record_frame_count(decklink_ctx->recorder));
+            sdi_record_close(decklink_ctx->recorder);
+            decklink_ctx->recorder = NULL;
+        }
+    }
+
+    if (!decklink_ctx->recorder) {
+        /* We need the signal geometry to start */
+        if (!videoframe || (videoframe->GetFlags() & bmdFrameHasNoInputSource))
+            return;
+
+        struct sdi_record_header_s hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.video_format = decklink_opts_->video_format;
+        hdr.width = videoframe->GetWidth();
+        hdr.height = videoframe->GetHeight();
+        hdr.stride = videoframe->GetRowBytes();
+        hdr.timebase_num = decklink_opts_->timebase_num;
+        hdr.timebase_den = decklink_opts_->timebase_den;
+        hdr.interlaced = decklink_opts_->interlaced;
+        hdr.tff = decklink_opts_->tff;
+        hdr.audio_channels = decklink_opts_->num_channels;
+        hdr.vanc_line_bytes = hdr.stride;
+        hdr.created_us = obe_mdate();
+
+        char fn[256];
+        if (decklink_ctx->recorder_segment == 0)
+            sprintf(fn, "/tmp/cardindex%d-%lu.obesdi", decklink_opts_->card_idx, (unsigned long)time(0));
+        else
+            sprintf(fn, "/tmp/cardindex%d-%lu-%d.obesdi", decklink_opts_->card_idx, (unsigned long)time(0),
+                decklink_ctx->recorder_segment);
+        if (sdi_record_open(&decklink_ctx->recorder, fn, &hdr) < 0) {
+            klsyslog_and_stdout(LOG_ERR, "Decklink card index %i: unable to create recording %s",
+                decklink_opts_->card_idx, fn);
+            *remaining = 0;
+            return;
+        }
+        decklink_ctx->recorder_segment++;
+        klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: recording to %s", decklink_opts_->card_idx, fn);
+    }
+
+    struct sdi_record_frame_s f;
+    memset(&f, 0, sizeof(f));
+
+    void *video = NULL, *audio = NULL;
+    uint32_t vanc_line_nrs[DECKLINK_VANC_LINES];
+    const void *vanc_lines[DECKLINK_VANC_LINES];
+    IDeckLinkVideoFrameAncillary *ancillary = NULL;
+
+    if (videoframe) {
+        f.flags |= SDI_RECORD_FLAG_VIDEO;
+        f.hw_flags = videoframe->GetFlags();
+        if (f.hw_flags & bmdFrameHasNoInputSource)
+            f.flags |= SDI_RECORD_FLAG_NO_SIGNAL;
+
+        videoframe->GetBytes(&video);
+        f.video_bytes = videoframe->GetRowBytes() * videoframe->GetHeight();
+        f.video_pts = vtime;
+        f.video_duration = decklink_ctx->vframe_duration;
+
+        /* Walk the same VANC lines the callback does, keep whichever the hardware gives us. */
+        int j;
+        for (j = 0; first_active_line[j].format != -1; j++) {
+            if (decklink_opts_->video_format == first_active_line[j].format)
+                break;
+        }
+        if (first_active_line[j].format != -1 && videoframe->GetAncillaryData(&ancillary) == S_OK) {
+            int line = decklink_opts_->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
+            while (f.vanc_lines < DECKLINK_VANC_LINES && line != first_active_line[j].line) {
+                void *anc_line;
+                if (ancillary->GetBufferForVerticalBlankingLine(line, &anc_line) == S_OK) {
+                    vanc_line_nrs[f.vanc_lines] = line;
+                    vanc_lines[f.vanc_lines++] = anc_line;
+                }
+                line = sdi_next_line(decklink_opts_->video_format, line);
+            }
+        }
+    }
+
+    if (audioframe) {
+        f.flags |= SDI_RECORD_FLAG_AUDIO;
+        audioframe->GetBytes(&audio);
+        f.audio_samples = audioframe->GetSampleFrameCount();
+        f.audio_pts = atime;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    f.hw_received_us = ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+
+    if (sdi_record_write(decklink_ctx->recorder, &f, video, audio, vanc_line_nrs, vanc_lines) < 0) {
+        klsyslog_and_stdout(LOG_ERR, "Decklink card index %i: recording write failed, stopping",
+            decklink_opts_->card_idx);
+        *remaining = 0;
+    } else if (*remaining > 0) {
+        (*remaining)--;
+    }
+
+    if (ancillary)
+        ancillary->Release();
+
+    if (*remaining == 0) {
+        klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: recording complete, %" PRIu64 " frames",
+            decklink_opts_->card_idx, sdi_record_frame_count(decklink_ctx->recorder));
+        sdi_record_close(decklink_ctx->recorder);
+        decklink_ctx->recorder = NULL;
+    }
 }
 
 HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFrame *videoframe, IDeckLinkAudioInputPacket *audioframe)
 {
-	if (!cached)
+	decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
+
+	if (!decklink_ctx->cached_frame)
 		return S_OK;
 
-	g_decklink_injected_frame_count++;
-	if (g_decklink_injected_frame_count > g_decklink_injected_frame_count_max) {
+	decklink_ctx->injected_frame_count++;
+	if (decklink_ctx->injected_frame_count > g_decklink_injected_frame_count_max) {
             char msg[128];
             sprintf(msg, "Decklink card index %i: More than %d frames were injected, aborting.\n",
                 decklink_opts_->card_idx,
@@ -1068,7 +1461,6 @@ HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFra
             exit(1);
         }
 
-	decklink_ctx_t *decklink_ctx = &decklink_opts_->decklink_ctx;
  	BMDTimeValue frame_duration;
 	obe_t *h = decklink_ctx->h;
 
@@ -1076,7 +1468,7 @@ HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFra
 	videoframe->GetStreamTime(&decklink_ctx->stream_time, &frame_duration, OBE_CLOCK);
 	obe_clock_tick(h, (int64_t)decklink_ctx->stream_time);
 
-	obe_raw_frame_t *raw_frame = obe_raw_frame_copy(cached);
+	obe_raw_frame_t *raw_frame = obe_raw_frame_copy(decklink_ctx->cached_frame);
 	raw_frame->pts = decklink_ctx->stream_time;
 
 	avfm_set_pts_video(&raw_frame->avfm, decklink_ctx->stream_time + clock_offset);
@@ -1102,7 +1494,7 @@ HRESULT DeckLinkCaptureDelegate::noVideoInputFrameArrived(IDeckLinkVideoInputFra
 	avfm_set_hw_received_time(&raw_frame->avfm);
 #if 0
 	//avfm_dump(&raw_frame->avfm);
-	printf("Injecting cached frame %d for time %" PRIi64 "\n", g_decklink_injected_frame_count, raw_frame->pts);
+	printf("Injecting cached frame %d for time %" PRIi64 "\n", decklink_ctx->injected_frame_count, raw_frame->pts);
 #endif
 	add_to_filter_queue(h, raw_frame);
 
@@ -1129,8 +1521,10 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
 
 
 	uint32_t val[2];
-	decklink_ctx->p_input->GetAvailableVideoFrameCount(&val[0]);
-	decklink_ctx->p_input->GetAvailableAudioSampleFrameCount(&val[1]);
+	if (decklink_ctx->p_input) {
+		decklink_ctx->p_input->GetAvailableVideoFrameCount(&val[0]);
+		decklink_ctx->p_input->GetAvailableAudioSampleFrameCount(&val[1]);
+	}
 
 	if (g_decklink_histogram_print_secs > 0) {
 		ltn_histogram_interval_print(STDOUT_FILENO, decklink_ctx->callback_hdl, g_decklink_histogram_print_secs);
@@ -1288,6 +1682,10 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
        videoframe->GetStreamTime(&vtime, &decklink_ctx->vframe_duration, OBE_CLOCK);
     }
 
+    int *record_frames = recordFramesRemaining(decklink_opts_);
+    if ((record_frames && *record_frames) || decklink_ctx->recorder)
+        recordFrame(decklink_opts_, videoframe, audioframe, vtime, packet_time);
+
     if (g_decklink_monitor_hw_clocks)
     {
         static BMDTimeValue last_vtime = 0;
@@ -1339,7 +1737,7 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
     } /* if g_decklink_monitor_hw_clocks */
     ltn_histogram_sample_end(decklink_ctx->callback_1_hdl);
 
-    if (g_decklink_inject_frame_enable) {
+    if (inject_frame_enabled(decklink_ctx)) {
         if (videoframe && videoframe->GetFlags() & bmdFrameHasNoInputSource) {
             return noVideoInputFrameArrived(videoframe, audioframe);
         }
@@ -1411,7 +1809,7 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
             sprintf(t, "%s", ctime(&now));
             t[strlen(t) - 1] = 0;
             printf("%s -- Simulating video loss\n", t);
-            if (g_decklink_inject_frame_enable)
+            if (inject_frame_enabled(decklink_ctx))
                 return noVideoInputFrameArrived(videoframe, audioframe);
             else
                 videoframe = NULL;
@@ -1475,6 +1873,8 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
         if (decklink_ctx->last_vanc_cache_dump + VANC_CACHE_DUMP_INTERVAL <= time(0)) {
             decklink_ctx->last_vanc_cache_dump = time(0);
             _vanc_cache_dump(decklink_ctx);
+            printf("vanc prescan: %" PRIu64 " lines parsed, %" PRIu64 " skipped\n",
+                decklink_ctx->vanc_lines_parsed, decklink_ctx->vanc_lines_skipped);
         }
     }
 
@@ -1491,10 +1891,10 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
         else if (decklink_opts_->probe && decklink_ctx->audio_pairs[0].smpte337_frames_written > 6)
             decklink_opts_->probe_success = 1;
 
-        if (g_decklink_injected_frame_count > 0) {
+        if (decklink_ctx->injected_frame_count > 0) {
             klsyslog_and_stdout(LOG_INFO, "Decklink card index %i: Injected %d cached video frame(s)",
-                decklink_opts_->card_idx, g_decklink_injected_frame_count);
-            g_decklink_injected_frame_count = 0;
+                decklink_opts_->card_idx, decklink_ctx->injected_frame_count);
+            decklink_ctx->injected_frame_count = 0;
         }
 
         /* use SDI ticks as clock source */
@@ -1523,7 +1923,7 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
                     exit(0);
                 }
 
-                if (g_decklink_inject_frame_enable == 0) {
+                if (!inject_frame_enabled(decklink_ctx)) {
                     pthread_mutex_lock(&h->drop_mutex);
                     h->video_encoder_drop = h->audio_encoder_drop = h->mux_drop = 1;
                     pthread_mutex_unlock(&h->drop_mutex);
@@ -1978,11 +2378,11 @@ HRESULT DeckLinkCaptureDelegate::timedVideoInputFrameArrived( IDeckLinkVideoInpu
             //raw_frame->avfm.hw_audio_correction_clk = clock_offset;
             //avfm_dump(&raw_frame->avfm);
 
-            if (g_decklink_inject_frame_enable)
-                cache_video_frame(raw_frame);
+            if (inject_frame_enabled(decklink_ctx))
+                cache_video_frame(decklink_ctx, raw_frame);
 
             /* Ensure we put any associated video vanc / metadata into this raw frame. */
-            avmetadata_clone(&raw_frame->metadata, &decklink_ctx->metadataVANC);
+            avmetadata_clone_arena(&raw_frame->metadata, &decklink_ctx->metadataVANC, &raw_frame->arena);
 
             if( add_to_filter_queue( h, raw_frame ) < 0 )
                 goto fail;
@@ -2058,6 +2458,8 @@ static void close_card( decklink_opts_t *decklink_opts )
 {
     decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
 
+    replay_stop(decklink_opts);
+
     if( decklink_ctx->p_config )
         decklink_ctx->p_config->Release();
 
@@ -2100,9 +2502,18 @@ static void close_card( decklink_opts_t *decklink_opts )
     if( IS_SD( decklink_opts->video_format ) )
         vbi_raw_decoder_destroy( &decklink_ctx->non_display_parser.vbi_decoder );
 
-    if (decklink_ctx->avr)
-        swr_free(&decklink_ctx->avr);
+    if (decklink_ctx->audio_pool) {
+        /* Buffers still downstream hold their own reference to the pool. */
+        audio_pool_put(decklink_ctx->audio_pool, NULL);
+        decklink_ctx->audio_pool = NULL;
+    }
+
+    if (decklink_ctx->recorder) {
+        sdi_record_close(decklink_ctx->recorder);
+        decklink_ctx->recorder = NULL;
+    }
 
+    cache_video_frame(decklink_ctx, NULL);
 }
 
 /* VANC Callbacks */
@@ -2617,6 +3028,275 @@ static void * detector_callback(void *user_context,
         return 0;
 }
 
+/* Replay of a recording made with sdi_input.record_frames. Each record is wrapped in the
+ * SDK frame interfaces and handed to VideoInputFrameArrived(), so the replay exercises
+ * exactly the code a card does. The objects live on the replay thread stack, reference
+ * counting is a no-op.
+ */
+class ReplayAncillary : public IDeckLinkVideoFrameAncillary
+{
+public:
+    ReplayAncillary(struct sdi_replay_s *replay, const struct sdi_replay_frame_s *frame, BMDDisplayMode mode)
+        : replay_(replay), frame_(frame), mode_(mode) { }
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID *) { return E_NOINTERFACE; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual HRESULT STDMETHODCALLTYPE GetBufferForVerticalBlankingLine(uint32_t lineNumber, void **buffer)
+    {
+        /* Lines the hardware refused during the recording are refused again. */
+        const void *p = sdi_replay_vanc_line(replay_, frame_, lineNumber);
+        if (!p)
+            return E_FAIL;
+        *buffer = (void *)p;
+        return S_OK;
+    }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void) { return bmdFormat10BitYUV; }
+    virtual BMDDisplayMode STDMETHODCALLTYPE GetDisplayMode(void) { return mode_; }
+
+private:
+    struct sdi_replay_s *replay_;
+    const struct sdi_replay_frame_s *frame_;
+    BMDDisplayMode mode_;
+};
+
+class ReplayVideoFrame : public IDeckLinkVideoInputFrame
+{
+public:
+    ReplayVideoFrame(const struct sdi_record_header_s *hdr, const struct sdi_replay_frame_s *frame,
+        ReplayAncillary *ancillary, void *bytes, int64_t pts)
+        : hdr_(hdr), frame_(frame), ancillary_(ancillary), bytes_(bytes), pts_(pts) { }
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID *) { return E_NOINTERFACE; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual long STDMETHODCALLTYPE GetWidth(void) { return hdr_->width; }
+    virtual long STDMETHODCALLTYPE GetHeight(void) { return hdr_->height; }
+    virtual long STDMETHODCALLTYPE GetRowBytes(void) { return hdr_->stride; }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat(void) { return bmdFormat10BitYUV; }
+    virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags(void) { return (BMDFrameFlags)frame_->hdr->hw_flags; }
+    virtual HRESULT STDMETHODCALLTYPE GetBytes(void **buffer) { *buffer = bytes_; return S_OK; }
+    virtual HRESULT STDMETHODCALLTYPE GetTimecode(BMDTimecodeFormat, IDeckLinkTimecode **timecode)
+    {
+        *timecode = NULL;
+        return S_FALSE;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)
+    {
+        *ancillary = ancillary_;
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale)
+    {
+        *frameTime = av_rescale(pts_, timeScale, OBE_CLOCK);
+        *frameDuration = av_rescale(frame_->hdr->video_duration, timeScale, OBE_CLOCK);
+        return S_OK;
+    }
+    virtual HRESULT STDMETHODCALLTYPE GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration)
+    {
+        *frameTime = av_rescale(frame_->hdr->hw_received_us, timeScale, 1000000);
+        *frameDuration = av_rescale(frame_->hdr->video_duration, timeScale, OBE_CLOCK);
+        return S_OK;
+    }
+
+private:
+    const struct sdi_record_header_s *hdr_;
+    const struct sdi_replay_frame_s *frame_;
+    ReplayAncillary *ancillary_;
+    void *bytes_;
+    int64_t pts_;
+};
+
+class ReplayAudioPacket : public IDeckLinkAudioInputPacket
+{
+public:
+    ReplayAudioPacket(const struct sdi_replay_frame_s *frame, void *bytes, int64_t pts)
+        : frame_(frame), bytes_(bytes), pts_(pts) { }
+
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID *) { return E_NOINTERFACE; }
+    virtual ULONG STDMETHODCALLTYPE AddRef(void) { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release(void) { return 1; }
+
+    virtual long STDMETHODCALLTYPE GetSampleFrameCount(void) { return frame_->hdr->audio_samples; }
+    virtual HRESULT STDMETHODCALLTYPE GetBytes(void **buffer) { *buffer = bytes_; return S_OK; }
+    virtual HRESULT STDMETHODCALLTYPE GetPacketTime(BMDTimeValue *packetTime, BMDTimeScale timeScale)
+    {
+        *packetTime = av_rescale(pts_, timeScale, OBE_CLOCK);
+        return S_OK;
+    }
+
+private:
+    const struct sdi_replay_frame_s *frame_;
+    void *bytes_;
+    int64_t pts_;
+};
+
+static void *replay_thread_func(void *p)
+{
+    decklink_opts_t *decklink_opts = (decklink_opts_t *)p;
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+    const struct sdi_record_header_s *hdr = sdi_replay_header(decklink_ctx->replay);
+
+    /* The callback paints into video and audio buffers, the mapping is read only. */
+    uint8_t *video = (uint8_t *)av_malloc(hdr->stride * hdr->height);
+    uint8_t *audio = NULL;
+    unsigned int audio_size = 0;
+
+    int64_t base = -1, offset = 0, last = 0, last_duration = 0;
+    uint64_t frames = 0;
+
+    struct timespec start, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    printf(PREFIX "Replay of %s starts, %s\n", decklink_opts->replay_location,
+        g_decklink_replay_turbo ? "turbo" : "realtime");
+
+    while (video && !decklink_ctx->replay_threadTerminate) {
+        struct sdi_replay_frame_s frame;
+        int ret = sdi_replay_next(decklink_ctx->replay, &frame);
+        if (ret < 0) {
+            fprintf(stderr, PREFIX "Replay of %s is truncated or corrupt after %" PRIu64 " frames\n",
+                decklink_opts->replay_location, frames);
+            break;
+        }
+        if (ret == 1) {
+            if (!g_decklink_replay_loop || frames == 0)
+                break;
+
+            /* Keep the clocks moving forward across the loop. */
+            offset = last + last_duration;
+            base = -1;
+            sdi_replay_rewind(decklink_ctx->replay);
+            continue;
+        }
+
+        const struct sdi_record_frame_s *f = frame.hdr;
+        int64_t clk = (f->flags & SDI_RECORD_FLAG_VIDEO) ? f->video_pts : f->audio_pts;
+        if (base == -1)
+            base = clk;
+        int64_t delta = offset - base;
+        last = clk + delta;
+        if (f->video_duration)
+            last_duration = f->video_duration;
+
+        if (!g_decklink_replay_turbo) {
+            int64_t ns = av_rescale(last, 1000000000, OBE_CLOCK);
+            deadline.tv_sec = start.tv_sec + (ns / 1000000000);
+            deadline.tv_nsec = start.tv_nsec + (ns % 1000000000);
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR &&
+                !decklink_ctx->replay_threadTerminate)
+                ;
+        }
+
+        ReplayAncillary ancillary(decklink_ctx->replay, &frame, decklink_ctx->enabled_mode_id);
+        ReplayVideoFrame vframe(hdr, &frame, &ancillary, video, f->video_pts + delta);
+        if (frame.video)
+            memcpy(video, frame.video, f->video_bytes);
+
+        unsigned int len = f->audio_samples * hdr->audio_channels * sizeof(int32_t);
+        if (len > audio_size) {
+            av_freep(&audio);
+            audio_size = 0;
+            audio = (uint8_t *)av_malloc(len);
+            if (!audio)
+                break;
+            audio_size = len;
+        }
+        ReplayAudioPacket aframe(&frame, audio, f->audio_pts + delta);
+        if (frame.audio)
+            memcpy(audio, frame.audio, len);
+
+        decklink_ctx->p_delegate->VideoInputFrameArrived(
+            (f->flags & SDI_RECORD_FLAG_VIDEO) ? &vframe : NULL,
+            (f->flags & SDI_RECORD_FLAG_AUDIO) ? &aframe : NULL);
+        frames++;
+    }
+
+    printf(PREFIX "Replay of %s complete, %" PRIu64 " frames\n", decklink_opts->replay_location, frames);
+
+    av_free(video);
+    av_free(audio);
+
+    return NULL;
+}
+
+static int open_replay( decklink_opts_t *decklink_opts )
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    if (sdi_replay_open(&decklink_ctx->replay, decklink_opts->replay_location) < 0) {
+        fprintf(stderr, PREFIX "Unable to open recording %s\n", decklink_opts->replay_location);
+        return -1;
+    }
+
+    const struct sdi_record_header_s *hdr = sdi_replay_header(decklink_ctx->replay);
+    const struct obe_to_decklink_video *fmt = getVideoFormatByOBEName(hdr->video_format);
+    if (!fmt || hdr->audio_channels != (uint32_t)decklink_opts->num_channels) {
+        fprintf(stderr, PREFIX "Recording %s has an unsupported format\n", decklink_opts->replay_location);
+        return -1;
+    }
+
+    if (decklink_opts->video_format != INPUT_VIDEO_FORMAT_UNDEFINED && decklink_opts->video_format != fmt->obe_name) {
+        fprintf(stderr, PREFIX "Recording %s is %s, ignoring the configured video format\n",
+            decklink_opts->replay_location, fmt->ascii_name);
+    }
+
+    /* The recording stands in for format detection. */
+    decklink_opts->video_format = hdr->video_format;
+    decklink_opts->timebase_num = hdr->timebase_num;
+    decklink_opts->timebase_den = hdr->timebase_den;
+    decklink_opts->width = hdr->width;
+    decklink_opts->coded_height = hdr->height;
+    decklink_opts->height = hdr->height == 486 ? 480 : hdr->height;
+    decklink_opts->interlaced = hdr->interlaced;
+    decklink_opts->tff = hdr->tff;
+    calculate_audio_sfc_window(decklink_opts);
+    setup_pixel_funcs(decklink_opts);
+
+    decklink_ctx->enabled_mode_id = fmt->bmd_name;
+    decklink_ctx->enabled_mode_fmt = fmt;
+
+    printf(PREFIX "Replaying %s, %s, %" PRIu64 " frames recorded\n", decklink_opts->replay_location,
+        fmt->ascii_name, hdr->frame_count);
+
+    if (!decklink_opts->probe && open_audio(decklink_opts) < 0)
+        return -1;
+
+    decklink_ctx->p_delegate = new DeckLinkCaptureDelegate(decklink_opts);
+
+    decklink_ctx->replay_threadTerminate = 0;
+    if (pthread_create(&decklink_ctx->replay_threadId, NULL, replay_thread_func, decklink_opts) != 0) {
+        fprintf(stderr, PREFIX "Unable to start the replay thread\n");
+        return -1;
+    }
+    decklink_ctx->replay_threadRunning = 1;
+    ltnpthread_setname_np(decklink_ctx->replay_threadId, "obe-dl-replay");
+
+    return 0;
+}
+
+static void replay_stop( decklink_opts_t *decklink_opts )
+{
+    decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
+
+    if (decklink_ctx->replay_threadRunning) {
+        decklink_ctx->replay_threadTerminate = 1;
+        pthread_join(decklink_ctx->replay_threadId, NULL);
+        decklink_ctx->replay_threadRunning = 0;
+    }
+
+    if (decklink_ctx->replay) {
+        sdi_replay_close(decklink_ctx->replay);
+        decklink_ctx->replay = NULL;
+    }
+}
+
 static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
 {
     decklink_ctx_t *decklink_ctx = &decklink_opts->decklink_ctx;
@@ -2664,7 +3344,7 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
 
     if (OPTION_ENABLED(frame_injection)) {
         klsyslog_and_stdout(LOG_INFO, "Enabling option frame injection");
-        g_decklink_inject_frame_enable = 1;
+        decklink_ctx->inject_frame_enable = 1;
     }
 
     if (OPTION_ENABLED(allow_1080p60)) {
@@ -2703,6 +3383,13 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
         pair->smpte337_detected_ac3 = 0;
         pair->decklink_ctx = decklink_ctx;
         pair->input_stream_id = i + 1; /* Video is zero, audio onwards. */
+        if (decklink_ctx->device) {
+            /* Ids are shared by all devices, use the one this pair was probed with. */
+            for (int j = 0; j < decklink_ctx->device->num_input_streams; j++) {
+                if (decklink_ctx->device->input_streams[j]->sdi_audio_pair == i + 1)
+                    pair->input_stream_id = decklink_ctx->device->input_streams[j]->input_stream_id;
+            }
+        }
 
         if (OPTION_ENABLED(bitstream_audio)) {
             pair->smpte337_detector = smpte337_detector_alloc((smpte337_detector_callback)detector_callback, pair);
@@ -2739,6 +3426,12 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
         goto finish;
     }
 
+    if (decklink_opts->replay_location)
+    {
+        ret = open_replay(decklink_opts);
+        goto finish;
+    }
+
     decklink_iterator = CreateDeckLinkIteratorInstance();
     if( !decklink_iterator )
     {
@@ -2988,29 +3681,10 @@ static int open_card( decklink_opts_t *decklink_opts, int allowFormatDetection)
         goto finish;
     }
 
-    if( !decklink_opts->probe )
+    if( !decklink_opts->probe && open_audio( decklink_opts ) < 0 )
     {
-        decklink_ctx->avr = swr_alloc();
-        if (!decklink_ctx->avr)
-        {
-            fprintf(stderr, PREFIX "Could not alloc libswresample context\n");
-            ret = -1;
-            goto finish;
-        }
-
-        /* Give libswresample a made up channel map */
-        av_opt_set_int( decklink_ctx->avr, "in_channel_layout",   (1 << decklink_opts->num_channels) - 1, 0 );
-        av_opt_set_int( decklink_ctx->avr, "in_sample_fmt",       AV_SAMPLE_FMT_S32, 0 );
-        av_opt_set_int( decklink_ctx->avr, "in_sample_rate",      48000, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_channel_layout",  (1 << decklink_opts->num_channels) - 1, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_sample_fmt",      AV_SAMPLE_FMT_S32P, 0 );
-        av_opt_set_int( decklink_ctx->avr, "out_sample_rate",     48000, 0 );
-
-        if (swr_init(decklink_ctx->avr) < 0)
-        {
-            fprintf(stderr, PREFIX "couldn't setup sample rate conversion\n");
-            goto finish;
-        }
+        ret = -1;
+        goto finish;
     }
 
     decklink_ctx->p_delegate = new DeckLinkCaptureDelegate( decklink_opts );
@@ -3090,6 +3764,7 @@ static void *probe_stream( void *ptr )
     decklink_opts->enable_los_exit_ms = user_opts->enable_los_exit_ms;
     decklink_opts->enable_frame_injection = user_opts->enable_frame_injection;
     decklink_opts->enable_allow_1080p60 = user_opts->enable_allow_1080p60;
+    decklink_opts->replay_location = user_opts->location;
 
     decklink_opts->probe = non_display_parser->probe = 1;
 
@@ -3353,6 +4028,7 @@ static void *open_input( void *ptr )
     decklink_opts->enable_patch1 = user_opts->enable_patch1;
     decklink_opts->enable_los_exit_ms = user_opts->enable_los_exit_ms;
     decklink_opts->enable_allow_1080p60 = user_opts->enable_allow_1080p60;
+    decklink_opts->replay_location = user_opts->location;
 
     decklink_ctx = &decklink_opts->decklink_ctx;
 
@@ -495,7 +495,7 @@ static void deliver_audio_frame(dektec_opts_t *opts, unsigned char *plane, int s
 
 	rf->release_data = obe_release_audio_data;
 	rf->release_frame = obe_release_frame;
-	rf->input_stream_id = 1;
+	rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_AUDIO);
 
 	if (add_to_filter_queue(ctx->h, rf) < 0 ) {
 	}
@@ -573,6 +573,8 @@ static void deliver_video_frame(dektec_opts_t *opts, unsigned char *plane, int s
 		//raw_frame->avfm.hw_audio_correction_clk = clock_offset;
 			//avfm_dump(&raw_frame->avfm);
 
+		raw_frame->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_VIDEO);
+
 		if (add_to_filter_queue(ctx->h, raw_frame) < 0 ) {
 		}
 
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "sdi_record.h"
+
+/* The writer maps a window of the file and grows it in large steps, so a capture
+ * callback only ever pays for a memcpy. When a window is full we kick off writeback
+ * for it and map the next one.
+ */
+#define SDI_RECORD_WINDOW (64 * 1024 * 1024)
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((uint64_t)(a) - 1))
+
+struct sdi_record_s
+{
+	int fd;
+	struct sdi_record_header_s hdr;
+
+	uint8_t *map;
+	uint64_t map_offset;   /* File offset of map[0] */
+	uint64_t map_len;
+	uint64_t pos;          /* Next write, absolute file offset */
+	uint64_t seq;
+};
+
+struct sdi_replay_s
+{
+	int fd;
+	uint8_t *map;
+	uint64_t size;
+	uint64_t pos;
+	const struct sdi_record_header_s *hdr;
+};
+
+static uint64_t record_size(const struct sdi_record_header_s *hdr, const struct sdi_record_frame_s *f)
+{
+	uint64_t len = sizeof(*f);
+	len += f->video_bytes;
+	len += (uint64_t)f->audio_samples * hdr->audio_channels * sizeof(int32_t);
+	len += (uint64_t)f->vanc_lines * (sizeof(struct sdi_record_vanc_s) + hdr->vanc_line_bytes);
+
+	return ALIGN_UP(len, SDI_RECORD_ALIGN);
+}
+
+static int record_map_window(struct sdi_record_s *ctx, uint64_t needed)
+{
+	if (ctx->map) {
+#if defined(__linux__)
+		/* Start writeback of the window we're leaving, so dirty pages don't pile up. */
+		sync_file_range(ctx->fd, ctx->map_offset, ctx->map_len, SYNC_FILE_RANGE_WRITE);
+#endif
+		munmap(ctx->map, ctx->map_len);
+		ctx->map = NULL;
+	}
+
+	long pagesize = sysconf(_SC_PAGESIZE);
+	uint64_t offset = ctx->pos & ~((uint64_t)pagesize - 1);
+	uint64_t len = ALIGN_UP((ctx->pos - offset) + needed, pagesize);
+	if (len < SDI_RECORD_WINDOW)
+		len = SDI_RECORD_WINDOW;
+
+#if defined(__linux__)
+	if (posix_fallocate(ctx->fd, offset, len) != 0)
+#endif
+	{
+		if (ftruncate(ctx->fd, offset + len) < 0)
+			return -1;
+	}
+
+	ctx->map = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, offset);
+	if (ctx->map == MAP_FAILED) {
+		ctx->map = NULL;
+		return -1;
+	}
+	ctx->map_offset = offset;
+	ctx->map_len = len;
+
+	return 0;
+}
+
+int sdi_record_open(struct sdi_record_s **p, const char *filename, const struct sdi_record_header_s *hdr)
+{
+	struct sdi_record_s *ctx = (struct sdi_record_s *)calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (ctx->fd < 0) {
+		free(ctx);
+		return -1;
+	}
+
+	ctx->hdr = *hdr;
+	memcpy(ctx->hdr.magic, SDI_RECORD_MAGIC, sizeof(ctx->hdr.magic));
+	ctx->hdr.version = SDI_RECORD_VERSION;
+	ctx->hdr.header_size = ALIGN_UP(sizeof(ctx->hdr), SDI_RECORD_ALIGN);
+	ctx->hdr.frame_count = 0;
+
+	if (record_map_window(ctx, ctx->hdr.header_size) < 0) {
+		close(ctx->fd);
+		free(ctx);
+		return -1;
+	}
+	memcpy(ctx->map, &ctx->hdr, sizeof(ctx->hdr));
+	ctx->pos = ctx->hdr.header_size;
+
+	*p = ctx;
+	return 0;
+}
+
+int sdi_record_write(struct sdi_record_s *ctx, struct sdi_record_frame_s *f,
+	const void *video, const void *audio,
+	const uint32_t *vanc_line_nrs, const void * const *vanc_lines)
+{
+	f->magic = SDI_RECORD_FRAME_MAGIC;
+	f->seq = ctx->seq;
+	if (!video)
+		f->video_bytes = 0;
+	if (!audio)
+		f->audio_samples = 0;
+
+	/* The geometry is fixed for the life of a recording, the caller starts a new one when it changes. */
+	if (f->video_bytes > (uint64_t)ctx->hdr.stride * ctx->hdr.height)
+		return -1;
+	f->size = record_size(&ctx->hdr, f);
+
+	if (ctx->pos + f->size > ctx->map_offset + ctx->map_len) {
+		if (record_map_window(ctx, f->size) < 0)
+			return -1;
+	}
+
+	uint8_t *dst = ctx->map + (ctx->pos - ctx->map_offset);
+	uint8_t *end = dst + f->size;
+
+	memcpy(dst, f, sizeof(*f));
+	dst += sizeof(*f);
+
+	if (f->video_bytes) {
+		memcpy(dst, video, f->video_bytes);
+		dst += f->video_bytes;
+	}
+
+	uint32_t audio_bytes = f->audio_samples * ctx->hdr.audio_channels * sizeof(int32_t);
+	if (audio_bytes) {
+		memcpy(dst, audio, audio_bytes);
+		dst += audio_bytes;
+	}
+
+	for (uint32_t i = 0; i < f->vanc_lines; i++) {
+		struct sdi_record_vanc_s v = { vanc_line_nrs[i], 0 };
+		memcpy(dst, &v, sizeof(v));
+		dst += sizeof(v);
+		memcpy(dst, vanc_lines[i], ctx->hdr.vanc_line_bytes);
+		dst += ctx->hdr.vanc_line_bytes;
+	}
+
+	/* Padding, keep the file deterministic. */
+	memset(dst, 0, end - dst);
+
+	ctx->pos += f->size;
+	ctx->seq++;
+
+	return 0;
+}
+
+const struct sdi_record_header_s *sdi_record_header(struct sdi_record_s *ctx)
+{
+	return &ctx->hdr;
+}
+
+uint64_t sdi_record_frame_count(struct sdi_record_s *ctx)
+{
+	return ctx->seq;
+}
+
+void sdi_record_close(struct sdi_record_s *ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->map)
+		munmap(ctx->map, ctx->map_len);
+
+	/* Trim the preallocated tail and finalize the header. */
+	if (ftruncate(ctx->fd, ctx->pos) < 0)
+		perror("sdi_record ftruncate");
+	ctx->hdr.frame_count = ctx->seq;
+	if (pwrite(ctx->fd, &ctx->hdr, sizeof(ctx->hdr), 0) != sizeof(ctx->hdr))
+		perror("sdi_record pwrite");
+
+	close(ctx->fd);
+	free(ctx);
+}
+
+int sdi_replay_open(struct sdi_replay_s **p, const char *filename)
+{
+	struct sdi_replay_s *ctx = (struct sdi_replay_s *)calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->fd = open(filename, O_RDONLY);
+	if (ctx->fd < 0) {
+		free(ctx);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(ctx->fd, &st) < 0 || (uint64_t)st.st_size < sizeof(struct sdi_record_header_s)) {
+		close(ctx->fd);
+		free(ctx);
+		return -1;
+	}
+	ctx->size = st.st_size;
+
+	ctx->map = (uint8_t *)mmap(NULL, ctx->size, PROT_READ, MAP_SHARED, ctx->fd, 0);
+	if (ctx->map == MAP_FAILED) {
+		close(ctx->fd);
+		free(ctx);
+		return -1;
+	}
+	madvise(ctx->map, ctx->size, MADV_SEQUENTIAL);
+
+	ctx->hdr = (const struct sdi_record_header_s *)ctx->map;
+	if (memcmp(ctx->hdr->magic, SDI_RECORD_MAGIC, sizeof(ctx->hdr->magic)) != 0 ||
+		ctx->hdr->version != SDI_RECORD_VERSION ||
+		ctx->hdr->header_size > ctx->size ||
+		(uint64_t)ctx->hdr->stride * ctx->hdr->height > UINT32_MAX) {
+		sdi_replay_close(ctx);
+		return -1;
+	}
+
+	ctx->pos = ctx->hdr->header_size;
+
+	*p = ctx;
+	return 0;
+}
+
+const struct sdi_record_header_s *sdi_replay_header(struct sdi_replay_s *ctx)
+{
+	return ctx->hdr;
+}
+
+int sdi_replay_next(struct sdi_replay_s *ctx, struct sdi_replay_frame_s *frame)
+{
+	if (ctx->pos + sizeof(struct sdi_record_frame_s) > ctx->size)
+		return 1;
+
+	const struct sdi_record_frame_s *f = (const struct sdi_record_frame_s *)(ctx->map + ctx->pos);
+	if (f->magic == 0 && f->size == 0)
+		return 1; /* Preallocated tail of a recording that wasn't closed */
+	if (f->magic != SDI_RECORD_FRAME_MAGIC || f->size != record_size(ctx->hdr, f) || ctx->pos + f->size > ctx->size)
+		return -1;
+
+	/* Replay hands out a frame buffer sized from the header, a record can't be larger. */
+	if (f->video_bytes > (uint64_t)ctx->hdr->stride * ctx->hdr->height)
+		return -1;
+
+	const uint8_t *p = (const uint8_t *)(f + 1);
+	frame->hdr = f;
+	frame->video = f->video_bytes ? p : NULL;
+	p += f->video_bytes;
+	frame->audio = f->audio_samples ? p : NULL;
+	p += (uint64_t)f->audio_samples * ctx->hdr->audio_channels * sizeof(int32_t);
+	frame->vanc = f->vanc_lines ? p : NULL;
+
+	ctx->pos += f->size;
+
+	return 0;
+}
+
+void sdi_replay_rewind(struct sdi_replay_s *ctx)
+{
+	ctx->pos = ctx->hdr->header_size;
+}
+
+const void *sdi_replay_vanc_line(struct sdi_replay_s *ctx, const struct sdi_replay_frame_s *frame, uint32_t line_nr)
+{
+	const uint8_t *p = frame->vanc;
+
+	for (uint32_t i = 0; i < frame->hdr->vanc_lines; i++) {
+		const struct sdi_record_vanc_s *v = (const struct sdi_record_vanc_s *)p;
+		if (v->line_nr == line_nr)
+			return p + sizeof(*v);
+		p += sizeof(*v) + ctx->hdr->vanc_line_bytes;
+	}
+
+	return NULL;
+}
+
+void sdi_replay_close(struct sdi_replay_s *ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->map)
+		munmap(ctx->map, ctx->size);
+	close(ctx->fd);
+	free(ctx);
+}
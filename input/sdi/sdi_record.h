@@ -0,0 +1,133 @@
+#ifndef SDI_RECORD_H
+#define SDI_RECORD_H
+
+/* SDI capture record and replay.
+ *
+ * A segment file holds everything a hardware callback saw for each frame: the raw v210
+ * video, interleaved S32 PCM, the raw v210 VANC lines the hardware exposed, and the
+ * hardware clocks (the inputs to avfm_s). Replaying a segment back through the same
+ * capture callback reproduces LOS glitches, SMPTE337 detection flaps and caption drops
+ * without the original feed.
+ *
+ * Layout: sdi_record_header_s, then one record per callback:
+ *   sdi_record_frame_s
+ *   video_bytes of v210
+ *   audio_samples * audio_channels * 4 bytes of interleaved S32 PCM
+ *   vanc_lines * (sdi_record_vanc_s + vanc_line_bytes of v210)
+ * Every record starts 64 byte aligned. Fields are host endian.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDI_RECORD_MAGIC        "OBESDIR1"
+#define SDI_RECORD_VERSION      1
+#define SDI_RECORD_FRAME_MAGIC  0x4d415246 /* 'FRAM' */
+#define SDI_RECORD_ALIGN        64
+
+/* Card indexes the record controls can address, see sdi_input.record_frames */
+#define SDI_RECORD_MAX_CARDS    16
+
+struct sdi_record_header_s
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_size;
+
+	int32_t  video_format;      /* INPUT_VIDEO_FORMAT_* */
+	uint32_t width;
+	uint32_t height;            /* Coded height, Eg. 486 for NTSC */
+	uint32_t stride;            /* Bytes per v210 row */
+	uint32_t timebase_num;
+	uint32_t timebase_den;
+	uint32_t interlaced;
+	uint32_t tff;
+	uint32_t audio_channels;
+	uint32_t vanc_line_bytes;
+
+	int64_t  created_us;        /* Wall clock, microseconds since the epoch */
+	uint64_t frame_count;       /* Updated on close, zero if the recorder didn't exit cleanly */
+	uint8_t  reserved[48];
+};
+
+#define SDI_RECORD_FLAG_VIDEO     (1 << 0)
+#define SDI_RECORD_FLAG_AUDIO     (1 << 1)
+#define SDI_RECORD_FLAG_NO_SIGNAL (1 << 2)
+
+struct sdi_record_frame_s
+{
+	uint32_t magic;
+	uint32_t size;              /* Entire record, including padding */
+	uint64_t seq;
+	uint32_t flags;             /* SDI_RECORD_FLAG_* */
+	uint32_t hw_flags;          /* Hardware specific frame flags, Eg. BMDFrameFlags */
+	uint32_t video_bytes;
+	uint32_t audio_samples;     /* Per channel */
+	uint32_t vanc_lines;
+	uint32_t reserved0;
+
+	/* Hardware clocks, 27MHz. */
+	int64_t  video_pts;
+	int64_t  video_duration;
+	int64_t  audio_pts;
+
+	/* Wall clock the callback fired, as avfm_set_hw_received_time() would have seen it. */
+	int64_t  hw_received_us;
+	int64_t  reserved1[2];
+};
+
+struct sdi_record_vanc_s
+{
+	uint32_t line_nr;
+	uint32_t reserved;
+};
+
+/* Writer. Safe to call from a capture callback, the payload is copied into a
+ * shared mapping of the file and written back by the kernel. Width, height, stride,
+ * video format and audio channels are fixed by the header, a writer whose signal
+ * changes must close and open a new recording. sdi_record_write() fails a frame
+ * larger than the header allows.
+ */
+struct sdi_record_s;
+
+int  sdi_record_open(struct sdi_record_s **ctx, const char *filename, const struct sdi_record_header_s *hdr);
+int  sdi_record_write(struct sdi_record_s *ctx, struct sdi_record_frame_s *frame,
+	const void *video, const void *audio,
+	const uint32_t *vanc_line_nrs, const void * const *vanc_lines);
+const struct sdi_record_header_s *sdi_record_header(struct sdi_record_s *ctx);
+uint64_t sdi_record_frame_count(struct sdi_record_s *ctx);
+void sdi_record_close(struct sdi_record_s *ctx);
+
+/* Reader */
+struct sdi_replay_s;
+
+struct sdi_replay_frame_s
+{
+	const struct sdi_record_frame_s *hdr;
+	const uint8_t *video;
+	const uint8_t *audio;
+	const uint8_t *vanc;
+};
+
+int  sdi_replay_open(struct sdi_replay_s **ctx, const char *filename);
+const struct sdi_record_header_s *sdi_replay_header(struct sdi_replay_s *ctx);
+
+/* Returns 0 with the next record, 1 at end of file, < 0 if the file is truncated or corrupt.
+ * video_bytes never exceeds the header's stride * height.
+ */
+int  sdi_replay_next(struct sdi_replay_s *ctx, struct sdi_replay_frame_s *frame);
+void sdi_replay_rewind(struct sdi_replay_s *ctx);
+
+/* Returns the v210 payload for a VANC line, or NULL if the hardware didn't provide it. */
+const void *sdi_replay_vanc_line(struct sdi_replay_s *ctx, const struct sdi_replay_frame_s *frame, uint32_t line_nr);
+
+void sdi_replay_close(struct sdi_replay_s *ctx);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SDI_RECORD_H */
@@ -24,6 +24,10 @@
 #include <stdint.h>
 #include <unistd.h>
 #include "smpte337_detector.h"
+#include "common/mirror_ring.h"
+
+/* Packed 16bit word stream, see smpte337_scan.h. A frame of 16 channels is ~6.4KB per pair. */
+#define RING_SIZE (32 * 1024)
 
 struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback cb, void *cbContext)
 {
@@ -33,154 +37,43 @@ struct smpte337_detector_s *smpte337_detector_alloc(smpte337_detector_callback c
 
 	ctx->cb = cb;
 	ctx->cbContext = cbContext;
-	ctx->rb = rb_new_threadsafe(32 * 1024, 256 * 1024);
-	if (!ctx->rb) {
+	ctx->ring = mirror_ring_alloc(RING_SIZE, "obe-smpte337");
+	if (!ctx->ring) {
 		free(ctx);
 		return NULL;
 	}
+	smpte337_scan_init(&ctx->scan);
 
 	return ctx;
 }
 
 void smpte337_detector_free(struct smpte337_detector_s *ctx)
 {
-	rb_free(ctx->rb);
+	mirror_ring_free(ctx->ring);
 	free(ctx);
 }
 
-static void handleCallback(struct smpte337_detector_s *ctx, uint8_t datamode, uint8_t datatype,
-	uint32_t payload_bitCount, uint8_t *payload)
+static void handleCallback(void *opaque, uint8_t datamode, uint8_t datatype,
+	uint32_t payload_bitCount, uint8_t *payload, uint64_t offset)
 {
+	struct smpte337_detector_s *ctx = opaque;
 	ctx->cb(ctx->cbContext, ctx, datamode, datatype, payload_bitCount, payload);
 }
 
 /* 16b mode is largely untested, fair wanring. */
-static size_t smpte337_detector_write_16b(struct smpte337_detector_s *ctx, uint8_t *buf,
-	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame,
-	uint32_t frameStrideBytes,
-	uint32_t spanCount)
+static void smpte337_detector_pack_16b(uint8_t *dst, const uint8_t *buf, uint32_t audioFrames,
+	uint32_t frameStrideBytes, uint32_t spanCount)
 {
-	size_t consumed = 0;
-
-	uint16_t *p = (uint16_t *)buf;
 	for (int i = 0; i < audioFrames; i++) {
-
-		uint16_t *q = p;
+		const uint8_t *x = buf;
 		for (int k = 0; k < spanCount; k++) {
-			/* Sample in N words into a byte orientied buffer */
-			uint8_t *x = (uint8_t *)q;
-
 			/* Flush the word into the fifo MSB first */
-			int didOverflow = 0;
-			rb_write_with_state(ctx->rb, ((const char *)x) + 1, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			rb_write_with_state(ctx->rb, ((const char *)x) + 0, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			q++;
-			consumed += 2;
+			*dst++ = x[1];
+			*dst++ = x[0];
+			x += 2;
 		}
-
-		p += (frameStrideBytes / sizeof(uint16_t));
+		buf += frameStrideBytes;
 	}
-	return consumed;
-}
-
-static size_t smpte337_detector_write_32b(struct smpte337_detector_s *ctx, uint8_t *buf,
-	uint32_t audioFrames, uint32_t sampleDepth, uint32_t channelsPerFrame,
-	uint32_t frameStrideBytes,
-	uint32_t spanCount)
-{
-	size_t consumed = 0;
-
-	uint32_t *p = (uint32_t *)buf;
-	for (int i = 0; i < audioFrames; i++) {
-
-		uint32_t *q = p;
-		for (int k = 0; k < spanCount; k++) {
-			/* Sample in N words into a byte orientied buffer */
-			uint8_t *x = (uint8_t *)q;
-
-			/* Flush the word into the fifo MSB first */
-			int didOverflow = 0;
-			rb_write_with_state(ctx->rb, ((const char *)x) + 3, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			rb_write_with_state(ctx->rb, ((const char *)x) + 2, 1, &didOverflow);
-			if (didOverflow) {
-				fprintf(stderr, "overflow occured.\n");
-			}
-			q++;
-			consumed += 2;
-		}
-
-		p += (frameStrideBytes / sizeof(uint32_t));
-	}
-	return consumed;
-}
-
-static void run_detector(struct smpte337_detector_s *ctx)
-{
-	int skipped = 0;
-
-#define PEEK_LEN 16
-	uint8_t dat[PEEK_LEN];
-	while(1) {
-		if (rb_used(ctx->rb) < PEEK_LEN)
-			break;
-
-		if (rb_peek(ctx->rb, (char *)&dat[0], PEEK_LEN) < PEEK_LEN)
-			break;
-
-		/* Find the supported patterns - In this case, AC3 only in 16bit mode */
-		/* See SMPTE 337M 2015 spec table 6.
-		 * Pa = dat0/1
-		 * Pb = dat2/3 ... etc
-		 */
-		if (dat[0] == 0xF8 && dat[1] == 0x72 && dat[2] == 0x4e && dat[3] == 0x1f) {
-			/* Confirmed.... pa = 16bit, pb = 16bit */
-
-			/* Check the burst_info.... */
-			if ((dat[5] & 0x1f) == 0x01) {
-				/* Bits 0-4 datatype, 1 = AC3 */
-				/* Bits 5-6 datamode, 0 = 16bit */
-				/* Bits   7 errorflg, 0 = no error */
-				uint32_t payload_bitCount = (dat[6] << 8) | dat[7];
-				uint32_t payload_byteCount = payload_bitCount / 8;
-				
-				if (rb_used(ctx->rb) >= (8 + payload_byteCount)) {
-					char *payload = NULL;
-					size_t l = rb_read_alloc(ctx->rb, &payload, 8 + payload_byteCount);
-					if (l != (8 + payload_byteCount)) {
-						fprintf(stderr, "[smpte337_detector] Warning, rb read failure.\n");
-
-						/* Intensionally flush the ring and start acquisition again. */
-						rb_empty(ctx->rb);
-					} else {
-						handleCallback(ctx, (dat[5] >> 5) & 0x03, dat[5] & 0x1f,
-							payload_bitCount, (uint8_t *)payload + 8);
-					}
-					if (payload)
-						free(payload);
-				} else {
-					/* Not enough data in the ring buffer, come back next time. */
-					break;
-				}
-
-			} else {
-				rb_discard(ctx->rb, 1); /* Pop a byte, and continue the search */
-				skipped++;
-			}
-		} else {
-			rb_discard(ctx->rb, 1); /* Pop a byte, and continue the search */
-			skipped++;
-		}
-
-	} /* while */
 }
 
 size_t smpte337_detector_write(struct smpte337_detector_s *ctx, uint8_t *buf,
@@ -193,18 +86,27 @@ size_t smpte337_detector_write(struct smpte337_detector_s *ctx, uint8_t *buf,
 		return 0;
 	}
 
-	size_t ret = 0;
+	size_t len = (size_t)audioFrames * spanCount * 2;
+	if (len > mirror_ring_space(ctx->ring)) {
+		/* Intensionally flush the ring and start acquisition again. */
+		fprintf(stderr, "[smpte337_detector] overflow occured.\n");
+		mirror_ring_flush(ctx->ring);
+		if (len > mirror_ring_space(ctx->ring))
+			return 0;
+	}
+
 	if (sampleDepth == 16) {
-		ret = smpte337_detector_write_16b(ctx, buf, audioFrames, sampleDepth,
-			channelsPerFrame, frameStrideBytes, spanCount);
+		smpte337_detector_pack_16b(mirror_ring_write_ptr(ctx->ring), buf, audioFrames,
+			frameStrideBytes, spanCount);
 	} else
 	if (sampleDepth == 32) {
-		ret = smpte337_detector_write_32b(ctx, buf, audioFrames, sampleDepth,
-			channelsPerFrame, frameStrideBytes, spanCount);
+		ctx->scan.pack(mirror_ring_write_ptr(ctx->ring), buf, audioFrames,
+			frameStrideBytes, spanCount);
 	}
+	mirror_ring_write_commit(ctx->ring, len);
 
 	/* Now all the fifo contains byte stream re-ordered data, run the detector. */
-	run_detector(ctx);
+	smpte337_scan_run(&ctx->scan, ctx->ring, handleCallback, ctx);
 
-	return ret;
+	return len;
 }
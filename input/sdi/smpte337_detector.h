@@ -32,13 +32,14 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
-#include "encoders/audio/ac3bitstream/klringbuffer.h"
+#include "input/sdi/smpte337_scan.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct smpte337_detector_s;
+struct mirror_ring_s;
 
 typedef void (*smpte337_detector_callback)(void *user_context,
 	struct smpte337_detector_s *ctx, 
@@ -47,7 +48,8 @@ typedef void (*smpte337_detector_callback)(void *user_context,
 
 struct smpte337_detector_s
 {
-	KLRingBuffer *rb;
+	struct mirror_ring_s *ring;
+	struct smpte337_scan_s scan;
 
 	smpte337_detector_callback cb;
 	void *cbContext;
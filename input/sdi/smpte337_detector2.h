@@ -32,8 +32,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <pthread.h>
-#include "input/sdi/v4l2/xorg-list.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,21 +40,14 @@ extern "C" {
 struct smpte337_detector2_s;
 struct avfm_s;
 
+/* The payload points into the detector's ring, it is only valid for the duration of the callback.
+ * The callee may modify it in place.
+ */
 typedef void (*smpte337_detector2_callback)(void *user_context,
 	struct smpte337_detector2_s *ctx, 
 	uint8_t datamode, uint8_t datatype, uint32_t payload_bitCount,
 	uint8_t *payload, struct avfm_s *avfm);
 
-struct smpte337_detector2_s
-{
-	struct xorg_list itemList;
-	pthread_mutex_t itemListMutex;
-	int itemListTotalBytes;
-
-	smpte337_detector2_callback cb;
-	void *cbContext;
-};
-
 struct smpte337_detector2_s *smpte337_detector2_alloc(smpte337_detector2_callback cb, void *cbContext);
 
 void smpte337_detector2_free(struct smpte337_detector2_s *ctx);
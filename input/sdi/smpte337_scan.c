@@ -0,0 +1,156 @@
+#include <stdint.h>
+
+#include "smpte337_scan.h"
+#include "common/mirror_ring.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SMPTE337_X86 1
+#include <immintrin.h>
+#else
+#define SMPTE337_X86 0
+#endif
+
+static int find_c(const uint8_t *buf, int len)
+{
+	for (int i = 0; i + 4 <= len; i += 2) {
+		uint32_t v = smpte337_rb32(buf + i);
+		if (v == SMPTE337_PAPB_16 || v == SMPTE337_PAPB_20 || v == SMPTE337_PAPB_24)
+			return i;
+	}
+	return -1;
+}
+
+static void pack_c(uint8_t *dst, const uint8_t *src, int frames, int stride, int span)
+{
+	for (int i = 0; i < frames; i++) {
+		for (int k = 0; k < span; k++) {
+			*dst++ = src[(k * 4) + 3];
+			*dst++ = src[(k * 4) + 2];
+		}
+		src += stride;
+	}
+}
+
+#if SMPTE337_X86
+/* Eight candidate words per pass: compare the stream and the stream one word on
+ * against Pa and Pb, as little endian 16bit lanes.
+ */
+__attribute__((target("sse2")))
+static int find_sse2(const uint8_t *buf, int len)
+{
+	const __m128i pa16 = _mm_set1_epi16((short)0x72F8), pb16 = _mm_set1_epi16((short)0x1F4E);
+	const __m128i pa20 = _mm_set1_epi16((short)0x876F), pb20 = _mm_set1_epi16((short)0xE154);
+	const __m128i pa24 = _mm_set1_epi16((short)0xF896), pb24 = _mm_set1_epi16((short)0x4EA5);
+
+	int i = 0;
+	for (; i + 18 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i + 2));
+		__m128i m = _mm_and_si128(_mm_cmpeq_epi16(a, pa16), _mm_cmpeq_epi16(b, pb16));
+		m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi16(a, pa20), _mm_cmpeq_epi16(b, pb20)));
+		m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi16(a, pa24), _mm_cmpeq_epi16(b, pb24)));
+		int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	int r = find_c(buf + i, len - i);
+	return r < 0 ? -1 : i + r;
+}
+
+/* Pairs only, the common case. Four sample periods per pass. */
+__attribute__((target("sse2")))
+static void pack_sse2(uint8_t *dst, const uint8_t *src, int frames, int stride, int span)
+{
+	if (span != 2) {
+		pack_c(dst, src, frames, stride, span);
+		return;
+	}
+
+	int i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		__m128i a = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src + (0 * stride))),
+		                               _mm_loadl_epi64((const __m128i *)(src + (1 * stride))));
+		__m128i b = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(src + (2 * stride))),
+		                               _mm_loadl_epi64((const __m128i *)(src + (3 * stride))));
+		/* Arithmetic shift keeps the upper half in signed 16bit range, so the pack can't saturate. */
+		__m128i w = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+		w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+		_mm_storeu_si128((__m128i *)dst, w);
+		dst += 16;
+		src += 4 * stride;
+	}
+	pack_c(dst, src, frames - i, stride, span);
+}
+#endif
+
+void smpte337_scan_init(struct smpte337_scan_s *scan)
+{
+	scan->find = find_c;
+	scan->pack = pack_c;
+#if SMPTE337_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		scan->find = find_sse2;
+		scan->pack = pack_sse2;
+	}
+#endif
+}
+
+int smpte337_scan_run(const struct smpte337_scan_s *scan, struct mirror_ring_s *ring,
+	smpte337_scan_burst_cb burst, void *opaque)
+{
+	int skipped_mode = 0;
+
+	while (1) {
+		size_t used = mirror_ring_used(ring);
+		if (used < 8)
+			break;
+
+		const uint8_t *dat = mirror_ring_read_ptr(ring);
+		int pos = scan->find(dat, used);
+		if (pos < 0) {
+			/* Nothing, keep the last word in case it's the first half of a preamble. */
+			mirror_ring_read_consume(ring, used - 2);
+			break;
+		}
+		mirror_ring_read_consume(ring, pos);
+		dat += pos;
+		used -= pos;
+		if (used < 8)
+			break;
+
+		/* See SMPTE 337M 2015 spec table 6.
+		 * Pa = dat0/1
+		 * Pb = dat2/3 ... etc
+		 */
+		if (smpte337_rb32(dat) != SMPTE337_PAPB_16) {
+			skipped_mode = smpte337_rb32(dat) == SMPTE337_PAPB_20 ? 20 : 24;
+			mirror_ring_read_consume(ring, 2); /* Skip the preamble, and continue the search */
+			continue;
+		}
+
+		/* Check the burst_info.... */
+		/* Bits 0-4 datatype, 1 = AC3 */
+		/* Bits 5-6 datamode, 0 = 16bit */
+		/* Bits   7 errorflg, 0 = no error */
+		if ((dat[5] & 0x1f) != 0x01) {
+			mirror_ring_read_consume(ring, 2);
+			continue;
+		}
+
+		uint32_t payload_bitCount = (dat[6] << 8) | dat[7];
+		uint32_t payload_byteCount = payload_bitCount / 8;
+		if (used < 8 + payload_byteCount) {
+			/* Not enough data in the ring buffer, come back next time. */
+			break;
+		}
+
+		burst(opaque, (dat[5] >> 5) & 0x03, dat[5] & 0x1f,
+			payload_bitCount, (uint8_t *)dat + 8, mirror_ring_tail(ring));
+
+		mirror_ring_read_consume(ring, (8 + payload_byteCount + 1) & ~1);
+	}
+
+	return skipped_mode;
+}
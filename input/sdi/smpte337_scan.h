@@ -0,0 +1,58 @@
+#ifndef _SMPTE337_SCAN_H
+#define _SMPTE337_SCAN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shared by the SMPTE337 detectors. Audio samples are packed into a 16bit big endian
+ * word stream (the upper 16 bits of every sample, as 16bit data mode carries it), and
+ * that stream is searched for the Pa/Pb preamble.
+ */
+
+/* Pa/Pb as seen in the 16bit word stream, 16/20/24bit data modes. Only 16bit mode
+ * bursts can be delivered, the others are recognised so they can be reported and skipped.
+ */
+#define SMPTE337_PAPB_16 0xF8724E1F
+#define SMPTE337_PAPB_20 0x6F8754E1 /* 0x6F872 / 0x54E1F, top 16 bits */
+#define SMPTE337_PAPB_24 0x96F8A54E /* 0x96F872 / 0xA54E1F, top 16 bits */
+
+struct smpte337_scan_s
+{
+	/* Return the first word aligned offset in buf holding a Pa/Pb pair in any data mode, or -1. */
+	int  (*find)(const uint8_t *buf, int len);
+
+	/* Pack span words from each of frames 32bit sample periods, stride bytes apart, writing span * 2 bytes per period. */
+	void (*pack)(uint8_t *dst, const uint8_t *src, int frames, int stride, int span);
+};
+
+/* Pick the fastest implementation this cpu supports. */
+void smpte337_scan_init(struct smpte337_scan_s *scan);
+
+struct mirror_ring_s;
+
+/* An AC-3 burst, payload points into the ring and is only valid for the duration of the call.
+ * offset is the absolute stream offset of the burst's Pa, see mirror_ring_tail().
+ */
+typedef void (*smpte337_scan_burst_cb)(void *opaque, uint8_t datamode, uint8_t datatype,
+	uint32_t payload_bitCount, uint8_t *payload, uint64_t offset);
+
+/* Consume the packed word stream in ring, calling burst for every complete 16bit mode AC-3 burst.
+ * Stops at the first incomplete one, which stays in the ring for the next call.
+ * Returns the data mode (20 or 24) of the last unsupported burst skipped, otherwise 0.
+ */
+int smpte337_scan_run(const struct smpte337_scan_s *scan, struct mirror_ring_s *ring,
+	smpte337_scan_burst_cb burst, void *opaque);
+
+static inline uint32_t smpte337_rb32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _SMPTE337_SCAN_H */
@@ -5,6 +5,13 @@
 
 #include "v210.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define V210_ADF_SSE2 1
+#else
+#define V210_ADF_SSE2 0
+#endif
+
 #define LOCAL_DEBUG 0
 
 /* TODO: duplicate of font from osd.c */
@@ -1377,3 +1384,78 @@ int V210_painter_reset(struct V210_painter_s *ctx, uint8_t *frame, int widthPixe
         return 0;
 }
 
+
+/* Unpack one v210 group (4 words, 6 pixels) into its 12 components, in wire order Cb Y Cr Y ... */
+static inline void V210_unpack_group(const uint32_t *w, uint16_t *c)
+{
+	for (int i = 0; i < 4; i++) {
+		c[(i * 3) + 0] = (w[i]      ) & 0x3ff;
+		c[(i * 3) + 1] = (w[i] >> 10) & 0x3ff;
+		c[(i * 3) + 2] = (w[i] >> 20) & 0x3ff;
+	}
+}
+
+/* Candidate group g holds a 0x3ff component, confirm a real ADF around it.
+ * SD carries ANC in the multiplexed stream (000 3ff 3ff on consecutive words),
+ * HD carries it independently in Y and C (every other word).
+ */
+static int V210_confirm_adf(const uint32_t *line, int groups, int g)
+{
+	uint16_t c[36];
+	int first = g > 0 ? g - 1 : 0;
+	int last = g + 1 < groups ? g + 1 : g;
+	int count = 0;
+
+	for (int i = first; i <= last; i++, count += 12)
+		V210_unpack_group(line + (i * 4), &c[count]);
+
+	for (int i = 0; i + 2 < count; i++) {
+		if (c[i] == 0x000 && c[i + 1] == 0x3ff && c[i + 2] == 0x3ff)
+			return 1;
+		if (i + 4 < count && c[i] == 0x000 && c[i + 2] == 0x3ff && c[i + 4] == 0x3ff)
+			return 1;
+	}
+
+	return 0;
+}
+
+int V210_line_has_adf(const uint32_t *line, int widthPixels)
+{
+	int groups = (widthPixels + 5) / 6;
+	int g = 0;
+
+	/* 0x3ff is illegal as a video sample, so only ADF and TRS words carry it.
+	 * Search for any 10bit field of 0x3ff, four words (one group) at a time.
+	 */
+#if V210_ADF_SSE2
+	const __m128i m0 = _mm_set1_epi32(0x3ff);
+	const __m128i m1 = _mm_set1_epi32(0x3ff << 10);
+	const __m128i m2 = _mm_set1_epi32(0x3ff << 20);
+
+	for (; g < groups; g++) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(line + (g * 4)));
+		__m128i hit = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(v, m0), m0),
+				     _mm_cmpeq_epi32(_mm_and_si128(v, m1), m1)),
+			_mm_cmpeq_epi32(_mm_and_si128(v, m2), m2));
+
+		if (_mm_movemask_epi8(hit) && V210_confirm_adf(line, groups, g))
+			return 1;
+	}
+#else
+	for (; g < groups; g++) {
+		const uint32_t *w = line + (g * 4);
+		int hit = 0;
+		for (int i = 0; i < 4; i++) {
+			if ((w[i] & 0x3ff) == 0x3ff ||
+			    (w[i] & (0x3ff << 10)) == (0x3ff << 10) ||
+			    (w[i] & (0x3ff << 20)) == (0x3ff << 20))
+				hit = 1;
+		}
+		if (hit && V210_confirm_adf(line, groups, g))
+			return 1;
+	}
+#endif
+
+	return 0;
+}
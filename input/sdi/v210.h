@@ -28,6 +28,11 @@ void V210_write_32bit_value(void *frame_bytes, uint32_t stride, uint32_t value,
 
 uint32_t V210_read_32bit_value(void *frame_bytes, uint32_t stride, uint32_t lineNr, double scalefactor);
 
+/* Fast pre-scan of a packed v210 VANC line, returns 1 if it contains an
+ * ancillary data flag (0x000 0x3ff 0x3ff), without unpacking the line.
+ */
+int  V210_line_has_adf(const uint32_t *line, int widthPixels);
+
 /* Write text to V210 packed planes */
 int  V210_painter_reset(struct V210_painter_s *ctx, uint8_t *frame, int widthPixels, int heightPixels, int strideBytes, int interlaced);
 void V210_painter_draw_ascii_at(struct V210_painter_s *ctx, int x, int y, const char *str);
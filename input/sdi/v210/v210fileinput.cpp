@@ -47,65 +47,134 @@ extern "C"
 #include "input/sdi/ancillary.h"
 #include "input/sdi/vbi.h"
 #include "input/sdi/x86/sdi.h"
+#include "input/sdi/v210.h"
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/mathematics.h>
 #include <libavutil/bswap.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 }
 
+/* File driven capture emulator, a hardware free load generator.
+ *
+ * <location>        raw v210 frames, back to back, in the user selected video-format.
+ *                   Without a location we fall back to the historical raw-input<card-idx>.v210.
+ * <location>.pcm    optional, interleaved S32LE 48KHz PCM, v210_input.audio_channels wide.
+ *                   Eg. ffmpeg -i src.ts -f s32le -ar 48000 -ac 2 clip.v210.pcm
+ * <location>.vanc   optional, a 16 byte header (OBEVANC1, u32le lines per frame, u32le first line number)
+ *                   then per frame that many v210 lines at the video stride.
+ *
+ * A decode thread converts frames ahead of time (libavcodec v210 with slice threads), a pacing thread
+ * releases them on absolute CLOCK_MONOTONIC deadlines so the interval is exact, including 1001 rates.
+ * Audio follows the SDI sample cadence (1602/1601/.. at 29.97) and loops with the video.
+ */
+
+int g_v210_input_audio_channels = 2;
+
+#define V210_DECODE_AHEAD 4
+#define V210_VANC_MAGIC "OBEVANC1"
+
 struct obe_to_v210_video
 {
     int obe_name;
     int width, height;
-    uint32_t reserved;
     int timebase_num;
     int timebase_den;
+    int interlaced;
 };
 
 const static struct obe_to_v210_video video_format_tab[] =
 {
-    { INPUT_VIDEO_FORMAT_720P_5994, 1280, 720, 0 /* bmdModeHD720p60 */, 1001, 60000 },
-    { INPUT_VIDEO_FORMAT_720P_60,   1280, 720, 0 /* bmdModeHD720p60 */, 1000, 60000 },
+    { INPUT_VIDEO_FORMAT_PAL,          720,  576, 1,    25,    1 },
+    { INPUT_VIDEO_FORMAT_NTSC,         720,  486, 1001, 30000, 1 },
+    { INPUT_VIDEO_FORMAT_720P_2997,   1280,  720, 1001, 30000, 0 },
+    { INPUT_VIDEO_FORMAT_720P_50,     1280,  720, 1,    50,    0 },
+    { INPUT_VIDEO_FORMAT_720P_5994,   1280,  720, 1001, 60000, 0 },
+    { INPUT_VIDEO_FORMAT_720P_60,     1280,  720, 1,    60,    0 },
+    { INPUT_VIDEO_FORMAT_1080I_50,    1920, 1080, 1,    25,    1 },
+    { INPUT_VIDEO_FORMAT_1080I_5994,  1920, 1080, 1001, 30000, 1 },
+    { INPUT_VIDEO_FORMAT_1080I_60,    1920, 1080, 1,    30,    1 },
+    { INPUT_VIDEO_FORMAT_1080P_2398,  1920, 1080, 1001, 24000, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_24,    1920, 1080, 1,    24,    0 },
+    { INPUT_VIDEO_FORMAT_1080P_25,    1920, 1080, 1,    25,    0 },
+    { INPUT_VIDEO_FORMAT_1080P_2997,  1920, 1080, 1001, 30000, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_30,    1920, 1080, 1,    30,    0 },
+    { INPUT_VIDEO_FORMAT_1080P_50,    1920, 1080, 1,    50,    0 },
+    { INPUT_VIDEO_FORMAT_1080P_5994,  1920, 1080, 1001, 60000, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_60,    1920, 1080, 1,    60,    0 },
+    { INPUT_VIDEO_FORMAT_2160P_25,    3840, 2160, 1,    25,    0 },
+    { INPUT_VIDEO_FORMAT_2160P_2997,  3840, 2160, 1001, 30000, 0 },
+    { INPUT_VIDEO_FORMAT_2160P_30,    3840, 2160, 1,    30,    0 },
+    { INPUT_VIDEO_FORMAT_2160P_50,    3840, 2160, 1,    50,    0 },
+    { INPUT_VIDEO_FORMAT_2160P_5994,  3840, 2160, 1001, 60000, 0 },
+    { INPUT_VIDEO_FORMAT_2160P_60,    3840, 2160, 1,    60,    0 },
 };
 
-static int lookupOBEName(int w, int h, int den, int num)
+static const struct obe_to_v210_video *lookupOBEFormat(int obe_name)
 {
 	for (unsigned int i = 0; i < (sizeof(video_format_tab) / sizeof(struct obe_to_v210_video)); i++) {
-		const struct obe_to_v210_video *fmt = &video_format_tab[i];
-		if ((fmt->width == w) && (fmt->height == h) &&
-			(fmt->timebase_den == den) && (fmt->timebase_num == num))
-		{
-			return fmt->obe_name;
-		}
+		if (video_format_tab[i].obe_name == obe_name)
+			return &video_format_tab[i];
 	}
 
-	return video_format_tab[0].obe_name;
+	/* Historical default */
+	return &video_format_tab[4];
 }
 
+/* A mapped input file */
+struct v210_file_s
+{
+	int fd;
+	uint8_t *addr;
+	int64_t size;
+};
+
+/* One decoded frame waiting for its deadline */
+struct v210_item_s
+{
+	obe_raw_frame_t *video;
+	obe_raw_frame_t *audio;
+};
+
 typedef struct
 {
 	/* V210 input related */
-	int v210_fd;
-	uint8_t *v210_addr;
-	int64_t v210_file_size;
+	struct v210_file_s video;
 	unsigned int frameSizeBytesVideo;
 	unsigned int totalInputFrames;
 	unsigned int currentFrame;
 	uint64_t v_counter;
 
+	/* Sidecars */
+	struct v210_file_s audio;
+	int64_t totalAudioSamples;
+	struct v210_file_s vanc;
+	unsigned int vancLinesPerFrame;
+	unsigned int vancFirstLine;
+	uint16_t *vancUnpacked;
+	void (*unpack_line)(uint32_t *src, uint16_t *dst, int width);
+	obe_sdi_non_display_data_t non_display_parser;
+
 	/* AVCodec for V210 conversion. */
-	AVCodec         *dec;
+	const AVCodec   *dec;
 	AVCodecContext  *codec;
 	/* End: AVCodec for V210 conversion. */
 
-	pthread_t vthreadId;
-	int vthreadTerminate, vthreadRunning, vthreadComplete;
+	/* Decoded frames, handed from the decode thread to the pacing thread. */
+	obe_queue_t queue;
+
+	pthread_t dthreadId, vthreadId;
+	int dthreadRunning, vthreadRunning;
+	volatile int threadTerminate;
+
+	uint64_t lateFrames;
 
 	obe_device_t *device;
 	obe_t *h;
 
 	AVRational   v_timebase;
+	int64_t      v_duration; /* 27MHz */
 } v210_ctx_t;
 
 typedef struct
@@ -114,9 +183,11 @@ typedef struct
 
     /* Input */
     int card_idx;
+    const char *location;
 
     int video_format;
     int num_channels;
+    int audio_channels;
 
     /* True if we're problem, else false during normal streaming. */
     int probe;
@@ -126,6 +197,7 @@ typedef struct
 
     int width;
     int height;
+    int stride;
     int timebase_num;
     int timebase_den;
 
@@ -133,78 +205,302 @@ typedef struct
     int tff;
 } v210_opts_t;
 
-static uint8_t *getNextFrameAddress(v210_opts_t *opts)
+static int v210_file_open(struct v210_file_s *f, const char *fn)
 {
-	v210_ctx_t *ctx = &opts->ctx;
+	f->fd = open(fn, O_RDONLY
+#if defined(__linux__)
+		| O_LARGEFILE
+#endif
+		);
+	if (f->fd < 0)
+		return -1;
 
-	if (ctx->currentFrame + 1 >= ctx->totalInputFrames) {
-		ctx->currentFrame = 0;
-	} else
-		ctx->currentFrame++;
+	struct stat buf;
+	if (fstat(f->fd, &buf) < 0 || buf.st_size == 0) {
+		close(f->fd);
+		f->fd = -1;
+		return -1;
+	}
+	f->size = buf.st_size;
+
+	/* Fault every page in now, a load generator shouldn't stall on disk mid stream. */
+	int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+	flags |= MAP_POPULATE;
+#endif
+	f->addr = (uint8_t *)mmap(NULL, f->size, PROT_READ, flags, f->fd, 0);
+	if (f->addr == MAP_FAILED) {
+		perror("mmap");
+		close(f->fd);
+		f->fd = -1;
+		f->addr = NULL;
+		return -1;
+	}
 
-	return ctx->v210_addr + (ctx->currentFrame * ctx->frameSizeBytesVideo);
+	printf(MODULE_PREFIX "Mapped '%s', %" PRIi64 " bytes at %p\n", fn, f->size, f->addr);
+
+	return 0;
 }
 
-static void *v210_videoThreadFunc(void *p)
+static void v210_file_close(struct v210_file_s *f)
+{
+	if (f->addr)
+		munmap(f->addr, f->size);
+	if (f->fd >= 0)
+		close(f->fd);
+	f->addr = NULL;
+	f->fd = -1;
+}
+
+/* SDI audio cadence, the number of 48KHz samples that belong to frame n. */
+static int64_t audioSampleOffset(v210_opts_t *opts, uint64_t frame)
+{
+	return av_rescale(frame, (int64_t)48000 * opts->timebase_num, opts->timebase_den);
+}
+
+static obe_raw_frame_t *buildAudioFrame(v210_opts_t *opts, unsigned int frameNr)
 {
-	v210_opts_t *opts = (v210_opts_t *)p;
 	v210_ctx_t *ctx = &opts->ctx;
 
-	printf(MODULE_PREFIX "Video thread starts\n");
+	if (!ctx->audio.addr || !ctx->totalAudioSamples)
+		return NULL;
 
-	ctx->vthreadRunning = 1;
-	ctx->vthreadComplete = 0;
-	ctx->vthreadTerminate = 0;
+	int64_t first = audioSampleOffset(opts, frameNr);
+	int num_samples = audioSampleOffset(opts, frameNr + 1) - first;
 
-	while (!ctx->vthreadTerminate && opts->probe == 0) {
+	obe_raw_frame_t *raw_frame = new_raw_frame();
+	if (!raw_frame)
+		return NULL;
 
-		/* Ship the payload into the OBE pipeline. */
-		obe_raw_frame_t *raw_frame = new_raw_frame();
-		if (!raw_frame) {
-			fprintf(stderr, MODULE_PREFIX "Could not allocate raw video frame\n");
+	raw_frame->audio_frame.num_samples = num_samples;
+	raw_frame->audio_frame.num_channels = opts->num_channels;
+	raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
+	if (av_samples_alloc(raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize,
+		opts->num_channels, num_samples, AV_SAMPLE_FMT_S32P, 0) < 0) {
+		free(raw_frame);
+		return NULL;
+	}
+	av_samples_set_silence(raw_frame->audio_frame.audio_data, 0, num_samples, opts->num_channels, AV_SAMPLE_FMT_S32P);
+
+	/* Deinterleave into S32P, wrapping at the end of the sidecar. */
+	const int32_t *pcm = (const int32_t *)ctx->audio.addr;
+	int ch = opts->audio_channels;
+	for (int i = 0; i < num_samples; i++) {
+		const int32_t *src = pcm + (((first + i) % ctx->totalAudioSamples) * ch);
+		for (int c = 0; c < ch; c++)
+			((int32_t *)raw_frame->audio_frame.audio_data[c])[i] = src[c];
+	}
+
+	raw_frame->release_data = obe_release_audio_data;
+	raw_frame->release_frame = obe_release_frame;
+	for (int i = 0; i < ctx->device->num_input_streams; i++) {
+		if (ctx->device->input_streams[i]->stream_format == AUDIO_PCM) {
+			raw_frame->input_stream_id = ctx->device->input_streams[i]->input_stream_id;
 			break;
 		}
+	}
 
-		AVFrame *frame = av_frame_alloc();
-		ctx->codec->width = opts->width;
-		ctx->codec->height = opts->height;
+	return raw_frame;
+}
 
-		usleep(166 * 100);
+static void parseVANC(v210_opts_t *opts, obe_raw_frame_t *raw_frame, unsigned int frameNr)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+
+	if (!ctx->vanc.addr || !ctx->vancLinesPerFrame)
+		return;
+
+	int64_t frameBytes = (int64_t)ctx->vancLinesPerFrame * opts->stride;
+	int64_t frames = (ctx->vanc.size - 16) / frameBytes;
+	if (frames <= 0)
+		return;
+
+	uint8_t *p = ctx->vanc.addr + 16 + ((frameNr % frames) * frameBytes);
+	int line = ctx->vancFirstLine;
+	for (unsigned int i = 0; i < ctx->vancLinesPerFrame; i++) {
+		if (V210_line_has_adf((const uint32_t *)p, opts->width)) {
+			ctx->unpack_line((uint32_t *)p, ctx->vancUnpacked, opts->width);
+			parse_vanc_line(ctx->h, &ctx->non_display_parser, raw_frame, ctx->vancUnpacked, opts->width, line);
+		}
+		p += opts->stride;
+		line = sdi_next_line(opts->video_format, line);
+	}
+}
+
+static obe_raw_frame_t *buildVideoFrame(v210_opts_t *opts, unsigned int frameNr)
+{
+	v210_ctx_t *ctx = &opts->ctx;
+
+	obe_raw_frame_t *raw_frame = new_raw_frame();
+	if (!raw_frame) {
+		fprintf(stderr, MODULE_PREFIX "Could not allocate raw video frame\n");
+		return NULL;
+	}
 
-		AVPacket pkt;
-		av_init_packet(&pkt);
+	AVFrame *frame = av_frame_alloc();
+	if (!frame) {
+		free(raw_frame);
+		return NULL;
+	}
 
-		pkt.data = getNextFrameAddress(opts);
-		pkt.size = ctx->frameSizeBytesVideo;
+	AVPacket pkt;
+	av_init_packet(&pkt);
+	pkt.data = ctx->video.addr + ((int64_t)frameNr * ctx->frameSizeBytesVideo);
+	pkt.size = ctx->frameSizeBytesVideo;
+
+	/* obe_get_buffer2 hands us an image we own, released with obe_release_video_data() */
+	int ret = avcodec_send_packet(ctx->codec, &pkt);
+	if (ret >= 0)
+		ret = avcodec_receive_frame(ctx->codec, frame);
+	if (ret < 0) {
+		fprintf(stderr, MODULE_PREFIX "Could not decode frame %d\n", frameNr);
+		av_frame_free(&frame);
+		free(raw_frame);
+		return NULL;
+	}
 
-		int ret = avcodec_send_packet(ctx->codec, &pkt);
-		while (ret >= 0) {
-			ret = avcodec_receive_frame(ctx->codec, frame);
-			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-				return NULL;
-			else if (ret < 0) {
+	raw_frame->release_data = obe_release_video_data;
+	raw_frame->release_frame = obe_release_frame;
+
+	memcpy(raw_frame->alloc_img.stride, frame->linesize, sizeof(raw_frame->alloc_img.stride));
+	memcpy(raw_frame->alloc_img.plane, frame->data, sizeof(raw_frame->alloc_img.plane));
+	av_frame_free(&frame);
+	raw_frame->alloc_img.csp = ctx->codec->pix_fmt;
+	const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
+	raw_frame->alloc_img.planes = d->nb_components;
+	raw_frame->alloc_img.width = opts->width;
+	raw_frame->alloc_img.height = opts->height;
+	raw_frame->alloc_img.format = opts->video_format;
+	raw_frame->timebase_num = opts->timebase_num;
+	raw_frame->timebase_den = opts->timebase_den;
+	memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
+
+	if (IS_SD(opts->video_format)) {
+		int j;
+		for (j = 0; first_active_line[j].format != -1; j++) {
+			if (opts->video_format == first_active_line[j].format)
+				break;
+		}
+		raw_frame->img.first_line = first_active_line[j].line;
+		if (opts->video_format == INPUT_VIDEO_FORMAT_NTSC) {
+			raw_frame->img.height = 480;
+			while (raw_frame->img.first_line != NTSC_FIRST_CODED_LINE) {
+				for (int i = 0; i < raw_frame->img.planes; i++)
+					raw_frame->img.plane[i] += raw_frame->img.stride[i];
+
+				raw_frame->img.first_line = sdi_next_line(INPUT_VIDEO_FORMAT_NTSC, raw_frame->img.first_line);
 			}
+		}
+	}
+	raw_frame->sar_width = raw_frame->sar_height = 1;
+
+	parseVANC(opts, raw_frame, frameNr);
+
+	return raw_frame;
+}
+
+static void releaseItem(struct v210_item_s *item)
+{
+	if (item->video) {
+		item->video->release_data(item->video);
+		item->video->release_frame(item->video);
+	}
+	if (item->audio) {
+		item->audio->release_data(item->audio);
+		item->audio->release_frame(item->audio);
+	}
+	free(item);
+}
+
+/* Converts frames ahead of their deadline, so the pacing thread only has to wait and ship. */
+static void *v210_decodeThreadFunc(void *p)
+{
+	v210_opts_t *opts = (v210_opts_t *)p;
+	v210_ctx_t *ctx = &opts->ctx;
+
+	printf(MODULE_PREFIX "Decode thread starts\n");
+
+	while (!ctx->threadTerminate) {
+		pthread_mutex_lock(&ctx->queue.mutex);
+		while (ctx->queue.size >= V210_DECODE_AHEAD && !ctx->threadTerminate)
+			pthread_cond_wait(&ctx->queue.out_cv, &ctx->queue.mutex);
+		pthread_mutex_unlock(&ctx->queue.mutex);
+
+		if (ctx->threadTerminate)
+			break;
+
+		struct v210_item_s *item = (struct v210_item_s *)calloc(1, sizeof(*item));
+		if (!item)
+			break;
+
+		item->video = buildVideoFrame(opts, ctx->currentFrame);
+		item->audio = buildAudioFrame(opts, ctx->currentFrame);
+		if (!item->video) {
+			releaseItem(item);
 			break;
 		}
 
-		raw_frame->release_data = obe_release_video_data;
-		raw_frame->release_frame = obe_release_frame;
+		if (++ctx->currentFrame >= ctx->totalInputFrames)
+			ctx->currentFrame = 0;
 
-		memcpy(raw_frame->alloc_img.stride, frame->linesize, sizeof(raw_frame->alloc_img.stride));
-		memcpy(raw_frame->alloc_img.plane, frame->data, sizeof(raw_frame->alloc_img.plane));
-		av_frame_free(&frame);
-		raw_frame->alloc_img.csp = ctx->codec->pix_fmt;
-                const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-		raw_frame->alloc_img.planes = d->nb_components;
-		raw_frame->alloc_img.width = opts->width;
-		raw_frame->alloc_img.height = opts->height;
-		raw_frame->alloc_img.format = opts->video_format;
-		raw_frame->timebase_num = opts->timebase_num;
-		raw_frame->timebase_den = opts->timebase_den;
-		memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
-
-		int64_t pts = av_rescale_q(ctx->v_counter++, ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
+		add_to_queue(&ctx->queue, item);
+	}
+
+	printf(MODULE_PREFIX "Decode thread complete\n");
+
+	return NULL;
+}
+
+static void v210_deadline(struct timespec *ts, const struct timespec *start, int64_t ns)
+{
+	ts->tv_sec = start->tv_sec + (ns / 1000000000);
+	ts->tv_nsec = start->tv_nsec + (ns % 1000000000);
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void *v210_videoThreadFunc(void *p)
+{
+	v210_opts_t *opts = (v210_opts_t *)p;
+	v210_ctx_t *ctx = &opts->ctx;
+
+	printf(MODULE_PREFIX "Video thread starts\n");
+
+	struct timespec start, deadline, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!ctx->threadTerminate) {
+
+		pthread_mutex_lock(&ctx->queue.mutex);
+		while (ctx->queue.size == 0 && !ctx->threadTerminate)
+			pthread_cond_wait(&ctx->queue.in_cv, &ctx->queue.mutex);
+		if (ctx->threadTerminate) {
+			pthread_mutex_unlock(&ctx->queue.mutex);
+			break;
+		}
+		struct v210_item_s *item = (struct v210_item_s *)ctx->queue.queue[0];
+		pthread_mutex_unlock(&ctx->queue.mutex);
+		remove_from_queue(&ctx->queue);
+
+		/* Absolute deadlines, computed from the frame count, never accumulate error. */
+		int64_t ns = av_rescale(ctx->v_counter, (int64_t)1000000000 * ctx->v_timebase.num, ctx->v_timebase.den);
+		v210_deadline(&deadline, &start, ns);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && !ctx->threadTerminate)
+			;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t lateness = ((int64_t)(now.tv_sec - deadline.tv_sec) * 1000000000) + (now.tv_nsec - deadline.tv_nsec);
+		if (lateness > av_rescale(1000000000, ctx->v_timebase.num, ctx->v_timebase.den)) {
+			if ((ctx->lateFrames++ % 100) == 0)
+				fprintf(stderr, MODULE_PREFIX "Decode can't keep up, %" PRIu64 " frames late\n", ctx->lateFrames);
+		}
+
+		int64_t pts = av_rescale(ctx->v_counter++, (int64_t)OBE_CLOCK * ctx->v_timebase.num, ctx->v_timebase.den);
 		obe_clock_tick(ctx->h, pts);
+
+		obe_raw_frame_t *raw_frame = item->video;
 		raw_frame->pts = pts;
 
 		/* AVFM */
@@ -216,24 +512,30 @@ static void *v210_videoThreadFunc(void *p)
 		avfm_set_pts_audio(&raw_frame->avfm, pts);
 
 		avfm_set_hw_received_time(&raw_frame->avfm);
-		double dur = 27000000 / (opts->timebase_den / opts->timebase_num);
-		avfm_set_video_interval_clk(&raw_frame->avfm, dur);
-		//raw_frame->avfm.hw_audio_correction_clk = clock_offset;
-			//avfm_dump(&raw_frame->avfm);
+		avfm_set_video_interval_clk(&raw_frame->avfm, ctx->v_duration);
 
 		if (add_to_filter_queue(ctx->h, raw_frame) < 0 ) {
 		}
 
-		if (frame)
-			av_frame_free(&frame);
+		if (item->audio) {
+			raw_frame = item->audio;
+			raw_frame->pts = pts;
+			avfm_init(&raw_frame->avfm, AVFM_AUDIO_PCM);
+			avfm_set_hw_status_mask(&raw_frame->avfm, AVFM_HW_STATUS__BLACKMAGIC_DUPLEX_FULL);
+			avfm_set_pts_video(&raw_frame->avfm, pts);
+			avfm_set_pts_audio(&raw_frame->avfm, pts);
+			avfm_set_hw_received_time(&raw_frame->avfm);
+			avfm_set_video_interval_clk(&raw_frame->avfm, ctx->v_duration);
+
+			if (add_to_filter_queue(ctx->h, raw_frame) < 0 ) {
+			}
+		}
 
-		av_packet_unref(&pkt);
+		free(item);
 	}
 	printf(MODULE_PREFIX "Video thread complete\n");
 
-	ctx->vthreadComplete = 1;
-	pthread_exit(0);
-	return 0;
+	return NULL;
 }
 
 static void close_device(v210_opts_t *opts)
@@ -242,20 +544,35 @@ static void close_device(v210_opts_t *opts)
 
 	printf(MODULE_PREFIX "Closing card idx #%d\n", opts->card_idx);
 
+	pthread_mutex_lock(&ctx->queue.mutex);
+	ctx->threadTerminate = 1;
+	pthread_cond_broadcast(&ctx->queue.in_cv);
+	pthread_cond_broadcast(&ctx->queue.out_cv);
+	pthread_mutex_unlock(&ctx->queue.mutex);
+
 	if (ctx->vthreadRunning) {
-		ctx->vthreadTerminate = 1;
-		while (!ctx->vthreadComplete)
-			usleep(50 * 1000);
+		pthread_join(ctx->vthreadId, NULL);
+		ctx->vthreadRunning = 0;
+	}
+	if (ctx->dthreadRunning) {
+		pthread_join(ctx->dthreadId, NULL);
+		ctx->dthreadRunning = 0;
 	}
 
-	if (ctx->codec) {
-		avcodec_close(ctx->codec);
-		av_free(ctx->codec);
+	while (ctx->queue.size) {
+		releaseItem((struct v210_item_s *)ctx->queue.queue[0]);
+		remove_from_queue(&ctx->queue);
 	}
 
-	munmap(ctx->v210_addr, ctx->v210_file_size);
-	close(ctx->v210_fd);
-	ctx->v210_fd = -1;
+	if (ctx->codec)
+		avcodec_free_context(&ctx->codec);
+
+	obe_destroy_queue(&ctx->queue);
+
+	av_freep(&ctx->vancUnpacked);
+	v210_file_close(&ctx->vanc);
+	v210_file_close(&ctx->audio);
+	v210_file_close(&ctx->video);
 
 	printf(MODULE_PREFIX "Closed card idx #%d\n", opts->card_idx);
 }
@@ -265,96 +582,101 @@ static int open_device(v210_opts_t *opts)
 	printf(MODULE_PREFIX "%s()\n", __func__);
 
 	v210_ctx_t *ctx = &opts->ctx;
+	char fn[256];
 
-	char fn[64];
-	sprintf(fn, "../../raw-input%d.v210", opts->card_idx);
-	printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
+	ctx->video.fd = ctx->audio.fd = ctx->vanc.fd = -1;
+	obe_init_queue(&ctx->queue, (char *)"v210 decoded frames");
 
-	ctx->v210_fd = open(fn,
-#if defined(__linux__)
-		O_LARGEFILE,
-#else
-		0,
-#endif
-		0600); //6 = read+write for me!
-	if (ctx->v210_fd < 0) {
-		fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
-		sprintf(fn, "raw-input%d.v210", opts->card_idx);
-		printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
-		ctx->v210_fd = open(fn,
-#if defined(__linux__)
-			O_LARGEFILE,
-#else
-			0,
-#endif
-			0600); //6 = read+write for me!
-		if (ctx->v210_fd < 0) {
+	const struct obe_to_v210_video *fmt = lookupOBEFormat(opts->video_format);
+	opts->video_format = fmt->obe_name;
+	opts->width = fmt->width;
+	opts->height = fmt->height;
+	opts->interlaced = fmt->interlaced;
+	opts->tff = 1; /* NTSC is bff in baseband but coded as tff */
+	opts->timebase_num = fmt->timebase_num;
+	opts->timebase_den = fmt->timebase_den;
+	opts->stride = ((opts->width + 47) / 48) * 128;
+
+	ctx->v_timebase.num = opts->timebase_num;
+	ctx->v_timebase.den = opts->timebase_den;
+	ctx->v_duration = av_rescale(OBE_CLOCK, opts->timebase_num, opts->timebase_den);
+	ctx->frameSizeBytesVideo = opts->stride * opts->height;
+
+	if (opts->location) {
+		snprintf(fn, sizeof(fn), "%s", opts->location);
+		if (v210_file_open(&ctx->video, fn) < 0) {
 			fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
 			return -1;
 		}
+	} else {
+		sprintf(fn, "../../raw-input%d.v210", opts->card_idx);
+		printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
+		if (v210_file_open(&ctx->video, fn) < 0) {
+			fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
+			sprintf(fn, "raw-input%d.v210", opts->card_idx);
+			printf(MODULE_PREFIX "Searching for V210 filename '%s'\n", fn);
+			if (v210_file_open(&ctx->video, fn) < 0) {
+				fprintf(stderr, MODULE_PREFIX "No input filename '%s' detected.\n", fn);
+				return -1;
+			}
+		}
 	}
 
-	struct stat buf;
-	if (fstat(ctx->v210_fd, &buf) < 0) {
-		close(ctx->v210_fd);
-		ctx->v210_fd = -1;
-		fprintf(stderr, MODULE_PREFIX "Unable to obtain file size.\n");
+	ctx->totalInputFrames = ctx->video.size / ctx->frameSizeBytesVideo;
+	if (ctx->totalInputFrames == 0) {
+		fprintf(stderr, MODULE_PREFIX "'%s' is smaller than a single %dx%d frame.\n", fn, opts->width, opts->height);
 		return -1;
 	}
 
-	ctx->v210_file_size = buf.st_size;
-
-	/* Determine the overall size of the video frame. */
-	ctx->frameSizeBytesVideo = 3456 * 720;
-	ctx->totalInputFrames = ctx->v210_file_size / ctx->frameSizeBytesVideo;
-
-	ctx->v210_addr = (uint8_t *)mmap(NULL, ctx->v210_file_size, PROT_READ, MAP_SHARED, ctx->v210_fd, 0);
-	printf("Mapped %" PRIi64 " bytes at %p, %" PRIu64" frames.\n",
-		ctx->v210_file_size, ctx->v210_addr,
-		ctx->v210_file_size / ctx->frameSizeBytesVideo);
-
-	if (ctx->v210_addr == (void*)-1) {
-		fprintf(stderr, MODULE_PREFIX "Unable to MMAP file.\n");
-		perror("mmap");
-		close(ctx->v210_fd);
-		ctx->v210_fd = -1;
-		return -1;
+	fprintf(stderr, MODULE_PREFIX "Resolution %dx%d @ %d/%d, %d frames\n",
+		opts->width, opts->height,
+		opts->timebase_den, opts->timebase_num, ctx->totalInputFrames);
+
+	/* Optional sidecars */
+	char sfn[512];
+	snprintf(sfn, sizeof(sfn), "%s.pcm", fn);
+	if (v210_file_open(&ctx->audio, sfn) == 0) {
+		ctx->totalAudioSamples = ctx->audio.size / (opts->audio_channels * sizeof(int32_t));
+		printf(MODULE_PREFIX "Audio sidecar, %d channels, %" PRIi64 " samples\n", opts->audio_channels, ctx->totalAudioSamples);
 	}
 
-	/* We need to understand how much VANC we're going to be receiving. */
-	opts->width = 1280;
-	opts->height = 720;
-	opts->interlaced = 0;
-	opts->timebase_den = 60000;
-	opts->timebase_num = 1001;
-	opts->video_format = lookupOBEName(opts->width, opts->height, opts->timebase_den, opts->timebase_num);
-
-	ctx->v_timebase.den = opts->timebase_den;
-	ctx->v_timebase.num = opts->timebase_num;
-
-	fprintf(stderr, MODULE_PREFIX "Detected resolution %dx%d @ %d/%d\n",
-		opts->width, opts->height,
-		opts->timebase_den, opts->timebase_num);
+	snprintf(sfn, sizeof(sfn), "%s.vanc", fn);
+	if (v210_file_open(&ctx->vanc, sfn) == 0) {
+		if (ctx->vanc.size < 16 || memcmp(ctx->vanc.addr, V210_VANC_MAGIC, 8) != 0) {
+			fprintf(stderr, MODULE_PREFIX "'%s' has no " V210_VANC_MAGIC " header, ignoring.\n", sfn);
+			v210_file_close(&ctx->vanc);
+		} else {
+			uint32_t *hdr = (uint32_t *)(ctx->vanc.addr + 8);
+			ctx->vancLinesPerFrame = hdr[0];
+			ctx->vancFirstLine = hdr[1];
+			ctx->vancUnpacked = (uint16_t *)av_malloc(opts->width * 2 * sizeof(uint16_t));
+			ctx->unpack_line = IS_SD(opts->video_format) ? obe_v210_line_to_uyvy_c : obe_v210_line_to_nv20_c;
+			printf(MODULE_PREFIX "VANC sidecar, %d lines per frame from line %d\n",
+				ctx->vancLinesPerFrame, ctx->vancFirstLine);
+		}
+	}
 
 	ctx->dec = avcodec_find_decoder(AV_CODEC_ID_V210);
 	if (!ctx->dec) {
 		fprintf(stderr, MODULE_PREFIX "Could not find v210 decoder\n");
+		return -1;
 	}
 
 	ctx->codec = avcodec_alloc_context3(ctx->dec);
 	if (!ctx->codec) {
 		fprintf(stderr, MODULE_PREFIX "Could not allocate a codec context\n");
+		return -1;
 	}
 
-#if 0
-	ctx->codec->get_buffer = obe_get_buffer;
-	ctx->codec->release_buffer = obe_release_buffer;
-	ctx->codec->reget_buffer = obe_reget_buffer;
-	ctx->codec->flags |= CODEC_FLAG_EMU_EDGE;
-#endif
+	ctx->codec->width = opts->width;
+	ctx->codec->height = opts->height;
+	ctx->codec->get_buffer2 = obe_get_buffer2;
+	ctx->codec->thread_count = 0;
+	ctx->codec->thread_type = FF_THREAD_SLICE;
 
 	if (avcodec_open2(ctx->codec, ctx->dec, NULL) < 0) {
 		fprintf(stderr, MODULE_PREFIX "Could not open libavcodec\n");
+		return -1;
 	}
 
 	return 0; /* Success */
@@ -380,7 +702,9 @@ static void *v210_probe_stream(void *ptr)
 	obe_input_t *user_opts = &probe_ctx->user_opts;
 	obe_device_t *device;
 	obe_int_input_stream_t *streams[MAX_STREAMS];
-	int num_streams = 2;
+	int num_streams = 0;
+	int num_pairs = 0;
+	obe_sdi_non_display_data_t *non_display_parser;
 
 	printf(MODULE_PREFIX "%s()\n", __func__);
 
@@ -392,41 +716,46 @@ static void *v210_probe_stream(void *ptr)
 		goto finish;
 	}
 
-	/* TODO: support multi-channel */
 	opts->num_channels = 16;
+	opts->audio_channels = av_clip(g_v210_input_audio_channels, 1, opts->num_channels);
 	opts->card_idx = user_opts->card_idx;
+	opts->location = user_opts->location;
 	opts->video_format = user_opts->video_format;
 	opts->probe = 1;
 
 	ctx = &opts->ctx;
 	ctx->h = h;
+	non_display_parser = &ctx->non_display_parser;
+	non_display_parser->probe = 1;
 
 	/* Open device */
 	if (open_device(opts) < 0) {
 		fprintf(stderr, MODULE_PREFIX "Unable to open the V210 input file.\n");
+		close_device(opts);
 		goto finish;
 	}
 
-	sleep(1);
+	/* Discover which services the VANC sidecar carries. */
+	if (ctx->vanc.addr) {
+		obe_raw_frame_t *raw_frame = new_raw_frame();
+		if (raw_frame) {
+			parseVANC(opts, raw_frame, 0);
+			obe_release_frame(raw_frame);
+		}
+	}
+	num_pairs = ctx->audio.addr ? (opts->audio_channels + 1) / 2 : 0;
 
 	close_device(opts);
 
 	opts->probe_success = 1;
 	fprintf(stderr, MODULE_PREFIX "Probe success\n" );
 
-	if (!opts->probe_success) {
-		fprintf(stderr, MODULE_PREFIX "No valid frames received - check connection and input format\n");
-		goto finish;
-	}
-
-	/* TODO: probe for SMPTE 337M */
-	/* TODO: factor some of the code below out */
-
-	for( int i = 0; i < 2; i++ ) {
+	for (int i = 0; i < 1 + num_pairs; i++) {
 
 		streams[i] = (obe_int_input_stream_t*)calloc( 1, sizeof(*streams[i]) );
 		if (!streams[i])
 			goto finish;
+		num_streams++;
 
 		/* TODO: make it take a continuous set of stream-ids */
 		pthread_mutex_lock( &h->device_list_mutex );
@@ -444,16 +773,16 @@ static void *v210_probe_stream(void *ptr)
 			streams[i]->interlaced = opts->interlaced;
 			streams[i]->tff = 1; /* NTSC is bff in baseband but coded as tff */
 			streams[i]->sar_num = streams[i]->sar_den = 1; /* The user can choose this when encoding */
-		}
-		else if( i == 1 ) {
-			/* TODO: various v4l2 assumptions about audio being 48KHz need resolved.
-         		 * Some sources could be 44.1 and this module will fall down badly.
-			 */
+
+			if (add_non_display_services(non_display_parser, streams[i], USER_DATA_LOCATION_FRAME) < 0)
+				goto finish;
+		} else {
 			streams[i]->stream_type = STREAM_TYPE_AUDIO;
 			streams[i]->stream_format = AUDIO_PCM;
 			streams[i]->num_channels  = 2;
-			streams[i]->sample_format = AV_SAMPLE_FMT_S16;
+			streams[i]->sample_format = AV_SAMPLE_FMT_S32P;
 			streams[i]->sample_rate = 48000;
+			streams[i]->sdi_audio_pair = i;
 		}
 	}
 
@@ -470,9 +799,11 @@ static void *v210_probe_stream(void *ptr)
 	add_device(h, device);
 
 finish:
-	opts->probe = 0;
-	if (opts)
+	if (opts) {
+		if (opts->ctx.non_display_parser.num_frame_data)
+			free(opts->ctx.non_display_parser.frame_data);
 		free(opts);
+	}
 
 	free(probe_ctx);
 
@@ -496,7 +827,9 @@ static void *v210_open_input(void *ptr)
 	pthread_cleanup_push(close_thread, (void *)opts);
 
 	opts->num_channels = 16;
+	opts->audio_channels = av_clip(g_v210_input_audio_channels, 1, opts->num_channels);
 	opts->card_idx = user_opts->card_idx;
+	opts->location = user_opts->location;
 	opts->video_format = user_opts->video_format;
 
 	ctx = &opts->ctx;
@@ -504,13 +837,20 @@ static void *v210_open_input(void *ptr)
 	ctx->device = device;
 	ctx->h = h;
 	ctx->v_counter = 0;
+	ctx->non_display_parser.device = device;
 
-	if (open_device(opts) < 0)
-		return NULL;
-
-	pthread_create(&ctx->vthreadId, 0, v210_videoThreadFunc, opts);
+	if (open_device(opts) == 0) {
+		if (pthread_create(&ctx->dthreadId, 0, v210_decodeThreadFunc, opts) == 0) {
+			ctx->dthreadRunning = 1;
+			ltnpthread_setname_np(ctx->dthreadId, "obe-v210-decode");
+		}
+		if (pthread_create(&ctx->vthreadId, 0, v210_videoThreadFunc, opts) == 0) {
+			ctx->vthreadRunning = 1;
+			ltnpthread_setname_np(ctx->vthreadId, "obe-v210-pacer");
+		}
 
-	sleep(INT_MAX);
+		sleep(INT_MAX);
+	}
 
 	pthread_cleanup_pop(1);
 
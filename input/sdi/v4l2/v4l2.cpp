@@ -34,6 +34,14 @@
  * ../../ffmpeg/ffmpeg -f alsa -i plughw:CARD=C920,DEV=0 -f video4linux2 -s 320x240 -i /dev/video0 new.mp4
  */
 
+/* Status 2026-10-19
+ * Full frame rate, the frame rate comes from VIDIOC_G_PARM. YU12, YUYV, UYVY, NV12 and P010 capture.
+ * Buffers are USERPTR where the driver allows it. YU12 buffers go down the pipeline without a copy
+ * and are requeued when the encoder releases them, everything else is converted once into a recycled image.
+ * Test without hardware using the vivid driver:
+ * modprobe vivid; v4l2-ctl -d /dev/video0 --set-fmt-video=width=1920,height=1080,pixelformat=NV12 --set-parm=60
+ */
+
 #if defined(__linux__)
 
 #define __STDC_FORMAT_MACROS   1
@@ -61,6 +69,7 @@ extern "C"
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libyuv/convert.h>
+#include <libyuv/planar_functions.h>
 #if 0
 #include <pulse/simple.h>
 #include <pulse/error.h>
@@ -68,7 +77,10 @@ extern "C"
 #include <alsa/asoundlib.h>
 }
 
-#define DO_60 1
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
 struct obe_to_v4l2
 {
     int obe_name;
@@ -86,20 +98,104 @@ struct obe_to_v4l2_video
 
 const static struct obe_to_v4l2_video video_format_tab[] =
 {
-#if DO_60
-    { INPUT_VIDEO_FORMAT_720P_60, 1280, 720, 0 /* bmdModeHD720p60 */, 1001, 60000 },
-#else
-    { INPUT_VIDEO_FORMAT_720P_60, 1280, 720, 0 /* bmdModeHD720p60 */, 1001, 30000 },
-#endif
+    { INPUT_VIDEO_FORMAT_720P_60,     1280,  720, 0 /* bmdModeHD720p60 */, 1001, 60000 },
+    { INPUT_VIDEO_FORMAT_720P_50,     1280,  720, 0, 1,    50 },
+    { INPUT_VIDEO_FORMAT_720P_2997,   1280,  720, 0, 1001, 30000 },
+    { INPUT_VIDEO_FORMAT_1080P_2398,  1920, 1080, 0, 1001, 24000 },
+    { INPUT_VIDEO_FORMAT_1080P_24,    1920, 1080, 0, 1,    24 },
+    { INPUT_VIDEO_FORMAT_1080P_25,    1920, 1080, 0, 1,    25 },
+    { INPUT_VIDEO_FORMAT_1080P_2997,  1920, 1080, 0, 1001, 30000 },
+    { INPUT_VIDEO_FORMAT_1080P_30,    1920, 1080, 0, 1,    30 },
+    { INPUT_VIDEO_FORMAT_1080P_50,    1920, 1080, 0, 1,    50 },
+    { INPUT_VIDEO_FORMAT_1080P_5994,  1920, 1080, 0, 1001, 60000 },
+    { INPUT_VIDEO_FORMAT_1080P_60,    1920, 1080, 0, 1,    60 },
     { -1, 0, 0, 0, -1, -1 },
 };
 
+static const struct obe_to_v4l2_video *lookupVideoFormat(int width, int height, int num, int den)
+{
+	for (int i = 0; video_format_tab[i].obe_name != -1; i++) {
+		const struct obe_to_v4l2_video *fmt = &video_format_tab[i];
+		if (fmt->width == width && fmt->height == height &&
+			(int64_t)fmt->timebase_num * den == (int64_t)fmt->timebase_den * num)
+			return fmt;
+	}
+
+	return NULL;
+}
+
+#ifndef V4L2_PIX_FMT_P010
+#define V4L2_PIX_FMT_P010 v4l2_fourcc('P', '0', '1', '0')
+#endif
+
+/* Capture formats we accept, and what we hand the video filter. YU12 is already what the
+ * encoders want, so those buffers are handed down the pipeline without a copy.
+ */
+struct v4l2_pixfmt_s
+{
+	uint32_t fourcc;
+	enum AVPixelFormat csp;
+	int zerocopy;
+	const char *name;
+};
+
+const static struct v4l2_pixfmt_s pixfmt_tab[] =
+{
+	{ V4L2_PIX_FMT_YUV420, AV_PIX_FMT_YUV420P,   1, "YU12" },
+	{ V4L2_PIX_FMT_YUYV,   AV_PIX_FMT_YUV420P,   0, "YUYV" },
+	{ V4L2_PIX_FMT_UYVY,   AV_PIX_FMT_YUV420P,   0, "UYVY" },
+	{ V4L2_PIX_FMT_NV12,   AV_PIX_FMT_YUV420P,   0, "NV12" },
+	{ V4L2_PIX_FMT_P010,   AV_PIX_FMT_YUV420P10, 0, "P010" },
+	{ 0, AV_PIX_FMT_NONE, 0, NULL },
+};
+
+static const struct v4l2_pixfmt_s *lookupPixelFormat(uint32_t fourcc)
+{
+	for (int i = 0; pixfmt_tab[i].fourcc; i++) {
+		if (pixfmt_tab[i].fourcc == fourcc)
+			return &pixfmt_tab[i];
+	}
+
+	return NULL;
+}
+
 struct capture_buffer_s
 {
 	struct v4l2_buffer vidbuf;
 	void *data;
 	int length;
-	int free;
+	int queued; /* Owned by the driver */
+};
+
+#define MAX_BUFFERS 16
+#define MAX_IMAGES 16
+
+/* Capture buffers and converted images outlive the input thread. Frames still in the pipeline
+ * hold a reference, and hand their memory back here when the encoder releases them.
+ * Zero copy capture buffers are requeued to the driver on release.
+ */
+struct v4l2_pool_s
+{
+	pthread_mutex_t mutex;
+	int refcount;
+
+	int fd;
+	int streaming;
+	enum v4l2_memory memory;
+
+	struct capture_buffer_s buffers[MAX_BUFFERS];
+	int numFrames;
+
+	int imageSize;
+	int numImages;
+	uint8_t *images[MAX_IMAGES];
+};
+
+/* Stored in raw_frame->opaque */
+struct v4l2_frame_ref_s
+{
+	struct v4l2_pool_s *pool;
+	int bufferNr; /* -1 for a pooled image */
 };
 
 typedef struct
@@ -113,11 +209,14 @@ typedef struct
 	pthread_t athreadId;
 	int athreadTerminate, athreadRunning, athreadComplete;
 
-#define MAX_BUFFERS 16
-	struct capture_buffer_s buffers[MAX_BUFFERS];
-	int numFrames;
+	struct v4l2_pool_s *pool;
+	const struct v4l2_pixfmt_s *pixfmt;
+	int bytesperline;
 
 	int64_t last_frame_time;
+	int64_t last_sequence;
+	uint64_t dropped_frames;
+	uint64_t copied_frames;
 
 	obe_device_t *device;
 	obe_t *h;
@@ -172,18 +271,186 @@ static int wait_for_frame_v4l2(int fd)
 	return ret;
 }
 
-static int enqueue_buffer(v4l2_opts_t *v4l2_opts, int bufferNr)
+/* Call with pool->mutex held */
+static int enqueue_buffer_locked(struct v4l2_pool_s *pool, int bufferNr)
 {
-	v4l2_ctx_t *v4l2_ctx = &v4l2_opts->v4l2_ctx;
+	if (!pool->streaming)
+		return 0;
 
-	v4l2_ctx->buffers[bufferNr].free = 1;
-	int ret = ioctl(v4l2_ctx->fd, VIDIOC_QBUF, &v4l2_ctx->buffers[bufferNr].vidbuf);
+	int ret = ioctl(pool->fd, VIDIOC_QBUF, &pool->buffers[bufferNr].vidbuf);
 	if (ret < 0)
 		syslog(LOG_ERR, "[v4l2]: Could not enq frame %d, ret = %d\n", bufferNr, ret);
+	else
+		pool->buffers[bufferNr].queued = 1;
 
 	return ret;
 }
 
+static int enqueue_buffer(struct v4l2_pool_s *pool, int bufferNr)
+{
+	pthread_mutex_lock(&pool->mutex);
+	int ret = enqueue_buffer_locked(pool, bufferNr);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return ret;
+}
+
+static struct v4l2_pool_s *pool_alloc(int fd)
+{
+	struct v4l2_pool_s *pool = (struct v4l2_pool_s *)calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->refcount = 1;
+	pool->fd = fd;
+
+	return pool;
+}
+
+static void pool_unref(struct v4l2_pool_s *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	int refcount = --pool->refcount;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (refcount)
+		return;
+
+	for (int i = 0; i < pool->numFrames; i++) {
+		if (pool->memory == V4L2_MEMORY_MMAP)
+			munmap(pool->buffers[i].data, pool->buffers[i].length);
+		else
+			free(pool->buffers[i].data);
+	}
+	for (int i = 0; i < pool->numImages; i++)
+		av_free(pool->images[i]);
+
+	close(pool->fd);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+/* Takes a pool reference, dropped again in release_video_data(). */
+static uint8_t *pool_get_image(struct v4l2_pool_s *pool)
+{
+	uint8_t *image = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->numImages)
+		image = pool->images[--pool->numImages];
+	pool->refcount++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!image)
+		image = (uint8_t *)av_malloc(pool->imageSize);
+
+	if (!image)
+		pool_unref(pool);
+
+	return image;
+}
+
+static void release_video_data(void *ptr)
+{
+	obe_raw_frame_t *raw_frame = (obe_raw_frame_t *)ptr;
+	struct v4l2_frame_ref_s *ref = (struct v4l2_frame_ref_s *)raw_frame->opaque;
+	struct v4l2_pool_s *pool = ref->pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (ref->bufferNr >= 0) {
+		enqueue_buffer_locked(pool, ref->bufferNr);
+	} else {
+		if (pool->numImages < MAX_IMAGES)
+			pool->images[pool->numImages++] = raw_frame->alloc_img.plane[0];
+		else
+			av_free(raw_frame->alloc_img.plane[0]);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool_unref(pool);
+	free(ref);
+
+	/* The video filter may swap in its own image after releasing ours, that one is av_malloc'd. */
+	raw_frame->opaque = NULL;
+	memset(&raw_frame->alloc_img.plane, 0, sizeof(raw_frame->alloc_img.plane));
+	raw_frame->release_data = obe_release_video_data;
+}
+
+/* P010 (10bit in the top of 16bit words, interleaved CbCr) to YUV420P10 (10bit in the bottom). */
+static void p010_to_yuv420p10(const uint8_t *src, int src_stride, uint8_t **dst, int *dst_stride, int width, int height)
+{
+	for (int y = 0; y < height; y++) {
+		const uint16_t *s = (const uint16_t *)(src + y * src_stride);
+		uint16_t *d = (uint16_t *)(dst[0] + y * dst_stride[0]);
+		int x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+		for (; x + 8 <= width; x += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+			_mm_storeu_si128((__m128i *)(d + x), _mm_srli_epi16(v, 6));
+		}
+#endif
+		for (; x < width; x++)
+			d[x] = s[x] >> 6;
+	}
+
+	const uint8_t *uv = src + src_stride * height;
+	for (int y = 0; y < height / 2; y++) {
+		const uint16_t *s = (const uint16_t *)(uv + y * src_stride);
+		uint16_t *u = (uint16_t *)(dst[1] + y * dst_stride[1]);
+		uint16_t *v = (uint16_t *)(dst[2] + y * dst_stride[2]);
+		int x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+		/* 8 CbCr pairs per iteration. After the shift every word fits in 15 bits,
+		 * so the signed 32 to 16 bit packs deinterleave without saturating.
+		 */
+		for (; x + 8 <= width / 2; x += 8) {
+			__m128i a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s + (x * 2))), 6);
+			__m128i b = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s + (x * 2) + 8)), 6);
+			__m128i cb = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+			__m128i cr = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+			_mm_storeu_si128((__m128i *)(u + x), cb);
+			_mm_storeu_si128((__m128i *)(v + x), cr);
+		}
+#endif
+		for (; x < width / 2; x++) {
+			u[x] = s[(x * 2) + 0] >> 6;
+			v[x] = s[(x * 2) + 1] >> 6;
+		}
+	}
+}
+
+/* Convert a captured buffer into planar 4:2:0, libyuv covers the 8bit formats with its own SIMD. */
+static void convert_frame(v4l2_opts_t *v4l2_opts, const uint8_t *src, obe_image_t *img)
+{
+	v4l2_ctx_t *v4l2_ctx = &v4l2_opts->v4l2_ctx;
+	int w = v4l2_opts->width;
+	int h = v4l2_opts->height;
+	int bpl = v4l2_ctx->bytesperline;
+
+	switch (v4l2_ctx->pixfmt->fourcc) {
+	case V4L2_PIX_FMT_YUYV:
+		libyuv::YUY2ToI420(src, bpl,
+			img->plane[0], img->stride[0], img->plane[1], img->stride[1], img->plane[2], img->stride[2], w, h);
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		libyuv::UYVYToI420(src, bpl,
+			img->plane[0], img->stride[0], img->plane[1], img->stride[1], img->plane[2], img->stride[2], w, h);
+		break;
+	case V4L2_PIX_FMT_NV12:
+		libyuv::NV12ToI420(src, bpl, src + (bpl * h), bpl,
+			img->plane[0], img->stride[0], img->plane[1], img->stride[1], img->plane[2], img->stride[2], w, h);
+		break;
+	case V4L2_PIX_FMT_P010:
+		p010_to_yuv420p10(src, bpl, img->plane, img->stride, w, h);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+		libyuv::I420Copy(src, bpl, src + (bpl * h), bpl / 2, src + (bpl * h) + ((bpl / 2) * (h / 2)), bpl / 2,
+			img->plane[0], img->stride[0], img->plane[1], img->stride[1], img->plane[2], img->stride[2], w, h);
+		break;
+	}
+}
+
 static void *audioThreadFunc(void *p)
 {
 	v4l2_opts_t *v4l2_opts = (v4l2_opts_t *)p;
@@ -303,7 +570,7 @@ static void *videoThreadFunc(void *p)
 {
 	v4l2_opts_t *v4l2_opts = (v4l2_opts_t *)p;
 	v4l2_ctx_t *v4l2_ctx = &v4l2_opts->v4l2_ctx;
-//	int frame_counter = 0;
+	struct v4l2_pool_s *pool = v4l2_ctx->pool;
 
 	obe_raw_frame_t *raw_frame = NULL;
 	int bufferType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -313,15 +580,19 @@ static void *videoThreadFunc(void *p)
 	}
 
 	/* Place all buffers on the h/w */
-	for (int i = 0; i < v4l2_ctx->numFrames; i++) {
-		enqueue_buffer(v4l2_opts, i);
+	pthread_mutex_lock(&pool->mutex);
+	pool->streaming = 1;
+	for (int i = 0; i < pool->numFrames; i++) {
+		enqueue_buffer_locked(pool, i);
 	}
+	pthread_mutex_unlock(&pool->mutex);
 
 	v4l2_ctx->vthreadRunning = 1;
 	v4l2_ctx->vthreadComplete = 0;
 	v4l2_ctx->vthreadTerminate = 0;
 	v4l2_ctx->v_counter = 0;
 	v4l2_ctx->a_counter = 0;
+	v4l2_ctx->last_sequence = -1;
 	while (!v4l2_ctx->vthreadTerminate && v4l2_opts->probe == 0) {
 
 		if (wait_for_frame_v4l2(v4l2_ctx->fd) <= 0)
@@ -329,85 +600,116 @@ static void *videoThreadFunc(void *p)
 
 		/* Dequeue a video frame */
 		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
 		buf.type = bufferType;
+		buf.memory = pool->memory;
 		if (ioctl(v4l2_ctx->fd, VIDIOC_DQBUF, &buf) < 0) {
 			syslog(LOG_ERR, "[v4l2]: Could not dq frame\n" );
 			continue;
 		}
-//printf("[%08lld] dq idx %d\n", v4l2_ctx->v_counter, buf.index);
 
-		v4l2_ctx->buffers[ buf.index ].free = 0;
+		pthread_mutex_lock(&pool->mutex);
+		pool->buffers[ buf.index ].queued = 0;
+		int queued = 0;
+		for (int i = 0; i < pool->numFrames; i++)
+			queued += pool->buffers[i].queued;
+		pthread_mutex_unlock(&pool->mutex);
 
-#if DO_60
-#else
-		/* TODO: SLower platforms can't keep up with 60fps.
-		 * frame drop for development purposes.
+		/* The driver counts every frame it captured, gaps mean we (or it) fell behind.
+		 * Keep the PTS honest so audio stays locked.
 		 */
-		if (frame_counter++ & 1) {
-			/* Drop the frame */
-			enqueue_buffer(v4l2_opts, buf.index);
-			continue;
+		if (v4l2_ctx->last_sequence >= 0 && buf.sequence > v4l2_ctx->last_sequence + 1) {
+			uint32_t lost = buf.sequence - v4l2_ctx->last_sequence - 1;
+			v4l2_ctx->dropped_frames += lost;
+			v4l2_ctx->v_counter += lost;
+			syslog(LOG_WARNING, "[v4l2]: %u frame(s) lost, %" PRIu64 " total\n", lost, v4l2_ctx->dropped_frames);
 		}
-#endif
+		v4l2_ctx->last_sequence = buf.sequence;
+
 		raw_frame = new_raw_frame();
-		if (!raw_frame) {
+		struct v4l2_frame_ref_s *ref = (struct v4l2_frame_ref_s *)calloc(1, sizeof(*ref));
+		if (!raw_frame || !ref) {
 			syslog(LOG_ERR, "[v4l2]: Could not allocate raw video frame\n" );
+			free(raw_frame);
+			free(ref);
 			break;
 		}
+		ref->pool = pool;
 
-//printf("data %p len = %d\n", frame_bytes, frame_len);
+		obe_image_t *img = &raw_frame->alloc_img;
+		img->csp = v4l2_ctx->pixfmt->csp;
+		img->format = v4l2_opts->video_format;
+		img->width = v4l2_opts->width;
+		img->height = v4l2_opts->height;
+		img->first_line = 1;
+		const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(img->csp);
+		img->planes = d->nb_components;
 
-		/* TODO: YUYV only. Drivers will non YUYV colorspaces won't work reliably. */
-		raw_frame->alloc_img.csp = AV_PIX_FMT_YUV420P;
-		raw_frame->alloc_img.format = v4l2_opts->video_format;
-		raw_frame->alloc_img.width = v4l2_opts->width;
-		raw_frame->alloc_img.height = v4l2_opts->height;
-		raw_frame->alloc_img.first_line = 1;
-                const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(raw_frame->alloc_img.csp);
-		raw_frame->alloc_img.planes = d->nb_components;
+		uint8_t *src = (uint8_t *)pool->buffers[ buf.index ].data;
 
-		raw_frame->alloc_img.stride[0] = v4l2_opts->width;
-		raw_frame->alloc_img.stride[1] = v4l2_opts->width / 2;
-		raw_frame->alloc_img.stride[2] = v4l2_opts->width / 2;
-		raw_frame->alloc_img.stride[3] = 0;
+		/* Hand the capture buffer itself down the pipeline when we can, unless the
+		 * encoders are sitting on so many that the driver is about to run dry.
+		 */
+		if (v4l2_ctx->pixfmt->zerocopy && queued >= 2) {
+			int bpl = v4l2_ctx->bytesperline;
+			img->stride[0] = bpl;
+			img->stride[1] = bpl / 2;
+			img->stride[2] = bpl / 2;
+			img->plane[0] = src;
+			img->plane[1] = img->plane[0] + (bpl * v4l2_opts->height);
+			img->plane[2] = img->plane[1] + ((bpl / 2) * (v4l2_opts->height / 2));
+			ref->bufferNr = buf.index;
+
+			pthread_mutex_lock(&pool->mutex);
+			pool->refcount++;
+			pthread_mutex_unlock(&pool->mutex);
+		} else {
+			av_image_fill_linesizes(img->stride, img->csp, v4l2_opts->width);
+			uint8_t *image = pool_get_image(pool);
+			if (!image) {
+				syslog(LOG_ERR, "[v4l2]: Could not allocate image\n" );
+				free(raw_frame);
+				free(ref);
+				enqueue_buffer(pool, buf.index);
+				continue;
+			}
+			av_image_fill_pointers(img->plane, img->csp, v4l2_opts->height, image, img->stride);
+			ref->bufferNr = -1;
+
+			convert_frame(v4l2_opts, src, img);
+			enqueue_buffer(pool, buf.index);
+
+			if (v4l2_ctx->pixfmt->zerocopy)
+				v4l2_ctx->copied_frames++;
+		}
+		memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
 
 		int64_t pts = av_rescale_q(v4l2_ctx->v_counter++, v4l2_ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
 		obe_clock_tick(v4l2_ctx->h, pts);
 		raw_frame->pts = pts;
 
-//printf("pts = %lld\n", raw_frame->pts);
 		raw_frame->timebase_num = v4l2_opts->timebase_num;
 		raw_frame->timebase_den = v4l2_opts->timebase_den;
 
-		raw_frame->alloc_img.plane[0] = (uint8_t *)calloc(1, v4l2_opts->width * v4l2_opts->height * 2);
-		raw_frame->alloc_img.plane[1] = raw_frame->alloc_img.plane[0] + (v4l2_opts->width * v4l2_opts->height);
-		raw_frame->alloc_img.plane[2] = raw_frame->alloc_img.plane[1] + ((v4l2_opts->width * v4l2_opts->height) / 4);
-		raw_frame->alloc_img.plane[3] = 0;
-		memcpy(&raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->alloc_img));
-
-		raw_frame->release_data = obe_release_video_data;
+		raw_frame->opaque = ref;
+		raw_frame->release_data = release_video_data;
 		raw_frame->release_frame = obe_release_frame;
 
-		/* Convert YUY2 to I420. */
-		libyuv::YUY2ToI420((unsigned char *)v4l2_ctx->buffers[ buf.index ].data,
-			v4l2_opts->width * 2,
-			raw_frame->alloc_img.plane[0], v4l2_opts->width,
-			raw_frame->alloc_img.plane[1], v4l2_opts->width / 2,
-			raw_frame->alloc_img.plane[2], v4l2_opts->width / 2,
-			v4l2_opts->width, v4l2_opts->height);
-
 		if (add_to_filter_queue(v4l2_ctx->h, raw_frame) < 0 ) {
 		}
-
-		enqueue_buffer(v4l2_opts, buf.index);
 	}
 
+	/* Frames still in the pipeline hand their buffers back to the pool, not the driver. */
+	pthread_mutex_lock(&pool->mutex);
+	pool->streaming = 0;
+	pthread_mutex_unlock(&pool->mutex);
+
 	if (ioctl(v4l2_ctx->fd, VIDIOC_STREAMOFF, &bufferType) < 0 ) {
 		syslog(LOG_ERR, "[v4l2]: Could not transition to STREAMOFF\n" );
 	}
 
-	for (int i = 0; i < v4l2_ctx->numFrames; i++)
-		munmap(v4l2_ctx->buffers[i].data, v4l2_ctx->buffers[i].length);
+	printf("[v4l2] Video thread complete, %" PRIu64 " frames lost, %" PRIu64 " zero copy frames copied\n",
+		v4l2_ctx->dropped_frames, v4l2_ctx->copied_frames);
 
 	v4l2_ctx->vthreadComplete = 1;
 	pthread_exit(0);
@@ -430,7 +732,14 @@ static void close_device(v4l2_opts_t *v4l2_opts)
 			usleep(50 * 1000);
 	}
 
-	/* close(fd) */
+	/* The pool owns the fd once it exists, and closes it when the last frame is released. */
+	if (v4l2_ctx->pool) {
+		pool_unref(v4l2_ctx->pool);
+		v4l2_ctx->pool = NULL;
+	} else if (v4l2_ctx->fd >= 0) {
+		close(v4l2_ctx->fd);
+	}
+	v4l2_ctx->fd = -1;
 }
 
 static int open_device(v4l2_opts_t *v4l2_opts)
@@ -490,77 +799,158 @@ static int open_device(v4l2_opts_t *v4l2_opts)
 
        	fprintf(stderr, "[v4l2] Detecting video format....\n");
         struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
 	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        int ret = ioctl(v4l2_ctx->fd, VIDIOC_G_FMT, &fmt);
-	if (ret < 0) {
-        	printf("ret = %d\n", ret);
+        int r = ioctl(v4l2_ctx->fd, VIDIOC_G_FMT, &fmt);
+	if (r < 0) {
+        	printf("ret = %d\n", r);
 		continue;
 	}
 
        	fprintf(stderr, "[v4l2] Detected resolution %d x %d\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
 	if (fmt.fmt.pix.width && fmt.fmt.pix.height) {
+		v4l2_ctx->pixfmt = lookupPixelFormat(fmt.fmt.pix.pixelformat);
+		if (!v4l2_ctx->pixfmt) {
+			/* Ask the driver for YUYV at the current size, most webcams and HDMI bridges have it. */
+			fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+			fmt.fmt.pix.bytesperline = 0;
+			if (ioctl(v4l2_ctx->fd, VIDIOC_S_FMT, &fmt) < 0 ||
+				!(v4l2_ctx->pixfmt = lookupPixelFormat(fmt.fmt.pix.pixelformat))) {
+				fprintf(stderr, "[v4l2] Unsupported pixel format, use YU12, YUYV, UYVY, NV12 or P010\n");
+				ret = -1;
+				goto finish;
+			}
+		}
 		v4l2_opts->width = fmt.fmt.pix.width;
 		v4l2_opts->height = fmt.fmt.pix.height;
+		v4l2_ctx->bytesperline = fmt.fmt.pix.bytesperline;
 		if (fmt.fmt.pix.field == V4L2_FIELD_NONE)
 			v4l2_opts->interlaced = 0;
 		else
 			v4l2_opts->interlaced = 1;
-		/* TODO: hardcoded 720p reference */
-		v4l2_opts->video_format = INPUT_VIDEO_FORMAT_720P_60;
-
-		v4l2_ctx->v_timebase.num = 1001;
-#if DO_60
-		v4l2_ctx->v_timebase.den = 60000;
-#else
-		v4l2_ctx->v_timebase.den = 30000;
-#endif
+
+		/* Frame rate, default to the historical 720p59.94 if the driver won't say. */
+		v4l2_ctx->v_timebase.num = video_format_tab[0].timebase_num;
+		v4l2_ctx->v_timebase.den = video_format_tab[0].timebase_den;
+
+		struct v4l2_streamparm parm;
+		memset(&parm, 0, sizeof(parm));
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (ioctl(v4l2_ctx->fd, VIDIOC_G_PARM, &parm) == 0 &&
+			parm.parm.capture.timeperframe.numerator && parm.parm.capture.timeperframe.denominator) {
+			v4l2_ctx->v_timebase.num = parm.parm.capture.timeperframe.numerator;
+			v4l2_ctx->v_timebase.den = parm.parm.capture.timeperframe.denominator;
+		}
+
+		const struct obe_to_v4l2_video *vfmt = lookupVideoFormat(v4l2_opts->width, v4l2_opts->height,
+			v4l2_ctx->v_timebase.num, v4l2_ctx->v_timebase.den);
+		if (vfmt) {
+			v4l2_opts->video_format = vfmt->obe_name;
+			v4l2_ctx->v_timebase.num = vfmt->timebase_num;
+			v4l2_ctx->v_timebase.den = vfmt->timebase_den;
+		} else {
+			fprintf(stderr, "[v4l2] No OBE format for %dx%d @ %d/%d, treating as 720p\n",
+				v4l2_opts->width, v4l2_opts->height, v4l2_ctx->v_timebase.den, v4l2_ctx->v_timebase.num);
+			v4l2_opts->video_format = INPUT_VIDEO_FORMAT_720P_60;
+		}
+
+		fprintf(stderr, "[v4l2] Capturing %s %dx%d @ %d/%d\n", v4l2_ctx->pixfmt->name,
+			v4l2_opts->width, v4l2_opts->height, v4l2_ctx->v_timebase.den, v4l2_ctx->v_timebase.num);
 
 		break;
 	}
     }
 
+    if (!v4l2_ctx->pixfmt) {
+        fprintf(stderr, "[v4l2] Unable to detect the video format\n");
+        ret = -1;
+        goto finish;
+    }
+
+    v4l2_ctx->pool = pool_alloc(v4l2_ctx->fd);
+    if (!v4l2_ctx->pool) {
+        ret = -1;
+        goto finish;
+    }
 
-    /* Now setup the videobuf buffers kernel to userspace memory mappings */
+    {
+    struct v4l2_pool_s *pool = v4l2_ctx->pool;
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(v4l2_ctx->fd, VIDIOC_G_FMT, &fmt);
+
+    /* Converted images, recycled through the pool instead of a calloc per frame. */
+    pool->imageSize = av_image_get_buffer_size(v4l2_ctx->pixfmt->csp, v4l2_opts->width, v4l2_opts->height + 1, 32);
+
+    /* Prefer USERPTR, our page aligned buffers can be handed straight to the encoders.
+     * Fall back to MMAP for drivers that don't support it.
+     */
     struct v4l2_requestbuffers req;
-    req.count = 8;
+    memset(&req, 0, sizeof(req));
+    req.count = MAX_BUFFERS;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
+    req.memory = V4L2_MEMORY_USERPTR;
+    pool->memory = V4L2_MEMORY_USERPTR;
 
     if (ioctl(v4l2_ctx->fd, VIDIOC_REQBUFS, &req) < 0) {
-        fprintf(stderr, "[v4l2] Driver error during _REQBUFS, continuing...\n" );
-        //ret = -1;
-        //goto finish;
+        fprintf(stderr, "[v4l2] USERPTR not supported by the driver, using MMAP\n" );
+        req.count = 8;
+        req.memory = V4L2_MEMORY_MMAP;
+        pool->memory = V4L2_MEMORY_MMAP;
+        if (ioctl(v4l2_ctx->fd, VIDIOC_REQBUFS, &req) < 0) {
+            fprintf(stderr, "[v4l2] Driver error during _REQBUFS, continuing...\n" );
+        }
     }
 
     /* Preserve how many buffers the driver wants to use */
-    v4l2_ctx->numFrames = req.count;
+    pool->numFrames = req.count > MAX_BUFFERS ? MAX_BUFFERS : req.count;
 
-    /* Query each buffer and map it to the video device */
-    for (int i = 0; i < v4l2_ctx->numFrames; i++) {
-        struct v4l2_buffer *vidbuf = &v4l2_ctx->buffers[i].vidbuf;
+    for (int i = 0; i < pool->numFrames; i++) {
+        struct v4l2_buffer *vidbuf = &pool->buffers[i].vidbuf;
 
+        memset(vidbuf, 0, sizeof(*vidbuf));
         vidbuf->index = i;
         vidbuf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vidbuf->memory = V4L2_MEMORY_MMAP;
+        vidbuf->memory = pool->memory;
+
+        if (pool->memory == V4L2_MEMORY_USERPTR) {
+            size_t length = (fmt.fmt.pix.sizeimage + 4095) & ~4095;
+            if (posix_memalign(&pool->buffers[i].data, 4096, length)) {
+                fprintf(stderr, "[v4l2]: Can't allocate buffer %d.\n", i);
+                pool->numFrames = i;
+                ret = -1;
+                goto finish;
+            }
+            pool->buffers[i].length = length;
+            vidbuf->m.userptr = (unsigned long)pool->buffers[i].data;
+            vidbuf->length = length;
+            continue;
+        }
+
+        /* Query each buffer and map it to the video device */
         if (ioctl(v4l2_ctx->fd, VIDIOC_QUERYBUF, vidbuf) < 0 ) {
             fprintf(stderr, "[v4l2]: Can't get information about buffer %d: %s.\n", i, strerror(errno));
+            pool->numFrames = i;
             ret = -1;
             goto finish;
         }
 
-        v4l2_ctx->buffers[i].data = mmap(0, vidbuf->length, PROT_READ | PROT_WRITE, MAP_SHARED, v4l2_ctx->fd, vidbuf->m.offset);
-        if (v4l2_ctx->buffers[i].data == MAP_FAILED) {
+        pool->buffers[i].data = mmap(0, vidbuf->length, PROT_READ | PROT_WRITE, MAP_SHARED, v4l2_ctx->fd, vidbuf->m.offset);
+        if (pool->buffers[i].data == MAP_FAILED) {
             fprintf(stderr, "[v4l2]: Can't map buffer %d: %s.\n", i, strerror(errno));
+            pool->numFrames = i;
             ret = -1;
             goto finish;
         }
-        v4l2_ctx->buffers[i].length = vidbuf->length;
+        pool->buffers[i].length = vidbuf->length;
+    }
     }
 
     syslog( LOG_INFO, "Opened V4L2 PCI card /dev/video%d", v4l2_opts->card_idx);
 
-    v4l2_opts->timebase_num = video_format_tab[0].timebase_num;
-    v4l2_opts->timebase_den = video_format_tab[0].timebase_den;
+    v4l2_opts->timebase_num = v4l2_ctx->v_timebase.num;
+    v4l2_opts->timebase_den = v4l2_ctx->v_timebase.den;
 
     if(!v4l2_opts->probe )
     {
@@ -655,7 +1045,7 @@ static void *probe_stream(void *ptr)
             streams[i]->height = v4l2_opts->height;
             streams[i]->timebase_num = v4l2_opts->timebase_num;
             streams[i]->timebase_den = v4l2_opts->timebase_den;
-            streams[i]->csp    = AV_PIX_FMT_YUV420P;
+            streams[i]->csp    = v4l2_opts->v4l2_ctx.pixfmt->csp;
             streams[i]->interlaced = v4l2_opts->interlaced;
             streams[i]->tff = 1; /* NTSC is bff in baseband but coded as tff */
             streams[i]->sar_num = streams[i]->sar_den = 1; /* The user can choose this when encoding */
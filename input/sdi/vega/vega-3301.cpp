@@ -321,7 +321,7 @@ static void deliver_audio_frame(vega_opts_t *opts, unsigned char *plane, int siz
 
 	rf->release_data = obe_release_audio_data;
 	rf->release_frame = obe_release_frame;
-	rf->input_stream_id = 1; // TODO: Is this correct?
+	rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_AUDIO);
 
 	if (add_to_filter_queue(ctx->h, rf) < 0 ) {
 		fprintf(stderr, MODULE_PREFIX "Unable to add audio frame to the filter q.\n");
@@ -420,6 +420,8 @@ static void deliver_video_nal(vega_opts_t *opts, unsigned char *buf, int lengthB
         avfm_set_video_interval_clk(&rf->avfm, dur);
         //avfm_dump(&rf->avfm);
 
+        rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_VIDEO);
+
         if (add_to_filter_queue(ctx->h, rf) < 0 ) {
                 fprintf(stderr, MODULE_PREFIX "Could not allocate raw video frame\n");
                 free(rf->alloc_img.plane[0]);
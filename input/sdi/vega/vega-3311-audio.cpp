@@ -107,7 +107,7 @@ static void deliver_audio_frame(vega_opts_t *opts, unsigned char *plane, int siz
 
 	rf->release_data = obe_release_audio_data;
 	rf->release_frame = obe_release_frame;
-	rf->input_stream_id = 1; // TODO: Is this correct?
+	rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_AUDIO);
 
 #if LOCAL_DEBUG
         static int64_t last_audio_pts = 0;
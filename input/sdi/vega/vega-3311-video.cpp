@@ -103,6 +103,8 @@ static void deliver_video_nal(vega_opts_t *opts, unsigned char *buf, int lengthB
         avfm_set_video_interval_clk(&rf->avfm, dur);
         //avfm_dump(&rf->avfm);
 
+        rf->input_stream_id = get_device_input_stream_id(ctx->device, STREAM_TYPE_VIDEO);
+
         if (add_to_filter_queue(ctx->h, rf) < 0 ) {
                 fprintf(stderr, MODULE_PREFIX "Could not allocate raw video frame\n");
                 free(rf->alloc_img.plane[0]);
@@ -39,4 +39,11 @@ typedef struct
 
 extern const obe_mux_func_t ts_muxer;
 
+/* Fused lowest latency output, mux/smoothing.c. Called from the mux thread in place of
+ * the mux smoothing queue: paces whole payloads to their PCRs and hands them to the outputs. */
+struct mux_pacer_s;
+struct mux_pacer_s *mux_pacer_alloc( obe_t *h );
+int mux_pacer_write( struct mux_pacer_s *p, const uint8_t *data, int len, const int64_t *pcr_list );
+void mux_pacer_free( struct mux_pacer_s *p );
+
 #endif
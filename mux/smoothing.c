@@ -26,6 +26,8 @@
 #include <libavutil/fifo.h>
 #include <libavutil/buffer.h>
 #include "common/common.h"
+#include "common/latency_ctl.h"
+#include "mux/mux.h"
 
 int64_t g_mux_smoother_last_item_count = 0;
 int64_t g_mux_smoother_last_total_item_size = 0;
@@ -33,6 +35,8 @@ int64_t g_mux_smoother_fifo_pcr_size = 0;
 int64_t g_mux_smoother_fifo_data_size = 0;
 int64_t g_mux_smoother_trim_ms = 0;
 int64_t g_mux_smoother_dump = 0;
+int64_t g_mux_smoother_handoff_us = 0; /* Worst mux to smoother wait over the last second */
+int64_t g_mux_smoother_latency_ms = 0;
 
 #define MODULE_PREFIX "[mux-smoother]: "
 
@@ -47,6 +51,8 @@ static void *mux_start_smoothing( void *ptr )
     AVFifoBuffer *fifo_data = NULL, *fifo_pcr = NULL;
     AVBufferRef **output_buffers = NULL;
     int trim_ms_pending = 0;
+    int64_t handoff_max = 0, handoff_window = 0;
+    struct latency_ctl_s *latency_ctl = NULL;
 
     if (g_mux_smoother_trim_ms)
         trim_ms_pending = 1;
@@ -79,29 +85,35 @@ static void *mux_start_smoothing( void *ptr )
 
     if( h->obe_system != OBE_SYSTEM_TYPE_LOWEST_LATENCY )
     {
+        /* With several programs, smooth over the longest of their VBV delays */
         for( int i = 0; i < h->num_encoders; i++ )
         {
             if( h->encoders[i]->is_video )
             {
-                pthread_mutex_lock( &h->encoders[i]->queue.mutex );
-                while( !h->encoders[i]->is_ready )
-                    pthread_cond_wait( &h->encoders[i]->queue.in_cv, &h->encoders[i]->queue.mutex );
+                obe_core_encoder_wait_ready( h->encoders[i] );
                 x264_param_t *params = h->encoders[i]->encoder_params;
-                temporal_vbv_size = av_rescale_q_rnd(
+                int64_t vbv_size = av_rescale_q_rnd(
                 (int64_t)params->rc.i_vbv_buffer_size * params->rc.f_vbv_buffer_init,
                 (AVRational){1, params->rc.i_vbv_max_bitrate }, (AVRational){ 1, OBE_CLOCK }, AV_ROUND_UP );
-                pthread_mutex_unlock( &h->encoders[i]->queue.mutex );
-                break;
+                if( vbv_size > temporal_vbv_size )
+                    temporal_vbv_size = vbv_size;
             }
         }
+
+        latency_ctl = latency_ctl_alloc( "mux smoothing", temporal_vbv_size );
+        g_mux_smoother_latency_ms = temporal_vbv_size / 27000;
     }
 
     while( 1 )
     {
         pthread_mutex_lock( &h->mux_smoothing_queue.mutex );
 
+        int woken = 0;
         while( h->mux_smoothing_queue.size == num_muxed_data && !h->cancel_mux_smoothing_thread )
+        {
             pthread_cond_wait( &h->mux_smoothing_queue.in_cv, &h->mux_smoothing_queue.mutex );
+            woken = 1;
+        }
 
         if( h->cancel_mux_smoothing_thread )
         {
@@ -109,6 +121,22 @@ static void *mux_start_smoothing( void *ptr )
             break;
         }
 
+        /* Wakeup latency: the muxer queued into an empty queue and we were asleep on it.
+         * This is what the fused mux saves on each mux output. */
+        if( woken && buffer_complete && !num_muxed_data )
+        {
+            int64_t now = obe_mdate();
+            obe_muxed_data_t *first = h->mux_smoothing_queue.queue[0];
+            if( now - first->created > handoff_max )
+                handoff_max = now - first->created;
+            if( now - handoff_window >= 1000000 )
+            {
+                g_mux_smoother_handoff_us = handoff_max;
+                handoff_max = 0;
+                handoff_window = now;
+            }
+        }
+
         if (g_mux_smoother_dump) {
             g_mux_smoother_dump = 0;
 
@@ -178,7 +206,8 @@ static void *mux_start_smoothing( void *ptr )
 
             start_pcr = start_data->pcr_list[0];
             end_pcr = end_data->pcr_list[(end_data->len / 188)-1];
-            if( end_pcr - start_pcr >= temporal_vbv_size )
+            /* After a drop, refill only as far as the controller has found safe */
+            if( end_pcr - start_pcr >= ( latency_ctl ? latency_ctl_refill_depth( latency_ctl ) : temporal_vbv_size ) )
             {
                 buffer_complete = 1;
                 start_clock = -1;
@@ -222,10 +251,22 @@ static void *mux_start_smoothing( void *ptr )
         /* Write the associated PCR list to the fifo_pcr fifo. */
         /* Destroy the cloned copy, and the original on the queue. */
         g_mux_smoother_last_total_item_size = 0;
+        int64_t now_clock = get_input_clock_in_mpeg_ticks( h ), now_us = obe_mdate();
         for( int i = 0; i < num_muxed_data; i++ )
         {
             g_mux_smoother_last_total_item_size += muxed_data[i]->len;
 
+            /* Slack is how long before its first packet is due this arrived from the mux.
+             * Moving start_clock is how the depth changes, a little per sample so the
+             * output runs slightly fast or slow, or all at once when data is late. */
+            if( latency_ctl && start_clock != -1 )
+            {
+                int64_t arrival = now_clock - ( now_us - muxed_data[i]->created ) * 27;
+                int64_t due = muxed_data[i]->pcr_list[0] - start_pcr + start_clock;
+                start_clock += latency_ctl_sample( latency_ctl, now_clock, due - arrival );
+                g_mux_smoother_latency_ms = latency_ctl_depth( latency_ctl ) / 27000;
+            }
+
             int len = av_fifo_size( fifo_data ) + muxed_data[i]->len;
 
 #if LOCAL_DEBUG
@@ -323,8 +364,131 @@ static void *mux_start_smoothing( void *ptr )
     av_fifo_free( fifo_data );
     av_fifo_free( fifo_pcr );
     free( output_buffers );
+    latency_ctl_free( latency_ctl );
 
     return NULL;
 }
 
 const obe_smoothing_func_t mux_smoothing = { mux_start_smoothing };
+
+/* Fused lowest latency path. With no VBV to buffer, the smoothing thread only slices the
+ * mux output into payloads and sleeps to each one's PCR, so the mux thread can do that
+ * itself and skip the queue, the wakeup and the copies through the fifos. Payload buffers
+ * come from a pool sized once up front.
+ */
+struct mux_pacer_s
+{
+    obe_t *h;
+    AVBufferPool *pool;
+    AVBufferRef *cur;
+    int cur_packets;
+    int64_t start_clock, start_pcr;
+    int trim_ms_pending;
+};
+
+struct mux_pacer_s *mux_pacer_alloc( obe_t *h )
+{
+    struct mux_pacer_s *p = calloc( 1, sizeof(*p) );
+    if( !p )
+        return NULL;
+
+    p->h = h;
+    p->start_clock = -1;
+    p->trim_ms_pending = !!g_mux_smoother_trim_ms;
+    p->pool = av_buffer_pool_init( obe_core_get_payload_size() + obe_core_get_payload_packets() * sizeof(int64_t), NULL );
+    if( !p->pool )
+    {
+        free( p );
+        return NULL;
+    }
+
+    return p;
+}
+
+void mux_pacer_free( struct mux_pacer_s *p )
+{
+    if( !p )
+        return;
+
+    av_buffer_unref( &p->cur );
+    av_buffer_pool_uninit( &p->pool );
+    free( p );
+}
+
+static int mux_pacer_send( struct mux_pacer_s *p )
+{
+    obe_t *h = p->h;
+    int64_t cur_pcr = AV_RN64( p->cur->data );
+
+    if( p->trim_ms_pending )
+    {
+        usleep( g_mux_smoother_trim_ms * 1000 );
+        p->trim_ms_pending = 0;
+    }
+
+    if( p->start_clock != -1 )
+        sleep_input_clock( h, cur_pcr - p->start_pcr + p->start_clock );
+    else
+    {
+        p->start_clock = get_input_clock_in_mpeg_ticks( h );
+        p->start_pcr = cur_pcr;
+    }
+
+    for( int i = 1; i < h->num_outputs; i++ )
+    {
+        AVBufferRef *ref = av_buffer_ref( p->cur );
+        if( !ref || add_to_queue( &h->outputs[i]->queue, ref ) < 0 )
+            return -1;
+    }
+    if( add_to_queue( &h->outputs[0]->queue, p->cur ) < 0 )
+        return -1;
+
+    p->cur = NULL;
+    p->cur_packets = 0;
+
+    return 0;
+}
+
+int mux_pacer_write( struct mux_pacer_s *p, const uint8_t *data, int len, const int64_t *pcr_list )
+{
+    obe_t *h = p->h;
+    int payload_packets = obe_core_get_payload_packets();
+    int num_packets = len / 188;
+
+    /* Same as the smoothing thread, start over after a drop */
+    pthread_mutex_lock( &h->drop_mutex );
+    if( h->mux_drop )
+    {
+        syslog( LOG_INFO, "Mux pacing reset\n" );
+        h->mux_drop = 0;
+        av_buffer_unref( &p->cur );
+        p->cur_packets = 0;
+        p->start_clock = -1;
+        p->trim_ms_pending = !!g_mux_smoother_trim_ms;
+    }
+    pthread_mutex_unlock( &h->drop_mutex );
+
+    for( int i = 0; i < num_packets; )
+    {
+        if( !p->cur )
+        {
+            p->cur = av_buffer_pool_get( p->pool );
+            if( !p->cur )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return -1;
+            }
+        }
+
+        int n = MIN( payload_packets - p->cur_packets, num_packets - i );
+        memcpy( &p->cur->data[p->cur_packets * sizeof(int64_t)], &pcr_list[i], n * sizeof(int64_t) );
+        memcpy( &p->cur->data[payload_packets * sizeof(int64_t) + p->cur_packets * 188], &data[i * 188], n * 188 );
+        p->cur_packets += n;
+        i += n;
+
+        if( p->cur_packets == payload_packets && mux_pacer_send( p ) < 0 )
+            return -1;
+    }
+
+    return 0;
+}
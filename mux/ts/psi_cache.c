@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "psi_cache.h"
+#include "common/crc.h"
+
+#define TS_PACKET_SIZE 188
+#define NULL_PID 0x1fff
+#define SDT_PID 0x11
+
+/* A PMT section is at most 1024 bytes, six packets */
+#define MAX_TEMPLATE_PACKETS 8
+#define MAX_SECTION_SIZE 1024
+
+struct psi_template_s
+{
+	uint16_t pid;
+	uint8_t cc;
+
+	/* Continuity counter is zero, it's patched on the way out. */
+	uint8_t pkts[MAX_TEMPLATE_PACKETS][TS_PACKET_SIZE];
+	int num_pkts;           /* 0 until built, a single program writer's packets pass until then */
+};
+
+/* Follows the writer's sections on one PID */
+struct psi_capture_s
+{
+	uint16_t pid;
+	int tmpl;               /* Template fed with the writer's packets as they are, -1 when rebuilt */
+
+	uint8_t cap[MAX_TEMPLATE_PACKETS][TS_PACKET_SIZE];
+	int cap_pkts;
+	int cap_bytes;
+	int cap_need;           /* Section bytes still expected, 0 when not capturing */
+
+	uint8_t section[MAX_SECTION_SIZE]; /* Last good section, when rebuilt */
+	int section_len;
+};
+
+struct psi_cache_s
+{
+	int num;
+	struct psi_template_s *t;
+
+	int num_cap;
+	struct psi_capture_s *cap;
+
+	/* Splitting the writer's single program, 0 otherwise.
+	 * Templates are the PAT, a PMT per program then the SDT.
+	 */
+	int num_programs;
+	struct psi_cache_program_s *programs;
+
+	int64_t period;         /* 27MHz */
+	int64_t last;           /* Output time of the last repetition, -1 before the first */
+
+	int num_ready;          /* Templates with a first capture */
+	int active;             /* A repetition is being spread over the null slots */
+	int cur, next;          /* Template and packet inserted next */
+
+	struct psi_cache_stats_s stats;
+};
+
+static struct psi_cache_s *cache_alloc(int num_templates, int num_captures, int period_ms)
+{
+	struct psi_cache_s *c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->t = calloc(num_templates, sizeof(*c->t));
+	c->cap = calloc(num_captures, sizeof(*c->cap));
+	if (!c->t || !c->cap) {
+		psi_cache_free(c);
+		return NULL;
+	}
+
+	c->num = num_templates;
+	c->num_cap = num_captures;
+	c->period = (int64_t)period_ms * 27000;
+	c->last = -1;
+
+	return c;
+}
+
+struct psi_cache_s *psi_cache_alloc(const uint16_t *pids, int num_pids, int period_ms)
+{
+	struct psi_cache_s *c = cache_alloc(num_pids, num_pids, period_ms);
+	if (!c)
+		return NULL;
+
+	for (int i = 0; i < num_pids; i++) {
+		c->t[i].pid = pids[i];
+		c->cap[i].pid = pids[i];
+		c->cap[i].tmpl = i;
+	}
+
+	return c;
+}
+
+struct psi_cache_s *psi_cache_alloc_programs(const struct psi_cache_program_s *programs, int num_programs,
+	uint16_t writer_pmt_pid, int period_ms)
+{
+	struct psi_cache_s *c = cache_alloc(num_programs + 2, 3, period_ms);
+	if (!c)
+		return NULL;
+
+	c->programs = calloc(num_programs, sizeof(*c->programs));
+	if (!c->programs) {
+		psi_cache_free(c);
+		return NULL;
+	}
+	c->num_programs = num_programs;
+
+	for (int k = 0; k < num_programs; k++) {
+		struct psi_cache_program_s *p = &c->programs[k];
+		uint16_t *pids = malloc((programs[k].num_pids + 1) * sizeof(*pids));
+
+		*p = programs[k];
+		p->pids = pids;
+		p->service_name = strdup(programs[k].service_name ? programs[k].service_name : "");
+		p->provider_name = strdup(programs[k].provider_name ? programs[k].provider_name : "");
+		if (!pids || !p->service_name || !p->provider_name) {
+			psi_cache_free(c);
+			return NULL;
+		}
+		memcpy(pids, programs[k].pids, programs[k].num_pids * sizeof(*pids));
+
+		c->t[1 + k].pid = p->pmt_pid;
+	}
+	c->t[0].pid = 0;
+	c->t[num_programs + 1].pid = SDT_PID;
+
+	c->cap[0].pid = 0;
+	c->cap[1].pid = writer_pmt_pid;
+	c->cap[2].pid = SDT_PID;
+	for (int i = 0; i < c->num_cap; i++)
+		c->cap[i].tmpl = -1;
+
+	return c;
+}
+
+void psi_cache_free(struct psi_cache_s *c)
+{
+	if (!c)
+		return;
+
+	for (int k = 0; c->programs && k < c->num_programs; k++) {
+		free((void *)c->programs[k].pids);
+		free((void *)c->programs[k].service_name);
+		free((void *)c->programs[k].provider_name);
+	}
+	free(c->programs);
+	free(c->cap);
+	free(c->t);
+	free(c);
+}
+
+void psi_cache_get_stats(struct psi_cache_s *c, struct psi_cache_stats_s *stats)
+{
+	*stats = c->stats;
+}
+
+static int payload_offset(const uint8_t *p)
+{
+	int afc = (p[3] >> 4) & 3;
+	if (!(afc & 1))
+		return -1;
+
+	int off = 4 + ((afc & 2) ? 1 + p[4] : 0);
+	return off < TS_PACKET_SIZE ? off : -1;
+}
+
+/* Gather the captured section's bytes, returns its length. */
+static int capture_section(struct psi_capture_s *cap, uint8_t *sec)
+{
+	int need = cap->cap_need, len = 0;
+
+	for (int i = 0; i < cap->cap_pkts && need > 0; i++) {
+		const uint8_t *p = cap->cap[i];
+		int off = payload_offset(p);
+		if (i == 0)
+			off += 1 + p[off];
+
+		int n = TS_PACKET_SIZE - off < need ? TS_PACKET_SIZE - off : need;
+		memcpy(sec + len, p + off, n);
+		len += n;
+		need -= n;
+	}
+
+	return len;
+}
+
+static void set_template_pkts(struct psi_cache_s *c, struct psi_template_s *t, uint8_t pkts[][TS_PACKET_SIZE], int num_pkts)
+{
+	if (t->num_pkts == num_pkts && memcmp(t->pkts, pkts, num_pkts * TS_PACKET_SIZE) == 0)
+		return;
+
+	if (!t->num_pkts)
+		c->num_ready++;
+
+	memcpy(t->pkts, pkts, num_pkts * TS_PACKET_SIZE);
+	t->num_pkts = num_pkts;
+	c->stats.regenerations++;
+
+	printf("[psi-cache] pid 0x%04x template built, %d packet(s), %" PRIu64 " regenerations\n",
+		t->pid, t->num_pkts, c->stats.regenerations);
+}
+
+/* Packetize a section we built, stuffing the last packet. */
+static void set_template_section(struct psi_cache_s *c, struct psi_template_s *t, const uint8_t *sec, int len)
+{
+	uint8_t pkts[MAX_TEMPLATE_PACKETS][TS_PACKET_SIZE];
+	int pos = 0, n = 0;
+
+	while (pos < len && n < MAX_TEMPLATE_PACKETS) {
+		uint8_t *p = pkts[n];
+		int off = 4;
+
+		p[0] = 0x47;
+		p[1] = (n ? 0 : 0x40) | (t->pid >> 8);
+		p[2] = t->pid & 0xff;
+		p[3] = 0x10;
+		if (!n)
+			p[off++] = 0; /* pointer_field */
+
+		int chunk = TS_PACKET_SIZE - off < len - pos ? TS_PACKET_SIZE - off : len - pos;
+		memcpy(p + off, sec + pos, chunk);
+		memset(p + off + chunk, 0xff, TS_PACKET_SIZE - off - chunk);
+		pos += chunk;
+		n++;
+	}
+
+	set_template_pkts(c, t, pkts, n);
+}
+
+/* Fill in section_length and append the CRC_32 to a section of len bytes, returns the new length. */
+static int section_finish(uint8_t *sec, int len)
+{
+	int section_length = len + 4 - 3;
+	sec[1] = (sec[1] & 0xf0) | ((section_length >> 8) & 0x0f);
+	sec[2] = section_length & 0xff;
+
+	uint32_t crc = obe_crc32_mpeg(OBE_CRC32_MPEG_INIT, sec, len);
+	sec[len++] = crc >> 24;
+	sec[len++] = crc >> 16;
+	sec[len++] = crc >> 8;
+	sec[len++] = crc;
+
+	return len;
+}
+
+static int program_has_pid(const struct psi_cache_program_s *p, uint16_t pid)
+{
+	for (int i = 0; i < p->num_pids; i++) {
+		if (p->pids[i] == pid)
+			return 1;
+	}
+	return 0;
+}
+
+/* Keep the writer's header and any network PID entry, then list our programs. */
+static void split_pat(struct psi_cache_s *c, const uint8_t *sec, int len)
+{
+	uint8_t out[MAX_SECTION_SIZE];
+	int n = 8;
+
+	memcpy(out, sec, 8);
+	for (int i = 8; i + 4 <= len - 4; i += 4) {
+		if (!sec[i] && !sec[i + 1]) {
+			memcpy(out + n, sec + i, 4);
+			n += 4;
+		}
+	}
+
+	for (int k = 0; k < c->num_programs && n + 8 <= MAX_SECTION_SIZE; k++) {
+		const struct psi_cache_program_s *p = &c->programs[k];
+		out[n++] = p->program_num >> 8;
+		out[n++] = p->program_num;
+		out[n++] = 0xe0 | (p->pmt_pid >> 8);
+		out[n++] = p->pmt_pid;
+	}
+
+	n = section_finish(out, n);
+	set_template_section(c, &c->t[0], out, n);
+}
+
+/* Each program's PMT is the writer's, with its own number, PCR PID and elementary streams. */
+static void split_pmt(struct psi_cache_s *c, const uint8_t *sec, int len)
+{
+	if (len < 16)
+		return;
+
+	int es_start = 12 + (((sec[10] & 0x0f) << 8) | sec[11]);
+	int es_end = len - 4;
+	if (es_start > es_end)
+		return;
+
+	for (int k = 0; k < c->num_programs; k++) {
+		const struct psi_cache_program_s *p = &c->programs[k];
+		uint8_t out[MAX_SECTION_SIZE];
+		int n = es_start;
+
+		memcpy(out, sec, es_start);
+		out[3] = p->program_num >> 8;
+		out[4] = p->program_num;
+		out[8] = (out[8] & 0xe0) | ((p->pcr_pid >> 8) & 0x1f);
+		out[9] = p->pcr_pid;
+
+		for (int i = es_start; i + 5 <= es_end; ) {
+			uint16_t pid = ((sec[i + 1] & 0x1f) << 8) | sec[i + 2];
+			int es_len = 5 + (((sec[i + 3] & 0x0f) << 8) | sec[i + 4]);
+			if (i + es_len > es_end)
+				break;
+
+			if (program_has_pid(p, pid)) {
+				memcpy(out + n, sec + i, es_len);
+				n += es_len;
+			}
+			i += es_len;
+		}
+
+		n = section_finish(out, n);
+		set_template_section(c, &c->t[1 + k], out, n);
+	}
+}
+
+/* A service per program, with the writer's EIT and running status flags. */
+static void split_sdt(struct psi_cache_s *c, const uint8_t *sec, int len)
+{
+	uint8_t out[MAX_SECTION_SIZE];
+	uint8_t flags = 0xfc, running = 0x80;
+	int n = 11;
+
+	if (len < 15)
+		return;
+
+	if (len >= 11 + 5 + 4) {
+		flags = sec[13];
+		running = sec[14] & 0xf0;
+	}
+	memcpy(out, sec, 11);
+
+	for (int k = 0; k < c->num_programs; k++) {
+		const struct psi_cache_program_s *p = &c->programs[k];
+		int plen = strlen(p->provider_name), slen = strlen(p->service_name);
+		if (plen > 255)
+			plen = 255;
+		if (slen > 255)
+			slen = 255;
+
+		int dlen = 2 + 3 + plen + slen;
+		if (n + 5 + dlen + 4 > MAX_SECTION_SIZE)
+			break;
+
+		out[n++] = p->program_num >> 8;
+		out[n++] = p->program_num;
+		out[n++] = flags;
+		out[n++] = running | ((dlen >> 8) & 0x0f);
+		out[n++] = dlen;
+
+		out[n++] = 0x48; /* service_descriptor */
+		out[n++] = dlen - 2;
+		out[n++] = p->service_type;
+		out[n++] = plen;
+		memcpy(out + n, p->provider_name, plen);
+		n += plen;
+		out[n++] = slen;
+		memcpy(out + n, p->service_name, slen);
+		n += slen;
+	}
+
+	n = section_finish(out, n);
+	set_template_section(c, &c->t[c->num - 1], out, n);
+}
+
+static void capture_done(struct psi_cache_s *c, struct psi_capture_s *cap)
+{
+	uint8_t sec[MAX_SECTION_SIZE];
+	int len = capture_section(cap, sec);
+	cap->cap_need = 0;
+
+	/* Keep repeating the last good template rather than a damaged one */
+	if (obe_crc32_mpeg(OBE_CRC32_MPEG_INIT, sec, len)) {
+		c->stats.crc_errors++;
+		fprintf(stderr, "[psi-cache] pid 0x%04x section failed its CRC, %" PRIu64 " errors\n",
+			cap->pid, c->stats.crc_errors);
+		return;
+	}
+
+	if (cap->tmpl >= 0) {
+		set_template_pkts(c, &c->t[cap->tmpl], cap->cap, cap->cap_pkts);
+		return;
+	}
+
+	if (len == cap->section_len && memcmp(sec, cap->section, len) == 0)
+		return;
+	memcpy(cap->section, sec, len);
+	cap->section_len = len;
+
+	if (cap->pid == 0)
+		split_pat(c, sec, len);
+	else if (cap->pid == SDT_PID)
+		split_sdt(c, sec, len);
+	else
+		split_pmt(c, sec, len);
+}
+
+/* Follow the writer's sections on this PID, a complete section becomes the template if it differs. */
+static void capture(struct psi_cache_s *c, struct psi_capture_s *cap, const uint8_t *p)
+{
+	int off = payload_offset(p);
+	if (off < 0)
+		return;
+
+	if (p[1] & 0x40) {
+		int sec = off + 1 + p[off];
+		if (sec + 3 > TS_PACKET_SIZE) {
+			cap->cap_need = 0;
+			return;
+		}
+		cap->cap_need = 3 + (((p[sec + 1] & 0x0f) << 8) | p[sec + 2]);
+		cap->cap_bytes = TS_PACKET_SIZE - sec;
+		cap->cap_pkts = 0;
+		if (cap->cap_need > MAX_SECTION_SIZE) {
+			cap->cap_need = 0;
+			return;
+		}
+	} else if (cap->cap_need) {
+		if (cap->cap_pkts == MAX_TEMPLATE_PACKETS) {
+			cap->cap_need = 0;
+			return;
+		}
+		cap->cap_bytes += TS_PACKET_SIZE - off;
+	} else
+		return;
+
+	memcpy(cap->cap[cap->cap_pkts], p, TS_PACKET_SIZE);
+	cap->cap[cap->cap_pkts][3] &= 0xf0;
+	cap->cap_pkts++;
+
+	if (cap->cap_bytes >= cap->cap_need)
+		capture_done(c, cap);
+}
+
+static void make_null(uint8_t *p)
+{
+	p[1] = (p[1] & 0x80) | (NULL_PID >> 8);
+	p[2] = NULL_PID & 0xff;
+	p[3] = 0x10;
+}
+
+/* Next template packet of the repetition in progress, NULL when it is complete. */
+static struct psi_template_s *next_template(struct psi_cache_s *c)
+{
+	while (c->cur < c->num && c->next >= c->t[c->cur].num_pkts) {
+		c->cur++;
+		c->next = 0;
+	}
+	return c->cur < c->num ? &c->t[c->cur] : NULL;
+}
+
+void psi_cache_process(struct psi_cache_s *c, uint8_t *pkts, int num_pkts, const int64_t *pcr_list)
+{
+	for (int i = 0; i < num_pkts; i++) {
+		uint8_t *p = pkts + (i * TS_PACKET_SIZE);
+		uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+
+		for (int k = 0; k < c->num_cap; k++) {
+			struct psi_capture_s *cap = &c->cap[k];
+			if (cap->pid != pid)
+				continue;
+
+			capture(c, cap, p);
+			/* A split program's tables are all ours, the writer's never pass */
+			if (cap->tmpl < 0 || c->t[cap->tmpl].num_pkts) {
+				make_null(p);
+				pid = NULL_PID;
+			} else
+				c->t[cap->tmpl].cc = (p[3] + 1) & 0x0f; /* We carry on from the writer's counter */
+			break;
+		}
+
+		if (pid != NULL_PID || !c->num_ready)
+			continue;
+
+		if (c->last < 0 || pcr_list[i] - c->last >= c->period) {
+			if (c->active)
+				c->stats.late++;
+			c->active = 1;
+			c->cur = 0;
+			c->next = 0;
+			c->last = pcr_list[i];
+		}
+
+		if (!c->active)
+			continue;
+
+		struct psi_template_s *t = next_template(c);
+		memcpy(p, t->pkts[c->next++], TS_PACKET_SIZE);
+		p[3] |= t->cc;
+		t->cc = (t->cc + 1) & 0x0f;
+
+		if (!next_template(c)) {
+			c->active = 0;
+			c->stats.repetitions++;
+		}
+	}
+}
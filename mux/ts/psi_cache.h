@@ -0,0 +1,61 @@
+#ifndef OBE_PSI_CACHE_H
+#define OBE_PSI_CACHE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* PSI repetition from cached packet templates.
+ * The TS writer's own PAT and PMT packets are captured once, and again only when their
+ * content changes. From then on the writer's packets on those PIDs become null packets
+ * and the tables are repeated at the configured period by copying the templates into
+ * null packet slots, patching only the continuity counter. The writer can then run with
+ * a long PSI period. Needs a CBR mux, otherwise there are no null slots to fill.
+ *
+ * With psi_cache_alloc_programs() the writer carries every stream as a single program and
+ * the cache splits it: the PAT lists each program, each program gets a PMT with its own
+ * elementary streams out of the writer's PMT, and the SDT gets a service per program.
+ * This is how a multiple program TS is written with a libmpegts that only takes one.
+ */
+struct psi_cache_s;
+
+struct psi_cache_stats_s
+{
+	uint64_t regenerations; /* Templates built or rebuilt from the writer's tables */
+	uint64_t repetitions;   /* Complete PAT and PMT sets inserted */
+	uint64_t late;          /* Repetitions due before the previous one found enough null slots */
+	uint64_t crc_errors;    /* Captured sections discarded for a bad CRC_32 */
+};
+
+struct psi_cache_program_s
+{
+	uint16_t program_num;
+	uint16_t pmt_pid;
+	uint16_t pcr_pid;
+	const uint16_t *pids;   /* Elementary streams carried */
+	int num_pids;
+	uint8_t service_type;   /* SDT service descriptor */
+	const char *service_name;
+	const char *provider_name;
+};
+
+/* pids[0] is the PAT, the rest PMTs. Period in ms. */
+struct psi_cache_s *psi_cache_alloc(const uint16_t *pids, int num_pids, int period_ms);
+
+/* The writer describes all streams as one program with its PMT on writer_pmt_pid. */
+struct psi_cache_s *psi_cache_alloc_programs(const struct psi_cache_program_s *programs, int num_programs,
+	uint16_t writer_pmt_pid, int period_ms);
+void psi_cache_free(struct psi_cache_s *c);
+
+/* Rewrite a buffer of 188 byte packets in place. pcr_list holds each packet's 27MHz output time. */
+void psi_cache_process(struct psi_cache_s *c, uint8_t *pkts, int num_pkts, const int64_t *pcr_list);
+
+void psi_cache_get_stats(struct psi_cache_s *c, struct psi_cache_stats_s *stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_PSI_CACHE_H */
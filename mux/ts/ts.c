@@ -278,12 +278,18 @@
  */
 #include "common/common.h"
 #include "mux/mux.h"
+#include "psi_cache.h"
 #include <libmpegts.h>
 #include <libswresample/swresample.h>
 #include <libltntstools/ltntstools.h>
 
 #define MIN_PID 0x30
 
+/* psi-cache, the writer's own PAT/PMT period once the cache repeats the tables, and the
+ * repetition period when none is configured. */
+#define PSI_CACHE_WRITER_PERIOD  1000
+#define PSI_CACHE_DEFAULT_PERIOD 100
+
 #define PREFIX "[Mux]: "
 
 int g_mux_audio_mp2_force_pmt_11172 = 0;
@@ -347,14 +353,58 @@ static obe_output_stream_t *get_output_mux_stream( obe_mux_params_t *mux_params,
     return NULL;
 }
 
+/* MPTS, one program per device. Each program rebases its non video frames against its own
+ * first video frame, which may arrive well after the other programs have started.
+ * With abr-programs, each smaller video rendition also gets a program of its own.
+ * libmpegts writes every stream as a single program, psi_cache splits its PAT, PMT and
+ * SDT into one entry per program. All programs run off the one mux clock, so they share
+ * the first program's PCR PID.
+ */
+typedef struct
+{
+    obe_device_t *device;
+    int output_stream_id; /* The rendition carried, -1 for a device's program */
+    int video_pid;
+    int width;
+    int height;
+    int64_t first_video_pts;
+    int64_t first_video_real_pts;
+    char service_name[64];
+} mux_program_t;
+
+static int get_mux_program_idx( obe_t *h, mux_program_t *programs, int num_programs, obe_output_stream_t *output_stream )
+{
+    obe_device_t *device = get_device_by_input_stream( h, output_stream->input_stream_id );
+    for( int i = 0; i < num_programs; i++ )
+    {
+        if( programs[i].output_stream_id == output_stream->output_stream_id )
+            return i;
+    }
+    for( int i = 0; i < num_programs; i++ )
+    {
+        if( programs[i].device == device && programs[i].output_stream_id == -1 )
+            return i;
+    }
+    return 0;
+}
+
+/* A video encode that isn't the main one for its input */
+static int is_video_rendition( obe_t *h, obe_output_stream_t *output_stream )
+{
+    obe_int_input_stream_t *input_stream = get_input_stream( h, output_stream->input_stream_id );
+    obe_output_stream_t *main;
+
+    if( output_stream->stream_action != STREAM_ENCODE || !input_stream || input_stream->stream_type != STREAM_TYPE_VIDEO )
+        return 0;
+
+    main = get_output_stream_by_input_stream( h, output_stream->input_stream_id );
+    return main && main->output_stream_id != output_stream->output_stream_id;
+}
+
 static void encoder_wait( obe_t *h, int output_stream_id )
 {
     /* Wait for encoder to be ready */
-    obe_encoder_t *encoder = get_encoder( h, output_stream_id );
-    pthread_mutex_lock( &encoder->queue.mutex );
-    while( !encoder->is_ready )
-        pthread_cond_wait( &encoder->queue.in_cv, &encoder->queue.mutex );
-    pthread_mutex_unlock( &encoder->queue.mutex );
+    obe_core_encoder_wait_ready( get_encoder( h, output_stream_id ) );
 }
 
 struct queue_size_s {
@@ -505,14 +555,20 @@ void *open_muxer( void *ptr )
     obe_t *h = mux_params->h;
     obe_mux_opts_t *mux_opts = &h->mux_opts;
     int cur_pid = MIN_PID;
-    int stream_format, video_pid = 0, video_found = 0, width = 0,
-    height = 0, has_dds = 0, len = 0, num_frames = 0;
+    int stream_format, video_found = 0, has_dds = 0, len = 0, num_frames = 0;
     uint8_t *output;
-    int64_t first_video_pts = -1, video_dts, first_video_real_pts = -1;
+    int64_t video_dts;
     int64_t *pcr_list;
     ts_writer_t *w;
     ts_main_t params = {0};
-    ts_program_t program = {0};
+    ts_program_t *programs = NULL;
+    ts_program_t writer_program;
+    mux_program_t *mux_programs = NULL;
+    mux_program_t *mux_program;
+    int num_device_programs = h->num_devices > 1 ? h->num_devices : 1;
+    int num_programs = num_device_programs;
+    int *stream_program = NULL;
+    ts_stream_t *streams = NULL;
     ts_stream_t *stream;
     ts_dvb_sub_t subtitles;
     ts_dvb_vbi_t *vbi_services;
@@ -525,6 +581,8 @@ void *open_muxer( void *ptr )
     char *service_name = "OBE Service";
     char *provider_name = "Open Broadcast Encoder";
     struct ltntstools_stream_statistics_s *streamstats = NULL;
+    struct psi_cache_s *psi_cache = NULL;
+    struct mux_pacer_s *pacer = NULL;
 
     struct sched_param param = {0};
     param.sched_priority = 99;
@@ -559,41 +617,87 @@ void *open_muxer( void *ptr )
         }
     }
 
-    params.num_programs = 1;
-    params.programs = &program;
-    program.is_3dtv = !!mux_opts->is_3dtv;
-    // TODO more mux opts
+    for( int i = 0; mux_opts->abr_programs && !mux_opts->passthrough && i < mux_params->num_output_streams; i++ )
+        num_programs += is_video_rendition( h, &mux_params->output_streams[i] );
 
-    program.streams = calloc( mux_params->num_output_streams, sizeof(*program.streams) );
-    if( !program.streams )
+    programs = calloc( num_programs, sizeof(*programs) );
+    mux_programs = calloc( num_programs, sizeof(*mux_programs) );
+    streams = calloc( mux_params->num_output_streams, sizeof(*streams) );
+    stream_program = calloc( mux_params->num_output_streams, sizeof(*stream_program) );
+    if( !programs || !mux_programs || !streams || !stream_program )
     {
         fprintf( stderr, "malloc failed\n" );
         goto end;
     }
 
-    program.num_streams = mux_params->num_output_streams;
+    params.num_programs = num_programs;
+    params.programs = programs;
+    params.ts_id = mux_opts->passthrough ? h->devices[0]->ts_id : mux_opts->ts_id ? mux_opts->ts_id : 1;
 
-    if( mux_opts->passthrough )
+    /* Program numbers and PMT PIDs come first, so a single program keeps its historical PID layout.
+     * Per device input options win, then the mux options for the first program, then defaults.
+     */
+    for( int k = 0; k < num_device_programs; k++ )
     {
-        /* TODO lock when we can add multiple devices */
-        params.ts_id = h->devices[0]->ts_id;
-        program.program_num = h->devices[0]->program_num;
-        program.pmt_pid = h->devices[0]->pmt_pid;
-        program.pcr_pid = h->devices[0]->pcr_pid;
+        obe_device_t *device = h->num_devices ? h->devices[k] : NULL;
+        ts_program_t *program = &programs[k];
+
+        mux_programs[k].device = device;
+        mux_programs[k].output_stream_id = -1;
+        mux_programs[k].first_video_pts = -1;
+        mux_programs[k].first_video_real_pts = -1;
+
+        program->is_3dtv = !!mux_opts->is_3dtv;
+        // TODO more mux opts
+
+        if( mux_opts->passthrough )
+        {
+            program->program_num = device->program_num;
+            program->pmt_pid = device->pmt_pid;
+            program->pcr_pid = device->pcr_pid;
+        }
+        else if( device && device->user_opts.program_num )
+            program->program_num = device->user_opts.program_num;
+        else
+            program->program_num = (mux_opts->program_num ? mux_opts->program_num : 1) + k;
+
+        if( !mux_opts->passthrough )
+        {
+            if( device && device->user_opts.pmt_pid )
+                program->pmt_pid = device->user_opts.pmt_pid;
+            else
+                program->pmt_pid = k == 0 && mux_opts->pmt_pid ? mux_opts->pmt_pid : cur_pid++;
+            /* PCR PID is done later once we know the video pid */
+        }
     }
-    else
+
+    /* ABR rendition programs follow, numbered on from the highest program number so far */
+    for( int i = 0, k = num_device_programs; k < num_programs && i < mux_params->num_output_streams; i++ )
     {
-        params.ts_id = mux_opts->ts_id ? mux_opts->ts_id : 1;
-        program.program_num = mux_opts->program_num ? mux_opts->program_num : 1;
-        program.pmt_pid = mux_opts->pmt_pid ? mux_opts->pmt_pid : cur_pid++;
-        /* PCR PID is done later once we know the video pid */
+        output_stream = &mux_params->output_streams[i];
+        if( !is_video_rendition( h, output_stream ) )
+            continue;
+
+        mux_programs[k].device = get_device_by_input_stream( h, output_stream->input_stream_id );
+        mux_programs[k].output_stream_id = output_stream->output_stream_id;
+        mux_programs[k].first_video_pts = -1;
+        mux_programs[k].first_video_real_pts = -1;
+
+        programs[k].is_3dtv = !!mux_opts->is_3dtv;
+        for( int n = 0; n < k; n++ )
+            programs[k].program_num = MAX( programs[k].program_num, programs[n].program_num + 1 );
+        programs[k].pmt_pid = cur_pid++;
+        k++;
     }
 
-    for( int i = 0; i < program.num_streams; i++ )
+    /* Streams are set up in output stream order, then handed to their programs */
+    for( int i = 0; i < mux_params->num_output_streams; i++ )
     {
-        stream = &program.streams[i];
+        stream = &streams[i];
         output_stream = &mux_params->output_streams[i];
         input_stream = get_input_stream( h, output_stream->input_stream_id );
+        stream_program[i] = get_mux_program_idx( h, mux_programs, num_programs, output_stream );
+        mux_program = &mux_programs[stream_program[i]];
 
         if( output_stream->stream_action == STREAM_ENCODE )
             stream_format = output_stream->stream_format;
@@ -652,9 +756,13 @@ void *open_muxer( void *ptr )
         {
             encoder_wait( h, output_stream->output_stream_id );
 
-            width = output_stream->avc_param.i_width;
-            height = output_stream->avc_param.i_height;
-            video_pid = stream->pid;
+            /* A program carrying several renditions is described by its largest */
+            if( output_stream->avc_param.i_width * output_stream->avc_param.i_height > mux_program->width * mux_program->height )
+            {
+                mux_program->width = output_stream->avc_param.i_width;
+                mux_program->height = output_stream->avc_param.i_height;
+                mux_program->video_pid = stream->pid;
+            }
         }
         else if( stream_format == AUDIO_MP2 )
             stream->audio_frame_size = (double)MP2_NUM_SAMPLES * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
@@ -662,9 +770,17 @@ void *open_muxer( void *ptr )
             stream->audio_frame_size = (double)AC3_NUM_SAMPLES * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
         else if( stream_format == AUDIO_E_AC_3 || stream_format == AUDIO_AAC )
         {
-            encoder_wait( h, output_stream->output_stream_id );
-            encoder = get_encoder( h, output_stream->output_stream_id );
-            stream->audio_frame_size = (double)encoder->num_samples * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
+            /* The frame size is known up front for the codecs we use, don't hold up
+             * the PSI waiting on the audio encoder to open.
+             */
+            int num_samples = obe_core_encoder_get_expected_num_samples( output_stream );
+            if( !num_samples )
+            {
+                encoder_wait( h, output_stream->output_stream_id );
+                encoder = get_encoder( h, output_stream->output_stream_id );
+                num_samples = encoder->num_samples;
+            }
+            stream->audio_frame_size = (double)num_samples * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
         }
         else if (stream_format == AUDIO_AC_3_BITSTREAM) {
             output_stream->ts_opts.frames_per_pes = 1;
@@ -677,21 +793,141 @@ void *open_muxer( void *ptr )
 	}
     }
 
-    /* Video stream isn't guaranteed to be first so populate program parameters here */
-    if( !mux_opts->passthrough ) {
-        program.pcr_pid = mux_opts->pcr_pid ? mux_opts->pcr_pid : video_pid;
+    for( int k = 0; k < num_programs; k++ )
+    {
+        obe_device_t *device = mux_programs[k].device;
+        ts_program_t *program = &programs[k];
+
+        program->streams = calloc( mux_params->num_output_streams, sizeof(*program->streams) );
+        if( !program->streams )
+        {
+            fprintf( stderr, "malloc failed\n" );
+            goto end;
+        }
+
+        for( int i = 0; i < mux_params->num_output_streams; i++ )
+        {
+            if( stream_program[i] == k )
+                program->streams[program->num_streams++] = streams[i];
+        }
+
+        /* Video stream isn't guaranteed to be first so populate program parameters here */
+        if( !mux_opts->passthrough )
+        {
+            if( mux_programs[k].output_stream_id >= 0 )
+                program->pcr_pid = mux_programs[k].video_pid;
+            else if( device && device->user_opts.pcr_pid )
+                program->pcr_pid = device->user_opts.pcr_pid;
+            else
+                program->pcr_pid = k == 0 && mux_opts->pcr_pid ? mux_opts->pcr_pid : mux_programs[k].video_pid;
+        }
+
+        program->sdt.service_type = mux_programs[k].height >= 720 ? DVB_SERVICE_TYPE_ADVANCED_CODEC_HD : DVB_SERVICE_TYPE_ADVANCED_CODEC_SD;
+        if( mux_programs[k].output_stream_id >= 0 )
+        {
+            /* Device programs come first, so the base name is already set */
+            int base = 0;
+            for( int n = 0; n < num_device_programs; n++ )
+            {
+                if( mux_programs[n].device == device )
+                    base = n;
+            }
+            snprintf( mux_programs[k].service_name, sizeof(mux_programs[k].service_name), "%s %dx%d", programs[base].sdt.service_name,
+                      mux_programs[k].width, mux_programs[k].height );
+            program->sdt.service_name = mux_programs[k].service_name;
+        }
+        else if( device && device->user_opts.service_name )
+            program->sdt.service_name = device->user_opts.service_name;
+        else if( k == 0 )
+            program->sdt.service_name = mux_opts->service_name ? mux_opts->service_name : service_name;
+        else
+        {
+            snprintf( mux_programs[k].service_name, sizeof(mux_programs[k].service_name), "%s %d", service_name, k + 1 );
+            program->sdt.service_name = mux_programs[k].service_name;
+        }
+        program->sdt.provider_name = mux_opts->provider_name ? mux_opts->provider_name : provider_name;
+
+        printf(PREFIX "program %d: program_num %d, pmt pid 0x%x, pcr pid 0x%x, %d streams, '%s'\n",
+            k, program->program_num, program->pmt_pid, program->pcr_pid, program->num_streams, program->sdt.service_name);
     }
 
-    program.sdt.service_type = height >= 720 ? DVB_SERVICE_TYPE_ADVANCED_CODEC_HD : DVB_SERVICE_TYPE_ADVANCED_CODEC_SD;
-    program.sdt.service_name = mux_opts->service_name ? mux_opts->service_name : service_name;
-    program.sdt.provider_name = mux_opts->provider_name ? mux_opts->provider_name : provider_name;
+    if( num_programs > 1 )
+    {
+        if( !params.cbr )
+        {
+            fprintf( stderr, "[ts] %d programs need a CBR mux, their tables are inserted into null packets\n", num_programs );
+            goto end;
+        }
+
+        /* The writer sees one program carrying everything, psi_cache lists the real ones */
+        writer_program = programs[0];
+        writer_program.streams = streams;
+        writer_program.num_streams = mux_params->num_output_streams;
+        params.num_programs = 1;
+        params.programs = &writer_program;
+
+        for( int k = 1; k < num_programs; k++ )
+        {
+            if( programs[k].pcr_pid != programs[0].pcr_pid )
+                printf( PREFIX "program %d: PCR carried on the shared pid 0x%x\n", k, programs[0].pcr_pid );
+            programs[k].pcr_pid = programs[0].pcr_pid;
+        }
+    }
+
+    if( mux_opts->psi_cache && !params.cbr )
+        printf( PREFIX "psi-cache needs a CBR mux to find null packets, disabled\n" );
+    else if( mux_opts->psi_cache )
+        params.pat_period = PSI_CACHE_WRITER_PERIOD;
 
     if( ts_setup_transport_stream( w, &params ) < 0 )
     {
         fprintf( stderr, "[ts] Transport stream setup failed\n" );
+        if( params.pat_period == PSI_CACHE_WRITER_PERIOD )
+            fprintf( stderr, "[ts] psi-cache needs libmpegts to accept a %d ms PAT period\n", PSI_CACHE_WRITER_PERIOD );
         goto end;
     }
 
+    if( num_programs > 1 )
+    {
+        struct psi_cache_program_s psi_programs[num_programs];
+        uint16_t psi_program_pids[num_programs][mux_params->num_output_streams];
+
+        for( int k = 0; k < num_programs; k++ )
+        {
+            psi_programs[k].program_num = programs[k].program_num;
+            psi_programs[k].pmt_pid = programs[k].pmt_pid;
+            psi_programs[k].pcr_pid = programs[k].pcr_pid;
+            psi_programs[k].pids = psi_program_pids[k];
+            psi_programs[k].num_pids = programs[k].num_streams;
+            for( int i = 0; i < programs[k].num_streams; i++ )
+                psi_program_pids[k][i] = programs[k].streams[i].pid;
+            psi_programs[k].service_type = programs[k].sdt.service_type;
+            psi_programs[k].service_name = programs[k].sdt.service_name;
+            psi_programs[k].provider_name = programs[k].sdt.provider_name;
+        }
+
+        psi_cache = psi_cache_alloc_programs( psi_programs, num_programs, programs[0].pmt_pid,
+                                              mux_opts->pat_period ? mux_opts->pat_period : PSI_CACHE_DEFAULT_PERIOD );
+        if( !psi_cache )
+        {
+            fprintf( stderr, "malloc failed\n" );
+            goto end;
+        }
+    }
+    else if( mux_opts->psi_cache && params.cbr )
+    {
+        uint16_t psi_pids[2] = { 0, programs[0].pmt_pid };
+
+        psi_cache = psi_cache_alloc( psi_pids, 2, mux_opts->pat_period ? mux_opts->pat_period : PSI_CACHE_DEFAULT_PERIOD );
+        if( !psi_cache )
+        {
+            fprintf( stderr, "malloc failed\n" );
+            goto end;
+        }
+    }
+
+    printf(PREFIX "startup: PSI available after %" PRIi64 " ms\n", (obe_mdate() - h->start_time) / 1000);
+
     ts_set_ve_version(w, h->sw_major, h->sw_minor, h->sw_patch);
 
     ts_set_section_padding(w, mux_opts->section_padding);
@@ -706,12 +942,13 @@ void *open_muxer( void *ptr )
     }
 
     /* setup any streams if necessary */
-    for( int i = 0; i < program.num_streams; i++ )
+    for( int i = 0; i < mux_params->num_output_streams; i++ )
     {
-        stream = &program.streams[i];
+        stream = &streams[i];
         output_stream = &mux_params->output_streams[i];
         input_stream = get_input_stream( h, output_stream->input_stream_id );
         encoder = get_encoder( h, output_stream->output_stream_id );
+        mux_program = &mux_programs[stream_program[i]];
 
         if( output_stream->stream_action == STREAM_ENCODE )
             stream_format = output_stream->stream_format;
@@ -793,7 +1030,7 @@ void *open_muxer( void *ptr )
             subtitles.composition_page_id = input_stream->composition_page_id;
             subtitles.ancillary_page_id = input_stream->ancillary_page_id;
             /* A lot of streams don't have DDS flagged correctly so we assume all HD uses DDS */
-            has_dds = width >= 1280 && height >= 720;
+            has_dds = mux_program->width >= 1280 && mux_program->height >= 720;
             if( ts_setup_dvb_subtitles( w, stream->pid, has_dds, 1, &subtitles ) < 0 )
             {
                 fprintf( stderr, "[ts] Could not setup DVB Subtitle stream\n" );
@@ -879,6 +1116,17 @@ void *open_muxer( void *ptr )
     streamstats = malloc(sizeof(*streamstats));
     ltntstools_pid_stats_reset(streamstats);
 
+    if( h->mux_fused )
+    {
+        pacer = mux_pacer_alloc( h );
+        if( !pacer )
+        {
+            fprintf( stderr, "[ts] could not create pacer\n" );
+            goto end;
+        }
+        printf( PREFIX "fused mux, pacing output on the mux thread\n" );
+    }
+
     while( 1 )
     {
         video_found = 0;
@@ -919,12 +1167,15 @@ void *open_muxer( void *ptr )
                     last_video_dts = coded_frame->real_dts;
 
                     /* FIXME: handle case where first_video_pts < coded_frame->real_pts */
-                    if( first_video_pts == -1 )
+                    output_stream = get_output_mux_stream( mux_params, coded_frame->output_stream_id );
+                    mux_program = &mux_programs[stream_program[output_stream - mux_params->output_streams]];
+                    if( mux_program->first_video_pts == -1 )
                     {
                         /* Get rid of frames which are too early */
-                        first_video_pts = coded_frame->pts;
-                        first_video_real_pts = coded_frame->real_pts;
-                        remove_early_frames( h, first_video_pts );
+                        mux_program->first_video_pts = coded_frame->pts;
+                        mux_program->first_video_real_pts = coded_frame->real_pts;
+                        if( mux_program->output_stream_id == -1 )
+                            remove_early_frames( h, mux_program->first_video_pts, num_device_programs > 1 ? mux_program->device : NULL );
                         printf("Frame too early, removing ---- BAD\n");
                     }
                     break;
@@ -959,6 +1210,28 @@ void *open_muxer( void *ptr )
             }
         } // while
 
+        /* The other programs' video may start later than the one we synchronise to */
+        for( int i = 0; num_programs > 1 && i < h->mux_queue.size; i++ )
+        {
+            coded_frame = h->mux_queue.queue[i];
+            if( coded_frame->type != CF_VIDEO )
+                continue;
+
+            output_stream = get_output_mux_stream( mux_params, coded_frame->output_stream_id );
+            mux_program = &mux_programs[stream_program[output_stream - mux_params->output_streams]];
+            if( mux_program->first_video_pts == -1 )
+            {
+                mux_program->first_video_pts = coded_frame->pts;
+                mux_program->first_video_real_pts = coded_frame->real_pts;
+                /* A rendition program carries nothing but its video */
+                if( mux_program->output_stream_id == -1 )
+                {
+                    remove_early_frames( h, mux_program->first_video_pts, mux_program->device );
+                    i = -1; /* The queue has changed */
+                }
+            }
+        }
+
         frames = calloc( h->mux_queue.size, sizeof(*frames) );
         if( !frames )
         {
@@ -991,6 +1264,15 @@ void *open_muxer( void *ptr )
             }
 
             output_stream = get_output_mux_stream( mux_params, coded_frame->output_stream_id );
+            mux_program = &mux_programs[stream_program[output_stream - mux_params->output_streams]];
+
+            /* This program's video hasn't started, hold its other frames back */
+            if( coded_frame->type != CF_VIDEO && mux_program->first_video_pts == -1 )
+                continue;
+
+            int64_t first_video_pts = mux_program->first_video_pts;
+            int64_t first_video_real_pts = mux_program->first_video_real_pts;
+
             // FIXME name
             /* Rescaled_dts only applies to non-video frames, in the queue prior to related video frames,
              * such as when running in normal latency and AC3 bitstream, were 50 or so AC3 frames arrive
@@ -1116,23 +1398,38 @@ if (fh)
                 }
             }
 
-            muxed_data = new_muxed_data( len );
-            if( !muxed_data )
+            if( pacer )
             {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                goto end;
+                /* Straight to the outputs, libmpegts' buffer is ours until the next write */
+                if( psi_cache )
+                    psi_cache_process( psi_cache, output, len / 188, pcr_list );
+                if( mux_pacer_write( pacer, output, len, pcr_list ) < 0 )
+                    goto end;
             }
-
-            memcpy( muxed_data->data, output, len );
-            muxed_data->pcr_list = malloc( (len / 188) * sizeof(int64_t) );
-            if( !muxed_data->pcr_list )
+            else
             {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                destroy_muxed_data( muxed_data );
-                goto end;
+                muxed_data = new_muxed_data( len );
+                if( !muxed_data )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    goto end;
+                }
+
+                memcpy( muxed_data->data, output, len );
+                muxed_data->pcr_list = malloc( (len / 188) * sizeof(int64_t) );
+                if( !muxed_data->pcr_list )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    destroy_muxed_data( muxed_data );
+                    goto end;
+                }
+                memcpy( muxed_data->pcr_list, pcr_list, (len / 188) * sizeof(int64_t) );
+
+                if( psi_cache )
+                    psi_cache_process( psi_cache, muxed_data->data, len / 188, muxed_data->pcr_list );
+
+                add_to_queue( &h->mux_smoothing_queue, muxed_data );
             }
-            memcpy( muxed_data->pcr_list, pcr_list, (len / 188) * sizeof(int64_t) );
-            add_to_queue( &h->mux_smoothing_queue, muxed_data );
         }
 
         for( int i = 0; i < num_frames; i++ )
@@ -1146,12 +1443,27 @@ if (fh)
 
 end:
     free(streamstats);
+    mux_pacer_free( pacer );
+
+    if( psi_cache )
+    {
+        struct psi_cache_stats_s psi_stats;
+        psi_cache_get_stats( psi_cache, &psi_stats );
+        printf( PREFIX "psi-cache: %" PRIu64 " regenerations, %" PRIu64 " repetitions, %" PRIu64 " late\n",
+                psi_stats.regenerations, psi_stats.repetitions, psi_stats.late );
+        psi_cache_free( psi_cache );
+    }
 
     ts_close_writer( w );
 
     /* TODO: clean more */
 
-    free( program.streams );
+    for( int k = 0; programs && k < num_programs; k++ )
+        free( programs[k].streams );
+    free( programs );
+    free( mux_programs );
+    free( streams );
+    free( stream_program );
     free( ptr );
 
     return NULL;
@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tstd.h"
+#include "common/crc.h"
+
+#define TS_PACKET_SIZE 188
+#define MAX_PIDS       64
+#define MAX_AUS        128
+#define TB_SIZE        512
+#define SYSTEM_RATE    1000000   /* Rxn for PSI, 2.4.2.6 */
+#define AUDIO_RX       2000000
+#define CLOCK          27000000.0
+#define PCR_WRAP       (((int64_t)1 << 33) * 300)
+#define MAX_PCR_INTERVAL (CLOCK * 0.040)
+#define MAX_PCR_ERROR  13        /* 500ns at 27MHz */
+#define MAX_RESIDENCY  CLOCK
+
+#define PREFIX "[tstd] "
+
+enum pid_kind_e
+{
+	PID_PCR_ONLY,
+	PID_PSI,
+	PID_VIDEO,
+	PID_AUDIO,
+};
+
+struct au_s
+{
+	double decode_time;
+	int64_t size;
+};
+
+struct pid_s
+{
+	uint16_t pid;
+	enum pid_kind_e kind;
+
+	/* Bytes per 27MHz tick */
+	double rx;
+	double rbx;
+
+	double tb_empty;        /* Time TB runs dry */
+	double mb_empty;
+	double mb_size;
+	double eb_size;
+	double eb_level;
+
+	struct au_s aus[MAX_AUS];
+	int au_head, au_count;
+
+	/* Access unit being received */
+	int in_au;
+	double decode_time;
+	int64_t au_bytes;
+	int au_late;
+	int au_overflowed;
+	int au_seen_data;
+	int64_t last_dts;
+	int have_last_dts;
+
+	/* Audio frames, a header may straddle packets */
+	enum tstd_audio_framing_e framing;
+	int sample_rate;
+	uint8_t hdr[8];
+	int hdr_len;
+	int frame_left;
+	double next_decode_time;
+	int have_next;
+
+	int64_t last_pcr;
+	uint64_t last_pcr_packet;
+	int have_pcr;
+
+	double last_report[TSTD_MAX_VIOLATION];
+};
+
+struct tstd_s
+{
+	int64_t muxrate;
+	uint8_t index[8192];    /* Slot + 1, 0 when untracked */
+	struct pid_s pids[MAX_PIDS];
+	int num_pids;
+
+	/* PCR field minus output time, learned from the first PCR */
+	int64_t stc_offset;
+	int have_stc;
+
+	struct tstd_stats_s stats;
+};
+
+static const char *violation_names[TSTD_MAX_VIOLATION] =
+{
+	[TSTD_TB_OVERFLOW]    = "TB overflow",
+	[TSTD_MB_OVERFLOW]    = "MB overflow",
+	[TSTD_EB_OVERFLOW]    = "EB overflow",
+	[TSTD_EB_UNDERFLOW]   = "EB underflow",
+	[TSTD_RESIDENCY]      = "residency over 1s",
+	[TSTD_DTS_ORDER]      = "DTS out of order",
+	[TSTD_PTS_BEFORE_DTS] = "PTS before DTS",
+	[TSTD_PCR_INTERVAL]   = "PCR interval",
+	[TSTD_PCR_ACCURACY]   = "PCR accuracy",
+	[TSTD_PSI_CRC]        = "PSI CRC error",
+};
+
+const char *tstd_violation_name(enum tstd_violation_e v)
+{
+	if (v < 0 || v >= TSTD_MAX_VIOLATION)
+		return "unknown";
+	return violation_names[v];
+}
+
+static int64_t wrap_diff(int64_t a, int64_t b, int64_t wrap)
+{
+	int64_t d = (a - b) % wrap;
+	if (d < -wrap / 2)
+		d += wrap;
+	else if (d >= wrap / 2)
+		d -= wrap;
+	return d;
+}
+
+/* Prints are limited to one per second of stream time for each PID and kind */
+static void violation(struct tstd_s *t, struct pid_s *s, enum tstd_violation_e v, double now, const char *fmt, double val)
+{
+	t->stats.violations[v]++;
+	t->stats.total_violations++;
+
+	if (s->last_report[v] && now - s->last_report[v] < CLOCK)
+		return;
+	s->last_report[v] = now ? now : 1;
+
+	char detail[64];
+	snprintf(detail, sizeof(detail), fmt, val);
+	fprintf(stderr, PREFIX "pid 0x%04x: %s, %s (%" PRIu64 " total)\n",
+		s->pid, violation_names[v], detail, t->stats.violations[v]);
+}
+
+static struct pid_s *add_pid(struct tstd_s *t, uint16_t pid, enum pid_kind_e kind)
+{
+	pid &= 0x1fff;
+	struct pid_s *s;
+
+	if (t->index[pid]) {
+		s = &t->pids[t->index[pid] - 1];
+	} else {
+		if (t->num_pids == MAX_PIDS)
+			return NULL;
+		s = &t->pids[t->num_pids++];
+		t->index[pid] = t->num_pids;
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->pid = pid;
+	s->kind = kind;
+	if (kind == PID_PSI)
+		s->rx = SYSTEM_RATE / 8 / CLOCK;
+
+	return s;
+}
+
+int tstd_add_video(struct tstd_s *t, uint16_t pid, int64_t max_bitrate, int64_t cpb_size)
+{
+	struct pid_s *s = add_pid(t, pid, PID_VIDEO);
+	if (!s)
+		return -1;
+
+	/* 2.4.2.6 for AVC/HEVC: Rxn = 1.2 * BitRate, Rbxn = BitRate,
+	 * BSmux = 0.004 * max(1.2 * BitRate, 2Mbit/s), BSoh = 1/750 s of the same */
+	double rate = max_bitrate;
+	double mb_rate = 1.2 * rate > 2000000 ? 1.2 * rate : 2000000;
+	s->rx = 1.2 * rate / 8 / CLOCK;
+	s->rbx = rate / 8 / CLOCK;
+	s->mb_size = (0.004 + 1.0 / 750) * mb_rate / 8;
+	s->eb_size = cpb_size / 8;
+
+	return 0;
+}
+
+int tstd_add_audio(struct tstd_s *t, uint16_t pid, int buffer_size, enum tstd_audio_framing_e framing, int sample_rate)
+{
+	struct pid_s *s = add_pid(t, pid, PID_AUDIO);
+	if (!s)
+		return -1;
+
+	s->rx = AUDIO_RX / 8 / CLOCK;
+	s->eb_size = buffer_size;
+	s->framing = sample_rate > 0 ? framing : TSTD_AUDIO_PES;
+	s->sample_rate = sample_rate;
+
+	return 0;
+}
+
+struct tstd_s *tstd_alloc(int64_t muxrate)
+{
+	struct tstd_s *t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->muxrate = muxrate;
+	add_pid(t, 0, PID_PSI);
+
+	return t;
+}
+
+void tstd_free(struct tstd_s *t)
+{
+	free(t);
+}
+
+void tstd_get_stats(struct tstd_s *t, struct tstd_stats_s *stats)
+{
+	*stats = t->stats;
+}
+
+static int64_t read_timestamp(const uint8_t *p)
+{
+	return ((int64_t)(p[0] & 0x0e) << 29) | (p[1] << 22) | ((p[2] >> 1) << 15) | (p[3] << 7) | (p[4] >> 1);
+}
+
+/* A 90kHz timestamp as a time on the output clock */
+static double stc_time(struct tstd_s *t, int64_t now, int64_t ts)
+{
+	int64_t stc = (now + t->stc_offset) % PCR_WRAP;
+	return now + wrap_diff(ts * 300, stc, PCR_WRAP);
+}
+
+static void parse_pat(struct tstd_s *t, struct pid_s *s, const uint8_t *p, int len, int64_t now)
+{
+	int pointer = p[0];
+	p += 1 + pointer;
+	len -= 1 + pointer;
+	if (len < 8 || p[0] != 0x00)
+		return;
+
+	int section_len = ((p[1] & 0x0f) << 8) | p[2];
+	if (section_len + 3 > len || section_len < 9)
+		return;
+
+	/* Don't start tracking PIDs from a corrupt table */
+	if (obe_crc32_mpeg(OBE_CRC32_MPEG_INIT, p, section_len + 3)) {
+		violation(t, s, TSTD_PSI_CRC, now, "%.0f byte section", section_len + 3);
+		return;
+	}
+
+	/* Programs start after the 8 byte header, CRC is the last 4 */
+	for (int i = 8; i + 4 <= section_len + 3 - 4; i += 4) {
+		int program = (p[i] << 8) | p[i + 1];
+		uint16_t pid = ((p[i + 2] & 0x1f) << 8) | p[i + 3];
+		if (program && !t->index[pid])
+			add_pid(t, pid, PID_PSI);
+	}
+}
+
+static void handle_pcr(struct tstd_s *t, struct pid_s *s, const uint8_t *p, int64_t now)
+{
+	int64_t base = ((int64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+	int64_t pcr = base * 300 + (((p[10] & 1) << 8) | p[11]);
+	int discontinuity = p[5] & 0x80;
+
+	if (!t->have_stc || discontinuity) {
+		t->stc_offset = wrap_diff(pcr, now, PCR_WRAP);
+		t->have_stc = 1;
+	}
+
+	if (s->have_pcr && !discontinuity) {
+		int64_t interval = wrap_diff(pcr, s->last_pcr, PCR_WRAP);
+		if (interval / 27 > t->stats.pcr_interval_max_us)
+			t->stats.pcr_interval_max_us = interval / 27;
+		if (interval > MAX_PCR_INTERVAL || interval <= 0)
+			violation(t, s, TSTD_PCR_INTERVAL, now, "%.1fms", interval / 27000.0);
+
+		if (t->muxrate) {
+			uint64_t bits = (t->stats.packets - s->last_pcr_packet) * TS_PACKET_SIZE * 8;
+			int64_t expected = s->last_pcr + (int64_t)(bits * CLOCK / t->muxrate + 0.5);
+			int64_t error = wrap_diff(pcr, expected, PCR_WRAP);
+			int64_t error_ns = llabs(error) * 1000 / 27;
+			if (error_ns > t->stats.pcr_accuracy_max_ns)
+				t->stats.pcr_accuracy_max_ns = error_ns;
+			if (llabs(error) > MAX_PCR_ERROR)
+				violation(t, s, TSTD_PCR_ACCURACY, now, "%.0fns", error * 1000 / 27.0);
+		}
+	}
+
+	s->last_pcr = pcr;
+	s->last_pcr_packet = t->stats.packets;
+	s->have_pcr = 1;
+}
+
+static void remove_aus(struct pid_s *s, double now)
+{
+	while (s->au_count && s->aus[s->au_head].decode_time <= now) {
+		s->eb_level -= s->aus[s->au_head].size;
+		s->au_head = (s->au_head + 1) % MAX_AUS;
+		s->au_count--;
+	}
+}
+
+static void end_au(struct pid_s *s)
+{
+	if (!s->in_au)
+		return;
+	s->in_au = 0;
+
+	/* Far more pending than any sane buffer holds, the oldest is stale */
+	if (s->au_count == MAX_AUS) {
+		s->eb_level -= s->aus[s->au_head].size;
+		s->au_head = (s->au_head + 1) % MAX_AUS;
+		s->au_count--;
+	}
+
+	struct au_s *au = &s->aus[(s->au_head + s->au_count) % MAX_AUS];
+	au->decode_time = s->decode_time;
+	au->size = s->au_bytes;
+	s->au_count++;
+}
+
+static void begin_au(struct pid_s *s, double decode_time)
+{
+	end_au(s);
+	s->in_au = 1;
+	s->decode_time = decode_time;
+	s->au_bytes = 0;
+	s->au_late = 0;
+	s->au_overflowed = 0;
+	s->au_seen_data = 0;
+}
+
+static void start_au(struct tstd_s *t, struct pid_s *s, const uint8_t *pes, int len, int64_t now, int *header_len)
+{
+	*header_len = 0;
+	if (len < 9 || pes[0] || pes[1] || pes[2] != 1)
+		return;
+
+	*header_len = 9 + pes[8];
+	int flags = pes[7] >> 6;
+	if (!(flags & 2) || len < 14)
+		return; /* No PTS, the data carries on the current access unit */
+
+	int64_t pts = read_timestamp(pes + 9);
+	int64_t dts = (flags == 3 && len >= 19) ? read_timestamp(pes + 14) : pts;
+
+	if (wrap_diff(pts, dts, PCR_WRAP / 300) < 0)
+		violation(t, s, TSTD_PTS_BEFORE_DTS, now, "%.1fms", wrap_diff(dts, pts, PCR_WRAP / 300) / 90.0);
+	if (s->have_last_dts && wrap_diff(dts, s->last_dts, PCR_WRAP / 300) <= 0)
+		violation(t, s, TSTD_DTS_ORDER, now, "%.1fms", wrap_diff(dts, s->last_dts, PCR_WRAP / 300) / 90.0);
+	s->last_dts = dts;
+	s->have_last_dts = 1;
+
+	/* The PTS is for the first audio frame starting in this PES, the rest follow on */
+	if (s->framing != TSTD_AUDIO_PES) {
+		s->next_decode_time = stc_time(t, now, dts);
+		s->have_next = 1;
+		return;
+	}
+
+	begin_au(s, stc_time(t, now, dts));
+}
+
+static void eb_add(struct tstd_s *t, struct pid_s *s, double arrival, int bytes)
+{
+	remove_aus(s, arrival);
+
+	/* Joined mid PES, nothing to time it against */
+	if (!s->in_au)
+		return;
+
+	if (!s->au_seen_data && s->decode_time - arrival > MAX_RESIDENCY)
+		violation(t, s, TSTD_RESIDENCY, arrival, "%.0fms", (s->decode_time - arrival) / 27000.0);
+	if (!s->au_late && arrival > s->decode_time) {
+		s->au_late = 1;
+		violation(t, s, TSTD_EB_UNDERFLOW, arrival, "%.1fms late", (arrival - s->decode_time) / 27000.0);
+	}
+	s->au_seen_data = 1;
+	s->au_bytes += bytes;
+
+	s->eb_level += bytes;
+	if (s->eb_level > s->eb_size && !s->au_overflowed) {
+		s->au_overflowed = 1;
+		violation(t, s, TSTD_EB_OVERFLOW, arrival, "%.0f bytes over", s->eb_level - s->eb_size);
+	}
+}
+
+static const int mpeg_l2_kbps[2][15] =
+{
+	{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },  /* MPEG-2 LSF */
+};
+
+static const int mpeg_rates[3] = { 44100, 48000, 32000 };
+
+static const int ac3_kbps[19] =
+{
+	32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 576, 640
+};
+
+static int frame_header_size(enum tstd_audio_framing_e framing)
+{
+	switch (framing) {
+	case TSTD_AUDIO_MPEG: return 4;
+	case TSTD_AUDIO_ADTS: return 7;
+	case TSTD_AUDIO_LATM: return 3;
+	case TSTD_AUDIO_AC3:  return 6;
+	default:              return 0;
+	}
+}
+
+/* Frame size in bytes and its samples, or 0 when h is not a frame header */
+static int parse_frame_header(enum tstd_audio_framing_e framing, const uint8_t *h, int *samples)
+{
+	switch (framing) {
+	case TSTD_AUDIO_MPEG: {
+		int lsf = !(h[1] & 0x08);
+		int bitrate = mpeg_l2_kbps[lsf][(h[2] >> 4) == 15 ? 0 : h[2] >> 4];
+		int rate_idx = (h[2] >> 2) & 3;
+		if (h[0] != 0xff || (h[1] & 0xe6) != 0xe4 || !bitrate || rate_idx == 3)
+			return 0;
+		int rate = mpeg_rates[rate_idx] >> lsf;
+		*samples = 1152;
+		return 144000 * bitrate / rate + ((h[2] >> 1) & 1);
+	}
+	case TSTD_AUDIO_ADTS:
+		if (h[0] != 0xff || (h[1] & 0xf6) != 0xf0)
+			return 0;
+		*samples = 1024 * ((h[6] & 3) + 1);
+		return ((h[3] & 3) << 11) | (h[4] << 3) | (h[5] >> 5);
+	case TSTD_AUDIO_LATM:
+		if (h[0] != 0x56 || (h[1] & 0xe0) != 0xe0)
+			return 0;
+		*samples = 1024;
+		return (((h[1] & 0x1f) << 8) | h[2]) + 3;
+	case TSTD_AUDIO_AC3: {
+		if (h[0] != 0x0b || h[1] != 0x77)
+			return 0;
+		int fscod = h[4] >> 6;
+		if ((h[5] >> 3) > 10) {
+			/* E-AC-3, numblkscod is not sent for the reduced rates, those are six blocks */
+			static const int blocks[4] = { 1, 2, 3, 6 };
+			*samples = 256 * (fscod == 3 ? 6 : blocks[(h[4] >> 4) & 3]);
+			return ((((h[2] & 7) << 8) | h[3]) + 1) * 2;
+		}
+		int frmsizecod = h[4] & 0x3f;
+		if (fscod == 3 || frmsizecod >= 38)
+			return 0;
+		int bitrate = ac3_kbps[frmsizecod >> 1];
+		*samples = 1536;
+		if (fscod == 0)
+			return bitrate * 4;
+		if (fscod == 2)
+			return bitrate * 6;
+		return (bitrate * 1536000 / (44100 * 16) + (frmsizecod & 1)) * 2;
+	}
+	default:
+		return 0;
+	}
+}
+
+/* Walk audio payload frame by frame, each frame is an access unit in B */
+static void add_frames(struct tstd_s *t, struct pid_s *s, double arrival, const uint8_t *p, int len)
+{
+	int need = frame_header_size(s->framing);
+
+	while (len > 0) {
+		if (s->frame_left) {
+			int n = len < s->frame_left ? len : s->frame_left;
+			eb_add(t, s, arrival, n);
+			s->frame_left -= n;
+			p += n;
+			len -= n;
+			if (!s->frame_left)
+				end_au(s);
+			continue;
+		}
+
+		int n = need - s->hdr_len < len ? need - s->hdr_len : len;
+		memcpy(s->hdr + s->hdr_len, p, n);
+		s->hdr_len += n;
+		p += n;
+		len -= n;
+		if (s->hdr_len < need)
+			return;
+
+		int samples = 0;
+		int size = parse_frame_header(s->framing, s->hdr, &samples);
+		if (size < need) {
+			/* Not in sync, look for a header one byte on */
+			memmove(s->hdr, s->hdr + 1, --s->hdr_len);
+			continue;
+		}
+		s->hdr_len = 0;
+
+		/* Frames before the first PTS have no decode time and aren't modelled */
+		if (s->have_next) {
+			begin_au(s, s->next_decode_time);
+			s->next_decode_time += samples * CLOCK / s->sample_rate;
+		}
+		eb_add(t, s, arrival, need);
+		s->frame_left = size - need;
+		if (!s->frame_left)
+			end_au(s);
+	}
+}
+
+static void process_packet(struct tstd_s *t, const uint8_t *p, int64_t now)
+{
+	if (p[0] != 0x47)
+		return;
+
+	uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+	int afc = (p[3] >> 4) & 3;
+	int af_len = (afc & 2) ? p[4] : 0;
+	int has_pcr = (afc & 2) && af_len >= 7 && (p[5] & 0x10);
+
+	int slot = t->index[pid];
+	if (!slot) {
+		if (!has_pcr || !add_pid(t, pid, PID_PCR_ONLY))
+			return;
+		slot = t->index[pid];
+	}
+	struct pid_s *s = &t->pids[slot - 1];
+
+	if (has_pcr)
+		handle_pcr(t, s, p, now);
+
+	if (s->kind == PID_PCR_ONLY)
+		return;
+
+	/* TB fills at the output time and leaks at Rx */
+	double level = s->tb_empty > now ? (s->tb_empty - now) * s->rx : 0;
+	if (level + TS_PACKET_SIZE > TB_SIZE + 0.5)
+		violation(t, s, TSTD_TB_OVERFLOW, now, "%.0f bytes over", level + TS_PACKET_SIZE - TB_SIZE);
+	s->tb_empty = (s->tb_empty > now ? s->tb_empty : now) + TS_PACKET_SIZE / s->rx;
+
+	if (!(afc & 1))
+		return;
+	int offset = 4 + ((afc & 2) ? 1 + af_len : 0);
+	if (offset >= TS_PACKET_SIZE)
+		return;
+	const uint8_t *payload = p + offset;
+	int len = TS_PACKET_SIZE - offset;
+	int pusi = p[1] & 0x40;
+
+	if (s->kind == PID_PSI) {
+		if (pid == 0 && pusi)
+			parse_pat(t, s, payload, len, now);
+		return;
+	}
+
+	if (!t->have_stc)
+		return;
+
+	/* Last byte of the packet leaves TB at tb_empty */
+	double arrival = s->tb_empty;
+	int header_len = 0;
+	if (pusi)
+		start_au(t, s, payload, len, now, &header_len);
+	if (header_len > len)
+		header_len = len;
+
+	if (s->kind == PID_VIDEO) {
+		/* MB takes the whole PES and leaks into EB at Rbx */
+		double mb_level = s->mb_empty > arrival ? (s->mb_empty - arrival) * s->rbx : 0;
+		if (mb_level + len > s->mb_size + 0.5)
+			violation(t, s, TSTD_MB_OVERFLOW, arrival, "%.0f bytes over", mb_level + len - s->mb_size);
+		s->mb_empty = (s->mb_empty > arrival ? s->mb_empty : arrival) + len / s->rbx;
+		arrival = s->mb_empty;
+	}
+
+	if (len <= header_len)
+		return;
+	if (s->kind == PID_AUDIO && s->framing != TSTD_AUDIO_PES)
+		add_frames(t, s, arrival, payload + header_len, len - header_len);
+	else
+		eb_add(t, s, arrival, len - header_len);
+}
+
+void tstd_process(struct tstd_s *t, const uint8_t *pkts, int num_pkts, const int64_t *pcr_list)
+{
+	for (int i = 0; i < num_pkts; i++) {
+		process_packet(t, pkts + i * TS_PACKET_SIZE, pcr_list[i]);
+		t->stats.packets++;
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef OBE_TSTD_H
+#define OBE_TSTD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* T-STD verifier, ISO/IEC 13818-1 2.4.2.
+ * Follows the muxer's output packet by packet, using each packet's 27MHz output time as
+ * its arrival time. For every registered elementary stream it models the transport
+ * buffer TB, the video multiplex buffer MB with the leak method, and the elementary or
+ * main buffer EB/B with access units removed at their DTS, or PTS for audio. A video PES
+ * is one access unit. Audio PES are split at the frame headers of the stream's format and
+ * each frame is removed at the PES PTS plus the duration of the frames before it. PAT and
+ * PMTs get the system TB. It also checks PCR interval, PCR accuracy against the mux rate
+ * when CBR, and PTS/DTS order.
+ * Packets on other PIDs cost a table lookup and a PCR flag test.
+ */
+struct tstd_s;
+
+enum tstd_violation_e
+{
+	TSTD_TB_OVERFLOW,
+	TSTD_MB_OVERFLOW,
+	TSTD_EB_OVERFLOW,
+	TSTD_EB_UNDERFLOW,      /* Part of an access unit arrived after its decode time */
+	TSTD_RESIDENCY,         /* Decode time more than a second after arrival */
+	TSTD_DTS_ORDER,
+	TSTD_PTS_BEFORE_DTS,
+	TSTD_PCR_INTERVAL,      /* Over 40ms, TR 101 290 */
+	TSTD_PCR_ACCURACY,      /* Over 500ns */
+	TSTD_PSI_CRC,           /* PAT section failing its CRC_32 */
+	TSTD_MAX_VIOLATION
+};
+
+struct tstd_stats_s
+{
+	uint64_t packets;
+	uint64_t violations[TSTD_MAX_VIOLATION];
+	uint64_t total_violations;
+	int64_t pcr_interval_max_us;
+	int64_t pcr_accuracy_max_ns;
+};
+
+/* How an audio PID's PES payload divides into access units */
+enum tstd_audio_framing_e
+{
+	TSTD_AUDIO_PES,         /* Unknown, each PES is one access unit */
+	TSTD_AUDIO_MPEG,        /* MPEG-1/2 Layer II */
+	TSTD_AUDIO_ADTS,
+	TSTD_AUDIO_LATM,        /* LOAS AudioSyncStream, 1024 samples a frame */
+	TSTD_AUDIO_AC3,         /* AC-3 and E-AC-3 */
+};
+
+/* muxrate in bits/s when CBR, 0 otherwise (PCR accuracy is then not checked) */
+struct tstd_s *tstd_alloc(int64_t muxrate);
+void tstd_free(struct tstd_s *t);
+
+/* Video rates and sizes come from the encoder's VBV, bits/s and bits. Audio buffer is in bytes,
+ * sample_rate gives the frame durations. Returns -1 when out of slots.
+ */
+int tstd_add_video(struct tstd_s *t, uint16_t pid, int64_t max_bitrate, int64_t cpb_size);
+int tstd_add_audio(struct tstd_s *t, uint16_t pid, int buffer_size, enum tstd_audio_framing_e framing, int sample_rate);
+
+/* pkts are 188 bytes each, pcr_list their 27MHz output times */
+void tstd_process(struct tstd_s *t, const uint8_t *pkts, int num_pkts, const int64_t *pcr_list);
+
+void tstd_get_stats(struct tstd_s *t, struct tstd_stats_s *stats);
+const char *tstd_violation_name(enum tstd_violation_e v);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_TSTD_H */
@@ -23,6 +23,7 @@
 
 #include "common/common.h"
 #include "common/lavc.h"
+#include "common/statmux.h"
 #include "input/input.h"
 #include "filters/video/video.h"
 #include "filters/audio/audio.h"
@@ -123,6 +124,8 @@ void destroy_device( obe_device_t *device )
         free( device->input_streams[i] );
     if( device->probed_streams )
         free( device->probed_streams );
+    if( device->user_opts.service_name )
+        free( device->user_opts.service_name );
     free( device );
 }
 
@@ -281,15 +284,49 @@ void obe_release_audio_data( void *ptr )
 void obe_release_frame( void *ptr )
 {
      obe_raw_frame_t *raw_frame = ptr;
-     for( int i = 0; i < raw_frame->num_user_data; i++ )
-         free( raw_frame->user_data[i].data );
-     free( raw_frame->user_data );
 
+     /* User data and metadata items live in the arena */
      avmetadata_reset(&raw_frame->metadata);
+     obe_arena_free( raw_frame->arena );
 
      free( raw_frame );
 }
 
+void *obe_raw_frame_alloc( obe_raw_frame_t *raw_frame, size_t len )
+{
+    return obe_arena_alloc( &raw_frame->arena, len );
+}
+
+obe_user_data_t *obe_raw_frame_add_user_data( obe_raw_frame_t *raw_frame, int type, int source, int len )
+{
+    if( raw_frame->num_user_data == raw_frame->num_user_data_alloc )
+    {
+        /* The old array stays in the arena until the frame is released, it's small */
+        int alloc = raw_frame->num_user_data_alloc ? raw_frame->num_user_data_alloc * 2 : 4;
+        obe_user_data_t *tmp = obe_arena_alloc( &raw_frame->arena, alloc * sizeof(*tmp) );
+        if( !tmp )
+            return NULL;
+
+        if( raw_frame->num_user_data )
+            memcpy( tmp, raw_frame->user_data, raw_frame->num_user_data * sizeof(*tmp) );
+        raw_frame->user_data = tmp;
+        raw_frame->num_user_data_alloc = alloc;
+    }
+
+    obe_user_data_t *user_data = &raw_frame->user_data[raw_frame->num_user_data];
+    memset( user_data, 0, sizeof(*user_data) );
+    user_data->type = type;
+    user_data->source = source;
+    user_data->len = len;
+    user_data->data = obe_arena_alloc( &raw_frame->arena, len );
+    if( !user_data->data )
+        return NULL;
+
+    raw_frame->num_user_data++;
+
+    return user_data;
+}
+
 /* Muxed data */
 obe_muxed_data_t *new_muxed_data( int len )
 {
@@ -298,6 +335,7 @@ obe_muxed_data_t *new_muxed_data( int len )
         return NULL;
 
     muxed_data->ts = time(NULL);
+    muxed_data->created = obe_mdate();
     muxed_data->len = len;
     muxed_data->data = malloc( len );
     if( !muxed_data->data )
@@ -449,12 +487,20 @@ static void destroy_mux_smoothing( obe_queue_t *queue )
     obe_destroy_queue( queue );
 }
 
-int remove_early_frames( obe_t *h, int64_t pts )
+/* Device NULL removes early frames from every program */
+int remove_early_frames( obe_t *h, int64_t pts, obe_device_t *device )
 {
     void **tmp;
     for( int i = 0; i < h->mux_queue.size; i++ )
     {
         obe_coded_frame_t *frame = h->mux_queue.queue[i];
+        if( device )
+        {
+            obe_output_stream_t *output_stream = get_output_stream_by_id( h, frame->output_stream_id );
+            if( !output_stream || get_device_by_input_stream( h, output_stream->input_stream_id ) != device )
+                continue;
+        }
+
         if (frame->type != CF_VIDEO && frame->pts < pts)
         {
             destroy_coded_frame( frame );
@@ -489,14 +535,43 @@ static void destroy_output( obe_output_t *output )
 /* Input stream */
 obe_int_input_stream_t *get_input_stream( obe_t *h, int input_stream_id )
 {
-    for( int j = 0; j < h->devices[0]->num_input_streams; j++ )
+    for( int i = 0; i < h->num_devices; i++ )
     {
-        if( h->devices[0]->input_streams[j]->input_stream_id == input_stream_id )
-            return h->devices[0]->input_streams[j];
+        for( int j = 0; j < h->devices[i]->num_input_streams; j++ )
+        {
+            if( h->devices[i]->input_streams[j]->input_stream_id == input_stream_id )
+                return h->devices[i]->input_streams[j];
+        }
     }
     return NULL;
 }
 
+/* Device */
+obe_device_t *get_device_by_input_stream( obe_t *h, int input_stream_id )
+{
+    for( int i = 0; i < h->num_devices; i++ )
+    {
+        for( int j = 0; j < h->devices[i]->num_input_streams; j++ )
+        {
+            if( h->devices[i]->input_streams[j]->input_stream_id == input_stream_id )
+                return h->devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* The first of a device's streams of a type. For inputs that deliver a single video frame
+ * and a single PCM frame carrying every channel, rather than tagging per stream. */
+int get_device_input_stream_id( obe_device_t *device, int stream_type )
+{
+    for( int i = 0; i < device->num_input_streams; i++ )
+    {
+        if( device->input_streams[i]->stream_type == stream_type )
+            return device->input_streams[i]->input_stream_id;
+    }
+    return -1;
+}
+
 /* Encoder */
 obe_encoder_t *get_encoder( obe_t *h, int output_stream_id )
 {
@@ -529,6 +604,51 @@ obe_output_stream_t *get_output_stream_by_id(obe_t *h, int output_stream_id)
     return NULL;
 }
 
+/* The main encoded output fed by an input stream. For a video input with an ABR ladder
+ * this is the largest rendition, the first one configured on a tie.
+ */
+obe_output_stream_t *get_output_stream_by_input_stream( obe_t *h, int input_stream_id )
+{
+    obe_output_stream_t *main = NULL;
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *e = obe_core_get_output_stream_by_index(h, i);
+        if (e->input_stream_id != input_stream_id || e->stream_action != STREAM_ENCODE)
+            continue;
+        if (!main || e->avc_param.i_width * e->avc_param.i_height > main->avc_param.i_width * main->avc_param.i_height)
+            main = e;
+    }
+    return main;
+}
+
+/* Further video encodes of the same input, smaller than the main one, largest first */
+int get_video_renditions( obe_t *h, int input_stream_id, obe_output_stream_t **renditions, int max )
+{
+    obe_output_stream_t *main = get_output_stream_by_input_stream( h, input_stream_id );
+    obe_int_input_stream_t *input_stream = get_input_stream( h, input_stream_id );
+    int num = 0;
+
+    if( !main || !input_stream || input_stream->stream_type != STREAM_TYPE_VIDEO )
+        return 0;
+
+    for( int i = 0; i < h->num_output_streams && num < max; i++ )
+    {
+        obe_output_stream_t *e = obe_core_get_output_stream_by_index(h, i);
+        if( e == main || e->input_stream_id != input_stream_id || e->stream_action != STREAM_ENCODE )
+            continue;
+
+        int j = num++;
+        while( j > 0 && renditions[j-1]->avc_param.i_width * renditions[j-1]->avc_param.i_height <
+                        e->avc_param.i_width * e->avc_param.i_height )
+        {
+            renditions[j] = renditions[j-1];
+            j--;
+        }
+        renditions[j] = e;
+    }
+    return num;
+}
+
 obe_output_stream_t *get_output_stream_by_format( obe_t *h, int format )
 {
     for( int i = 0; i < h->num_output_streams; i++ )
@@ -540,6 +660,61 @@ obe_output_stream_t *get_output_stream_by_format( obe_t *h, int format )
     return NULL;
 }
 
+/* Start barrier */
+/* Called by an encoder thread once its codec is open and encoder_params are valid.
+ * The caller must hold e->queue.mutex, and remains responsible for broadcasting
+ * e->queue.in_cv to wake anyone blocked in obe_core_encoder_wait_ready().
+ */
+void obe_core_encoder_set_ready(obe_t *h, obe_encoder_t *e)
+{
+    e->is_ready = 1;
+    e->ready_time = obe_mdate();
+
+    printf("[core] startup: output stream %d (%s) ready after %" PRIi64 " ms\n",
+        e->output_stream_id, stream_format_name(e->priv_stream_format),
+        (e->ready_time - e->start_time) / 1000);
+
+    pthread_mutex_lock(&h->start_mutex);
+    h->start_ready++;
+    if (h->start_ready == h->start_expected) {
+        printf("[core] startup: all %d encoder(s) ready after %" PRIi64 " ms\n",
+            h->start_ready, (e->ready_time - h->start_time) / 1000);
+        syslog(LOG_INFO, "Channel encoders ready after %" PRIi64 " ms\n",
+            (e->ready_time - h->start_time) / 1000);
+    }
+    pthread_mutex_unlock(&h->start_mutex);
+}
+
+void obe_core_encoder_wait_ready(obe_encoder_t *e)
+{
+    pthread_mutex_lock(&e->queue.mutex);
+    while (!e->is_ready)
+        pthread_cond_wait(&e->queue.in_cv, &e->queue.mutex);
+    pthread_mutex_unlock(&e->queue.mutex);
+}
+
+/* The number of samples per coded audio frame, known before the encoder is open.
+ * This allows the muxer to build its PSI without waiting for audio encoders.
+ * Returns 0 when the frame size can only be discovered from the encoder.
+ */
+int obe_core_encoder_get_expected_num_samples(obe_output_stream_t *os)
+{
+    switch (os->stream_format) {
+    case AUDIO_MP2:
+        return MP2_NUM_SAMPLES;
+    case AUDIO_AC_3:
+    case AUDIO_E_AC_3:
+        return AC3_NUM_SAMPLES;
+    case AUDIO_AAC:
+        /* libfdk-aac reports a doubled frame size for SBR profiles */
+        if (os->aac_opts.aac_profile == AAC_HE_V1 || os->aac_opts.aac_profile == AAC_HE_V2)
+            return AAC_NUM_SAMPLES * 2;
+        return AAC_NUM_SAMPLES;
+    default:
+        return 0;
+    }
+}
+
 /* Syslog retains a pointer to the label. */
 static char g_logSuffix[128] = { 0 };
 obe_t *obe_setup(const char *syslogSuffix)
@@ -725,6 +900,50 @@ static int __pthread_join( pthread_t thread, void **retval )
     return -1;
 }
 
+static const obe_input_func_t *get_input_func( int input_type )
+{
+    if( input_type == INPUT_URL )
+        return &lavf_input;
+#if HAVE_DECKLINK
+    if( input_type == INPUT_DEVICE_DECKLINK )
+        return &decklink_input;
+#endif
+#if HAVE_BLUEDRIVER_P_H
+    if (input_type == INPUT_DEVICE_BLUEFISH)
+        return &bluefish_input;
+#endif
+#if HAVE_PROCESSING_NDI_LIB_H
+    if (input_type == INPUT_DEVICE_NDI)
+        return &ndi_input;
+#endif
+#if HAVE_DTAPI_H
+    if (input_type == INPUT_DEVICE_DEKTEC)
+        return &dektec_input;
+#endif
+#if HAVE_VEGA3301_CAP_TYPES_H
+    if (input_type == INPUT_DEVICE_VEGA3301)
+        return &vega3301_input;
+#endif
+#if HAVE_VEGA3311_CAP_TYPES_H
+    if (input_type == INPUT_DEVICE_VEGA3311)
+        return &vega3311_input;
+#endif
+    if (input_type == INPUT_DEVICE_V210)
+        return &v210_input;
+#if defined(__linux__)
+    if( input_type == INPUT_DEVICE_LINSYS_SDI )
+        return &linsys_sdi_input;
+    if (input_type == INPUT_DEVICE_V4L2)
+        return &v4l2_input;
+#endif
+#if defined(__APPLE__)
+    if (input_type == INPUT_DEVICE_AVFOUNDATION)
+        return &avfoundation_input;
+#endif
+
+    return NULL;
+}
+
 int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *program )
 {
     pthread_t thread;
@@ -733,7 +952,7 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
     obe_input_stream_t *stream_out;
     obe_input_probe_t *args = NULL;
 
-    obe_input_func_t  input;
+    const obe_input_func_t *input;
 
     int i = 0;
     int prev_devices = h->num_devices;
@@ -751,49 +970,8 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
         return -1;
     }
 
-    if( input_device->input_type == INPUT_URL )
-    {
-        //input = lavf_input;
-        fprintf( stderr, "URL input is not supported currently \n" );
-        goto fail;
-    }
-#if HAVE_DECKLINK
-    else if( input_device->input_type == INPUT_DEVICE_DECKLINK )
-        input = decklink_input;
-#endif
-#if HAVE_BLUEDRIVER_P_H
-    else if (input_device->input_type == INPUT_DEVICE_BLUEFISH)
-        input = bluefish_input;
-#endif
-#if HAVE_PROCESSING_NDI_LIB_H
-    else if (input_device->input_type == INPUT_DEVICE_NDI)
-        input = ndi_input;
-#endif
-#if HAVE_DTAPI_H
-    else if (input_device->input_type == INPUT_DEVICE_DEKTEC)
-        input = dektec_input;
-#endif
-#if HAVE_VEGA3301_CAP_TYPES_H
-    else if (input_device->input_type == INPUT_DEVICE_VEGA3301)
-        input = vega3301_input;
-#endif
-#if HAVE_VEGA3311_CAP_TYPES_H
-    else if (input_device->input_type == INPUT_DEVICE_VEGA3311)
-        input = vega3311_input;
-#endif
-    else if (input_device->input_type == INPUT_DEVICE_V210)
-        input = v210_input;
-#if defined(__linux__)
-    else if( input_device->input_type == INPUT_DEVICE_LINSYS_SDI )
-        input = linsys_sdi_input;
-    else if (input_device->input_type == INPUT_DEVICE_V4L2)
-        input = v4l2_input;
-#endif
-#if defined(__APPLE__)
-    else if (input_device->input_type == INPUT_DEVICE_AVFOUNDATION)
-        input = avfoundation_input;
-#endif
-    else
+    input = get_input_func( input_device->input_type );
+    if( !input )
     {
         fprintf(stderr, "Invalid input device, input = %d\n", input_device->input_type);
         return -1;
@@ -829,7 +1007,7 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
     if( obe_validate_input_params( input_device ) < 0 )
         goto fail;
 
-    if( pthread_create( &thread, NULL, input.probe_input, (void*)args ) < 0 )
+    if( pthread_create( &thread, NULL, input->probe_input, (void*)args ) < 0 )
     {
         fprintf( stderr, "Couldn't create probe thread \n" );
         goto fail;
@@ -906,6 +1084,10 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
 
     h->devices[h->num_devices-1]->probed_streams = program->streams;
 
+    /* The caller's string, the device keeps its own copy */
+    if( input_device->service_name )
+        h->devices[h->num_devices-1]->user_opts.service_name = strdup( input_device->service_name );
+
     /* Clone all of the probed input parameters into OBE's source abstraction. */
     for( i = 0; i < program->num_streams; i++ )
     {
@@ -952,6 +1134,27 @@ fail:
     return -1;
 }
 
+int obe_remove_devices( obe_t *h )
+{
+    if( h->is_active )
+    {
+        fprintf( stderr, "Devices cannot be removed while encoding \n" );
+        return -1;
+    }
+
+    pthread_mutex_lock( &h->device_list_mutex );
+    for( int i = 0; i < h->num_devices; i++ )
+    {
+        destroy_device( h->devices[i] );
+        h->devices[i] = NULL;
+    }
+    h->num_devices = 0;
+    h->cur_input_stream_id = 0;
+    pthread_mutex_unlock( &h->device_list_mutex );
+
+    return 0;
+}
+
 int obe_populate_avc_encoder_params( obe_t *h, int input_stream_id, x264_param_t *param, const char *preset_name, const char *tuning_name)
 {
     obe_int_input_stream_t *stream = get_input_stream( h, input_stream_id );
@@ -1157,6 +1360,7 @@ int obe_setup_output( obe_t *h, obe_output_opts_t *output_opts )
            fprintf( stderr, "Malloc failed\n" );
            return -1;
         }
+        h->outputs[i]->h = h;
         h->outputs[i]->output_dest.type = output_opts->outputs[i].type;
         if( output_opts->outputs[i].target )
         {
@@ -1174,9 +1378,102 @@ int obe_setup_output( obe_t *h, obe_output_opts_t *output_opts )
     return 0;
 }
 
+/* The statmux program of an x264 encode, -1 if its bitrate is not shared. Each device's
+ * main video takes part, ABR renditions keep the rate of their ladder step.
+ */
+static int get_statmux_idx( obe_t *h, obe_output_stream_t *ostream )
+{
+    int idx = 0;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *e = obe_core_get_output_stream_by_index(h, i);
+        if( e->stream_format != VIDEO_AVC || e->stream_action != STREAM_ENCODE ||
+            get_output_stream_by_input_stream( h, e->input_stream_id ) != e )
+            continue;
+        if( e == ostream )
+            return idx;
+        idx++;
+    }
+    return -1;
+}
+
+/* Several devices in a CBR mux share the sum of their video bitrates, see common/statmux.h */
+static void setup_statmux( obe_t *h )
+{
+    int num = 0;
+
+    if( !h->mux_opts.statmux || !h->mux_opts.cbr || h->num_devices < 2 )
+        return;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+        num += get_statmux_idx( h, obe_core_get_output_stream_by_index(h, i) ) >= 0;
+    if( num < 2 )
+        return;
+
+    h->statmux = statmux_alloc( num );
+    if( !h->statmux )
+    {
+        fprintf( stderr, "statmux: malloc failed, programs keep their own bitrates\n" );
+        return;
+    }
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *e = obe_core_get_output_stream_by_index(h, i);
+        int idx = get_statmux_idx( h, e );
+        if( idx < 0 )
+            continue;
+
+        statmux_set_program( h->statmux, idx, (int64_t)e->avc_param.rc.i_bitrate * 1000,
+                             (int64_t)e->avc_param.rc.i_vbv_max_bitrate * 1000 );
+        printf( "statmux: output stream %d, %d kb/s, up to %d kb/s\n", e->output_stream_id,
+                e->avc_param.rc.i_bitrate, e->avc_param.rc.i_vbv_max_bitrate );
+    }
+}
+
 /* LOS frame injection. */
 extern int g_decklink_inject_frame_enable;
 
+/* ABR ladder. Renditions of one input take the main encode's GOP, closed and without
+ * scenecut IDRs, so every rendition switches at the same frame.
+ */
+static void align_rendition_gops( obe_t *h )
+{
+    obe_output_stream_t *renditions[MAX_STREAMS];
+
+    for( int i = 0; i < h->num_devices; i++ )
+    {
+        obe_device_t *device = h->devices[i];
+        for( int j = 0; j < device->num_input_streams; j++ )
+        {
+            int id = device->input_streams[j]->input_stream_id;
+            int num = get_video_renditions( h, id, renditions, MAX_STREAMS );
+            if( !num )
+                continue;
+
+            obe_output_stream_t *main = get_output_stream_by_input_stream( h, id );
+            x264_param_t *p = &main->avc_param;
+            p->i_scenecut_threshold = 0;
+            p->b_open_gop = 0;
+            if( !p->b_intra_refresh )
+                p->i_keyint_min = p->i_keyint_max;
+
+            for( int k = 0; k < num; k++ )
+            {
+                x264_param_t *r = &renditions[k]->avc_param;
+                r->i_keyint_max = p->i_keyint_max;
+                r->i_keyint_min = p->i_keyint_min;
+                r->b_intra_refresh = p->b_intra_refresh;
+                r->i_scenecut_threshold = 0;
+                r->b_open_gop = 0;
+                printf( "ABR ladder, input stream %d rendition %dx%d follows %dx%d, keyint %d\n", id,
+                        r->i_width, r->i_height, p->i_width, p->i_height, p->i_keyint_max );
+            }
+        }
+    }
+}
+
 int obe_start( obe_t *h )
 {
     obe_int_input_stream_t  *input_stream;
@@ -1185,7 +1482,6 @@ int obe_start( obe_t *h )
     obe_vid_enc_params_t *vid_enc_params;
     obe_aud_enc_params_t *aud_enc_params;
 
-    obe_input_func_t  input;
     obe_aud_enc_func_t audio_encoder;
     obe_output_func_t output;
 
@@ -1195,62 +1491,47 @@ int obe_start( obe_t *h )
     /* TODO: decide upon thread priorities */
 
     /* Setup mutexes and cond vars */
-    pthread_mutex_init( &h->devices[0]->device_mutex, NULL );
+    for( int i = 0; i < h->num_devices; i++ )
+        pthread_mutex_init( &h->devices[i]->device_mutex, NULL );
     pthread_mutex_init( &h->drop_mutex, NULL );
     obe_init_queue( &h->enc_smoothing_queue, "encoder smoothing" );
     obe_init_queue( &h->mux_queue, "mux" );
     obe_init_queue( &h->mux_smoothing_queue, "mux smoothing" );
     pthread_mutex_init( &h->obe_clock_mutex, NULL );
     pthread_cond_init( &h->obe_clock_cv, NULL );
+    pthread_mutex_init( &h->start_mutex, NULL );
+
+    align_rendition_gops( h );
 
-    if( h->devices[0]->device_type == INPUT_URL )
+    /* Every encoder is launched before any of them is waited upon. Codec setup
+     * (x264_encoder_open, x265, libfdk-aac) then runs concurrently and each
+     * encoder checks in with the start barrier once it is ready.
+     */
+    h->start_time = obe_mdate();
+    h->start_ready = 0;
+    h->start_expected = 0;
+    for( int i = 0; i < h->num_output_streams; i++ )
     {
-        //input = lavf_input;
-        fprintf( stderr, "URL input is not supported currently \n" );
-        goto fail;
+        if( obe_core_get_output_stream_by_index(h, i)->stream_action == STREAM_ENCODE )
+            h->start_expected++;
     }
-#if HAVE_DECKLINK
-    else if( h->devices[0]->device_type == INPUT_DEVICE_DECKLINK )
-        input = decklink_input;
-#endif
-#if HAVE_BLUEDRIVER_P_H
-    else if( h->devices[0]->device_type == INPUT_DEVICE_BLUEFISH )
-        input = bluefish_input;
-#endif
-#if HAVE_PROCESSING_NDI_LIB_H
-    else if (h->devices[0]->device_type == INPUT_DEVICE_NDI)
-        input = ndi_input;
-#endif
-#if HAVE_DTAPI_H
-    else if (h->devices[0]->device_type == INPUT_DEVICE_DEKTEC)
-        input = dektec_input;
-#endif
-#if HAVE_VEGA3301_CAP_TYPES_H
-    else if (h->devices[0]->device_type == INPUT_DEVICE_VEGA3301)
-        input = vega3301_input;
-#endif
-#if HAVE_VEGA3311_CAP_TYPES_H
-    else if (h->devices[0]->device_type == INPUT_DEVICE_VEGA3311)
-        input = vega3311_input;
-#endif
-    else if( h->devices[0]->device_type == INPUT_DEVICE_V210)
-        input = v210_input;
-#if defined(__linux__)
-    else if( h->devices[0]->device_type == INPUT_DEVICE_LINSYS_SDI )
-        input = linsys_sdi_input;
-    else if (h->devices[0]->device_type == INPUT_DEVICE_V4L2)
-        input = v4l2_input;
-#endif
-#if defined(__APPLE__)
-    else if (h->devices[0]->device_type == INPUT_DEVICE_AVFOUNDATION)
-        input = avfoundation_input;
-#endif
-    else
+
+    /* Optional, audio encoders attach to this pool instead of each running its own loop. */
+    if( obe_audio_pool_start( h ) < 0 )
     {
-        fprintf( stderr, "Invalid input device \n" );
+        fprintf( stderr, "Couldn't create audio encoder pool \n" );
         goto fail;
     }
 
+    for( int i = 0; i < h->num_devices; i++ )
+    {
+        if( !get_input_func( h->devices[i]->device_type ) )
+        {
+            fprintf( stderr, "Invalid input device \n" );
+            goto fail;
+        }
+    }
+
     /* Open Output Threads */
     for( int i = 0; i < h->num_outputs; i++ )
     {
@@ -1261,11 +1542,15 @@ int obe_start( obe_t *h )
         switch (h->outputs[i]->output_dest.type) {
         case OUTPUT_UDP:
         case OUTPUT_RTP:
+        case OUTPUT_RIST:
             output = ip_output;
             break;
         case OUTPUT_FILE_TS:
             output = file_ts_output;
             break;
+        case OUTPUT_TSTD:
+            output = tstd_output;
+            break;
         default:
             fprintf(stderr, "Invalid output type, undefined.\n");
             goto fail;
@@ -1279,6 +1564,8 @@ int obe_start( obe_t *h )
         ltnpthread_setname_np(h->outputs[i]->output_thread, "obe-output");
     }
 
+    setup_statmux( h );
+
     /* Open Encoder Threads */
     for( int i = 0; i < h->num_output_streams; i++ )
     {
@@ -1295,6 +1582,7 @@ int obe_start( obe_t *h )
             sprintf(n, "output stream #%d", i);
             obe_init_queue( &h->encoders[h->num_encoders]->queue, n);
             h->encoders[h->num_encoders]->output_stream_id = os->output_stream_id;
+            h->encoders[h->num_encoders]->start_time = obe_mdate();
 
             obe_output_stream_t *ostream = obe_core_get_output_stream_by_index(h, i);
 
@@ -1315,6 +1603,8 @@ int obe_start( obe_t *h )
                 }
                 vid_enc_params->h = h;
                 vid_enc_params->encoder = h->encoders[h->num_encoders];
+                vid_enc_params->statmux_idx = get_statmux_idx( h, ostream );
+                vid_enc_params->statmux = vid_enc_params->statmux_idx >= 0 ? h->statmux : NULL;
                 h->encoders[h->num_encoders]->is_video = 1;
 
                 memcpy(&vid_enc_params->avc_param, &ostream->avc_param, sizeof(x264_param_t));
@@ -1670,7 +1960,8 @@ int obe_start( obe_t *h )
                 /* Determine whether we want the TWOLAME (only) audio encoder to rebase its time from the head of its fifo,
                  * and reset bases its clock from the h/w every 100ms or so.
                  */
-                if (g_decklink_inject_frame_enable)
+                obe_device_t *aud_device = get_device_by_input_stream( h, input_stream->input_stream_id );
+                if (g_decklink_inject_frame_enable || (aud_device && aud_device->user_opts.enable_frame_injection))
                     aud_enc_params->use_fifo_head_timing = 1;
                 else
                     aud_enc_params->use_fifo_head_timing = 0;
@@ -1698,13 +1989,28 @@ int obe_start( obe_t *h )
         ltnpthread_setname_np(h->enc_smoothing_thread, "obe-enc-smoothing");
     }
 
+    if( h->mux_opts.fused )
+    {
+        int num_video = 0;
+        for( int i = 0; i < h->num_encoders; i++ )
+            num_video += h->encoders[i]->is_video;
+
+        if( h->obe_system == OBE_SYSTEM_TYPE_LOWEST_LATENCY && h->mux_opts.cbr && num_video == 1 )
+            h->mux_fused = 1;
+        else
+            fprintf( stderr, "Fused mux needs lowest latency, CBR and a single video encoder, using the smoothing thread \n" );
+    }
+
     /* Open Mux Smoothing Thread */
-    if( pthread_create( &h->mux_smoothing_thread, NULL, mux_smoothing.start_smoothing, (void*)h ) < 0 )
+    if( !h->mux_fused )
     {
-        fprintf( stderr, "Couldn't create mux smoothing thread \n" );
-        goto fail;
+        if( pthread_create( &h->mux_smoothing_thread, NULL, mux_smoothing.start_smoothing, (void*)h ) < 0 )
+        {
+            fprintf( stderr, "Couldn't create mux smoothing thread \n" );
+            goto fail;
+        }
+        ltnpthread_setname_np(h->mux_smoothing_thread, "obe-mux-smoothing");
     }
-    ltnpthread_setname_np(h->mux_smoothing_thread, "obe-mux-smoothing");
 
     /* Open Mux Thread */
     obe_mux_params_t *mux_params = calloc( 1, sizeof(*mux_params) );
@@ -1725,111 +2031,133 @@ int obe_start( obe_t *h )
     }
     ltnpthread_setname_np(h->mux_thread, "obe-muxer");
 
-    /* Open Filter Thread */
-    for( int i = 0; i < h->devices[0]->num_input_streams; i++ )
+    /* Open Filter Threads */
+    for( int d = 0; d < h->num_devices; d++ )
     {
-        input_stream = h->devices[0]->input_streams[i];
-        if( input_stream && ( input_stream->stream_type == STREAM_TYPE_VIDEO || input_stream->stream_type == STREAM_TYPE_AUDIO ) )
-        {
-            h->filters[h->num_filters] = calloc( 1, sizeof(obe_filter_t) );
-            if( !h->filters[h->num_filters] )
-                goto fail;
+        obe_device_t *device = h->devices[d];
 
-            char n[64];
-            if (input_stream->stream_type == STREAM_TYPE_VIDEO)
-                sprintf(n, "input stream #%d [VIDEO]", i);
-            else
-            if (input_stream->stream_type == STREAM_TYPE_AUDIO)
-                sprintf(n, "input stream #%d [AUDIO]", i);
-            else
-                sprintf(n, "input stream #%d [OTHER]", i);
-
-            obe_init_queue( &h->filters[h->num_filters]->queue, n );
-
-            h->filters[h->num_filters]->num_stream_ids = 1;
-            h->filters[h->num_filters]->stream_id_list = malloc( sizeof(*h->filters[h->num_filters]->stream_id_list) );
-            if( !h->filters[h->num_filters]->stream_id_list )
+        for( int i = 0; i < device->num_input_streams; i++ )
+        {
+            input_stream = device->input_streams[i];
+            if( input_stream && ( input_stream->stream_type == STREAM_TYPE_VIDEO || input_stream->stream_type == STREAM_TYPE_AUDIO ) )
             {
-                fprintf( stderr, "Malloc failed\n" );
-                goto fail;
-            }
+                if( h->num_filters == MAX_STREAMS )
+                {
+                    fprintf( stderr, "Too many filters, only %d streams are supported across all devices\n", MAX_STREAMS );
+                    goto fail;
+                }
 
-            h->filters[h->num_filters]->stream_id_list[0] = input_stream->input_stream_id;
+                h->filters[h->num_filters] = calloc( 1, sizeof(obe_filter_t) );
+                if( !h->filters[h->num_filters] )
+                    goto fail;
 
-            if( input_stream->stream_type == STREAM_TYPE_VIDEO )
-            {
-                vid_filter_params = calloc( 1, sizeof(*vid_filter_params) );
-                if( !vid_filter_params )
+                char n[64];
+                if (input_stream->stream_type == STREAM_TYPE_VIDEO)
+                    sprintf(n, "input stream #%d [VIDEO]", i);
+                else
+                if (input_stream->stream_type == STREAM_TYPE_AUDIO)
+                    sprintf(n, "input stream #%d [AUDIO]", i);
+                else
+                    sprintf(n, "input stream #%d [OTHER]", i);
+
+                obe_init_queue( &h->filters[h->num_filters]->queue, n );
+
+                h->filters[h->num_filters]->num_stream_ids = 1;
+                h->filters[h->num_filters]->stream_id_list = malloc( sizeof(*h->filters[h->num_filters]->stream_id_list) );
+                if( !h->filters[h->num_filters]->stream_id_list )
                 {
                     fprintf( stderr, "Malloc failed\n" );
                     goto fail;
                 }
 
-                vid_filter_params->h = h;
-                vid_filter_params->filter = h->filters[h->num_filters];
-                vid_filter_params->input_stream = input_stream;
-                obe_output_stream_t *ostream = obe_core_get_output_stream_by_index(h, i);
-                vid_filter_params->target_csp = ostream->avc_param.i_csp & X264_CSP_MASK;
+                h->filters[h->num_filters]->stream_id_list[0] = input_stream->input_stream_id;
+
+                if( input_stream->stream_type == STREAM_TYPE_VIDEO )
+                {
+                    vid_filter_params = calloc( 1, sizeof(*vid_filter_params) );
+                    if( !vid_filter_params )
+                    {
+                        fprintf( stderr, "Malloc failed\n" );
+                        goto fail;
+                    }
+
+                    vid_filter_params->h = h;
+                    vid_filter_params->filter = h->filters[h->num_filters];
+                    vid_filter_params->input_stream = input_stream;
+                    vid_filter_params->output_stream = get_output_stream_by_input_stream( h, input_stream->input_stream_id );
+                    if( !vid_filter_params->output_stream )
+                        vid_filter_params->output_stream = obe_core_get_output_stream_by_index(h, 0);
+                    vid_filter_params->target_csp = vid_filter_params->output_stream->avc_param.i_csp & X264_CSP_MASK;
+                    vid_filter_params->num_renditions = get_video_renditions( h, input_stream->input_stream_id,
+                                                                              vid_filter_params->renditions, MAX_STREAMS );
 #if 0
-                vid_filter_params->target_csp = X264_CSP_I422;
+                    vid_filter_params->target_csp = X264_CSP_I422;
 #endif
 
-                if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, video_filter.start_filter, vid_filter_params ) < 0 )
-                {
-                    fprintf( stderr, "Couldn't create video filter thread \n" );
-                    goto fail;
-                }
-                ltnpthread_setname_np(h->filters[h->num_filters]->filter_thread, "obe-vid-filter");
+                    if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, video_filter.start_filter, vid_filter_params ) < 0 )
+                    {
+                        fprintf( stderr, "Couldn't create video filter thread \n" );
+                        goto fail;
+                    }
+                    ltnpthread_setname_np(h->filters[h->num_filters]->filter_thread, "obe-vid-filter");
 #if 0
 PRINT_OBE_FILTER(h->filters[h->num_filters], "VIDEO FILTER");
 #endif
-            }
-            else
-            {
+                }
+                else
+                {
 #if 0
 PRINT_OBE_FILTER(h->filters[h->num_filters], "AUDIO FILTER");
 #endif
-                aud_filter_params = calloc( 1, sizeof(*aud_filter_params) );
-                if( !aud_filter_params )
-                {
-                    fprintf( stderr, "Malloc failed\n" );
-                    goto fail;
+                    aud_filter_params = calloc( 1, sizeof(*aud_filter_params) );
+                    if( !aud_filter_params )
+                    {
+                        fprintf( stderr, "Malloc failed\n" );
+                        goto fail;
+                    }
+
+                    aud_filter_params->h = h;
+                    aud_filter_params->filter = h->filters[h->num_filters];
+                    aud_filter_params->device = device;
+
+                    if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, audio_filter.start_filter, aud_filter_params ) < 0 )
+                    {
+                        fprintf( stderr, "Couldn't create filter thread \n" );
+                        goto fail;
+                    }
+                    ltnpthread_setname_np(h->filters[h->num_filters]->filter_thread, "obe-aud-filter");
                 }
 
-                aud_filter_params->h = h;
-                aud_filter_params->filter = h->filters[h->num_filters];
-
-                if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, audio_filter.start_filter, aud_filter_params ) < 0 )
-                {
-                    fprintf( stderr, "Couldn't create filter thread \n" );
-                    goto fail;
-                }
-                ltnpthread_setname_np(h->filters[h->num_filters]->filter_thread, "obe-aud-filter");
+                h->num_filters++;
             }
-
-            h->num_filters++;
         }
     }
 
-    /* Open Input Thread */
-    obe_input_params_t *input_params = calloc( 1, sizeof(*input_params) );
-    if( !input_params )
+    /* Open Input Threads, one per device */
+    for( int d = 0; d < h->num_devices; d++ )
     {
-        fprintf( stderr, "Malloc failed\n" );
-        goto fail;
-    }
-    input_params->h = h;
-    input_params->device = h->devices[0];
+        obe_input_params_t *input_params = calloc( 1, sizeof(*input_params) );
+        if( !input_params )
+        {
+            fprintf( stderr, "Malloc failed\n" );
+            goto fail;
+        }
+        input_params->h = h;
+        input_params->device = h->devices[d];
 
-    /* TODO: in the future give it only the streams which are necessary */
-    input_params->audio_samples = num_samples;
+        /* TODO: in the future give it only the streams which are necessary */
+        input_params->audio_samples = num_samples;
 
-    if( pthread_create( &h->devices[0]->device_thread, NULL, input.open_input, (void*)input_params ) < 0 )
-    {
-        fprintf( stderr, "Couldn't create input thread \n" );
-        goto fail;
+        if( pthread_create( &h->devices[d]->device_thread, NULL, get_input_func( h->devices[d]->device_type )->open_input, (void*)input_params ) < 0 )
+        {
+            fprintf( stderr, "Couldn't create input thread \n" );
+            goto fail;
+        }
+        ltnpthread_setname_np(h->devices[d]->device_thread, "obe-device");
     }
-    ltnpthread_setname_np(h->devices[0]->device_thread, "obe-device");
+
+    printf("[core] startup: %d encoder(s) launched, pipeline threads created after %" PRIi64 " ms\n",
+        h->start_expected, (obe_mdate() - h->start_time) / 1000);
 
     h->is_active = 1;
 
@@ -1879,6 +2207,18 @@ void obe_close( obe_t *h )
         __pthread_join( h->encoders[i]->encoder_thread, &ret_ptr );
     }
 
+    /* Pooled audio encoders have exited their threads, the pool owns their codecs */
+    obe_audio_pool_stop( h );
+
+    if( h->statmux )
+    {
+        struct statmux_stats_s statmux_stats;
+        statmux_get_stats( h->statmux, &statmux_stats );
+        printf( "statmux: %" PRIu64 " reallocations\n", statmux_stats.reallocations );
+        statmux_free( h->statmux );
+        h->statmux = NULL;
+    }
+
     fprintf( stderr, "encoders cancelled \n" );
 
     /* Cancel encoder smoothing thread */
@@ -1912,7 +2252,8 @@ void obe_close( obe_t *h )
     h->cancel_mux_smoothing_thread = 1;
     pthread_cond_signal( &h->mux_smoothing_queue.in_cv );
     pthread_mutex_unlock( &h->mux_smoothing_queue.mutex );
-    __pthread_join( h->mux_smoothing_thread, &ret_ptr );
+    if( h->mux_smoothing_thread )
+        __pthread_join( h->mux_smoothing_thread, &ret_ptr );
 
     fprintf( stderr, "mux smoothing cancelled \n" );
 
@@ -2142,28 +2483,47 @@ void obe_raw_frame_free(obe_raw_frame_t *frame)
 }
 #endif
 
-obe_raw_frame_t *obe_raw_frame_copy(obe_raw_frame_t *frame)
+/* Everything but the picture, the caller fills alloc_img and img. */
+obe_raw_frame_t *obe_raw_frame_copy_props(obe_raw_frame_t *frame)
 {
     obe_raw_frame_t *f = new_raw_frame();
+    if (!f)
+        return NULL;
 
     memcpy(f, frame, sizeof(*frame));
+    memset(&f->alloc_img, 0, sizeof(f->alloc_img));
+    memset(&f->img, 0, sizeof(f->img));
+
+    /* The copy gets its own arena, deep copy everything carved from the source's. */
+    f->arena = NULL;
+    f->user_data = NULL;
+    f->num_user_data = 0;
+    f->num_user_data_alloc = 0;
+    avmetadata_init(&f->metadata);
+
+    for (int i = 0; i < frame->num_user_data; i++) {
+        obe_user_data_t *ud = obe_raw_frame_add_user_data(f, frame->user_data[i].type, frame->user_data[i].source,
+            frame->user_data[i].len);
+        if (!ud)
+            break;
+        ud->field = frame->user_data[i].field;
+        memcpy(ud->data, frame->user_data[i].data, ud->len);
+    }
 
-    obe_image_copy(&f->alloc_img, &frame->alloc_img);
+    avmetadata_clone_arena(&f->metadata, &frame->metadata, &f->arena);
 
-    memcpy(&f->img, &f->alloc_img, sizeof(frame->alloc_img));
+    return f;
+}
 
-    if (f->num_user_data) {
-        f->user_data = (obe_user_data_t *)malloc(sizeof(obe_user_data_t) * f->num_user_data);
-        memcpy(f->user_data, frame->user_data, sizeof(obe_user_data_t) * f->num_user_data);
+obe_raw_frame_t *obe_raw_frame_copy(obe_raw_frame_t *frame)
+{
+    obe_raw_frame_t *f = obe_raw_frame_copy_props(frame);
+    if (!f)
+        return NULL;
 
-        for (int i = 0; i < f->num_user_data; i++) {
-            f->user_data[i].data = (uint8_t *)malloc(frame->user_data[i].len);
-            memcpy(f->user_data[i].data, frame->user_data[i].data, f->user_data[i].len);
-        }
+    obe_image_copy(&f->alloc_img, &frame->alloc_img);
 
-    } else {
-        f->user_data = NULL;
-    }
+    memcpy(&f->img, &f->alloc_img, sizeof(frame->alloc_img));
 
 //    obe_raw_frame_printf(f);
 
@@ -141,6 +141,12 @@ typedef struct
     int enable_allow_1080p60;
     int enable_hdr;
     int enable_smpte2031;
+
+    /* MPTS, the program this device is carried in. Zero or NULL picks a default. */
+    int program_num;
+    int pmt_pid;
+    int pcr_pid;
+    char *service_name;
 } obe_input_t;
 
 /**** Stream Formats ****/
@@ -231,9 +237,13 @@ typedef struct
     obe_input_stream_t *streams;
 } obe_input_program_t;
 
-/* Only one program is returned */
+/* Only one program is returned. The device is added to those already probed,
+ * each device is carried as its own program. */
 int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *program );
 
+/* Forget every probed device, before obe_start() only. Input stream ids start from zero again. */
+int obe_remove_devices( obe_t *h );
+
 enum stream_action_e
 {
     STREAM_PASSTHROUGH,
@@ -482,6 +492,20 @@ typedef struct
     int sb_size;
 
     int section_padding;
+
+    /* ABR ladder, carry each smaller video rendition as its own program rather than
+     * as a further video PID in the program of its device. */
+    int abr_programs;
+
+    /* Repeat PAT and PMT from cached packets, patching only the continuity counter. CBR only. */
+    int psi_cache;
+
+    /* Lowest latency, CBR, one video encoder: the mux thread paces its own output and the
+     * mux smoothing thread is not started. */
+    int fused;
+
+    /* Several devices in a CBR mux share their video bitrate by complexity, see common/statmux.h */
+    int statmux;
 } obe_mux_opts_t;
 
 int obe_setup_muxer( obe_t *h, obe_mux_opts_t *mux_opts );
@@ -496,6 +520,8 @@ enum output_e
     OUTPUT_RTP, /* MPEG-TS in RTP in UDP */
     OUTPUT_LINSYS_ASI,
     OUTPUT_FILE_TS, /* MPEG-TS in file */
+    OUTPUT_RIST, /* MPEG-TS in RTP with retransmission, RIST simple profile */
+    OUTPUT_TSTD, /* T-STD buffer model check, nothing is sent */
 //    OUTPUT_LINSYS_SMPTE_310M,
 };
 
@@ -30,6 +30,9 @@
 #include <ctype.h>
 #include <include/DeckLinkAPIVersion.h>
 #include <common/scte104filtering.h>
+#include <common/latency_ctl.h>
+#include <common/statmux.h>
+#include <input/sdi/sdi_record.h>
 
 #include <signal.h>
 #define _GNU_SOURCE
@@ -45,6 +48,7 @@
 #include "obecli.h"
 #include "obecli-shared.h"
 #include "common/common.h"
+#include "filters/audio/audio.h"
 #include "ltn_ws.h"
 
 #if HAVE_DTAPI_H
@@ -131,8 +135,8 @@ static const char * const aac_encapsulations[]       = { "adts", "latm", 0 };
 static const char * const mp2_modes[]                = { "auto", "stereo", "joint-stereo", "dual-channel", 0 };
 static const char * const channel_maps[]             = { "", "mono", "stereo", "5.0", "5.1", 0 };
 static const char * const mono_channels[]            = { "left", "right", 0 };
-static const char * const output_modules[]           = { "udp", "rtp", "linsys-asi", "filets", 0 };
-static const char * const addable_streams[]          = { "audio", "ttx" };
+static const char * const output_modules[]           = { "udp", "rtp", "linsys-asi", "filets", "rist", "tstd", 0 };
+static const char * const addable_streams[]          = { "audio", "ttx", "video", 0 };
 static const char * const preset_names[]        = { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo", NULL };
 static const char * const tuning_names[]        = { "animation", "zerolatency", "fastdecode", "grain", "ssim", "psnr", NULL };
 static const char * entropy_modes[] = { "cabac", "cavlc", NULL };
@@ -145,6 +149,10 @@ static const char * input_opts[]  = { "location", "card-idx", "video-format", "v
                                       "name", /* 13 */
                                       "hdr", /* 14 */
                                       "smpte2031", /* 15 */
+                                      "program-num", /* 16 */
+                                      "pmt-pid", /* 17 */
+                                      "pcr-pid", /* 18 */
+                                      "service-name", /* 19 */
                                       NULL };
 static const char * add_opts[] =    { "type" };
 /* TODO: split the stream options into general options, video options, ts options */
@@ -271,11 +279,13 @@ static const char * stream_opts[] = {
                                       "aspect-ratio", /* 103 */
                                       "max-refs", /* 104 */
                                       "vs-script", /* 105 */
+                                      "height", /* 106 */
                                       NULL };
 
 static const char * muxer_opts[]  = { "ts-type", "cbr", "ts-muxrate", "passthrough", "ts-id", "program-num", "pmt-pid", "pcr-pid",
                                       "pcr-period", "pat-period", "service-name", "provider-name", "scte35-pid", "smpte2038-pid",
-                                      "section-padding", "smpte2031-pid", NULL };
+                                      "section-padding", "smpte2031-pid", "abr-programs",
+                                      "psi-cache", "fused", "statmux", NULL };
 static const char * ts_types[]    = { "generic", "dvb", "cablelabs", "atsc", "isdb", NULL };
 static const char * output_opts[] = { "type", "target", "trim", NULL };
 
@@ -596,6 +606,20 @@ static int add_stream( char *command, obecli_command_t *child )
         }
     }
 
+    /* ABR ladder, a further encode of the nearest video stream before this one */
+    int template_id = -1;
+    if( !strcasecmp( type, addable_streams[2] ) )
+    {
+        for( int i = output_stream_id - 1; i >= 0 && template_id < 0; i-- )
+        {
+            int input_stream_id = cli.output_streams[i].input_stream_id;
+            if( input_stream_id >= 0 && input_stream_id < cli.program.num_streams &&
+                cli.program.streams[input_stream_id].stream_type == STREAM_TYPE_VIDEO )
+                template_id = i;
+        }
+        FAIL_IF_ERROR( template_id < 0, "No video stream before output stream %d\n", output_stream_id );
+    }
+
     tmp = realloc( cli.output_streams, sizeof(*cli.output_streams) * (cli.num_output_streams+1) );
     FAIL_IF_ERROR( !tmp, "malloc failed\n" );
     cli.output_streams = tmp;
@@ -618,6 +642,12 @@ static int add_stream( char *command, obecli_command_t *child )
         cli.output_streams[output_stream_id].input_stream_id = -1;
         cli.output_streams[output_stream_id].stream_format = stream_format;
     }
+    else if( !strcasecmp( type, addable_streams[2] ) ) /* Video rendition */
+    {
+        memcpy( &cli.output_streams[output_stream_id], &cli.output_streams[template_id], sizeof(*cli.output_streams) );
+        cli.output_streams[output_stream_id].ts_opts.pid = 0;
+        printf( "Added a rendition of output stream %d, set its height to scale it\n", template_id );
+    }
     cli.output_streams[output_stream_id].output_stream_id = output_stream_id;
 
     printf( "NOTE: output-stream-ids have CHANGED! \n" );
@@ -736,6 +766,10 @@ static int set_input( char *command, obecli_command_t *child )
         char *name = obe_get_option(input_opts[13], opts);
         char *hdr = obe_get_option( input_opts[14], opts );
         char *smpte2031 = obe_get_option( input_opts[15], opts );
+        char *program_num = obe_get_option( input_opts[16], opts );
+        char *pmt_pid = obe_get_option( input_opts[17], opts );
+        char *pcr_pid = obe_get_option( input_opts[18], opts );
+        char *service_name = obe_get_option( input_opts[19], opts );
 
         FAIL_IF_ERROR( video_format && ( check_enum_value( video_format, input_video_formats ) < 0 ),
                        "Invalid video format\n" );
@@ -773,6 +807,19 @@ static int set_input( char *command, obecli_command_t *child )
         cli.input.enable_vanc_cache = obe_otoi( vanc_cache, cli.input.enable_vanc_cache );
         cli.input.enable_los_exit_ms = obe_otoi( los_exit_ms, cli.input.enable_los_exit_ms );
         cli.input.card_idx = obe_otoi( card_idx, cli.input.card_idx );
+
+        /* MPTS, the program the next probed device is carried in */
+        cli.input.program_num = obe_otoi( program_num, cli.input.program_num );
+        cli.input.pmt_pid = obe_otoi( pmt_pid, cli.input.pmt_pid ) & 0x1fff;
+        cli.input.pcr_pid = obe_otoi( pcr_pid, cli.input.pcr_pid ) & 0x1fff;
+        if( service_name )
+        {
+            if( cli.input.service_name )
+                free( cli.input.service_name );
+            cli.input.service_name = strdup( service_name );
+            FAIL_IF_ERROR( !cli.input.service_name, "malloc failed\n" );
+        }
+
         if( video_format )
             parse_enum_value( video_format, input_video_formats, &cli.input.video_format );
         if( video_connection )
@@ -791,6 +838,22 @@ static int set_input( char *command, obecli_command_t *child )
     return 0;
 }
 
+/* An ABR rendition is a video encode added with "add stream video", so another encode of the
+ * same input is still left at the source size to carry the full resolution picture.
+ */
+static int is_rendition_stream( int idx, int src_height )
+{
+    for( int i = 0; i < cli.num_output_streams; i++ )
+    {
+        obe_output_stream_t *e = &cli.output_streams[i];
+        if( i == idx || e->input_stream_id != cli.output_streams[idx].input_stream_id )
+            continue;
+        if( !e->avc_param.i_height || e->avc_param.i_height == src_height )
+            return 1;
+    }
+    return 0;
+}
+
 static int set_stream( char *command, obecli_command_t *child )
 {
     obe_input_stream_t *input_stream = NULL;
@@ -933,6 +996,7 @@ static int set_stream( char *command, obecli_command_t *child )
             /* 71 - 95 audio*/
             char *threads            = obe_get_option( stream_opts[96], opts );
             char *width              = obe_get_option( stream_opts[97], opts );
+            char *height             = obe_get_option( stream_opts[106], opts );
             char *interlaced         = obe_get_option( stream_opts[98], opts );
             char *tff                = obe_get_option( stream_opts[99], opts );
             char *frame_packing      = obe_get_option( stream_opts[100], opts );
@@ -1102,7 +1166,24 @@ extern char g_video_encoder_tuning_name[64];
                     }
                 }
 
-                if ( width )
+                if ( height && obe_otoi( height, avc_param->i_height ) != avc_param->i_height )
+                {
+                    /* ABR ladder rendition, any size below the source. Width follows the source aspect if not given. */
+                    int src_width = avc_param->i_width, src_height = avc_param->i_height;
+                    int i_height = obe_otoi( height, src_height );
+                    int i_width = obe_otoi( width, ((src_width * i_height / src_height) + 1) & ~1 );
+
+                    FAIL_IF_ERROR( !is_rendition_stream( output_stream_id, src_height ),
+                                   "Height can only be set on a rendition, add one with \"add stream video\"\n" );
+                    FAIL_IF_ERROR( i_width <= 0 || i_height <= 0 || i_width > src_width || i_height > src_height,
+                                   "Rendition must not be larger than the source %dx%d\n", src_width, src_height );
+                    FAIL_IF_ERROR( (i_width & 1) || (i_height & 1), "Rendition width and height must be even\n" );
+                    FAIL_IF_ERROR( avc_param->b_interlaced && (i_height & 3),
+                                   "Interlaced rendition height must be a multiple of 4\n" );
+                    avc_param->i_width = i_width;
+                    avc_param->i_height = i_height;
+                }
+                else if ( width )
                 {
                     int i_width = obe_otoi( width, avc_param->i_width );
                     while( allowed_resolutions[i][0] && ( allowed_resolutions[i][1] != avc_param->i_height ||
@@ -1588,6 +1669,10 @@ static int set_muxer( char *command, obecli_command_t *child )
         char *smpte2038_pid = obe_get_option( muxer_opts[13], opts );
         char *sect_padding  = obe_get_option( muxer_opts[14], opts );
         char *smpte2031_pid = obe_get_option( muxer_opts[15], opts );
+        char *abr_programs  = obe_get_option( muxer_opts[16], opts );
+        char *psi_cache     = obe_get_option( muxer_opts[17], opts );
+        char *fused         = obe_get_option( muxer_opts[18], opts );
+        char *statmux       = obe_get_option( muxer_opts[19], opts );
 
         FAIL_IF_ERROR( ts_type && ( check_enum_value( ts_type, ts_types ) < 0 ),
                       "Invalid AVC profile\n" );
@@ -1644,6 +1729,10 @@ static int set_muxer( char *command, obecli_command_t *child )
         cli.mux_opts.smpte2038_pid = obe_otoi( smpte2038_pid, cli.mux_opts.smpte2038_pid ) & 0x1fff;
         cli.mux_opts.smpte2031_pid = obe_otoi( smpte2031_pid, cli.mux_opts.smpte2031_pid ) & 0x1fff;
         cli.mux_opts.section_padding = obe_otoi( sect_padding, cli.mux_opts.section_padding );
+        cli.mux_opts.abr_programs = obe_otoi( abr_programs, cli.mux_opts.abr_programs );
+        cli.mux_opts.psi_cache = obe_otoi( psi_cache, cli.mux_opts.psi_cache );
+        cli.mux_opts.fused = obe_otob( fused, cli.mux_opts.fused );
+        cli.mux_opts.statmux = obe_otob( statmux, cli.mux_opts.statmux );
 
         if( service_name )
         {
@@ -1689,6 +1778,10 @@ static int set_outputs( char *command, obecli_command_t *child )
 
 #if DO_SET_VARIABLE
 extern int g_decklink_monitor_hw_clocks;
+extern int g_decklink_vanc_prescan;
+extern int g_decklink_record_frames[SDI_RECORD_MAX_CARDS];
+extern int g_decklink_replay_turbo;
+extern int g_decklink_replay_loop;
 extern int g_decklink_histogram_reset;
 extern int g_decklink_histogram_print_secs;
 extern int g_decklink_render_walltime;
@@ -1751,6 +1844,16 @@ extern int g_x264_lookahead_new;
 /* LAVC */
 extern int g_audio_cf_debug;
 
+/* URL input */
+extern int g_lavf_input_freerun;
+extern int g_lavf_input_decode_threads;
+extern int g_lavf_input_ac3_passthrough;
+extern int g_v210_input_audio_channels;
+
+/* Audio encoder pool */
+extern int g_audio_encoder_pool_threads;
+extern int64_t g_audio_encoder_pool_cpumask;
+
 /* SEI Timestamping. */
 extern int g_sei_timestamping;
 
@@ -1764,6 +1867,9 @@ extern int64_t g_mux_smoother_last_total_item_size;
 extern int64_t g_mux_smoother_fifo_pcr_size;
 extern int64_t g_mux_smoother_fifo_data_size;
 extern int64_t g_mux_smoother_trim_ms;
+extern int64_t g_mux_smoother_handoff_us;
+extern int64_t g_mux_smoother_latency_ms;
+extern int64_t g_enc_smoother_latency_ms;
 extern int64_t g_mux_smoother_dump;
 
 /* UDP Packet output */
@@ -1779,11 +1885,14 @@ extern int g_udp_output_bad_sync_next_packet;
 extern int g_udp_output_stall_packet_ms;
 extern int g_udp_output_latency_alert_ms;
 extern int g_udp_output_bps;
+extern int g_rist_output_rtt_ms;
+extern int g_rist_output_loss_permille;
+extern int64_t g_rist_output_retransmits;
+extern uint64_t g_tstd_violations;
 
 /* LOS frame injection. */
 extern int g_decklink_inject_frame_enable;
 extern int g_decklink_injected_frame_count_max;
-extern int g_decklink_injected_frame_count;
 
 /* Core */
 extern int g_core_runtime_statistics_to_file;
@@ -1791,6 +1900,10 @@ extern int g_core_runtime_terminate_after_seconds;
 
 /* Filters */
 extern int g_filter_audio_effect_pcm;
+extern int g_filter_audio_loudness_meter;
+extern int g_filter_audio_loudness_true_peak;
+extern int g_filter_audio_loudness_normalize;
+extern int g_filter_audio_loudness_target;
 extern int g_filter_video_fullsize_jpg;
 
 /* Ancillary data */
@@ -1826,6 +1939,26 @@ extern time_t g_decklink_missing_video_last_time;
     printf("sdi_input.monitor_hw_clocks = %d [%s]\n",
         g_decklink_monitor_hw_clocks,
         g_decklink_monitor_hw_clocks == 0 ? "disabled" : "enabled");
+    printf("sdi_input.vanc_prescan = %d [%s]\n",
+        g_decklink_vanc_prescan,
+        g_decklink_vanc_prescan == 0 ? "disabled" : "enabled");
+    int recording = 0;
+    for (int i = 0; i < SDI_RECORD_MAX_CARDS; i++) {
+        if (g_decklink_record_frames[i] == 0)
+            continue;
+        printf("sdi_input.record_frames.%d = %d [%s]\n", i,
+            g_decklink_record_frames[i],
+            g_decklink_record_frames[i] < 0 ? "recording" : "recording, frames remaining");
+        recording++;
+    }
+    if (!recording)
+        printf("sdi_input.record_frames = 0 [disabled]\n");
+    printf("sdi_input.replay_turbo = %d [%s]\n",
+        g_decklink_replay_turbo,
+        g_decklink_replay_turbo == 0 ? "realtime" : "turbo");
+    printf("sdi_input.replay_loop = %d [%s]\n",
+        g_decklink_replay_loop,
+        g_decklink_replay_loop == 0 ? "disabled" : "enabled");
     printf("sdi_input.fake_every_other_frame_lose_audio_payload = %d [%s]\n", g_decklink_fake_every_other_frame_lose_audio_payload,
         g_decklink_fake_every_other_frame_lose_audio_payload == 0 ? "disabled" : "enabled");
     printf("sdi_input.missing_audio_frame_count = %d -- last: %s",
@@ -1848,9 +1981,20 @@ extern time_t g_decklink_missing_video_last_time;
     printf("ancillary.disable_captions = %d\n",
         g_ancillary_disable_captions);
 
+    printf("lavf_input.freerun = %d [%s]\n", g_lavf_input_freerun,
+        g_lavf_input_freerun < 0 ? "auto" : g_lavf_input_freerun == 0 ? "disabled" : "enabled");
+    printf("lavf_input.decode_threads = %d\n", g_lavf_input_decode_threads);
+    printf("lavf_input.ac3_passthrough = %d [%s]\n", g_lavf_input_ac3_passthrough,
+        g_lavf_input_ac3_passthrough == 0 ? "disabled" : "enabled");
+    printf("v210_input.audio_channels = %d\n", g_v210_input_audio_channels);
+
     printf("audio_encoder.ac3_offset_ms = %" PRIi64 "\n", ac3_offset_ms);
     printf("audio_encoder.mp2_offset_ms = %" PRIi64 "\n", mp2_offset_ms);
     printf("audio_encoder.last_pts = %" PRIi64 "\n", cur_pts);
+    printf("audio_encoder.pool_threads = %d [%s]\n",
+        g_audio_encoder_pool_threads,
+        g_audio_encoder_pool_threads == 0 ? "disabled" : "enabled");
+    printf("audio_encoder.pool_cpumask = 0x%" PRIx64 "\n", g_audio_encoder_pool_cpumask);
 
     printf("video_encoder.sei_timestamping = %d [%s]\n",
         g_sei_timestamping,
@@ -1934,7 +2078,23 @@ extern time_t g_decklink_missing_video_last_time;
     printf("udp_output.bps                     = %d\n",
         g_udp_output_bps);
     printf("udp_output.transport_payload_size  = %d\n", obe_core_get_payload_size());
+    printf("rist_output.rtt_ms                 = %d\n", g_rist_output_rtt_ms);
+    printf("rist_output.loss_permille          = %d\n", g_rist_output_loss_permille);
+    printf("rist_output.retransmits            = %" PRIi64 "\n", g_rist_output_retransmits);
+    printf("tstd_output.violations             = %" PRIu64 "\n", g_tstd_violations);
     printf("udp_output.trim_ms                 = %" PRIi64 "\n", g_mux_smoother_trim_ms);
+    printf("mux_smoother.handoff_us            = %" PRIi64 "%s\n", g_mux_smoother_handoff_us,
+        cli.h->mux_fused ? " (fused, no handoff)" : "");
+    printf("latency.control                    = %d\n", g_latency_control);
+    printf("latency.margin_ms                  = %d\n", g_latency_control_margin_ms);
+    printf("latency.step_down_ms               = %d\n", g_latency_control_step_down_ms);
+    printf("latency.step_up_ms                 = %d\n", g_latency_control_step_up_ms);
+    printf("latency.window_s                   = %d\n", g_latency_control_window_s);
+    printf("latency.slew_ppm                   = %d\n", g_latency_control_slew_ppm);
+    printf("latency.enc_smoothing_ms           = %" PRIi64 "\n", g_enc_smoother_latency_ms);
+    printf("latency.mux_smoothing_ms           = %" PRIi64 "\n", g_mux_smoother_latency_ms);
+    printf("statmux.period_ms                  = %d\n", g_statmux_period_ms);
+    printf("statmux.min_pct                    = %d\n", g_statmux_min_pct);
     printf("core.runtime_statistics_to_file    = %d\n",
         g_core_runtime_statistics_to_file);
     printf("core.runtime_terminate_after_seconds = %d\n",
@@ -1962,6 +2122,17 @@ extern time_t g_decklink_missing_video_last_time;
     if (g_filter_audio_effect_pcm & (1 << 9))
         printf(" CLIP_LEFT");
     printf("\n");
+    printf("filter.audio.loudness.meter        = %d [%s]\n",
+        g_filter_audio_loudness_meter,
+        g_filter_audio_loudness_meter == 0 ? "disabled" : "enabled");
+    printf("filter.audio.loudness.true_peak    = %d [%s]\n",
+        g_filter_audio_loudness_true_peak,
+        g_filter_audio_loudness_true_peak == 0 ? "disabled" : "enabled");
+    printf("filter.audio.loudness.normalize    = %d [%s]\n",
+        g_filter_audio_loudness_normalize,
+        g_filter_audio_loudness_normalize == 0 ? "disabled" : "enabled");
+    printf("filter.audio.loudness.target       = %d (LUFS)\n",
+        g_filter_audio_loudness_target);
     printf("filter.video.create_fullsize_jpg   = %d\n",
         g_filter_video_fullsize_jpg);
 
@@ -2041,7 +2212,6 @@ static int set_variable(char *command, obecli_command_t *child)
         g_decklink_fake_every_other_frame_lose_audio_payload_time = 0;
     } else
     if (strcasecmp(var, "sdi_input.inject_frame_enable") == 0) {
-        g_decklink_injected_frame_count = 0;
         g_decklink_inject_frame_enable = val;
     } else
     if (strcasecmp(var, "sdi_input.inject_frame_count_max") == 0) {
@@ -2050,6 +2220,30 @@ static int set_variable(char *command, obecli_command_t *child)
     if (strcasecmp(var, "sdi_input.monitor_hw_clocks") == 0) {
         g_decklink_monitor_hw_clocks = val;
     } else
+    if (strcasecmp(var, "sdi_input.vanc_prescan") == 0) {
+        g_decklink_vanc_prescan = val;
+    } else
+    if (strcasecmp(var, "sdi_input.record_frames") == 0) {
+        /* N frames from every card to /tmp/cardindex<idx>-<time>.obesdi, -1 until set back to 0 */
+        for (int i = 0; i < SDI_RECORD_MAX_CARDS; i++)
+            g_decklink_record_frames[i] = val;
+    } else
+    if (strncasecmp(var, "sdi_input.record_frames.", 24) == 0) {
+        /* The same for one card, sdi_input.record_frames.<card index> */
+        char *end;
+        long idx = strtol(&var[24], &end, 10);
+        if (end == &var[24] || *end || idx < 0 || idx >= SDI_RECORD_MAX_CARDS) {
+            printf("illegal card index, 0 to %d.\n", SDI_RECORD_MAX_CARDS - 1);
+            return -1;
+        }
+        g_decklink_record_frames[idx] = val;
+    } else
+    if (strcasecmp(var, "sdi_input.replay_turbo") == 0) {
+        g_decklink_replay_turbo = val;
+    } else
+    if (strcasecmp(var, "sdi_input.replay_loop") == 0) {
+        g_decklink_replay_loop = val;
+    } else
     if (strcasecmp(var, "sdi_input.record_audio_buffers") == 0) {
         g_decklink_record_audio_buffers = val;
     } else
@@ -2065,12 +2259,35 @@ static int set_variable(char *command, obecli_command_t *child)
     if (strcasecmp(var, "sdi_input.op47_teletext_reverse") == 0) {
         g_decklink_op47_teletext_reverse = val;
     } else
+    if (strcasecmp(var, "lavf_input.freerun") == 0) {
+        /* Only observed when the input is started */
+        g_lavf_input_freerun = val;
+    } else
+    if (strcasecmp(var, "lavf_input.decode_threads") == 0) {
+        g_lavf_input_decode_threads = val;
+    } else
+    if (strcasecmp(var, "lavf_input.ac3_passthrough") == 0) {
+        /* Changes the probed stream formats, set before probing */
+        g_lavf_input_ac3_passthrough = val;
+    } else
+    if (strcasecmp(var, "v210_input.audio_channels") == 0) {
+        /* Interleaved channels in the .pcm sidecar, set before probing */
+        g_v210_input_audio_channels = val;
+    } else
     if (strcasecmp(var, "audio_encoder.ac3_offset_ms") == 0) {
         ac3_offset_ms = val;
     } else
     if (strcasecmp(var, "audio_encoder.mp2_offset_ms") == 0) {
         mp2_offset_ms = val;
     } else
+    if (strcasecmp(var, "audio_encoder.pool_threads") == 0) {
+        /* Only observed when the encoders are started */
+        g_audio_encoder_pool_threads = val;
+    } else
+    if (strcasecmp(var, "audio_encoder.pool_cpumask") == 0) {
+        /* Masks are written in hex, parse with an explicit base 0 */
+        g_audio_encoder_pool_cpumask = strtoll(strchr(command, '=') + 1, NULL, 0);
+    } else
     if (strcasecmp(var, "udp_output.drop_next_video_packet") == 0) {
         g_udp_output_drop_next_video_packet = val;
     } else
@@ -2110,6 +2327,30 @@ static int set_variable(char *command, obecli_command_t *child)
     if (strcasecmp(var, "udp_output.trim_ms") == 0) {
         g_mux_smoother_trim_ms = sanitizeParamTrim(val);
     } else
+    if (strcasecmp(var, "latency.control") == 0) {
+        g_latency_control = val;
+    } else
+    if (strcasecmp(var, "latency.margin_ms") == 0) {
+        g_latency_control_margin_ms = val;
+    } else
+    if (strcasecmp(var, "latency.step_down_ms") == 0) {
+        g_latency_control_step_down_ms = val;
+    } else
+    if (strcasecmp(var, "latency.step_up_ms") == 0) {
+        g_latency_control_step_up_ms = val;
+    } else
+    if (strcasecmp(var, "latency.window_s") == 0) {
+        g_latency_control_window_s = val;
+    } else
+    if (strcasecmp(var, "latency.slew_ppm") == 0) {
+        g_latency_control_slew_ppm = val;
+    } else
+    if (strcasecmp(var, "statmux.period_ms") == 0) {
+        g_statmux_period_ms = val;
+    } else
+    if (strcasecmp(var, "statmux.min_pct") == 0) {
+        g_statmux_min_pct = val;
+    } else
     if (strcasecmp(var, "vanc_receiver.udp_port") == 0) {
         g_decklink_udp_vanc_receiver_port = val;
     } else
@@ -2124,23 +2365,23 @@ static int set_variable(char *command, obecli_command_t *child)
     } else
     if (strcasecmp(var, "codec.x264.bitrate") == 0) {
         g_x264_bitrate_bps = val;
-        g_x264_bitrate_bps_new = 1;
+        g_x264_bitrate_bps_new++;
     } else
     if (strcasecmp(var, "codec.x264.keyint_min") == 0) {
         g_x264_keyint_min = val;
-        g_x264_keyint_min_new = 1;
+        g_x264_keyint_min_new++;
     } else
     if (strcasecmp(var, "codec.x264.keyint_max") == 0) {
         g_x264_keyint_max = val;
-        g_x264_keyint_max_new = 1;
+        g_x264_keyint_max_new++;
     } else
     if (strcasecmp(var, "codec.x264.lookahead") == 0) {
         g_x264_lookahead = val;
-        g_x264_lookahead_new = 1;
+        g_x264_lookahead_new++;
     } else
     if (strcasecmp(var, "codec.x264.encode_alternate") == 0) {
         g_x264_encode_alternate = val;
-        g_x264_encode_alternate_new = 1;
+        g_x264_encode_alternate_new++;
     } else
     if (strcasecmp(var, "codec.audio.mp2.force_pmt_type_11172") == 0) {
         g_mux_audio_mp2_force_pmt_11172 = val;
@@ -2180,6 +2421,19 @@ static int set_variable(char *command, obecli_command_t *child)
     if (strcasecmp(var, "filter.audio.pcm.adjustment") == 0) {
         g_filter_audio_effect_pcm = val;
     } else
+    if (strcasecmp(var, "filter.audio.loudness.meter") == 0) {
+        g_filter_audio_loudness_meter = val;
+    } else
+    if (strcasecmp(var, "filter.audio.loudness.true_peak") == 0) {
+        /* Only observed when a stream's meter is created */
+        g_filter_audio_loudness_true_peak = val;
+    } else
+    if (strcasecmp(var, "filter.audio.loudness.normalize") == 0) {
+        g_filter_audio_loudness_normalize = val;
+    } else
+    if (strcasecmp(var, "filter.audio.loudness.target") == 0) {
+        g_filter_audio_loudness_target = val;
+    } else
     if (strcasecmp(var, "filter.video.create_fullsize_jpg") == 0) {
         g_filter_video_fullsize_jpg = val;
     } else
@@ -2430,6 +2684,13 @@ extern void hevc_show_stats();
     return 0;
 }
 
+static int show_loudness(char *command, obecli_command_t *child)
+{
+    audio_filter_loudness_show();
+
+    return 0;
+}
+
 static int show_encoders( char *command, obecli_command_t *child )
 {
     printf( "\nSupported Encoders: \n" );
@@ -2719,6 +2980,9 @@ static int start_encode( char *command, obecli_command_t *child )
     obe_output_stream_t *output_stream;
     FAIL_IF_ERROR( g_running, "Encoder already running\n" );
     FAIL_IF_ERROR( !cli.program.num_streams, "No active devices\n" );
+    /* The tables of each extra program go in null packets */
+    FAIL_IF_ERROR( ( cli.h->num_devices > 1 || cli.mux_opts.abr_programs ) && !cli.mux_opts.cbr,
+                   "Multiple programs (add input, abr-programs) need a CBR mux, set cbr=1\n" );
 
     int scte_index = 0;
     for( int i = 0; i < cli.num_output_streams; i++ )
@@ -2804,7 +3068,7 @@ static int start_encode( char *command, obecli_command_t *child )
     FAIL_IF_ERROR( !cli.output.num_outputs, "No outputs selected\n" );
     for( int i = 0; i < cli.output.num_outputs; i++ )
     {
-        if( ( cli.output.outputs[i].type == OUTPUT_UDP || cli.output.outputs[i].type == OUTPUT_RTP || cli.output.outputs[i].type == OUTPUT_FILE_TS ) &&
+        if( ( cli.output.outputs[i].type == OUTPUT_UDP || cli.output.outputs[i].type == OUTPUT_RTP || cli.output.outputs[i].type == OUTPUT_FILE_TS || cli.output.outputs[i].type == OUTPUT_RIST ) &&
              !cli.output.outputs[i].target )
         {
             fprintf( stderr, "No output target chosen. Output-ID %d\n", i );
@@ -2858,6 +3122,18 @@ static int stop_encode( char *command, obecli_command_t *child )
         cli.input.location = NULL;
     }
 
+    if( cli.input.service_name )
+    {
+        free( cli.input.service_name );
+        cli.input.service_name = NULL;
+    }
+
+    if( cli.program.streams )
+    {
+        free( cli.program.streams );
+        cli.program.streams = NULL;
+    }
+
     if( cli.mux_opts.service_name )
     {
         free( cli.mux_opts.service_name );
@@ -2889,33 +3165,42 @@ static int stop_encode( char *command, obecli_command_t *child )
     return 0;
 }
 
-static int probe_device( char *command, obecli_command_t *child )
+/* Probe cli.input as a further device. The probed streams belong to the device, so keep
+ * our own list across all of them.
+ */
+static int probe_another_device( void )
 {
-    if( !strlen( command ) )
-        return -1;
-
-    FAIL_IF_ERROR( strcasecmp( command, "input" ), "%s is not a valid item to probe\n", command )
-
-    /* TODO check for validity */
-
-    if( obe_probe_device( cli.h, &cli.input, &cli.program ) < 0 )
+    obe_input_program_t program = {0};
+    if( obe_probe_device( cli.h, &cli.input, &program ) < 0 )
         return -1;
 
-    show_input_streams( NULL, NULL );
-
-    if( cli.program.num_streams )
+    /* The program options applied to the device just probed */
+    cli.input.program_num = cli.input.pmt_pid = cli.input.pcr_pid = 0;
+    if( cli.input.service_name )
     {
-        if( cli.output_streams )
-            free( cli.output_streams );
+        free( cli.input.service_name );
+        cli.input.service_name = NULL;
+    }
 
-        cli.num_output_streams = cli.program.num_streams;
-        cli.output_streams = calloc( cli.num_output_streams, sizeof(*cli.output_streams) );
-        if( !cli.output_streams )
-        {
-            fprintf( stderr, "Malloc failed \n" );
-            return -1;
-        }
-        for( int i = 0; i < cli.num_output_streams; i++ )
+    if( program.num_streams )
+    {
+        int first = cli.program.num_streams;
+        int num_streams = first + program.num_streams;
+
+        obe_input_stream_t *streams = realloc( cli.program.streams, num_streams * sizeof(*streams) );
+        FAIL_IF_ERROR( !streams, "Malloc failed \n" );
+        memcpy( &streams[first], program.streams, program.num_streams * sizeof(*streams) );
+        cli.program.streams = streams;
+        cli.program.num_streams = num_streams;
+
+        obe_output_stream_t *output_streams = realloc( cli.output_streams, num_streams * sizeof(*output_streams) );
+        FAIL_IF_ERROR( !output_streams, "Malloc failed \n" );
+        memset( &output_streams[first], 0, program.num_streams * sizeof(*output_streams) );
+        cli.output_streams = output_streams;
+        cli.num_output_streams = num_streams;
+
+        /* Input stream ids are allocated in probe order, so they index cli.program.streams */
+        for( int i = first; i < cli.num_output_streams; i++ )
         {
             cli.output_streams[i].input_stream_id = i;
             cli.output_streams[i].output_stream_id = cli.program.streams[i].input_stream_id;
@@ -2933,11 +3218,46 @@ static int probe_device( char *command, obecli_command_t *child )
         }
     }
 
+    show_input_streams( NULL, NULL );
     show_output_streams( NULL, NULL );
 
     return 0;
 }
 
+static int probe_device( char *command, obecli_command_t *child )
+{
+    if( !strlen( command ) )
+        return -1;
+
+    FAIL_IF_ERROR( strcasecmp( command, "input" ), "%s is not a valid item to probe\n", command )
+
+    /* TODO check for validity */
+
+    /* Probing again replaces whatever was probed before, "add input" adds a program */
+    if( cli.h->num_devices )
+    {
+        if( obe_remove_devices( cli.h ) < 0 )
+            return -1;
+
+        free( cli.program.streams );
+        cli.program.streams = NULL;
+        cli.program.num_streams = 0;
+
+        free( cli.output_streams );
+        cli.output_streams = NULL;
+        cli.num_output_streams = 0;
+    }
+
+    return probe_another_device();
+}
+
+static int add_input( char *command, obecli_command_t *child )
+{
+    FAIL_IF_ERROR( !cli.h->num_devices, "No input. Please probe a device \n" );
+
+    return probe_another_device();
+}
+
 static int parse_command( char *command, obecli_command_t *commmand_list )
 {
     if( !strlen( command ) )
@@ -3188,6 +3508,7 @@ int main( int argc, char **argv )
     }
 
     cli.avc_profile = -1;
+    cli.mux_opts.statmux = 1;
 
     _usage(argv[0], 0);
 
@@ -3289,7 +3610,7 @@ static void *runtime_statistics_thread(void *p)
 
 	ctx->running = 1;
 	char ts[64];
-	char line[256] = { 0 };
+	char line[1024] = { 0 };
 	while (!ctx->terminate) {
 		sleep(1);
 		obe_getTimestamp(ts, NULL);
@@ -3303,6 +3624,23 @@ static void *runtime_statistics_thread(void *p)
 		 */
 		sprintf(APPEND(line), ",pid=%d", getpid());
 		sprintf(APPEND(line), ",bps=%d", g_udp_output_bps);
+		sprintf(APPEND(line), ",mux_handoff_us=%" PRIi64, g_mux_smoother_handoff_us);
+		sprintf(APPEND(line), ",enc_latency_ms=%" PRIi64 ",mux_latency_ms=%" PRIi64,
+			g_enc_smoother_latency_ms, g_mux_smoother_latency_ms);
+
+		for (int i = 0; i < ctx->cli->output.num_outputs; i++) {
+			if (ctx->cli->output.outputs[i].type == OUTPUT_RIST) {
+				sprintf(APPEND(line), ",rist_rtt_ms=%d,rist_loss_permille=%d,rist_retransmits=%" PRIi64,
+					g_rist_output_rtt_ms, g_rist_output_loss_permille, g_rist_output_retransmits);
+				break;
+			}
+		}
+		for (int i = 0; i < ctx->cli->output.num_outputs; i++) {
+			if (ctx->cli->output.outputs[i].type == OUTPUT_TSTD) {
+				sprintf(APPEND(line), ",tstd_violations=%" PRIu64, g_tstd_violations);
+				break;
+			}
+		}
 
 		// /sys/devices/platform/coretemp.0/hwmon/hwmon1
 
@@ -3319,6 +3657,18 @@ static void *runtime_statistics_thread(void *p)
 		/* Mux */
 		sprintf(APPEND(line), ",mux_dtstotal=%" PRIi64, g_mux_dtstotal);
 
+		/* Loudness, short-term and integrated LUFS and true-peak dBTP per metered output stream */
+		struct audio_filter_loudness_s loudness[MAX_STREAMS];
+		int num_loudness = 0;
+		if (g_filter_audio_loudness_meter)
+			num_loudness = audio_filter_loudness_get(loudness, MAX_STREAMS);
+		for (int i = 0; i < num_loudness && strlen(line) < sizeof(line) - 384; i++) {
+			sprintf(APPEND(line), ",a%d_lufs_s=%.1f,a%d_lufs_i=%.1f,a%d_dbtp=%.1f",
+				loudness[i].output_stream_id, loudness[i].stats.shortterm_lufs,
+				loudness[i].output_stream_id, loudness[i].stats.integrated_lufs,
+				loudness[i].output_stream_id, loudness[i].stats.true_peak_dbtp);
+		}
+
 		/* Thermals */
 		if (ctx->thermal_bm == 0) {
 			char tmp[256];
@@ -3372,7 +3722,7 @@ static void *runtime_statistics_thread(void *p)
 			sprintf(APPEND(line),",load1=%.02f,load5=%.02f,load15=%.02f", la[0], la[1], la[2]);
 		}
 
-		char msg[256];
+		char msg[sizeof(ts) + sizeof(line) + 8];
 		sprintf(msg, "ts=%s%s\n", ts, line);
 
 		if (g_core_runtime_statistics_to_file > 1)
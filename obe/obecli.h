@@ -40,6 +40,7 @@ if( cond )\
 typedef struct obecli_command_t obecli_command_t;
 
 static int add_stream( char *command, obecli_command_t *child );
+static int add_input( char *command, obecli_command_t *child );
 static int remove_stream( char *command, obecli_command_t *child );
 
 static int parse_command( char *command, obecli_command_t *commmand_list );
@@ -73,6 +74,7 @@ static int start_encode( char *command, obecli_command_t *child );
 static int stop_encode( char *command, obecli_command_t *child );
 
 static int show_queues(char *command, obecli_command_t *child);
+static int show_loudness(char *command, obecli_command_t *child);
 
 struct obecli_command_t
 {
@@ -119,6 +121,7 @@ typedef struct
 /* Commands */
 static obecli_command_t add_commands[] =
 {
+    { "input",  "",  "Probe another input, carried as its own program in a CBR mux", add_input, NULL },
     { "stream", "",  "Add stream", add_stream, NULL },
     { 0 }
 };
@@ -137,6 +140,7 @@ static obecli_command_t show_commands[] =
     //{ "filters",  "",  "Show supported filters",   show_filters, NULL },
     { "input",    "streams",  "Show input streams",  show_input,   NULL },
     { "inputs",   "",  "Show supported inputs",      show_inputs,   NULL },
+    { "loudness", "",  "Show audio loudness metrics", show_loudness, NULL },
     { "muxers",   "",  "Show supported muxers",      show_muxers,   NULL },
     { "output",   "streams",  "Show output streams", show_output,   NULL },
     { "outputs",  "",  "Show supported outputs",     show_outputs,  NULL },
@@ -240,6 +244,8 @@ static const obecli_output_name_t output_names[] =
     { OUTPUT_UDP, "UDP",  "MPEG-TS in UDP",        "internal" },
     { OUTPUT_RTP, "RTP",  "MPEG-TS in RTP in UDP", "internal" },
     { OUTPUT_FILE_TS, "FILETS",  "MPEG-TS in file", "internal" },
+    { OUTPUT_RIST, "RIST",  "MPEG-TS in RTP with retransmission", "internal" },
+    { OUTPUT_TSTD, "TSTD",  "T-STD buffer model check", "internal" },
     { 0, 0, 0, 0 },
 };
 #endif
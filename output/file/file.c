@@ -28,6 +28,7 @@
 #include "common/network/udp/udp.h"
 #include "output/output.h"
 #include "common/bitstream.h"
+#include "recorder.h"
 #include <libltntstools/ltntstools.h>
 
 #define LOCAL_DEBUG 1
@@ -38,15 +39,44 @@ struct file_ts_status
 {
     obe_output_t *output;
     void *segmentWriter;
+    struct recorder_s *recorder;
 };
 
+/* target is a filename, optionally followed by ?segment=seconds&direct=1&prealloc=MB.
+ * A trailing '@' keeps the libltntstools segment writer instead.
+ */
+static struct recorder_s *open_recorder(const char *target)
+{
+	struct recorder_opts_s opts = { 0 };
+	char filename[4096];
+	char buf[64];
+
+	snprintf(filename, sizeof(filename), "%s", target);
+	char *p = strchr(filename, '?');
+	if (p) {
+		if (av_find_info_tag(buf, sizeof(buf), "segment", p))
+			opts.segment_seconds = atoi(buf);
+		if (av_find_info_tag(buf, sizeof(buf), "direct", p))
+			opts.direct = atoi(buf);
+		if (av_find_info_tag(buf, sizeof(buf), "prealloc", p))
+			opts.prealloc_mb = atoi(buf);
+		*p = 0;
+	}
+	opts.filename = filename;
+
+	return recorder_alloc(&opts);
+}
+
 static void close_output(void *handle)
 {
 	struct file_ts_status *status = handle;
 
 	if (status->output->output_dest.type == OUTPUT_FILE_TS) {
-		ltntstools_segmentwriter_free(status->segmentWriter);
+		if (status->segmentWriter)
+			ltntstools_segmentwriter_free(status->segmentWriter);
 		status->segmentWriter = NULL;
+		recorder_free(status->recorder);
+		status->recorder = NULL;
 	}
 
 	if (status->output->output_dest.target)
@@ -81,7 +111,11 @@ static void *file_ts_start(void *ptr)
 	if (output_dest->target[ strlen(output_dest->target) - 1 ] == '@')
 		writeMode = 1;
 
-	int ret = ltntstools_segmentwriter_alloc(&status->segmentWriter, output_dest->target, writeMode);
+	int ret = 0;
+	if (writeMode)
+		ret = ltntstools_segmentwriter_alloc(&status->segmentWriter, output_dest->target, writeMode);
+	else if (!(status->recorder = open_recorder(output_dest->target)))
+		ret = -1;
 	if (ret < 0) {
             fprintf(stderr, PREFIX "Could not create file output [%s]\n", output_dest->target);
             return NULL;
@@ -117,12 +151,17 @@ static void *file_ts_start(void *ptr)
 		//printf(PREFIX "writing %d frames\n", num_muxed_data);
 #endif
 		for (int i = 0; i < num_muxed_data; i++) {
-			int len = 188 * 7;
-			size_t wlen = ltntstools_segmentwriter_write(status->segmentWriter,
-				&muxed_data[i]->data[7 * sizeof(int64_t)], len);
-			if (wlen <= 0) {
-				fprintf(stderr, PREFIX "Failed to write packet\n");
-				syslog(LOG_ERR, PREFIX "Failed to write packet\n");
+			uint8_t *ts_data = &muxed_data[i]->data[obe_core_get_payload_packets() * sizeof(int64_t)];
+			int len = obe_core_get_payload_size();
+			if (status->recorder) {
+				/* Coalesced and written on the recorder's own thread */
+				recorder_write(status->recorder, ts_data, len);
+			} else {
+				size_t wlen = ltntstools_segmentwriter_write(status->segmentWriter, ts_data, len);
+				if (wlen <= 0) {
+					fprintf(stderr, PREFIX "Failed to write packet\n");
+					syslog(LOG_ERR, PREFIX "Failed to write packet\n");
+				}
 			}
 
 			remove_from_queue(&output->queue);
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+
+#define TS_PACKET_SIZE 188
+#define BLOCK_SIZE  4096
+#define BUFFER_SIZE (47 * BLOCK_SIZE * 16) /* lcm(188, 4096) is 47 blocks, about 3MB */
+#define NUM_BUFFERS 16
+#define DEFAULT_PREALLOC_MB 64
+
+#define PREFIX "[recorder] "
+
+struct buf_s
+{
+	uint8_t *data;
+	int len;
+	int end_segment;        /* Close the file after this one */
+	struct buf_s *next;
+};
+
+struct recorder_s
+{
+	char *filename;
+	int segment_seconds;
+	int direct;
+	off_t prealloc;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct buf_s bufs[NUM_BUFFERS];
+	struct buf_s *free_list;
+	struct buf_s *full_head, *full_tail;
+	int rollover;           /* Close the file, nothing was queued to carry the mark */
+	int terminate;
+	pthread_t thread;
+	int thread_running;
+
+	/* Caller only */
+	struct buf_s *cur;
+	time_t segment_start;
+	int dropping;
+
+	/* Writer only */
+	int fd;
+	int fd_direct;
+	off_t offset, allocated;
+	char segment_time[32];  /* Timestamp in the last segment name, and how many opens shared it */
+	int segment_seq;
+
+	struct recorder_stats_s stats;
+};
+
+static void segment_name(struct recorder_s *r, char *name, int size)
+{
+	char ts[32] = "";
+	if (r->segment_seconds) {
+		time_t now = time(NULL);
+		struct tm tm;
+		localtime_r(&now, &tm);
+		strftime(ts, sizeof(ts), "-%Y%m%d-%H%M%S", &tm);
+	}
+
+	/* The name of the previous segment again, after a failed write or a rollover inside
+	 * the same second. Number it rather than truncate the earlier file.
+	 */
+	if (r->stats.segments && !strcmp(ts, r->segment_time))
+		r->segment_seq++;
+	else {
+		strcpy(r->segment_time, ts);
+		r->segment_seq = 0;
+	}
+
+	if (!r->segment_seconds && !r->segment_seq) {
+		snprintf(name, size, "%s", r->filename);
+		return;
+	}
+
+	int base = strlen(r->filename);
+	if (base > 3 && !strcmp(r->filename + base - 3, ".ts"))
+		base -= 3;
+
+	if (r->segment_seq)
+		snprintf(name, size, "%.*s%s-%d.ts", base, r->filename, ts, r->segment_seq);
+	else
+		snprintf(name, size, "%.*s%s.ts", base, r->filename, ts);
+}
+
+static int open_segment(struct recorder_s *r)
+{
+	char name[4096];
+	segment_name(r, name, sizeof(name));
+
+	r->fd_direct = 0;
+	if (r->direct) {
+		r->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		if (r->fd >= 0)
+			r->fd_direct = 1;
+		else if (errno == EINVAL) {
+			fprintf(stderr, PREFIX "%s refuses O_DIRECT, writing buffered\n", name);
+			r->direct = 0;
+		}
+	}
+	if (r->fd < 0)
+		r->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (r->fd < 0) {
+		fprintf(stderr, PREFIX "Could not open %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	r->offset = 0;
+	r->allocated = 0;
+	r->stats.segments++;
+	printf(PREFIX "recording to %s\n", name);
+
+	return 0;
+}
+
+static void close_segment(struct recorder_s *r)
+{
+	if (r->fd < 0)
+		return;
+
+	/* Hand back the preallocation past what was written */
+	if (r->allocated > r->offset && ftruncate(r->fd, r->offset) < 0)
+		fprintf(stderr, PREFIX "Could not trim: %s\n", strerror(errno));
+
+	close(r->fd);
+	r->fd = -1;
+}
+
+static void write_buffer(struct recorder_s *r, struct buf_s *b)
+{
+	if (r->fd < 0 && open_segment(r) < 0) {
+		pthread_mutex_lock(&r->mutex);
+		r->stats.bytes_dropped += b->len;
+		pthread_mutex_unlock(&r->mutex);
+		return;
+	}
+
+	if (r->prealloc && r->offset + b->len > r->allocated) {
+		off_t len = r->prealloc;
+		while (r->allocated + len < r->offset + b->len)
+			len += r->prealloc;
+		if (fallocate(r->fd, FALLOC_FL_KEEP_SIZE, r->allocated, len) == 0)
+			r->allocated += len;
+		else if (errno == EOPNOTSUPP) {
+			fprintf(stderr, PREFIX "filesystem can't preallocate, carrying on without\n");
+			r->prealloc = 0;
+		}
+	}
+
+	/* Only the tail of a segment is short, and it is the last write to this file */
+	if (r->fd_direct && (b->len % BLOCK_SIZE)) {
+		fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) & ~O_DIRECT);
+		r->fd_direct = 0;
+	}
+
+	int done = 0;
+	while (done < b->len) {
+		ssize_t n = pwrite(r->fd, b->data + done, b->len - done, r->offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, PREFIX "write failed: %s\n", n < 0 ? strerror(errno) : "no progress");
+			break;
+		}
+		done += n;
+	}
+
+	/* Short write: keep the whole packets, drop the partial one and carry on in a new
+	 * segment, so nothing after this lands misaligned.
+	 */
+	int failed = done < b->len;
+	if (failed)
+		done -= done % TS_PACKET_SIZE;
+	r->offset += done;
+
+	pthread_mutex_lock(&r->mutex);
+	r->stats.bytes_written += done;
+	r->stats.bytes_dropped += b->len - done;
+	r->stats.writes++;
+	pthread_mutex_unlock(&r->mutex);
+
+	if (failed) {
+		if (ftruncate(r->fd, r->offset) < 0)
+			fprintf(stderr, PREFIX "Could not trim: %s\n", strerror(errno));
+		close_segment(r);
+	}
+}
+
+static void *writer_thread(void *arg)
+{
+	struct recorder_s *r = arg;
+
+	pthread_mutex_lock(&r->mutex);
+	while (1) {
+		while (!r->full_head && !r->rollover && !r->terminate)
+			pthread_cond_wait(&r->cond, &r->mutex);
+
+		if (r->rollover) {
+			r->rollover = 0;
+			pthread_mutex_unlock(&r->mutex);
+			close_segment(r);
+			pthread_mutex_lock(&r->mutex);
+			continue;
+		}
+
+		struct buf_s *b = r->full_head;
+		if (!b)
+			break;
+
+		r->full_head = b->next;
+		if (!r->full_head)
+			r->full_tail = NULL;
+		pthread_mutex_unlock(&r->mutex);
+
+		write_buffer(r, b);
+		if (b->end_segment)
+			close_segment(r);
+
+		pthread_mutex_lock(&r->mutex);
+		b->len = 0;
+		b->end_segment = 0;
+		b->next = r->free_list;
+		r->free_list = b;
+	}
+	pthread_mutex_unlock(&r->mutex);
+
+	close_segment(r);
+
+	return NULL;
+}
+
+/* Queue the buffer being filled. With end_segment and nothing to queue, the mark goes on
+ * the last queued buffer, or straight to the writer when it has caught up.
+ */
+static void hand_over(struct recorder_s *r, int end_segment)
+{
+	pthread_mutex_lock(&r->mutex);
+	struct buf_s *b = r->cur;
+	if (b && !b->len) {
+		b->next = r->free_list;
+		r->free_list = b;
+		b = NULL;
+	}
+	r->cur = NULL;
+
+	if (b) {
+		b->end_segment = end_segment;
+		b->next = NULL;
+		if (r->full_tail)
+			r->full_tail->next = b;
+		else
+			r->full_head = b;
+		r->full_tail = b;
+	} else if (end_segment) {
+		if (r->full_tail)
+			r->full_tail->end_segment = 1;
+		else
+			r->rollover = 1;
+	}
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+void recorder_write(struct recorder_s *r, const uint8_t *buf, int len)
+{
+	if (r->segment_seconds) {
+		time_t now = time(NULL);
+		if (!r->segment_start)
+			r->segment_start = now;
+		else if (now - r->segment_start >= r->segment_seconds) {
+			r->segment_start = now;
+			hand_over(r, 1);
+		}
+	}
+
+	while (len) {
+		if (!r->cur) {
+			pthread_mutex_lock(&r->mutex);
+			r->cur = r->free_list;
+			if (r->cur)
+				r->free_list = r->cur->next;
+			else
+				r->stats.bytes_dropped += len;
+			pthread_mutex_unlock(&r->mutex);
+
+			if (!r->cur) {
+				if (!r->dropping)
+					fprintf(stderr, PREFIX "disk is behind, dropping\n");
+				r->dropping = 1;
+				return;
+			}
+			r->dropping = 0;
+		}
+
+		int n = BUFFER_SIZE - r->cur->len;
+		if (n > len)
+			n = len;
+		memcpy(r->cur->data + r->cur->len, buf, n);
+		r->cur->len += n;
+		buf += n;
+		len -= n;
+
+		if (r->cur->len == BUFFER_SIZE)
+			hand_over(r, 0);
+	}
+}
+
+struct recorder_s *recorder_alloc(const struct recorder_opts_s *opts)
+{
+	struct recorder_s *r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->fd = -1;
+	r->filename = strdup(opts->filename);
+	r->segment_seconds = opts->segment_seconds;
+	r->direct = opts->direct;
+	r->prealloc = (off_t)(opts->prealloc_mb > 0 ? opts->prealloc_mb : DEFAULT_PREALLOC_MB) * 1024 * 1024;
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		struct buf_s *b = &r->bufs[i];
+		if (posix_memalign((void **)&b->data, BLOCK_SIZE, BUFFER_SIZE)) {
+			b->data = NULL;
+			goto fail;
+		}
+		memset(b->data, 0, BUFFER_SIZE); /* Fault the pages in now rather than on the caller's thread */
+		b->next = r->free_list;
+		r->free_list = b;
+	}
+
+	if (!r->filename || pthread_create(&r->thread, NULL, writer_thread, r) != 0)
+		goto fail;
+	r->thread_running = 1;
+
+	return r;
+
+fail:
+	recorder_free(r);
+	return NULL;
+}
+
+void recorder_free(struct recorder_s *r)
+{
+	if (!r)
+		return;
+
+	if (r->thread_running) {
+		hand_over(r, 0);
+
+		pthread_mutex_lock(&r->mutex);
+		r->terminate = 1;
+		pthread_cond_signal(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+		pthread_join(r->thread, NULL);
+
+		printf(PREFIX "%" PRIu64 " bytes in %" PRIu64 " writes, %" PRIu64 " segment(s), %" PRIu64 " bytes dropped\n",
+			r->stats.bytes_written, r->stats.writes, r->stats.segments, r->stats.bytes_dropped);
+	}
+
+	for (int i = 0; i < NUM_BUFFERS; i++)
+		free(r->bufs[i].data);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->mutex);
+	free(r->filename);
+	free(r);
+}
+
+void recorder_get_stats(struct recorder_s *r, struct recorder_stats_s *stats)
+{
+	pthread_mutex_lock(&r->mutex);
+	*stats = r->stats;
+	pthread_mutex_unlock(&r->mutex);
+}
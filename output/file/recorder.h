@@ -0,0 +1,51 @@
+#ifndef OBE_OUTPUT_RECORDER_H
+#define OBE_OUTPUT_RECORDER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* TS recorder with large writes.
+ * The caller's packets are copied into a small pool of big buffers, each a whole number
+ * of TS packets and of 4KB blocks, and a writer thread writes them out. Files are
+ * preallocated ahead of the write position with fallocate and trimmed on close, optionally
+ * opened O_DIRECT. Segment rollover also happens on the writer thread. When the disk falls
+ * behind and the pool is empty, data is dropped and counted, the caller never waits.
+ */
+struct recorder_s;
+
+struct recorder_opts_s
+{
+	const char *filename;   /* With segments, name.ts becomes name-YYYYMMDD-HHMMSS.ts. A name that
+	                         * would repeat, after a failed write or two segments in a second,
+	                         * gets -1, -2.. appended. */
+	int segment_seconds;    /* 0 for one file */
+	int direct;             /* O_DIRECT, falls back to buffered if the filesystem refuses */
+	int prealloc_mb;        /* Allocated ahead of the write position, 0 for 64 */
+};
+
+struct recorder_stats_s
+{
+	uint64_t bytes_written;
+	uint64_t writes;
+	uint64_t bytes_dropped; /* The pool was empty, or a write failed */
+	uint64_t segments;
+};
+
+struct recorder_s *recorder_alloc(const struct recorder_opts_s *opts);
+
+/* Flushes what is buffered, trims the preallocation and joins the writer. */
+void recorder_free(struct recorder_s *r);
+
+/* len should be whole TS packets. Never blocks on the disk. */
+void recorder_write(struct recorder_s *r, const uint8_t *buf, int len);
+
+void recorder_get_stats(struct recorder_s *r, struct recorder_stats_s *stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OBE_OUTPUT_RECORDER_H */
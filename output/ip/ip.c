@@ -29,6 +29,7 @@
 #include "common/common.h"
 #include "common/network/network.h"
 #include "common/network/udp/udp.h"
+#include "common/network/rist/rist.h"
 #include "output/output.h"
 #include "common/bitstream.h"
 
@@ -44,24 +45,61 @@
 
 #define MAX_TS_PACKETS_SIZE (16 * 188)
 
+/* Null packet deletion header extension, after RIST TR-06-1. One word follows the
+ * extension header: N, E, the original packet count, T (204 byte packets), a bit per
+ * original packet set where a null was deleted, MSB first, then a sequence extension.
+ */
+#define NPD_EXTENSION_PROFILE 0x5249
+#define NPD_EXTENSION_SIZE 8
+#define NULL_PID 0x1fff
+
 typedef struct
 {
     hnd_t udp_handle;
+    struct rist_sender_s *rist; /* Instead of udp_handle for RIST */
 
     uint16_t seq;
     uint32_t ssrc;
 
     uint32_t pkt_cnt;
     uint32_t octet_cnt;
+
+    int null_deletion;
 } obe_rtp_ctx;
 
 struct ip_status
 {
     obe_output_t *output;
     hnd_t *ip_handle;
+    int null_deletion;
+    uint64_t nulls_deleted;
+    uint64_t packets_sent;
 };
 
-static int rtp_open( hnd_t *p_handle, obe_udp_opts_t *udp_opts )
+/* Copy the non null packets, returns how many there were. The source is shared with the
+ * other outputs so it is left alone. Timing is kept by the smoothing thread, each datagram
+ * still goes out at its own PCR.
+ */
+static int strip_null_packets( uint8_t *dst, const uint8_t *src, int num_packets, int *npd_bits )
+{
+    int kept = 0;
+
+    *npd_bits = 0;
+    for( int i = 0; i < num_packets; i++ )
+    {
+        const uint8_t *pkt = &src[i * 188];
+        if( ( ( pkt[1] << 8 | pkt[2] ) & 0x1fff ) == NULL_PID )
+        {
+            *npd_bits |= 1 << ( num_packets - 1 - i );
+            continue;
+        }
+        memcpy( &dst[kept++ * 188], pkt, 188 );
+    }
+
+    return kept;
+}
+
+static int rtp_open( hnd_t *p_handle, obe_udp_opts_t *udp_opts, int rist )
 {
     obe_rtp_ctx *p_rtp = calloc( 1, sizeof(*p_rtp) );
     if( !p_rtp )
@@ -70,13 +108,35 @@ static int rtp_open( hnd_t *p_handle, obe_udp_opts_t *udp_opts )
         return -1;
     }
 
-    if( udp_open( &p_rtp->udp_handle, udp_opts ) < 0 )
+    if( rist )
+    {
+        struct rist_sender_opts_s opts = {
+            .hostname = udp_opts->hostname,
+            .port = udp_opts->port,
+            .local_port = udp_opts->local_port,
+            .ttl = udp_opts->ttl,
+            .miface = udp_opts->miface,
+            .latency_ms = udp_opts->latency,
+            .buffer_packets = udp_opts->retransmit_buffer,
+        };
+        p_rtp->rist = rist_sender_alloc( &opts );
+        if( !p_rtp->rist )
+        {
+            fprintf( stderr, "[rist] Could not create rist output" );
+            free( p_rtp );
+            return -1;
+        }
+    }
+    else if( udp_open( &p_rtp->udp_handle, udp_opts ) < 0 )
     {
         fprintf( stderr, "[rtp] Could not create udp output" );
+        free( p_rtp );
         return -1;
     }
 
-    p_rtp->ssrc = av_get_random_seed();
+    /* RIST marks retransmissions in the SSRC LSB, originals keep it clear */
+    p_rtp->ssrc = av_get_random_seed() & ~( rist ? 1 : 0 );
+    p_rtp->null_deletion = udp_opts->null_deletion;
 
     *p_handle = p_rtp;
 
@@ -122,27 +182,46 @@ static int write_rtcp_pkt( hnd_t handle )
     return 0;
 }
 #endif
-static int write_rtp_pkt( hnd_t handle, uint8_t *data, int len, int64_t timestamp )
+/* With null deletion, len is what's left after stripping and num_packets the original count */
+static int write_rtp_pkt( hnd_t handle, uint8_t *data, int len, int64_t timestamp, int num_packets, int npd_bits )
 {
     obe_rtp_ctx *p_rtp = handle;
-    uint8_t pkt[RTP_HEADER_SIZE + MAX_TS_PACKETS_SIZE];
+    uint8_t pkt[RTP_HEADER_SIZE + NPD_EXTENSION_SIZE + MAX_TS_PACKETS_SIZE];
+    int hdr_len = RTP_HEADER_SIZE + ( p_rtp->null_deletion ? NPD_EXTENSION_SIZE : 0 );
     bs_t s;
-    bs_init( &s, pkt, RTP_HEADER_SIZE + MAX_TS_PACKETS_SIZE );
+    bs_init( &s, pkt, hdr_len );
 
     bs_write( &s, 2, RTP_VERSION ); // version
     bs_write1( &s, 0 );             // padding
-    bs_write1( &s, 0 );             // extension
+    bs_write1( &s, !!p_rtp->null_deletion ); // extension
     bs_write( &s, 4, 0 );           // CSRC count
     bs_write1( &s, 0 );             // marker
     bs_write( &s, 7, MPEG_TS_PAYLOAD_TYPE ); // payload type
     bs_write( &s, 16, p_rtp->seq++ ); // sequence number
     bs_write32( &s, timestamp / 300 ); // timestamp
     bs_write32( &s, p_rtp->ssrc );    // ssrc
+    if( p_rtp->null_deletion )
+    {
+        bs_write( &s, 16, NPD_EXTENSION_PROFILE ); // defined by profile
+        bs_write( &s, 16, 1 );          // length in words
+        bs_write1( &s, 1 );             // N, null packets deleted
+        bs_write1( &s, 0 );             // E, no sequence extension
+        bs_write( &s, 3, num_packets ); // original packet count
+        bs_write1( &s, 0 );             // T, 188 byte packets
+        bs_write( &s, 7, npd_bits );    // deleted packets
+        bs_write( &s, 3, 0 );           // reserved
+        bs_write( &s, 16, 0 );          // sequence extension
+    }
     bs_flush( &s );
 
-    memcpy( &pkt[RTP_HEADER_SIZE], data, len );
+    memcpy( &pkt[hdr_len], data, len );
 
-    if( udp_write( p_rtp->udp_handle, pkt, RTP_HEADER_SIZE + obe_core_get_payload_size() ) < 0 )
+    if( p_rtp->rist )
+    {
+        if( rist_sender_write( p_rtp->rist, pkt, hdr_len + len ) < 0 )
+            return -1;
+    }
+    else if( udp_write( p_rtp->udp_handle, pkt, hdr_len + len ) < 0 )
         return -1;
 
     p_rtp->pkt_cnt++;
@@ -155,7 +234,10 @@ static void rtp_close( hnd_t handle )
 {
     obe_rtp_ctx *p_rtp = handle;
 
-    udp_close( p_rtp->udp_handle );
+    if( p_rtp->rist )
+        rist_sender_free( p_rtp->rist );
+    else
+        udp_close( p_rtp->udp_handle );
     free( p_rtp );
 }
 
@@ -163,7 +245,12 @@ static void close_output( void *handle )
 {
     struct ip_status *status = handle;
 
-    if( status->output->output_dest.type == OUTPUT_RTP )
+    if( status->null_deletion && status->nulls_deleted + status->packets_sent )
+        printf( "[ip] null deletion: %" PRIu64 " of %" PRIu64 " packets not sent, %.1f%%\n", status->nulls_deleted,
+                status->nulls_deleted + status->packets_sent,
+                100.0 * status->nulls_deleted / ( status->nulls_deleted + status->packets_sent ) );
+
+    if( status->output->output_dest.type == OUTPUT_RTP || status->output->output_dest.type == OUTPUT_RIST )
     {
         if( *status->ip_handle )
             rtp_close( *status->ip_handle );
@@ -202,20 +289,28 @@ static void *open_output( void *ptr )
     int num_muxed_data = 0;
     AVBufferRef **muxed_data;
     obe_udp_opts_t udp_opts;
+    uint8_t stripped[MAX_TS_PACKETS_SIZE];
 
     struct sched_param param = {0};
     param.sched_priority = 99;
     pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
 
+    memset( &status, 0, sizeof(status) );
     status.output = output;
     status.ip_handle = &ip_handle;
     pthread_cleanup_push( close_output, (void*)&status );
 
     udp_populate_opts( &udp_opts, output_dest->target );
+    status.null_deletion = udp_opts.null_deletion;
+    if( status.null_deletion && obe_core_get_payload_packets() > 7 )
+    {
+        fprintf( stderr, "[ip] null deletion signals at most 7 packets per datagram, disabled\n" );
+        status.null_deletion = udp_opts.null_deletion = 0;
+    }
 
-    if( output_dest->type == OUTPUT_RTP )
+    if( output_dest->type == OUTPUT_RTP || output_dest->type == OUTPUT_RIST )
     {
-        if( rtp_open( &ip_handle, &udp_opts ) < 0 )
+        if( rtp_open( &ip_handle, &udp_opts, output_dest->type == OUTPUT_RIST ) < 0 )
             return NULL;
     }
     else
@@ -270,9 +365,23 @@ static void *open_output( void *ptr )
                 lastPacketTime = now;
             }
 
-            if( output_dest->type == OUTPUT_RTP )
+            uint8_t *ts_data = &muxed_data[i]->data[obe_core_get_payload_packets() * sizeof(int64_t)];
+            int ts_len = obe_core_get_payload_size();
+            int npd_bits = 0;
+
+            /* Plain UDP sends nothing for a datagram of nulls, RTP keeps its sequence. */
+            if( status.null_deletion )
+            {
+                int kept = strip_null_packets( stripped, ts_data, obe_core_get_payload_packets(), &npd_bits );
+                ts_data = stripped;
+                status.nulls_deleted += obe_core_get_payload_packets() - kept;
+                status.packets_sent += kept;
+                ts_len = kept * 188;
+            }
+
+            if( output_dest->type == OUTPUT_RTP || output_dest->type == OUTPUT_RIST )
             {
-                if( write_rtp_pkt( ip_handle, &muxed_data[i]->data[ obe_core_get_payload_packets() * sizeof(int64_t)], obe_core_get_payload_size(), AV_RN64( muxed_data[i]->data ) ) < 0 )
+                if( write_rtp_pkt( ip_handle, ts_data, ts_len, AV_RN64( muxed_data[i]->data ), obe_core_get_payload_packets(), npd_bits ) < 0 )
                     syslog( LOG_ERR, "[rtp] Failed to write RTP packet\n" );
             }
             else
@@ -412,7 +521,7 @@ static void *open_output( void *ptr )
                     }
                 }
 #endif
-                if( udp_write( ip_handle, &muxed_data[i]->data[obe_core_get_payload_packets() * sizeof(int64_t)], obe_core_get_payload_size() ) < 0 )
+                if( ts_len && udp_write( ip_handle, ts_data, ts_len ) < 0 )
                     syslog( LOG_ERR, "[udp] Failed to write UDP packet\n" );
             }
 
@@ -31,5 +31,6 @@ typedef struct
 
 extern const obe_output_func_t ip_output;
 extern const obe_output_func_t file_ts_output;
+extern const obe_output_func_t tstd_output;
 
 #endif /* OBE_OUTPUT_H */
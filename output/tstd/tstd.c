@@ -0,0 +1,179 @@
+/* T-STD verifier output.
+ * Takes the smoother's output like any other output and runs it through the buffer model
+ * in mux/ts/tstd.c. Nothing is sent anywhere, violations are logged and counted in
+ * g_tstd_violations for the runtime stats.
+ */
+
+#include <inttypes.h>
+
+#include "common/common.h"
+#include "output/output.h"
+#include "mux/ts/tstd.h"
+
+#define PREFIX "[tstd]: "
+
+uint64_t g_tstd_violations = 0;
+
+struct tstd_output_s
+{
+	obe_output_t *output;
+	struct tstd_s *tstd;
+};
+
+/* 13818-1 2.4.2.8, BSn for the audio formats OBE encodes */
+static int audio_buffer_size(obe_output_stream_t *output_stream)
+{
+	switch (output_stream->stream_format) {
+	case AUDIO_MP2:
+		return 3584;
+	case AUDIO_AAC:
+		return av_get_channel_layout_nb_channels(output_stream->channel_layout) > 2 ? 8976 : 3584;
+	case AUDIO_AC_3:
+	case AUDIO_E_AC_3:
+		return 5696;
+	default:
+		return 0;
+	}
+}
+
+static enum tstd_audio_framing_e audio_framing(obe_output_stream_t *output_stream)
+{
+	switch (output_stream->stream_format) {
+	case AUDIO_MP2:
+		return TSTD_AUDIO_MPEG;
+	case AUDIO_AAC:
+		return output_stream->aac_opts.latm_output ? TSTD_AUDIO_LATM : TSTD_AUDIO_ADTS;
+	case AUDIO_AC_3:
+	case AUDIO_E_AC_3:
+		return TSTD_AUDIO_AC3;
+	default:
+		return TSTD_AUDIO_PES;
+	}
+}
+
+/* PIDs are handed out when the muxer starts, which is before anything reaches us */
+static void register_streams(struct tstd_output_s *ctx)
+{
+	obe_t *h = ctx->output->h;
+
+	for (int i = 0; i < h->num_output_streams; i++) {
+		obe_output_stream_t *output_stream = obe_core_get_output_stream_by_index(h, i);
+		obe_int_input_stream_t *input_stream = get_input_stream(h, output_stream->input_stream_id);
+		uint16_t pid = output_stream->ts_opts.pid;
+
+		if (output_stream->stream_action != STREAM_ENCODE || !input_stream || !pid)
+			continue;
+
+		if (input_stream->stream_type == STREAM_TYPE_VIDEO) {
+			x264_param_t *param = &output_stream->avc_param;
+			if (param->rc.i_vbv_max_bitrate <= 0 || param->rc.i_vbv_buffer_size <= 0) {
+				printf(PREFIX "pid 0x%04x has no VBV, not modelled\n", pid);
+				continue;
+			}
+			tstd_add_video(ctx->tstd, pid, (int64_t)param->rc.i_vbv_max_bitrate * 1000,
+				(int64_t)param->rc.i_vbv_buffer_size * 1000);
+			printf(PREFIX "pid 0x%04x video, %d kbit/s, %d kbit buffer\n", pid,
+				param->rc.i_vbv_max_bitrate, param->rc.i_vbv_buffer_size);
+		} else if (input_stream->stream_type == STREAM_TYPE_AUDIO) {
+			int size = audio_buffer_size(output_stream);
+			if (!size)
+				continue;
+			tstd_add_audio(ctx->tstd, pid, size, audio_framing(output_stream), input_stream->sample_rate);
+			printf(PREFIX "pid 0x%04x audio, %d byte buffer, %d Hz frames\n", pid, size, input_stream->sample_rate);
+		}
+	}
+}
+
+static void close_output(void *handle)
+{
+	struct tstd_output_s *ctx = handle;
+
+	if (ctx->tstd) {
+		struct tstd_stats_s stats;
+		tstd_get_stats(ctx->tstd, &stats);
+		printf(PREFIX "%" PRIu64 " packets, %" PRIu64 " violations, max PCR interval %" PRIi64 "us, max PCR error %" PRIi64 "ns\n",
+			stats.packets, stats.total_violations, stats.pcr_interval_max_us, stats.pcr_accuracy_max_ns);
+		for (int i = 0; i < TSTD_MAX_VIOLATION; i++) {
+			if (stats.violations[i])
+				printf(PREFIX "  %s: %" PRIu64 "\n", tstd_violation_name(i), stats.violations[i]);
+		}
+		tstd_free(ctx->tstd);
+	}
+
+	if (ctx->output->output_dest.target)
+		free(ctx->output->output_dest.target);
+
+	pthread_mutex_unlock(&ctx->output->queue.mutex);
+	free(ctx);
+}
+
+static void *tstd_start(void *ptr)
+{
+	obe_output_t *output = ptr;
+	obe_t *h = output->h;
+
+	struct tstd_output_s *ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		fprintf(stderr, PREFIX "Unable to malloc\n");
+		return NULL;
+	}
+	ctx->output = output;
+
+	ctx->tstd = tstd_alloc(h->mux_opts.cbr ? h->mux_opts.ts_muxrate : 0);
+	if (!ctx->tstd) {
+		fprintf(stderr, PREFIX "Unable to malloc\n");
+		free(ctx);
+		return NULL;
+	}
+
+	pthread_cleanup_push(close_output, (void*)ctx);
+
+	int registered = 0;
+	while (1)
+	{
+		pthread_mutex_lock(&output->queue.mutex);
+		while (!output->queue.size && !output->cancel_thread)
+			pthread_cond_wait(&output->queue.in_cv, &output->queue.mutex);
+
+		if (output->cancel_thread) {
+			pthread_mutex_unlock(&output->queue.mutex);
+			break;
+		}
+
+		int num_muxed_data = output->queue.size;
+
+		AVBufferRef **muxed_data = malloc(num_muxed_data * sizeof(*muxed_data));
+		if (!muxed_data) {
+			pthread_mutex_unlock(&output->queue.mutex);
+			syslog(LOG_ERR, PREFIX "Malloc failed\n");
+			return NULL;
+		}
+		memcpy(muxed_data, output->queue.queue, num_muxed_data * sizeof(*muxed_data));
+		pthread_mutex_unlock(&output->queue.mutex);
+
+		if (!registered) {
+			register_streams(ctx);
+			registered = 1;
+		}
+
+		for (int i = 0; i < num_muxed_data; i++) {
+			const int64_t *pcr_list = (const int64_t *)muxed_data[i]->data;
+			const uint8_t *ts_data = &muxed_data[i]->data[obe_core_get_payload_packets() * sizeof(int64_t)];
+
+			tstd_process(ctx->tstd, ts_data, obe_core_get_payload_packets(), pcr_list);
+
+			remove_from_queue(&output->queue);
+			av_buffer_unref(&muxed_data[i]);
+		}
+		free(muxed_data);
+
+		struct tstd_stats_s stats;
+		tstd_get_stats(ctx->tstd, &stats);
+		g_tstd_violations = stats.total_violations;
+	}
+
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+const obe_output_func_t tstd_output = { tstd_start };
@@ -0,0 +1,151 @@
+/* Measures what a queue handoff between threads costs, as the mux to smoother hop does
+ * with obe_queue_t: a mutex, a condition variable and a sleeping consumer to wake.
+ * Items are timestamped by the producer every interval and timed on arrival after
+ * 0 (inline), 1 and 2 hops.
+ *
+ * ./handoff-bench [items] [interval_us]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_HOPS 2
+
+struct queue_s
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+	int64_t item;
+	int full;
+};
+
+struct bench_s
+{
+	int hops;
+	int items;
+	struct queue_s queues[MAX_HOPS];
+	int64_t *latency;
+};
+
+struct stage_s
+{
+	struct bench_s *b;
+	int index;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void put(struct queue_s *q, int64_t item)
+{
+	pthread_mutex_lock(&q->mutex);
+	q->item = item;
+	q->full = 1;
+	pthread_cond_signal(&q->cv);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static int64_t get(struct queue_s *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	while (!q->full)
+		pthread_cond_wait(&q->cv, &q->mutex);
+	int64_t item = q->item;
+	q->full = 0;
+	pthread_mutex_unlock(&q->mutex);
+	return item;
+}
+
+static void realtime(void)
+{
+	struct sched_param param = { .sched_priority = 99 };
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+
+static void *stage(void *arg)
+{
+	struct stage_s *s = arg;
+	struct bench_s *b = s->b;
+	realtime();
+
+	for (int i = 0; i < b->items; i++) {
+		int64_t item = get(&b->queues[s->index]);
+		if (s->index + 1 < b->hops)
+			put(&b->queues[s->index + 1], item);
+		else
+			b->latency[i] = now_ns() - item;
+	}
+	return NULL;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(int hops, int items, int interval_us)
+{
+	struct bench_s b = { .hops = hops, .items = items };
+	struct stage_s stages[MAX_HOPS];
+	pthread_t threads[MAX_HOPS];
+
+	b.latency = calloc(items, sizeof(*b.latency));
+	for (int i = 0; i < hops; i++) {
+		pthread_mutex_init(&b.queues[i].mutex, NULL);
+		pthread_cond_init(&b.queues[i].cv, NULL);
+		stages[i].b = &b;
+		stages[i].index = i;
+		pthread_create(&threads[i], NULL, stage, &stages[i]);
+	}
+
+	usleep(10000);
+	for (int i = 0; i < items; i++) {
+		usleep(interval_us);
+		int64_t t = now_ns();
+		if (hops)
+			put(&b.queues[0], t);
+		else
+			b.latency[i] = now_ns() - t;
+	}
+
+	for (int i = 0; i < hops; i++)
+		pthread_join(threads[i], NULL);
+
+	int64_t sum = 0;
+	for (int i = 0; i < items; i++)
+		sum += b.latency[i];
+	qsort(b.latency, items, sizeof(*b.latency), cmp);
+	printf("%d hop(s): mean %6.1fus  p50 %6.1fus  p99 %6.1fus  max %7.1fus\n", hops,
+		sum / 1000.0 / items, b.latency[items / 2] / 1000.0, b.latency[items * 99 / 100] / 1000.0,
+		b.latency[items - 1] / 1000.0);
+
+	free(b.latency);
+}
+
+int main(int argc, char **argv)
+{
+	int items = argc > 1 ? atoi(argv[1]) : 5000;
+	int interval_us = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if (items < 1 || interval_us < 0) {
+		fprintf(stderr, "usage: %s [items] [interval_us]\n", argv[0]);
+		return 1;
+	}
+
+	realtime();
+	for (int hops = 0; hops <= MAX_HOPS; hops++)
+		run(hops, items, interval_us);
+
+	return 0;
+}
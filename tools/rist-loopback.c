@@ -0,0 +1,238 @@
+/* Loopback check for common/network/rist
+ * Runs the sender against a minimal TR-06-1 receiver on 127.0.0.1. The receiver drops a
+ * share of what arrives, NACKs the gaps and sends receiver reports. At the end it says how
+ * many packets were never recovered. For real loss use netem on lo instead of, or as well
+ * as, -l:
+ *   tc qdisc add dev lo root netem loss 5% delay 10ms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../common/network/rist/rist.h"
+
+#define PAYLOAD 1316
+#define RENACK_US 20000
+
+static int g_port = 6000;
+static int g_loss_pct;
+static int g_latency_ms = 1000;
+static volatile int g_done;
+
+static void _usage(const char *program)
+{
+	fprintf(stderr, "%s [-n packets] [-r packets/s] [-l loss%%] [-L latency ms] [-p port]\n", program);
+	fprintf(stderr, " -n packets to send. [def: 10000]\n");
+	fprintf(stderr, " -r send rate. [def: 2000]\n");
+	fprintf(stderr, " -l receiver drops this percentage, retransmits included. [def: 0]\n");
+	fprintf(stderr, " -L sender latency window. [def: 1000]\n");
+	fprintf(stderr, " -p receiver RTP port, RTCP is the next one. [def: 6000]\n");
+}
+
+static int64_t _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int _bind(int port)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if (bind(fd, (struct sockaddr *)&a, sizeof(a)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	return fd;
+}
+
+struct rx_s
+{
+	int num;                /* Packets the sender will send */
+	uint8_t *have;
+	int64_t *asked;         /* When each missing packet was last NACKed */
+	int highest;
+	uint32_t ssrc;
+	uint64_t received, dropped, retransmits, duplicates;
+	uint32_t lsr;
+	int64_t lsr_time;
+};
+
+static void *_receiver(void *arg)
+{
+	struct rx_s *rx = arg;
+	int fd = _bind(g_port);
+	int rtcp_fd = _bind(g_port + 1);
+	struct sockaddr_in sender_rtcp;
+	int have_sender = 0;
+	int64_t next_rtcp = _now();
+	uint8_t buf[1500];
+
+	rx->highest = -1;
+	while (!g_done) {
+		struct pollfd pfd[2] = { { .fd = fd, .events = POLLIN }, { .fd = rtcp_fd, .events = POLLIN } };
+		poll(pfd, 2, 5);
+
+		if (pfd[0].revents & POLLIN) {
+			int n = recv(fd, buf, sizeof(buf), 0);
+			if (n >= 12 && (rand() % 100) >= g_loss_pct) {
+				int seq = (buf[2] << 8) | buf[3];  /* Fewer than 65536 packets, no unwrapping */
+				rx->ssrc = ((uint32_t)buf[8] << 24 | buf[9] << 16 | buf[10] << 8 | buf[11]) & ~1;
+				if (buf[11] & 1)
+					rx->retransmits++;
+				if (seq < rx->num) {
+					if (rx->have[seq])
+						rx->duplicates++;
+					else if (n - 12 == PAYLOAD && buf[12] == 0x47 && buf[13] == (seq & 0xff))
+						rx->have[seq] = 1;
+					if (seq > rx->highest)
+						rx->highest = seq;
+				}
+				rx->received++;
+			} else if (n > 0)
+				rx->dropped++;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			socklen_t len = sizeof(sender_rtcp);
+			int n = recvfrom(rtcp_fd, buf, sizeof(buf), 0, (struct sockaddr *)&sender_rtcp, &len);
+			if (n >= 28 && buf[1] == 200) {
+				rx->lsr = (uint32_t)buf[10] << 24 | buf[11] << 16 | buf[12] << 8 | buf[13];
+				rx->lsr_time = _now();
+				have_sender = 1;
+			}
+		}
+
+		if (!have_sender)
+			continue;
+
+		/* Generic NACK for every gap below the highest received, repeated until filled */
+		int64_t now = _now();
+		uint8_t nack[12 + 4 * 64];
+		int entries = 0;
+		for (int s = 0; s < rx->highest && entries < 64; s++) {
+			if (rx->have[s] || now - rx->asked[s] < RENACK_US)
+				continue;
+			rx->asked[s] = now;
+			nack[12 + entries * 4 + 0] = s >> 8;
+			nack[12 + entries * 4 + 1] = s;
+			nack[12 + entries * 4 + 2] = 0;
+			nack[12 + entries * 4 + 3] = 0;
+			entries++;
+		}
+		if (entries) {
+			nack[0] = 0x81;
+			nack[1] = 205;
+			nack[2] = 0;
+			nack[3] = 2 + entries;
+			memset(nack + 4, 0, 4);
+			nack[8] = rx->ssrc >> 24; nack[9] = rx->ssrc >> 16; nack[10] = rx->ssrc >> 8; nack[11] = rx->ssrc;
+			sendto(rtcp_fd, nack, 12 + entries * 4, 0, (struct sockaddr *)&sender_rtcp, sizeof(sender_rtcp));
+		}
+
+		if (now >= next_rtcp) {
+			/* Receiver report with LSR and DLSR so the sender can measure RTT */
+			uint8_t rr[32] = { 0x81, 201, 0, 7 };
+			uint32_t dlsr = (uint32_t)(((now - rx->lsr_time) << 16) / 1000000);
+			rr[8] = rx->ssrc >> 24; rr[9] = rx->ssrc >> 16; rr[10] = rx->ssrc >> 8; rr[11] = rx->ssrc;
+			rr[12] = rx->received ? rx->dropped * 256 / (rx->received + rx->dropped) : 0;
+			rr[24] = rx->lsr >> 24; rr[25] = rx->lsr >> 16; rr[26] = rx->lsr >> 8; rr[27] = rx->lsr;
+			rr[28] = dlsr >> 24; rr[29] = dlsr >> 16; rr[30] = dlsr >> 8; rr[31] = dlsr;
+			sendto(rtcp_fd, rr, sizeof(rr), 0, (struct sockaddr *)&sender_rtcp, sizeof(sender_rtcp));
+			next_rtcp = now + 100000;
+		}
+	}
+
+	close(fd);
+	close(rtcp_fd);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int num = 10000, rate = 2000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hn:r:l:L:p:")) != -1) {
+		switch (opt) {
+		case 'n': num = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		case 'l': g_loss_pct = atoi(optarg); break;
+		case 'L': g_latency_ms = atoi(optarg); break;
+		case 'p': g_port = atoi(optarg); break;
+		case 'h':
+		default:
+			_usage(argv[0]);
+			return -1;
+		}
+	}
+	if (num > 65536)
+		num = 65536;
+
+	struct rx_s rx = { .num = num };
+	rx.have = calloc(num, 1);
+	rx.asked = calloc(num, sizeof(*rx.asked));
+
+	pthread_t rx_thread;
+	pthread_create(&rx_thread, NULL, _receiver, &rx);
+	usleep(10000);
+
+	struct rist_sender_opts_s opts = { .hostname = "127.0.0.1", .port = g_port, .latency_ms = g_latency_ms };
+	struct rist_sender_s *r = rist_sender_alloc(&opts);
+	if (!r)
+		return 1;
+
+	uint8_t pkt[12 + PAYLOAD];
+	memset(pkt, 0, sizeof(pkt));
+	pkt[0] = 0x80;
+	pkt[1] = 33;
+	pkt[8] = 0x12; pkt[9] = 0x34; pkt[10] = 0x56; pkt[11] = 0x78;
+
+	int64_t start = _now();
+	for (int i = 0; i < num; i++) {
+		while (_now() < start + (int64_t)i * 1000000 / rate)
+			usleep(100);
+		uint32_t ts = i * 90000 / rate;
+		pkt[2] = i >> 8; pkt[3] = i;
+		pkt[4] = ts >> 24; pkt[5] = ts >> 16; pkt[6] = ts >> 8; pkt[7] = ts;
+		pkt[12] = 0x47;
+		pkt[13] = i;
+		rist_sender_write(r, pkt, sizeof(pkt));
+	}
+
+	/* Give the tail a latency window to be recovered */
+	usleep(g_latency_ms * 1000);
+
+	struct rist_sender_stats_s st;
+	rist_sender_get_stats(r, &st);
+	g_done = 1;
+	pthread_join(rx_thread, NULL);
+	rist_sender_free(r);
+
+	int missing = 0;
+	for (int i = 0; i < num; i++)
+		missing += !rx.have[i];
+
+	printf("receiver: %" PRIu64 " received, %" PRIu64 " dropped, %" PRIu64 " retransmits, %" PRIu64 " duplicates\n",
+		rx.received, rx.dropped, rx.retransmits, rx.duplicates);
+	printf("sender: rtt %dus, %" PRIu64 " nacked, %" PRIu64 " retransmitted, %" PRIu64 " expired, %" PRIu64 " suppressed\n",
+		st.rtt_us, st.nacked, st.retransmits, st.expired, st.suppressed);
+	printf("%d of %d packets not recovered\n", missing, num);
+
+	free(rx.have);
+	free(rx.asked);
+
+	return missing ? 1 : 0;
+}